@@ -0,0 +1,174 @@
+#include <math.h>
+
+#include "shl/assert.hpp"
+#include "shl/memory.hpp"
+#include "shl/defer.hpp"
+#include "shl/compare.hpp"
+#include "shl/format.hpp"
+#include "shl/io.hpp"
+#include "fs/path.hpp"
+
+#include "corpus.hpp"
+
+// content of compressible runs, long enough that runs don't all look alike
+static const char _dictionary[] =
+    "the quick brown fox jumps over the lazy dog. pack entries are stored "
+    "back to back in a single file with a table of contents at the end. ";
+
+#define _RUN_SIZE 32
+
+void init(bench_corpus *corpus)
+{
+    assert(corpus != nullptr);
+
+    init(&corpus->names);
+    init(&corpus->offsets);
+    init(&corpus->sizes);
+    init(&corpus->content);
+}
+
+void free(bench_corpus *corpus)
+{
+    assert(corpus != nullptr);
+
+    free<true>(&corpus->names);
+    free(&corpus->offsets);
+    free(&corpus->sizes);
+    free(&corpus->content);
+}
+
+u64 bench_random(u64 *state)
+{
+    u64 z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// uniform in [0, 1)
+static double _random_unit(u64 *state)
+{
+    return (double)(bench_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static s64 _random_size(u64 *state, s64 min_size, s64 max_size)
+{
+    if (max_size <= min_size)
+        return min_size;
+
+    double lo = log((double)Max(min_size, (s64)1));
+    double hi = log((double)max_size);
+    s64 size = (s64)exp(lo + _random_unit(state) * (hi - lo));
+
+    return Min(Max(size, min_size), max_size);
+}
+
+static void _generate_name(array<char> *buffer, string *name, s64 n, s64 name_length, u64 *state)
+{
+    const_string prefix = tformat("d%02d/entry%d_", (s32)(n % BENCH_CORPUS_DIRECTORY_COUNT), n);
+    s64 length = Max(prefix.size, name_length);
+
+    resize(buffer, length + 1);
+    copy_memory(prefix.c_str, buffer->data, prefix.size);
+
+    for (s64 i = prefix.size; i < length; ++i)
+        buffer->data[i] = (char)('a' + bench_random(state) % 26);
+
+    buffer->data[length] = '\0';
+    string_copy(buffer->data, name);
+}
+
+static void _generate_content(char *out, s64 size, double compressibility, u64 *state)
+{
+    const s64 dictionary_size = (s64)sizeof(_dictionary) - 1;
+
+    for (s64 i = 0; i < size; i += _RUN_SIZE)
+    {
+        s64 run = Min((s64)_RUN_SIZE, size - i);
+
+        if (_random_unit(state) < compressibility)
+        {
+            s64 start = (s64)(bench_random(state) % (u64)(dictionary_size - _RUN_SIZE));
+            copy_memory(_dictionary + start, out + i, run);
+        }
+        else
+        {
+            for (s64 j = 0; j < run; ++j)
+                out[i + j] = (char)(bench_random(state) & 0xff);
+        }
+    }
+}
+
+void bench_corpus_generate(bench_corpus *corpus, const bench_corpus_options *options)
+{
+    assert(corpus != nullptr);
+    assert(options != nullptr);
+    assert(options->entry_count >= 0);
+    assert(options->min_size >= 0 && options->min_size <= options->max_size);
+
+    u64 state = options->seed;
+    s64 count = options->entry_count;
+
+    free<true>(&corpus->names);
+    resize(&corpus->offsets, count);
+    resize(&corpus->sizes, count);
+
+    s64 total = 0;
+
+    for (s64 i = 0; i < count; ++i)
+    {
+        corpus->offsets[i] = total;
+        corpus->sizes[i] = _random_size(&state, options->min_size, options->max_size);
+        total += corpus->sizes[i];
+    }
+
+    resize(&corpus->content, total);
+
+    array<char> name_buffer{};
+    init(&name_buffer);
+    defer { free(&name_buffer); };
+
+    for (s64 i = 0; i < count; ++i)
+    {
+        string *name = add_at_end(&corpus->names);
+        init(name);
+        _generate_name(&name_buffer, name, i, options->name_length, &state);
+        _generate_content(corpus->content.data + corpus->offsets[i], corpus->sizes[i], options->compressibility, &state);
+    }
+}
+
+bool bench_corpus_write_files(const bench_corpus *corpus, const char *dir, error *err)
+{
+    assert(corpus != nullptr);
+    assert(dir != nullptr);
+
+    fs::path path{};
+    defer { fs::free(&path); };
+
+    for (s32 d = 0; d < BENCH_CORPUS_DIRECTORY_COUNT; ++d)
+    {
+        fs::path_set(&path, dir);
+        fs::path_append(&path, tformat("d%02d", d).c_str);
+
+        if (!fs::create_directories(&path, fs::permission::User, err))
+            return false;
+    }
+
+    for (s64 i = 0; i < corpus->names.size; ++i)
+    {
+        fs::path_set(&path, dir);
+        fs::path_append(&path, corpus->names[i].data);
+
+        io_handle h = io_open(path.c_str(), open_mode::WriteTrunc, err);
+
+        if (h == INVALID_IO_HANDLE)
+            return false;
+
+        defer { io_close(h); };
+
+        if (io_write(h, corpus->content.data + corpus->offsets[i], corpus->sizes[i], err) < 0)
+            return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+/* corpus.hpp
+
+Synthetic entries for pack-bench. The corpus is generated from a seed, so
+the same options always give the same names and contents.
+
+Entry sizes are distributed log-uniformly between min_size and max_size
+(many small entries, few large ones). Names have the form
+d<directory>/entry<n>_<padding> padded to name_length characters.
+compressibility is the fraction of the content copied from a small
+repeating dictionary, the rest is random bytes: 0 is incompressible,
+1 compresses very well.
+ */
+
+#include "shl/array.hpp"
+#include "shl/string.hpp"
+#include "shl/error.hpp"
+
+#define BENCH_CORPUS_DIRECTORY_COUNT 16
+
+struct bench_corpus_options
+{
+    s64 entry_count;
+    s64 min_size;
+    s64 max_size;
+    s64 name_length;
+    double compressibility;
+    u64 seed;
+};
+
+struct bench_corpus
+{
+    array<string> names;
+    array<s64> offsets; // offsets of the entries in content
+    array<s64> sizes;
+    array<char> content;
+};
+
+void init(bench_corpus *corpus);
+void free(bench_corpus *corpus);
+
+void bench_corpus_generate(bench_corpus *corpus, const bench_corpus_options *options);
+
+// writes every entry to a file named after it in dir, creating the directories
+bool bench_corpus_write_files(const bench_corpus *corpus, const char *dir, error *err = nullptr);
+
+// small deterministic random number generator (splitmix64)
+u64 bench_random(u64 *state);
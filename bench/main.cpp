@@ -0,0 +1,784 @@
+#include <stdlib.h> // strtoll, strtod
+#include <algorithm>
+#include <chrono>
+
+#include "fs/path.hpp"
+#include "shl/file_stream.hpp"
+#include "shl/memory.hpp"
+#include "shl/string.hpp"
+#include "shl/format.hpp"
+#include "shl/io.hpp"
+#include "shl/print.hpp"
+#include "shl/error.hpp"
+#include "shl/defer.hpp"
+#include "shl/compare.hpp"
+#include "pack/pack_info.hpp"
+#include "pack/pack_writer.hpp"
+#include "pack/pack_reader.hpp"
+#include "pack/pack_loader.hpp"
+#include "pack/positional_io.hpp"
+#include "pack/parallel.hpp"
+
+#include "corpus.hpp"
+
+#define stream_format(StreamPtr, ...) tprint((StreamPtr)->handle, __VA_ARGS__)
+
+#include "shl/compiler.hpp"
+
+#if MSVC
+#else
+[[noreturn]] extern void exit(int code);
+#endif
+
+// limits of counts and sizes given as arguments
+#define _MAX_COUNT 0x7fffffffll
+#define _MAX_SEED  0x7fffffffffffffffll
+
+struct arguments
+{
+    bench_corpus_options corpus;
+    s64 iterations;         // -i
+    s32 thread_count;       // -j, 0 = number of hardware threads
+    bool drop_os_cache;     // --drop-os-cache
+    fs::path dir;           // -d
+    fs::path out_path;      // -o, defaults to stdout
+};
+
+static const arguments default_arguments
+{
+    // about 20 MB of entries so a run with no arguments takes seconds,
+    // larger corpora are opt-in with -n and --max-size.
+    .corpus = {
+        .entry_count = 2000,
+        .min_size = 64,
+        .max_size = 64 * 1024,
+        .name_length = 32,
+        .compressibility = 0.5,
+        .seed = 1
+    },
+    .iterations = 5,
+    .thread_count = 0,
+    .drop_os_cache = false
+};
+
+static void init(arguments *args)
+{
+    assert(args != nullptr);
+    fs::init(&args->dir);
+    fs::init(&args->out_path);
+}
+
+static void free(arguments *args)
+{
+    assert(args != nullptr);
+    fs::free(&args->dir);
+    fs::free(&args->out_path);
+}
+
+struct bench_result
+{
+    const char *name;
+    s64 ops;   // operations per iteration, e.g. entries loaded
+    s64 bytes; // bytes processed per iteration
+    array<s64> times; // nanoseconds of every iteration
+};
+
+struct bench_context
+{
+    arguments *args;
+    bench_corpus corpus;
+    s64 corpus_bytes;
+
+    // the corpus packed uncompressed and compressed
+    fs::path package_path;
+    fs::path compressed_package_path;
+
+    array<const char*> names;     // names of the corpus entries
+    array<string> file_paths;     // paths of the corpus files
+    array<s64> shuffled;          // entry numbers in random order
+    array<string> missing_names;  // names that are not in the package
+    array<bench_result> results;
+};
+
+// keeps the compiler from optimizing away reads of entry contents
+static volatile u64 _sink = 0;
+
+static s64 _now()
+{
+    return (s64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static u64 _touch(const char *data, s64 size)
+{
+    // one read per cache line is enough to page in the contents
+    u64 sum = 0;
+
+    for (s64 i = 0; i < size; i += 64)
+        sum += (u8)data[i];
+
+    return sum;
+}
+
+static bench_result *_add_result(bench_context *ctx, const char *name, s64 ops, s64 bytes)
+{
+    bench_result *result = add_at_end(&ctx->results);
+    result->name = name;
+    result->ops = ops;
+    result->bytes = bytes;
+    init(&result->times);
+
+    return result;
+}
+
+/* runs the benchmark ctx->args->iterations times. setup is called before
+   every iteration and not measured, run is measured. both return false on
+   error. */
+template<typename Setup, typename Run>
+static bool _bench(bench_context *ctx, const char *name, s64 ops, s64 bytes, Setup setup, Run run, error *err)
+{
+    bench_result *result = _add_result(ctx, name, ops, bytes);
+
+    for (s64 i = 0; i < ctx->args->iterations; ++i)
+    {
+        if (!setup(err))
+            return false;
+
+        s64 start = _now();
+
+        if (!run(err))
+            return false;
+
+        add_at_end(&result->times, _now() - start);
+    }
+
+    tprint(stderr_handle(), "%s: done\n", name);
+
+    return true;
+}
+
+static bool _no_setup(error *)
+{
+    return true;
+}
+
+static bool _drop_os_cache(const char *path, error *err)
+{
+    io_handle h = io_open(path, open_mode::Read, err);
+
+    if (h == INVALID_IO_HANDLE)
+        return false;
+
+    defer { io_close(h); };
+
+    return pack_advise_at(h, 0, 0, pack_advice::DontNeed, err);
+}
+
+static void _add_corpus_entries(bench_context *ctx, pack_writer *writer)
+{
+    bench_corpus *corpus = &ctx->corpus;
+
+    for (s64 i = 0; i < corpus->names.size; ++i)
+        pack_writer_add_entry(writer, corpus->content.data + corpus->offsets[i], corpus->sizes[i], corpus->names[i].data);
+}
+
+static bool _bench_write(bench_context *ctx, error *err)
+{
+    arguments *args = ctx->args;
+    s64 count = ctx->corpus.names.size;
+
+    if (!_bench(ctx, "write_memory", count, ctx->corpus_bytes, _no_setup, [ctx, args](error *err) {
+            pack_writer writer{};
+            init(&writer);
+            defer { free(&writer); };
+
+            writer.thread_count = args->thread_count;
+            _add_corpus_entries(ctx, &writer);
+            return pack_writer_write_to_file(&writer, ctx->package_path.c_str(), err);
+        }, err))
+        return false;
+
+    if (!_bench(ctx, "write_memory_lz4", count, ctx->corpus_bytes, _no_setup, [ctx, args](error *err) {
+            pack_writer writer{};
+            init(&writer);
+            defer { free(&writer); };
+
+            writer.thread_count = args->thread_count;
+            writer.codec = PACK_CODEC_LZ4;
+            _add_corpus_entries(ctx, &writer);
+            return pack_writer_write_to_file(&writer, ctx->compressed_package_path.c_str(), err);
+        }, err))
+        return false;
+
+    fs::path out{};
+    defer { fs::free(&out); };
+    fs::path_set(&out, &args->dir);
+    fs::path_append(&out, "files.pack");
+
+    return _bench(ctx, "write_files", count, ctx->corpus_bytes, _no_setup, [ctx, args, &out](error *err) {
+            pack_writer writer{};
+            init(&writer);
+            defer { free(&writer); };
+
+            writer.thread_count = args->thread_count;
+
+            for (s64 i = 0; i < ctx->file_paths.size; ++i)
+                if (!pack_writer_add_file(&writer, ctx->file_paths[i].data, ctx->names[i], true, err))
+                    return false;
+
+            return pack_writer_write_to_file(&writer, out.c_str(), err);
+        }, err);
+}
+
+// measures opening only, the reader of the previous iteration is freed in setup
+static bool _bench_open(bench_context *ctx, error *err)
+{
+    const char *path = ctx->package_path.c_str();
+
+    pack_reader reader{};
+    init(&reader);
+    defer { free(&reader); };
+
+    auto setup = [&reader](error *) {
+        free(&reader);
+        init(&reader);
+        return true;
+    };
+
+    if (!_bench(ctx, "open_load", 1, 0, setup, [path, &reader](error *err) {
+            return pack_reader_load_from_path(&reader, path, err);
+        }, err))
+        return false;
+
+    if (!_bench(ctx, "open_map", 1, 0, setup, [path, &reader](error *err) {
+            return pack_reader_map_from_path(&reader, path, err);
+        }, err))
+        return false;
+
+    return _bench(ctx, "open_stream", 1, 0, setup, [path, &reader](error *err) {
+            return pack_reader_stream_from_path(&reader, path, err);
+        }, err);
+}
+
+static bool _bench_reader(bench_context *ctx, error *err)
+{
+    pack_reader reader{};
+    init(&reader);
+    defer { free(&reader); };
+
+    if (!pack_reader_map_from_path(&reader, ctx->package_path.c_str(), err))
+        return false;
+
+    s64 count = reader.toc->entry_count;
+
+    if (!_bench(ctx, "get_entry_sequential", count, ctx->corpus_bytes, _no_setup, [&reader, count](error *) {
+            u64 sum = 0;
+            pack_reader_entry entry{};
+
+            for (s64 i = 0; i < count; ++i)
+            {
+                pack_reader_get_entry(&reader, i, &entry);
+                sum += _touch(entry.content, entry.size);
+            }
+
+            _sink = _sink + sum;
+            return true;
+        }, err))
+        return false;
+
+    if (!_bench(ctx, "get_entry_random", count, ctx->corpus_bytes, _no_setup, [ctx, &reader](error *) {
+            u64 sum = 0;
+            pack_reader_entry entry{};
+
+            for_array(n, &ctx->shuffled)
+            {
+                pack_reader_get_entry(&reader, *n, &entry);
+                sum += _touch(entry.content, entry.size);
+            }
+
+            _sink = _sink + sum;
+            return true;
+        }, err))
+        return false;
+
+    if (!_bench(ctx, "lookup_by_name", count, 0, _no_setup, [ctx, &reader](error *err) {
+            for_array(n, &ctx->shuffled)
+            {
+                if (pack_reader_get_entry_index_by_name(&reader, ctx->names[*n]) != *n)
+                {
+                    format_error(err, 1, "lookup_by_name: entry %s not found", ctx->names[*n]);
+                    return false;
+                }
+            }
+
+            return true;
+        }, err))
+        return false;
+
+    return _bench(ctx, "lookup_missing", count, 0, _no_setup, [ctx, &reader](error *) {
+            s64 found = 0;
+
+            for_array(name, &ctx->missing_names)
+                found += pack_reader_get_entry_index_by_name(&reader, name->data) >= 0 ? 1 : 0;
+
+            _sink = _sink + (u64)found;
+            return true;
+        }, err);
+}
+
+static bool _load_all(pack_loader *loader, const s64 *order, s64 count, error *err)
+{
+    u64 sum = 0;
+    pack_entry entry{};
+
+    for (s64 i = 0; i < count; ++i)
+    {
+        if (!pack_loader_load_entry(loader, order[i], &entry, err))
+            return false;
+
+        sum += _touch(entry.data, entry.size);
+    }
+
+    _sink = _sink + sum;
+    return true;
+}
+
+static bool _bench_loader(bench_context *ctx, error *err)
+{
+    arguments *args = ctx->args;
+    s64 count = ctx->corpus.names.size;
+    const s64 *order = ctx->shuffled.data;
+
+    pack_loader loader{};
+    init(&loader);
+    defer { free(&loader); };
+
+    // package mode, compressed entries are decompressed on first load
+    const char *compressed = ctx->compressed_package_path.c_str();
+
+    if (!_bench(ctx, "loader_package_first_load", count, ctx->corpus_bytes, [&loader, compressed](error *err) {
+            return pack_loader_load_package_file(&loader, compressed, err);
+        }, [&loader, order, count](error *err) {
+            return _load_all(&loader, order, count, err);
+        }, err))
+        return false;
+
+    if (!_bench(ctx, "loader_package_cached", count, ctx->corpus_bytes, _no_setup, [&loader, order, count](error *err) {
+            return _load_all(&loader, order, count, err);
+        }, err))
+        return false;
+
+    // files mode
+    pack_loader_load_files(&loader, ctx->names.data, count, args->dir.c_str());
+
+    if (!_bench(ctx, "loader_files_uncached", count, ctx->corpus_bytes, [ctx, args, &loader](error *err) {
+            pack_loader_clear_loaded_file_entries(&loader);
+
+            if (!args->drop_os_cache)
+                return true;
+
+            for_array(path, &ctx->file_paths)
+                if (!_drop_os_cache(path->data, err))
+                    return false;
+
+            return true;
+        }, [&loader, order, count](error *err) {
+            return _load_all(&loader, order, count, err);
+        }, err))
+        return false;
+
+    return _bench(ctx, "loader_files_cached", count, ctx->corpus_bytes, _no_setup, [&loader, order, count](error *err) {
+            return _load_all(&loader, order, count, err);
+        }, err);
+}
+
+static bool _write_results(bench_context *ctx, error *err)
+{
+    arguments *args = ctx->args;
+    file_stream out{};
+    out.handle = stdout_handle();
+
+    if (args->out_path.size > 0)
+    {
+        if (!init(&out, args->out_path.c_str(), open_mode::WriteTrunc, err))
+            return false;
+    }
+
+    defer { if (args->out_path.size > 0) free(&out); };
+
+    stream_format(&out, "{\n  \"pack_version\": \"%s\",\n", pack_VERSION);
+    stream_format(&out, "  \"config\": {\n");
+    stream_format(&out, "    \"entry_count\": %d,\n", args->corpus.entry_count);
+    stream_format(&out, "    \"min_size\": %d,\n", args->corpus.min_size);
+    stream_format(&out, "    \"max_size\": %d,\n", args->corpus.max_size);
+    stream_format(&out, "    \"name_length\": %d,\n", args->corpus.name_length);
+    stream_format(&out, "    \"compressibility\": %f,\n", args->corpus.compressibility);
+    stream_format(&out, "    \"seed\": %d,\n", (s64)args->corpus.seed);
+    stream_format(&out, "    \"corpus_bytes\": %d,\n", ctx->corpus_bytes);
+    stream_format(&out, "    \"iterations\": %d,\n", args->iterations);
+    stream_format(&out, "    \"thread_count\": %d,\n", (s64)pack_thread_count(args->thread_count, ctx->corpus.names.size));
+    stream_format(&out, "    \"drop_os_cache\": %s\n", args->drop_os_cache ? "true" : "false");
+    stream_format(&out, "  },\n  \"results\": [\n");
+
+    for (s64 r = 0; r < ctx->results.size; ++r)
+    {
+        bench_result *result = ctx->results.data + r;
+        array<s64> *times = &result->times;
+        std::sort(times->data, times->data + times->size);
+
+        s64 total = 0;
+
+        for_array(t, times)
+            total += *t;
+
+        s64 min_ns = times->data[0];
+        s64 max_ns = times->data[times->size - 1];
+        s64 median_ns = times->data[times->size / 2];
+        s64 mean_ns = total / times->size;
+        double seconds = (double)Max(median_ns, (s64)1) / 1e9;
+
+        stream_format(&out, "    {\n");
+        stream_format(&out, "      \"name\": \"%s\",\n", result->name);
+        stream_format(&out, "      \"ops\": %d,\n", result->ops);
+        stream_format(&out, "      \"bytes\": %d,\n", result->bytes);
+        stream_format(&out, "      \"min_ns\": %d,\n", min_ns);
+        stream_format(&out, "      \"median_ns\": %d,\n", median_ns);
+        stream_format(&out, "      \"mean_ns\": %d,\n", mean_ns);
+        stream_format(&out, "      \"max_ns\": %d,\n", max_ns);
+        stream_format(&out, "      \"ns_per_op\": %f,\n", (double)median_ns / (double)Max(result->ops, (s64)1));
+        stream_format(&out, "      \"ops_per_s\": %f,\n", (double)result->ops / seconds);
+        stream_format(&out, "      \"mb_per_s\": %f\n", (double)result->bytes / seconds / (1024.0 * 1024.0));
+        stream_format(&out, "    }%s\n", r + 1 < ctx->results.size ? "," : "");
+    }
+
+    stream_format(&out, "  ]\n}\n");
+
+    return true;
+}
+
+static void init(bench_context *ctx, arguments *args)
+{
+    fill_memory(ctx, 0);
+    ctx->args = args;
+    init(&ctx->corpus);
+    fs::init(&ctx->package_path);
+    fs::init(&ctx->compressed_package_path);
+    init(&ctx->names);
+    init(&ctx->file_paths);
+    init(&ctx->shuffled);
+    init(&ctx->missing_names);
+    init(&ctx->results);
+}
+
+static void free(bench_context *ctx)
+{
+    for_array(result, &ctx->results)
+        free(&result->times);
+
+    free(&ctx->results);
+    free<true>(&ctx->missing_names);
+    free(&ctx->shuffled);
+    free(&ctx->names);
+    free<true>(&ctx->file_paths);
+    fs::free(&ctx->compressed_package_path);
+    fs::free(&ctx->package_path);
+    free(&ctx->corpus);
+}
+
+static bool _prepare(bench_context *ctx, error *err)
+{
+    arguments *args = ctx->args;
+    bench_corpus *corpus = &ctx->corpus;
+
+    bench_corpus_generate(corpus, &args->corpus);
+
+    s64 count = corpus->names.size;
+    ctx->corpus_bytes = corpus->content.size;
+
+    if (!fs::create_directories(&args->dir, fs::permission::User, err))
+        return false;
+
+    if (!bench_corpus_write_files(corpus, args->dir.c_str(), err))
+        return false;
+
+    fs::path_set(&ctx->package_path, &args->dir);
+    fs::path_append(&ctx->package_path, "bench.pack");
+    fs::path_set(&ctx->compressed_package_path, &args->dir);
+    fs::path_append(&ctx->compressed_package_path, "bench_lz4.pack");
+
+    resize(&ctx->names, count);
+    resize(&ctx->shuffled, count);
+
+    fs::path file{};
+    defer { fs::free(&file); };
+
+    for (s64 i = 0; i < count; ++i)
+    {
+        ctx->names[i] = corpus->names[i].data;
+        ctx->shuffled[i] = i;
+
+        fs::path_set(&file, &args->dir);
+        fs::path_append(&file, corpus->names[i].data);
+
+        string *path = add_at_end(&ctx->file_paths);
+        init(path);
+        string_copy(file.c_str(), path);
+
+        string *missing = add_at_end(&ctx->missing_names);
+        init(missing);
+        string_copy(tformat("%s_missing", corpus->names[i].data).c_str, missing);
+    }
+
+    // Fisher-Yates with the seed of the corpus
+    u64 state = args->corpus.seed ^ 0x5bd1e995ull;
+
+    for (s64 i = count - 1; i > 0; --i)
+    {
+        s64 j = (s64)(bench_random(&state) % (u64)(i + 1));
+        s64 tmp = ctx->shuffled[i];
+        ctx->shuffled[i] = ctx->shuffled[j];
+        ctx->shuffled[j] = tmp;
+    }
+
+    return true;
+}
+
+static void _show_help_and_exit()
+{
+    put(R"(pack-bench [-h] [-n <count>] [--min-size <n>] [--max-size <n>] [--name-length <n>] [--compressibility <f>] [--seed <n>] [-i <n>] [-j <n>] [--drop-os-cache] [-d <path>] [-o <path>]
+  v)"   pack_VERSION R"(
+
+Benchmarks writing, opening and reading packages and loading entries with
+pack_loader on a generated corpus, and writes the results as JSON.
+
+ARGUMENTS:
+  -h            Show this help and exit.
+  -n <count>    Number of entries in the corpus, defaults to 2000.
+  --min-size <n>
+  --max-size <n>
+                Range of the entry sizes in bytes, sizes are distributed
+                log-uniformly. Defaults to 64 and 65536.
+  --name-length <n>
+                Length of the entry names, defaults to 32.
+  --compressibility <f>
+                Fraction of the content that compresses well, from 0 to 1.
+                Defaults to 0.5.
+  --seed <n>    Seed of the corpus, defaults to 1.
+  -i <n>        Number of iterations of every benchmark, defaults to 5.
+  -j <n>        Number of threads writing packages. Defaults to the number of
+                hardware threads.
+  --drop-os-cache
+                Drop the files from the page cache before uncached loads.
+  -d <path>     Directory of the corpus files and packages, defaults to
+                pack-bench-data.
+  -o <path>     Write the results to path instead of stdout.
+)");
+
+    exit(0);
+}
+
+#define _next_arg(Var, Argc, Argv, I)\
+    {\
+        if ((I) >= (Argc) - 1)\
+        {\
+            format_error(err, 1, "argument '%s' missing parameter", (Argv)[(I)]);\
+            return false;\
+        }\
+    \
+        I += 1;\
+        Var = (Argv)[(I)];\
+    }
+
+static bool _parse_number(const char *arg, const char *narg, s64 min, s64 max, s64 *out, error *err)
+{
+    char *end = nullptr;
+    long long n = strtoll(narg, &end, 10);
+
+    if (end == narg || *end != '\0' || n < min || n > max)
+    {
+        format_error(err, 1, "invalid value '%s' for %s", narg, arg);
+        return false;
+    }
+
+    *out = (s64)n;
+    return true;
+}
+
+static bool _parse_arguments(int argc, char **argv, arguments *args, error *err)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const_string arg = to_const_string(argv[i]);
+        const char *narg = nullptr;
+        s64 n = 0;
+
+        if (arg == "-h"_cs)
+        {
+            _show_help_and_exit();
+            continue;
+        }
+
+        if (arg == "--drop-os-cache"_cs)
+        {
+            args->drop_os_cache = true;
+            continue;
+        }
+
+        if (arg == "-n"_cs)
+        {
+            _next_arg(narg, argc, argv, i);
+
+            if (!_parse_number(argv[i - 1], narg, 1, _MAX_COUNT, &args->corpus.entry_count, err))
+                return false;
+
+            continue;
+        }
+
+        if (arg == "--min-size"_cs)
+        {
+            _next_arg(narg, argc, argv, i);
+
+            if (!_parse_number(argv[i - 1], narg, 0, _MAX_COUNT, &args->corpus.min_size, err))
+                return false;
+
+            continue;
+        }
+
+        if (arg == "--max-size"_cs)
+        {
+            _next_arg(narg, argc, argv, i);
+
+            if (!_parse_number(argv[i - 1], narg, 0, _MAX_COUNT, &args->corpus.max_size, err))
+                return false;
+
+            continue;
+        }
+
+        if (arg == "--name-length"_cs)
+        {
+            _next_arg(narg, argc, argv, i);
+
+            if (!_parse_number(argv[i - 1], narg, 1, 4096, &args->corpus.name_length, err))
+                return false;
+
+            continue;
+        }
+
+        if (arg == "--compressibility"_cs)
+        {
+            _next_arg(narg, argc, argv, i);
+
+            char *end = nullptr;
+            double f = strtod(narg, &end);
+
+            if (end == narg || *end != '\0' || !(f >= 0.0 && f <= 1.0))
+            {
+                format_error(err, 1, "invalid compressibility '%s'", narg);
+                return false;
+            }
+
+            args->corpus.compressibility = f;
+            continue;
+        }
+
+        if (arg == "--seed"_cs)
+        {
+            _next_arg(narg, argc, argv, i);
+
+            if (!_parse_number(argv[i - 1], narg, 0, _MAX_SEED, &n, err))
+                return false;
+
+            args->corpus.seed = (u64)n;
+            continue;
+        }
+
+        if (arg == "-i"_cs)
+        {
+            _next_arg(narg, argc, argv, i);
+
+            if (!_parse_number(argv[i - 1], narg, 1, 1000000, &args->iterations, err))
+                return false;
+
+            continue;
+        }
+
+        if (arg == "-j"_cs)
+        {
+            _next_arg(narg, argc, argv, i);
+
+            if (!_parse_number(argv[i - 1], narg, 1, PACK_MAX_THREADS, &n, err))
+                return false;
+
+            args->thread_count = (s32)n;
+            continue;
+        }
+
+        if (arg == "-d"_cs)
+        {
+            _next_arg(narg, argc, argv, i);
+
+            if (!fs::absolute_path(narg, &args->dir, err))
+                return false;
+
+            continue;
+        }
+
+        if (arg == "-o"_cs)
+        {
+            _next_arg(narg, argc, argv, i);
+            fs::path_set(&args->out_path, narg);
+            continue;
+        }
+
+        format_error(err, 1, "unexpected argument '%s'", arg);
+        return false;
+    }
+
+    if (args->corpus.min_size > args->corpus.max_size)
+    {
+        format_error(err, 1, "--min-size %d is larger than --max-size %d", args->corpus.min_size, args->corpus.max_size);
+        return false;
+    }
+
+    return true;
+}
+
+static bool _main(int argc, char **argv, error *err)
+{
+    arguments args = default_arguments;
+    init(&args);
+    defer { free(&args); };
+
+    if (!_parse_arguments(argc, argv, &args, err))
+        return false;
+
+    if (args.dir.size == 0 && !fs::absolute_path("pack-bench-data", &args.dir, err))
+        return false;
+
+    bench_context ctx{};
+    init(&ctx, &args);
+    defer { free(&ctx); };
+
+    if (!_prepare(&ctx, err))
+        return false;
+
+    if (!_bench_write(&ctx, err)
+     || !_bench_open(&ctx, err)
+     || !_bench_reader(&ctx, err)
+     || !_bench_loader(&ctx, err))
+        return false;
+
+    return _write_results(&ctx, err);
+}
+
+int main(int argc, char **argv)
+{
+    error err{};
+
+    if (!_main(argc, argv, &err))
+    {
+        tprint(stderr_handle(), "error %d: %s\n", err.error_code, err.what);
+        return 1;
+    }
+
+    return 0;
+}
@@ -2,13 +2,6 @@
 # pack cmake package
 # defines functions for integrating pack into cmake projects
 
-# used internally
-macro(sanitize_path NAME_VAR PATH)
-    string(REGEX REPLACE "[/.]" "_" ${NAME_VAR} ${PATH})
-    string(REGEX REPLACE "__+" "_" ${NAME_VAR} ${${NAME_VAR}})
-    string(REGEX REPLACE "^_+" "" ${NAME_VAR} ${${NAME_VAR}})
-endmacro()
-
 # used internally
 macro(generate_header OUT_PATH)
     set(_OPTIONS)
@@ -29,36 +22,30 @@ macro(generate_header OUT_PATH)
         message(FATAL_ERROR "generate_header: missing BASE path")
     endif()
 
-    cmake_path(RELATIVE_PATH GENERATE_HEADER_PACKAGE
-               BASE_DIRECTORY "${GENERATE_HEADER_BASE}"
-               OUTPUT_VARIABLE REL_PACKAGE)
-
-    sanitize_path(SAFE_REL_PACKAGE "${REL_PACKAGE}")
-
-    set(_HEADER "// this file was generated by CMake pack\n\n#pragma once\n")
-    set(_HEADER "${_HEADER}\n#define ${SAFE_REL_PACKAGE} \"${REL_PACKAGE}\"\n")
-
-    list(LENGTH GENERATE_HEADER_FILES ENTRY_COUNT)
-
-    set(_HEADER "${_HEADER}#define ${SAFE_REL_PACKAGE}_file_count ${ENTRY_COUNT}\n")
-    set(_HEADER "${_HEADER}[[maybe_unused]] static const char *${SAFE_REL_PACKAGE}_files[] = {\n")
-
-    set(_HEADER_DEFS "")
+    set(_INDEX "## this file was generated by CMake pack\n\n")
 
-    set(_I 0)
     foreach(_FILE ${GENERATE_HEADER_FILES})
-        cmake_path(RELATIVE_PATH _FILE BASE_DIRECTORY "${GENERATE_HEADER_BASE}" OUTPUT_VARIABLE REL_FILE)
-        sanitize_path(SAFE_FILE "${REL_FILE}")
-        set(_HEADER "${_HEADER}    \"${REL_FILE}\",\n")
-        set(_HEADER_DEFS "${_HEADER_DEFS}#define ${SAFE_REL_PACKAGE}__${SAFE_FILE} ${_I}\n")
-        math(EXPR _I "${_I}+1")
+        set(_INDEX "${_INDEX}${_FILE}\n")
     endforeach()
 
-    set(_HEADER "${_HEADER}};\n\n${_HEADER_DEFS}\n")
+    set(_INDEX_FILE "${GENERATE_HEADER_PACKAGE}_index")
+    file(WRITE "${_INDEX_FILE}" "${_INDEX}")
+
+    get_filename_component(_HEADER_DIR "${OUT_PATH}" DIRECTORY)
+    file(MAKE_DIRECTORY "${_HEADER_DIR}")
 
-    file(WRITE "${OUT_PATH}" "${_HEADER}")
+    # packer -g generates the header of the package the index would pack,
+    # including the minimal perfect hash of the names, without writing it.
+    add_custom_command(
+        OUTPUT "${OUT_PATH}"
+        COMMAND "${packer_TARGET}" "-f" "-g" "-b" "${GENERATE_HEADER_BASE}" "-o" "${OUT_PATH}" "${_INDEX_FILE}"
+        MAIN_DEPENDENCY "${_INDEX_FILE}"
+        DEPENDS "${GENERATE_HEADER_FILES}" "${_INDEX_FILE}" "${packer_TARGET}"
+        VERBATIM)
 
-    unset(_HEADER)
+    unset(_INDEX)
+    unset(_INDEX_FILE)
+    unset(_HEADER_DIR)
 endmacro()
 
 # add_files(<OUT_VAR> <PATH>
@@ -126,12 +113,16 @@ macro(add_files OUT_FILES_VAR OUT_PATH)
             BASE "${OUT_PATH}"
             PACKAGE "${ADD_FILES_PACKAGE}"
             FILES ${${OUT_FILES_VAR}})
+
+        # the header is generated when building, by targets that depend on it
+        list(APPEND ${OUT_FILES_VAR} "${ADD_FILES_GEN_HEADER}")
     endif()
 endmacro()
 
 # add_package(<OUT_VAR> <package path>
 #             BASE <base path>
 #             [GEN_HEADER <header path>]
+#             [ALIGN <n>]
 #             FILES <files...>)
 #
 # Adds a dependency target for generating a package at <package path>
@@ -141,10 +132,13 @@ endmacro()
 #
 # If GEN_HEADER is set, generates a header file for use with
 # pack/package_loader.hpp at GEN_HEADER.
+#
+# If ALIGN is set, the contents of the entries are aligned to ALIGN bytes
+# (packer --align), e.g. 4096 for direct I/O.
 #             
 macro(add_package OUT_FILES_VAR OUT_PATH)
     set(_OPTIONS)
-    set(_SINGLE_VAL_ARGS BASE GEN_HEADER)
+    set(_SINGLE_VAL_ARGS BASE GEN_HEADER ALIGN)
     set(_MULTI_VAL_ARGS FILES)
 
     cmake_parse_arguments(ADD_PACKAGE "${_OPTIONS}" "${_SINGLE_VAL_ARGS}" "${_MULTI_VAL_ARGS}" ${ARGN})
@@ -171,11 +165,18 @@ macro(add_package OUT_FILES_VAR OUT_PATH)
     set(_INDEX_FILE "${OUT_PATH}_index")
     file(WRITE "${_INDEX_FILE}" "${_INDEX}")
 
-    message(DEBUG "  command:\n" "${packer_TARGET} -f -b ${ADD_PACKAGE_BASE} -o ${OUT_PATH} ${_INDEX_FILE}")
+    set(_ALIGN_ARGS)
+
+    if (DEFINED ADD_PACKAGE_ALIGN)
+        set(_ALIGN_ARGS "--align" "${ADD_PACKAGE_ALIGN}")
+    endif()
+
+    message(DEBUG "  command:\n" "${packer_TARGET} -f -u ${_ALIGN_ARGS} -b ${ADD_PACKAGE_BASE} -o ${OUT_PATH} ${_INDEX_FILE}")
 
+    # -u only rereads files that changed since the package was last written
     add_custom_command(
         OUTPUT "${OUT_PATH}"
-        COMMAND "${packer_TARGET}" "-f" "-b" "${ADD_PACKAGE_BASE}" "-o" "${OUT_PATH}" "${_INDEX_FILE}"
+        COMMAND "${packer_TARGET}" "-f" "-u" ${_ALIGN_ARGS} "-b" "${ADD_PACKAGE_BASE}" "-o" "${OUT_PATH}" "${_INDEX_FILE}"
         MAIN_DEPENDENCY "${_INDEX_FILE}"
         DEPENDS "${ADD_PACKAGE_FILES}" "${_INDEX_FILE}")
 
@@ -192,6 +193,7 @@ macro(add_package OUT_FILES_VAR OUT_PATH)
 
     unset(_INDEX)
     unset(_INDEX_FILE)
+    unset(_ALIGN_ARGS)
 endmacro()
 
 # pack(<OUT_VAR>
@@ -0,0 +1,358 @@
+
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+
+#include "shl/assert.hpp"
+#include "shl/memory.hpp"
+#include "shl/defer.hpp"
+#include "fs/path.hpp"
+#include "pack/parallel.hpp"
+
+#if defined(__linux__)
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h> // PATH_MAX
+#include <stdio.h>  // snprintf
+#include <string.h> // strerror
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#endif
+
+#include "dir_walk.hpp"
+
+// getdents64 buffer of every walking thread
+#define _DIRENT_BUFFER_SIZE 0x10000
+
+void free(packer_walk_file *file)
+{
+    assert(file != nullptr);
+
+    free(&file->path);
+}
+
+#if defined(__linux__)
+static void _info_from_statx(const struct statx *stx, packer_file_info *out)
+{
+    if (S_ISREG(stx->stx_mode))
+    {
+        out->type = packer_path_type::File;
+        out->size = (s64)stx->stx_size;
+    }
+    else
+    {
+        out->type = S_ISDIR(stx->stx_mode) ? packer_path_type::Directory : packer_path_type::Other;
+        out->size = -1;
+    }
+}
+#endif
+
+bool packer_stat(const char *path, packer_file_info *out, error *err)
+{
+    assert(path != nullptr);
+    assert(out != nullptr);
+
+    out->type = packer_path_type::None;
+    out->size = -1;
+
+#if defined(__linux__)
+    struct statx stx{};
+
+    if (statx(AT_FDCWD, path, 0, STATX_TYPE | STATX_SIZE, &stx) != 0)
+    {
+        if (errno == ENOENT || errno == ENOTDIR)
+            return true;
+
+        format_error(err, errno, "could not stat %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    _info_from_statx(&stx, out);
+#else
+    fs::const_fs_string p(path, string_length(path));
+
+    if (fs::is_file(p))
+        out->type = packer_path_type::File;
+    else if (fs::is_directory(p))
+        out->type = packer_path_type::Directory;
+    else if (fs::exists(p))
+        out->type = packer_path_type::Other;
+#endif
+
+    return true;
+}
+
+bool packer_stat_paths(const char *const *paths, s64 count, s32 thread_count, packer_file_info *out, error *err)
+{
+    assert(paths != nullptr || count == 0);
+    assert(out != nullptr || count == 0);
+
+    return pack_parallel_for(count, thread_count, err, [paths, out](s64 i, error *thread_err) {
+        return packer_stat(paths[i], out + i, thread_err);
+    });
+}
+
+static void _add_file(array<packer_walk_file> *files, const char *path, s64 size)
+{
+    packer_walk_file *file = add_at_end(files);
+    init(&file->path);
+    string_copy(path, &file->path);
+    file->size = size;
+}
+
+#if defined(__linux__)
+// directories left to read, shared by the walking threads
+struct _walk_queue
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    array<string> directories;
+    s32 busy; // threads reading a directory
+    bool failed;
+    error err;
+};
+
+// reads one directory, files go to files and subdirectories to subdirs
+static bool _read_directory(const char *dir, char *buffer, array<packer_walk_file> *files, array<string> *subdirs, error *err)
+{
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        format_error(err, errno, "could not open directory %s: %s", dir, strerror(errno));
+        return false;
+    }
+
+    defer { close(fd); };
+
+    char child_path[PATH_MAX];
+
+    while (true)
+    {
+        long n = syscall(SYS_getdents64, fd, buffer, _DIRENT_BUFFER_SIZE);
+
+        if (n < 0)
+        {
+            format_error(err, errno, "could not read directory %s: %s", dir, strerror(errno));
+            return false;
+        }
+
+        if (n == 0)
+            break;
+
+        for (long offset = 0; offset < n;)
+        {
+            struct dirent64 *ent = (struct dirent64*)(buffer + offset);
+            offset += ent->d_reclen;
+
+            const char *name = ent->d_name;
+
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                continue;
+
+            if (snprintf(child_path, PATH_MAX, "%s/%s", dir, name) >= PATH_MAX)
+            {
+                format_error(err, ENAMETOOLONG, "path too long: %s/%s", dir, name);
+                return false;
+            }
+
+            packer_file_info info{};
+
+            if (ent->d_type == DT_DIR)
+                info.type = packer_path_type::Directory;
+            else if (ent->d_type == DT_REG || ent->d_type == DT_LNK || ent->d_type == DT_UNKNOWN)
+            {
+                // usually the only stat of the entry. symlinks to files are
+                // followed, symlinks to directories are not walked since they
+                // may form cycles or add a tree twice.
+                struct statx stx{};
+                bool is_link = ent->d_type == DT_LNK;
+                bool ok = true;
+
+                if (ent->d_type == DT_UNKNOWN)
+                {
+                    ok = statx(fd, name, AT_SYMLINK_NOFOLLOW, STATX_TYPE | STATX_SIZE, &stx) == 0;
+                    is_link = ok && S_ISLNK(stx.stx_mode);
+                }
+
+                if (ent->d_type != DT_UNKNOWN || is_link)
+                    ok = statx(fd, name, 0, STATX_TYPE | STATX_SIZE, &stx) == 0;
+
+                if (!ok)
+                {
+                    // dangling symlinks fall through to the unknown path error
+                    if (errno != ENOENT)
+                    {
+                        format_error(err, errno, "could not stat %s: %s", child_path, strerror(errno));
+                        return false;
+                    }
+                }
+                else
+                    _info_from_statx(&stx, &info);
+
+                if (is_link && info.type == packer_path_type::Directory)
+                    continue;
+            }
+
+            if (info.type == packer_path_type::File)
+                _add_file(files, child_path, info.size);
+            else if (info.type == packer_path_type::Directory)
+            {
+                string *subdir = add_at_end(subdirs);
+                init(subdir);
+                string_copy(child_path, subdir);
+            }
+            else
+            {
+                // sockets, fifos, devices and dangling symlinks
+                format_error(err, 2, "cannot add unknown path %s", child_path);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static void _walk_worker(_walk_queue *queue, array<packer_walk_file> *files)
+{
+    char *buffer = (char*)alloc(_DIRENT_BUFFER_SIZE);
+    defer { dealloc(buffer, _DIRENT_BUFFER_SIZE); };
+
+    array<string> subdirs{};
+    init(&subdirs);
+    defer { free<true>(&subdirs); };
+
+    string dir{};
+    init(&dir);
+    defer { free(&dir); };
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(queue->mutex);
+
+            queue->cv.wait(lock, [queue]() {
+                return queue->failed || queue->directories.size > 0 || queue->busy == 0;
+            });
+
+            if (queue->failed || queue->directories.size == 0)
+                return;
+
+            string *last = queue->directories.data + queue->directories.size - 1;
+            string_copy(last->data, &dir);
+            free(last);
+            queue->directories.size -= 1;
+            queue->busy += 1;
+        }
+
+        error thread_err{};
+        bool ok = _read_directory(dir.data, buffer, files, &subdirs, &thread_err);
+
+        std::lock_guard<std::mutex> lock(queue->mutex);
+
+        if (!ok && !queue->failed)
+        {
+            queue->failed = true;
+            queue->err = thread_err;
+        }
+
+        // ownership of the subdirectory strings moves to the queue
+        add_at_end(&queue->directories, subdirs.data, subdirs.size);
+        subdirs.size = 0;
+        queue->busy -= 1;
+        queue->cv.notify_all();
+    }
+}
+#else
+static bool _walk_serial(const char *dir, array<packer_walk_file> *files, error *err)
+{
+    for_path(it, fs::const_fs_string(dir, string_length(dir)), fs::iterate_option::Fullpaths)
+    {
+        if (fs::is_directory(it->path))
+        {
+            // symlinked directories may form cycles or add a tree twice
+            if (fs::is_symlink(it->path))
+                continue;
+
+            if (!_walk_serial(it->path.c_str, files, err))
+                return false;
+        }
+        else if (fs::is_file(it->path))
+            _add_file(files, it->path.c_str, -1);
+        else
+        {
+            format_error(err, 2, "cannot add unknown path %s", it->path.c_str);
+            return false;
+        }
+    }
+
+    return true;
+}
+#endif
+
+bool packer_walk_directory(const char *dir, s32 thread_count, array<packer_walk_file> *out, error *err)
+{
+    assert(dir != nullptr);
+    assert(out != nullptr);
+
+    s64 first = out->size;
+
+#if defined(__linux__)
+    _walk_queue queue{};
+    init(&queue.directories);
+    defer { free<true>(&queue.directories); };
+
+    string *root = add_at_end(&queue.directories);
+    init(root);
+    string_copy(dir, root);
+
+    // the number of directories isn't known up front, every thread waits for
+    // subdirectories until all of them are idle.
+    s32 threads = pack_thread_count(thread_count, PACK_MAX_THREADS);
+
+    array<packer_walk_file> thread_files[PACK_MAX_THREADS];
+
+    for (s32 t = 0; t < threads; ++t)
+        init(thread_files + t);
+
+    std::thread pool[PACK_MAX_THREADS];
+
+    for (s32 t = 1; t < threads; ++t)
+        pool[t] = std::thread(_walk_worker, &queue, thread_files + t);
+
+    _walk_worker(&queue, thread_files);
+
+    for (s32 t = 1; t < threads; ++t)
+        pool[t].join();
+
+    // the file strings are moved to out
+    for (s32 t = 0; t < threads; ++t)
+    {
+        add_at_end(out, thread_files[t].data, thread_files[t].size);
+        free(thread_files + t);
+    }
+
+    if (queue.failed)
+    {
+        if (err != nullptr)
+            *err = queue.err;
+
+        return false;
+    }
+#else
+    (void)thread_count;
+
+    if (!_walk_serial(dir, out, err))
+        return false;
+#endif
+
+    // the order of directory entries depends on the file system
+    std::sort(out->data + first, out->data + out->size, [](const packer_walk_file &a, const packer_walk_file &b) {
+        return string_compare(a.path.data, b.path.data) < 0;
+    });
+
+    return true;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+/* dir_walk.hpp
+
+Collects the files to pack with as few system calls as possible. On Linux
+every directory is read with getdents64 and every file is stat'ed once with
+statx relative to its directory, instead of checking whether each path exists,
+is a file or is a directory and then opening it for its size. Subdirectories
+are read on multiple threads.
+The sizes are passed to pack_writer_add_file_entry, so files are not opened
+until their contents are written.
+ */
+
+#include "shl/array.hpp"
+#include "shl/string.hpp"
+#include "shl/error.hpp"
+
+enum class packer_path_type
+{
+    None, // does not exist
+    File,
+    Directory,
+    Other
+};
+
+struct packer_file_info
+{
+    packer_path_type type;
+    s64 size; // of files, -1 if unknown
+};
+
+struct packer_walk_file
+{
+    string path;
+    s64 size; // -1 if unknown
+};
+
+void free(packer_walk_file *file);
+
+// a single stat of path, following symlinks. a path that does not exist is not an error.
+bool packer_stat(const char *path, packer_file_info *out, error *err = nullptr);
+// stats count paths on up to thread_count threads, 0 = number of hardware threads
+bool packer_stat_paths(const char *const *paths, s64 count, s32 thread_count, packer_file_info *out, error *err = nullptr);
+
+// adds the files in dir and its subdirectories to out, sorted by path.
+// symlinks to files are followed, symlinks to directories are skipped.
+// anything else that's not a file or directory is an error.
+bool packer_walk_directory(const char *dir, s32 thread_count, array<packer_walk_file> *out, error *err = nullptr);
@@ -1,5 +1,9 @@
 
 #include <stdio.h> // snprintf, getline
+#include <stdlib.h> // strtol, strtoll, strtod
+#include <string.h> // strerror
+#include <errno.h>
+#include <algorithm>
 
 #include "fs/path.hpp"
 #include "shl/file_stream.hpp"
@@ -14,8 +18,10 @@
 #include "pack/package.hpp"
 #include "pack/pack_writer.hpp"
 #include "pack/pack_reader.hpp"
+#include "pack/parallel.hpp"
 
 #include "packer_info.hpp"
+#include "dir_walk.hpp"
 
 #define PACK_INDEX_EXTENSION "_index"
 
@@ -81,6 +87,9 @@ size_t getline(char** buf, size_t* bufLen, FILE* f)
 [[noreturn]] extern void exit(int code);
 #endif
 
+// fraction of a package that has to be unused before --compact rewrites it
+#define PACKER_DEFAULT_COMPACT_THRESHOLD 0.25
+
 struct arguments
 {
     bool verbose;           // -v
@@ -89,8 +98,20 @@ struct arguments
     bool generate_header;   // -g
     bool list;              // -l
     bool treat_index_as_file; // -i
+    bool compress;          // -c
+    bool dedup;             // -d
+    bool update;            // -u
+    bool append;            // -a
+    bool compact;           // --compact
+    bool verify;            // --verify
+    bool checksums;         // --checksums
+    double compact_threshold; // --compact-threshold
+    s32 thread_count;       // -j, 0 = number of hardware threads
+    s64 alignment;          // --align, 0 = default (or the alignment of compacted packages)
+    u32 format_version;     // --format-version, 0 = PACK_VERSION
     fs::path out_path;      // -o
     fs::path base_path;     // -b, defaults to current working directory
+    array<const char*> order_profiles; // --order-profile
     array<const_string> input_files; // anything thats not an arg
 };
 
@@ -101,7 +122,18 @@ static const arguments default_arguments
     .extract = false,
     .generate_header = false,
     .list = false,
-    .treat_index_as_file = false
+    .treat_index_as_file = false,
+    .compress = false,
+    .dedup = false,
+    .update = false,
+    .append = false,
+    .compact = false,
+    .verify = false,
+    .checksums = false,
+    .compact_threshold = PACKER_DEFAULT_COMPACT_THRESHOLD,
+    .thread_count = 0,
+    .alignment = 0,
+    .format_version = 0
 };
 
 static void init(arguments *args)
@@ -109,6 +141,7 @@ static void init(arguments *args)
     assert(args != nullptr);
     fs::init(&args->out_path);
     fs::init(&args->base_path);
+    init(&args->order_profiles);
     init(&args->input_files);
 }
 
@@ -117,6 +150,7 @@ static void free(arguments *args)
     assert(args != nullptr);
     fs::free(&args->out_path);
     fs::free(&args->base_path);
+    free(&args->order_profiles);
     free(&args->input_files);
 }
 
@@ -124,6 +158,7 @@ struct packer_path
 {
     fs::path input_path;
     fs::path target_path; // the name it has inside the package
+    s64 size;             // -1 if unknown
 };
 
 static void free(packer_path *p)
@@ -133,88 +168,145 @@ static void free(packer_path *p)
     fs::free(&p->target_path);
 }
 
-static bool _add_path_files(fs::const_fs_string path, array<packer_path> *out_paths, arguments *args, error *err)
+static bool _add_path_files(fs::const_fs_string path, array<packer_path> *out_paths, arguments *args, error *err);
+
+static void _add_packer_path(fs::const_fs_string path, s64 size, array<packer_path> *out_paths, arguments *args)
 {
-    if (args->verbose)
-        tprint(" adding path '%s'\n", path.c_str);
+    packer_path *pp = ::add_at_end(out_paths);
+    fill_memory(pp, 0);
+    fs::path_set(&pp->input_path, path);
+    fs::relative_path(&args->base_path, path, &pp->target_path);
+    pp->size = size;
+}
 
-    if (!fs::exists(path))
-    {
-        format_error(err, 1, "can't pack path because path does not exist: %s", path.c_str);
+static bool _is_index_file(fs::const_fs_string path, arguments *args)
+{
+    if (args->treat_index_as_file)
         return false;
-    }
 
-    if (fs::is_file(path))
+    fs::const_fs_string ext = fs::file_extension(path);
+    return ::string_ends_with(ext, PACK_INDEX_EXTENSION);
+}
+
+static bool _add_index_files(fs::const_fs_string path, array<packer_path> *out_paths, arguments *args, error *err)
+{
+    if (args->verbose)
+        tprint(" adding entries of index file %s\n", path.c_str);
+
+    array<fs::path> index_paths{};
+    defer { free<true>(&index_paths); };
+
+    FILE *f = fopen(path.c_str, "r");
+    defer { fclose(f); };
+
+    char* line = nullptr;
+    size_t len = 0;
+
+    while ((getline(&line, &len, f)) != -1)
     {
-        if (args->treat_index_as_file)
-        {
-            packer_path *pp = ::add_at_end(out_paths);
-            fill_memory(pp, 0);
-            fs::path_set(&pp->input_path, path);
-            fs::relative_path(&args->base_path, path, &pp->target_path);
-            return true;
-        }
+        if (len == 0)
+            continue;
 
-        // check for index file, then get files from that
-        fs::const_fs_string ext = fs::file_extension(path);
+        const_string strline = to_const_string(line);
 
-        if (!::string_ends_with(ext, PACK_INDEX_EXTENSION))
-        {
-            packer_path *pp = ::add_at_end(out_paths);
-            fill_memory(pp, 0);
-            fs::path_set(&pp->input_path, path);
-            fs::relative_path(&args->base_path, path, &pp->target_path);
-            return true;
-        }
+        if (strline.size > 0)
+            strline.size--;
 
-        if (args->verbose)
-            tprint(" adding entries of index file %s\n", path.c_str);
+        if (string_is_blank(strline))
+            continue;
 
-        array<fs::path> index_paths{};
-        defer { free<true>(&index_paths); };
+        if (string_begins_with(strline, "##"_cs))
+            continue;
 
-        FILE *f = fopen(path.c_str, "r");
-        defer { fclose(f); };
+        fs::path *index_path = ::add_at_end(&index_paths);
+        fill_memory(index_path, 0);
 
-        char* line = nullptr;
-        size_t len = 0;
+        if (!fs::weakly_canonical_path(strline, index_path, err))
+            return false;
+    }
 
-        while ((getline(&line, &len, f)) != -1)
-        {
-            if (len == 0)
-                continue;
+    if (line != nullptr)
+        _libc_free(line);
 
-            const_string strline = to_const_string(line);
+    // large indices list many files, stat them all up front instead of one by one
+    array<const char*> cpaths{};
+    defer { free(&cpaths); };
+    ::resize(&cpaths, index_paths.size);
 
-            if (strline.size > 0)
-                strline.size--;
+    for (s64 i = 0; i < index_paths.size; ++i)
+        cpaths[i] = index_paths[i].c_str();
 
-            if (string_is_blank(strline))
-                continue;
+    array<packer_file_info> infos{};
+    defer { free(&infos); };
+    ::resize(&infos, index_paths.size);
 
-            if (string_begins_with(strline, "##"_cs))
-                continue;
+    if (!packer_stat_paths(cpaths.data, cpaths.size, args->thread_count, infos.data, err))
+        return false;
+
+    for (s64 i = 0; i < index_paths.size; ++i)
+    {
+        fs::const_fs_string ip = to_const_string(index_paths.data + i);
 
-            fs::path *index_path = ::add_at_end(&index_paths);
-            fill_memory(index_path, 0);
+        if (infos[i].type == packer_path_type::File && !_is_index_file(ip, args))
+        {
+            if (args->verbose)
+                tprint(" adding path '%s'\n", ip.c_str);
 
-            if (!fs::weakly_canonical_path(strline, index_path, err))
-                return false;
+            _add_packer_path(ip, infos[i].size, out_paths, args);
         }
+        else if (!_add_path_files(ip, out_paths, args, err))
+            return false;
+    }
 
-        if (line != nullptr)
-            _libc_free(line);
+    return true;
+}
 
-        for_array(ipath, &index_paths)
-            if (!_add_path_files(to_const_string(ipath), out_paths, args, err))
-                return false;
+static bool _add_path_files(fs::const_fs_string path, array<packer_path> *out_paths, arguments *args, error *err)
+{
+    if (args->verbose)
+        tprint(" adding path '%s'\n", path.c_str);
+
+    packer_file_info info{};
+
+    if (!packer_stat(path.c_str, &info, err))
+        return false;
+
+    if (info.type == packer_path_type::None)
+    {
+        format_error(err, 1, "can't pack path because path does not exist: %s", path.c_str);
+        return false;
     }
-    else if (fs::is_directory(path))
+
+    if (info.type == packer_path_type::File)
     {
-        for_path(it, path, fs::iterate_option::Fullpaths)
+        // check for index file, then get files from that
+        if (_is_index_file(path, args))
+            return _add_index_files(path, out_paths, args, err);
+
+        _add_packer_path(path, info.size, out_paths, args);
+    }
+    else if (info.type == packer_path_type::Directory)
+    {
+        array<packer_walk_file> files{};
+        defer { free<true>(&files); };
+
+        if (!packer_walk_directory(path.c_str, args->thread_count, &files, err))
+            return false;
+
+        for_array(file, &files)
         {
-            if (!_add_path_files(it->path, out_paths, args, err))
-                return false;
+            fs::const_fs_string fp = fs::const_fs_string(file->path.data, file->path.size);
+
+            if (args->verbose)
+                tprint(" adding path '%s'\n", fp.c_str);
+
+            if (_is_index_file(fp, args))
+            {
+                if (!_add_index_files(fp, out_paths, args, err))
+                    return false;
+            }
+            else
+                _add_packer_path(fp, file->size, out_paths, args);
         }
     }
     else
@@ -265,6 +357,22 @@ static char _choice_prompt(const char *message, const char *choices, arguments *
     return c;
 }
 
+// moves the file at from over the file at to
+static bool _replace_file(const char *from, const char *to, error *err)
+{
+#if Windows
+    remove(to);
+#endif
+
+    if (rename(from, to) != 0)
+    {
+        format_error(err, errno, "could not replace %s: %s", to, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
 static bool _pack(arguments *args, error *err)
 {
     if (args->out_path.size == 0)
@@ -277,6 +385,9 @@ static bool _pack(arguments *args, error *err)
     fs::weakly_canonical_path(args->out_path, &outp);
     defer { fs::free(&outp); };
 
+    bool update = false;
+    bool append = false;
+
     if (fs::exists(&outp))
     {
         if (!fs::is_file(&outp))
@@ -285,6 +396,12 @@ static bool _pack(arguments *args, error *err)
             return false;
         }
 
+        update = args->update;
+        append = args->append;
+    }
+
+    if (fs::exists(&outp) && !update && !append)
+    {
         auto msg = tformat("output file %s already exists. overwrite? [y / n]: ", outp.c_str());
         char choice = _choice_prompt(msg.c_str, "yn", args, err);
 
@@ -321,12 +438,227 @@ static bool _pack(arguments *args, error *err)
     pack_writer writer{};
     init(&writer);
     defer { free(&writer); };
-    
+
+    if (args->compress)
+        writer.codec = PACK_CODEC_LZ4;
+
+    writer.thread_count = args->thread_count;
+    writer.dedup = args->dedup;
+
+    if (args->alignment > 0)
+        writer.alignment = args->alignment;
+
+    writer.version = args->format_version;
+
+    writer.record_sources = args->update;
+    writer.checksums = args->checksums;
+
+    pack_access_profile profile{};
+    init(&profile);
+    defer { free(&profile); };
+
+    for_array(profile_path, &args->order_profiles)
+        if (!pack_access_profile_read(&profile, *profile_path, err))
+            return false;
+
+    if (args->order_profiles.size > 0)
+        writer.order_profile = &profile;
+
     for_array(pth, &paths)
-        if (!pack_writer_add_file(&writer, pth->input_path.c_str(), pth->target_path.c_str(), true, err))
+    {
+        // sizes from the directory walk save opening every file here
+        if (pth->size >= 0)
+            pack_writer_add_file_entry(&writer, pth->input_path.c_str(), pth->target_path.c_str(), pth->size);
+        else if (!pack_writer_add_file(&writer, pth->input_path.c_str(), pth->target_path.c_str(), true, err))
+            return false;
+    }
+
+    if (append)
+    {
+        if (!pack_writer_append_to_file(&writer, outp.c_str(), err))
+            return false;
+    }
+    else if (!update)
+    {
+        if (!pack_writer_write_to_file(&writer, outp.c_str(), err))
+            return false;
+    }
+    else
+    {
+        // unchanged entries are copied from the existing package to a new file
+        // which then replaces it
+        pack_reader previous{};
+        init(&previous);
+        defer { free(&previous); };
+
+        if (!pack_reader_stream_from_path(&previous, outp.c_str(), err))
+            return false;
+
+        writer.previous = &previous;
+
+        string tmp_path{};
+        init(&tmp_path);
+        defer { free(&tmp_path); };
+
+        string_copy(tformat("%s.tmp", outp.c_str()).c_str, &tmp_path);
+
+        if (!pack_writer_write_to_file(&writer, tmp_path.data, err))
+        {
+            remove(tmp_path.data);
+            return false;
+        }
+
+        free(&previous);
+
+        if (!_replace_file(tmp_path.data, outp.c_str(), err))
+            return false;
+    }
+
+    if (args->verbose)
+    {
+        tprint("copied file bytes:\n");
+
+        for (int m = 0; m < PACK_COPY_METHOD_COUNT; ++m)
+            tprint("  %s: %d\n", pack_copy_method_name((pack_copy_method)m), writer.copied_bytes[m]);
+
+        if (args->dedup)
+            tprint("deduplicated entries: %d, bytes saved: %d\n", writer.dedup_entries, writer.dedup_saved_bytes);
+
+        if (update)
+            tprint("reused entries: %d of %d, bytes: %d\n", writer.reused_entries, writer.entries.size, writer.reused_bytes);
+
+        if (writer.order_profile != nullptr)
+            tprint("entries ordered by profile: %d of %d\n", writer.ordered_entries, writer.entries.size);
+    }
+
+    return true;
+}
+
+// rewrites the packages in which at least compact_threshold of the bytes are unused
+static bool _compact_packages(arguments *args, error *err)
+{
+    fs::path path{};
+    defer { fs::free(&path); };
+
+    string tmp_path{};
+    init(&tmp_path);
+    defer { free(&tmp_path); };
+
+    for_array(input_path, &args->input_files)
+    {
+        if (!fs::weakly_canonical_path(*input_path, &path, err))
+            return false;
+
+        pack_reader reader{};
+        init(&reader);
+        defer { free(&reader); };
+
+        if (!pack_reader_stream_from_path(&reader, path.c_str(), err))
+            return false;
+
+        s64 size = pack_reader_get_package_size(&reader);
+        s64 unused = size - pack_reader_get_used_size(&reader);
+
+        if (size <= 0 || (double)unused / (double)size < args->compact_threshold)
+        {
+            if (args->verbose)
+                tprint("skipping %s, %d of %d bytes unused\n", path.c_str(), unused, size);
+
+            continue;
+        }
+
+        // entries are copied as they are stored, replaced entries and old tables are left out
+        pack_writer writer{};
+        init(&writer);
+        defer { free(&writer); };
+
+        writer.thread_count = args->thread_count;
+        writer.record_sources = reader.source_info != nullptr;
+        writer.checksums = args->checksums || reader.checksums != nullptr;
+        writer.alignment = args->alignment > 0 ? args->alignment : pack_reader_get_alignment(&reader);
+        writer.version = args->format_version != 0 ? args->format_version : reader.version;
+        pack_writer_add_package_entries(&writer, &reader);
+
+        string_copy(tformat("%s.tmp", path.c_str()).c_str, &tmp_path);
+
+        if (!pack_writer_write_to_file(&writer, tmp_path.data, err))
+        {
+            remove(tmp_path.data);
+            return false;
+        }
+
+        free(&reader);
+
+        if (!_replace_file(tmp_path.data, path.c_str(), err))
+            return false;
+
+        if (args->verbose)
+            tprint("compacted %s, %d of %d bytes were unused\n", path.c_str(), unused, size);
+    }
+
+    return true;
+}
+
+// checks the entries of the input packages against their checksums
+static bool _verify_packages(arguments *args, error *err)
+{
+    bool all_ok = true;
+
+    for_array(input, &args->input_files)
+    {
+        pack_reader reader{};
+        init(&reader);
+        defer { free(&reader); };
+
+        if (!pack_reader_stream_from_path(&reader, input->c_str, err))
+            return false;
+
+        if (reader.checksums == nullptr)
+        {
+            format_error(err, 1, "package %s has no checksums, pack it with --checksums", input->c_str);
+            return false;
+        }
+
+        array<s64> corrupted{};
+        init(&corrupted);
+        defer { free(&corrupted); };
+
+        error verify_err{};
+
+        if (pack_reader_verify(&reader, args->thread_count, &corrupted, &verify_err))
+        {
+            if (args->verbose)
+                tprint("%s: %d entries ok\n", input->c_str, reader.toc->entry_count);
+
+            continue;
+        }
+
+        // reading the package failed
+        if (corrupted.size == 0)
+        {
+            if (err != nullptr)
+                *err = verify_err;
+
             return false;
+        }
+
+        for_array(n, &corrupted)
+        {
+            pack_reader_entry entry{};
+            pack_reader_get_entry(&reader, *n, &entry);
+            tprint("%s: entry %d (%s) is corrupted\n", input->c_str, *n, entry.name);
+        }
+
+        all_ok = false;
+    }
 
-    return pack_writer_write_to_file(&writer, outp.c_str(), err);
+    if (!all_ok)
+    {
+        set_error(err, 4, "corrupted entries found");
+        return false;
+    }
+
+    return true;
 }
 
 static void _sanitize_name(string *s)
@@ -367,6 +699,255 @@ static void _sanitize_name(string *s)
     // printf("after: %s\n", s->data);
 }
 
+/* minimal perfect hash of entry names, written to generated headers.
+   names are hashed with 32 bit FNV-1a and sorted into buckets by hash, then
+   for each bucket (largest first) a seed is searched for that maps all names
+   of the bucket to unused slots. the generated lookup function then only has
+   to hash the name, get the seed of its bucket, compute the slot and compare
+   a single name.
+ */
+static u32 _mph_hash(const char *name)
+{
+    u32 hash = 2166136261u;
+
+    for (; *name != '\0'; ++name)
+    {
+        hash ^= (u8)*name;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static u32 _mph_slot(u32 hash, u32 seed, u32 size)
+{
+    u32 x = hash ^ seed;
+    x = ((x >> 16) ^ x) * 0x45d9f3bu;
+    x = ((x >> 16) ^ x) * 0x45d9f3bu;
+    x = (x >> 16) ^ x;
+    return x % size;
+}
+
+static const char *_mph_functions = R"(
+#ifndef pack_mph_functions
+#define pack_mph_functions
+// minimal perfect hash functions used by the generated <package>_entry_index functions
+[[maybe_unused]] static constexpr unsigned int pack_mph_hash(const char *name)
+{
+    unsigned int hash = 2166136261u;
+
+    for (; *name != '\0'; ++name)
+    {
+        hash ^= (unsigned char)*name;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+[[maybe_unused]] static constexpr unsigned int pack_mph_slot(unsigned int hash, unsigned int seed, unsigned int size)
+{
+    unsigned int x = hash ^ seed;
+    x = ((x >> 16) ^ x) * 0x45d9f3bu;
+    x = ((x >> 16) ^ x) * 0x45d9f3bu;
+    x = (x >> 16) ^ x;
+    return x % size;
+}
+
+[[maybe_unused]] static constexpr bool pack_mph_equals(const char *a, const char *b)
+{
+    while (*a != '\0' && *a == *b)
+    {
+        ++a;
+        ++b;
+    }
+
+    return *a == *b;
+}
+
+[[maybe_unused]] static constexpr int pack_mph_lookup(const char *name, const char *const *files, const unsigned int *seeds, unsigned int bucket_count, const int *entries, unsigned int size)
+{
+    if (entries[0] == -1)
+        return -1;
+
+    unsigned int hash = pack_mph_hash(name);
+    int entry = entries[pack_mph_slot(hash, seeds[hash % bucket_count], size)];
+
+    return pack_mph_equals(files[entry], name) ? entry : -1;
+}
+#endif
+)";
+
+struct packer_mph
+{
+    array<u32> seeds;   // one per bucket
+    array<s32> entries; // slot -> entry index
+};
+
+static void free(packer_mph *mph)
+{
+    assert(mph != nullptr);
+    free(&mph->seeds);
+    free(&mph->entries);
+}
+
+static bool _build_mph(const char *const *names, s64 count, packer_mph *out, error *err)
+{
+    // only the first entry of a name can be looked up by name
+    array<s32> order{};
+    defer { free(&order); };
+    ::resize(&order, count);
+
+    for (s64 i = 0; i < count; ++i)
+        order[i] = (s32)i;
+
+    std::sort(order.data, order.data + count, [names](s32 a, s32 b) {
+        int cmp = string_compare(names[a], names[b]);
+        return cmp < 0 || (cmp == 0 && a < b);
+    });
+
+    array<bool> is_first{};
+    defer { free(&is_first); };
+    ::resize(&is_first, count);
+
+    for (s64 i = 0; i < count; ++i)
+        is_first[order[i]] = i == 0 || string_compare(names[order[i - 1]], names[order[i]]) != 0;
+
+    array<s32> keys{};
+    defer { free(&keys); };
+
+    array<u32> hashes{};
+    defer { free(&hashes); };
+
+    for (s64 i = 0; i < count; ++i)
+    {
+        if (!is_first[i])
+            continue;
+
+        add_at_end(&keys, (s32)i);
+        add_at_end(&hashes, _mph_hash(names[i]));
+    }
+
+    u32 size = (u32)keys.size;
+    u32 bucket_count = size / 2 + 1;
+
+    resize(&out->seeds, bucket_count);
+    fill_memory((void*)out->seeds.data, 0, sizeof(u32) * bucket_count);
+
+    resize(&out->entries, Max(size, 1u));
+    fill_memory((void*)out->entries.data, 0xff, sizeof(s32) * out->entries.size);
+
+    if (size == 0)
+        return true;
+
+    // sort keys into buckets
+    array<u32> bucket_starts{};
+    init(&bucket_starts, bucket_count + 1);
+    defer { free(&bucket_starts); };
+    fill_memory((void*)bucket_starts.data, 0, sizeof(u32) * bucket_starts.size);
+
+    for_array(hash, &hashes)
+        bucket_starts[*hash % bucket_count + 1] += 1;
+
+    u32 max_bucket_size = 0;
+
+    for (u32 b = 0; b < bucket_count; ++b)
+    {
+        max_bucket_size = Max(max_bucket_size, bucket_starts[b + 1]);
+        bucket_starts[b + 1] += bucket_starts[b];
+    }
+
+    array<u32> bucket_keys{};
+    init(&bucket_keys, size);
+    defer { free(&bucket_keys); };
+
+    array<u32> bucket_fill{};
+    init(&bucket_fill, bucket_count);
+    defer { free(&bucket_fill); };
+    fill_memory((void*)bucket_fill.data, 0, sizeof(u32) * bucket_count);
+
+    for (u32 k = 0; k < size; ++k)
+    {
+        u32 b = hashes[k] % bucket_count;
+        bucket_keys[bucket_starts[b] + bucket_fill[b]] = k;
+        bucket_fill[b] += 1;
+    }
+
+    array<u32> slots{};
+    init(&slots, max_bucket_size);
+    defer { free(&slots); };
+
+    u64 max_seed = (u64)size * 256 + 4096;
+
+    for (u32 bucket_size = max_bucket_size; bucket_size > 0; --bucket_size)
+    for (u32 b = 0; b < bucket_count; ++b)
+    {
+        if (bucket_starts[b + 1] - bucket_starts[b] != bucket_size)
+            continue;
+
+        u32 *bkeys = bucket_keys.data + bucket_starts[b];
+        bool placed = false;
+
+        for (u64 seed = 0; seed < max_seed && !placed; ++seed)
+        {
+            placed = true;
+
+            for (u32 j = 0; j < bucket_size && placed; ++j)
+            {
+                slots[j] = _mph_slot(hashes[bkeys[j]], (u32)seed, size);
+
+                if (out->entries[slots[j]] != -1)
+                    placed = false;
+
+                for (u32 l = 0; l < j && placed; ++l)
+                    if (slots[l] == slots[j])
+                        placed = false;
+            }
+
+            if (placed)
+            {
+                out->seeds[b] = (u32)seed;
+
+                for (u32 j = 0; j < bucket_size; ++j)
+                    out->entries[slots[j]] = keys[bkeys[j]];
+            }
+        }
+
+        if (!placed)
+        {
+            set_error(err, 4, "could not build a perfect hash of the entry names");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void _write_mph(file_stream *stream, const char *var_prefix, packer_mph *mph)
+{
+    stream_format(stream, "\n#define %s_mph_size %u\n", var_prefix, mph->entries.size);
+    stream_format(stream, "#define %s_mph_bucket_count %u\n", var_prefix, mph->seeds.size);
+    stream_format(stream, "[[maybe_unused]] static constexpr unsigned int %s_mph_seeds[] = {", var_prefix);
+
+    for (s64 i = 0; i < mph->seeds.size; ++i)
+        stream_format(stream, (i % 8 == 0) ? "\n    %uu," : " %uu,", mph->seeds[i]);
+
+    stream_format(stream, "\n};\n[[maybe_unused]] static constexpr int %s_mph_entries[] = {", var_prefix);
+
+    for (s64 i = 0; i < mph->entries.size; ++i)
+        stream_format(stream, (i % 8 == 0) ? "\n    %d," : " %d,", mph->entries[i]);
+
+    write(stream, "\n};\n", 4);
+
+    stream_format(stream, R"(
+// returns the index of the entry with the given name, or -1 if there is none
+[[maybe_unused]] static constexpr int %s_entry_index(const char *name)
+{
+    return pack_mph_lookup(name, %s_files, %s_mph_seeds, %s_mph_bucket_count, %s_mph_entries, %s_mph_size);
+}
+)", var_prefix, var_prefix, var_prefix, var_prefix, var_prefix, var_prefix);
+}
+
 static bool _generate_header(arguments *args, error *err)
 {
     if (args->out_path.size == 0)
@@ -406,6 +987,8 @@ static bool _generate_header(arguments *args, error *err)
 #pragma once
 )", packer_VERSION);
 
+    write(&stream, _mph_functions, string_length(_mph_functions));
+
     pack_reader reader{};
     defer { free(&reader); };
 
@@ -417,12 +1000,24 @@ static bool _generate_header(arguments *args, error *err)
     fs::path rel{};
     defer { fs::free(&rel); };
 
+    string package_name{};
+    defer { free(&package_name); };
+
     string var_prefix{};
     defer { free(&var_prefix); };
 
     string var_name{};
     defer { free(&var_name); };
 
+    array<packer_path> index_paths{};
+    defer { free<true>(&index_paths); };
+
+    array<const char*> names{};
+    defer { free(&names); };
+
+    packer_mph mph{};
+    defer { free(&mph); };
+
     for_array(path_, &args->input_files)
     {
         if (!fs::weakly_canonical_path(*path_, &input_path, err))
@@ -435,32 +1030,60 @@ static bool _generate_header(arguments *args, error *err)
         }
 
         fs::relative_path(&args->base_path, &input_path, &rel);
+        string_set(&package_name, to_const_string(rel));
 
-        if (args->verbose)
-            tprint("reading toc of archive %s\n", input_path.c_str());
+        free<true>(&index_paths);
+        names.size = 0;
 
-        string_set(&var_prefix, to_const_string(rel));
-        _sanitize_name(&var_prefix);
+        if (_is_index_file(to_const_string(input_path), args))
+        {
+            // the index file <package>_index lists the files of a package, so
+            // the header is the same as that of the package once it's written.
+            if (args->verbose)
+                tprint("reading index file %s\n", input_path.c_str());
 
-        free(&reader);
-        init(&reader);
+            if (!_add_index_files(to_const_string(input_path), &index_paths, args, err))
+                return false;
 
-        if (!pack_reader_load_from_path(&reader, rel.c_str(), err))
-            return false;
+            for_array(ip, &index_paths)
+                add_at_end(&names, ip->target_path.c_str());
 
-        stream_format(&stream, "\n#define %s \"%s\"\n", var_prefix.data, rel.c_str());
-        stream_format(&stream, "#define %s_file_count %u\n", var_prefix.data, reader.toc->entry_count);
-        stream_format(&stream, "[[maybe_unused]] static const char *%s_files[] = {\n", var_prefix.data);
+            package_name.size -= string_length(PACK_INDEX_EXTENSION);
+            package_name.data[package_name.size] = '\0';
+        }
+        else
+        {
+            if (args->verbose)
+                tprint("reading toc of archive %s\n", input_path.c_str());
+
+            free(&reader);
+            init(&reader);
+
+            if (!pack_reader_map_from_path(&reader, rel.c_str(), err))
+                return false;
+
+            for (s64 i = 0; i < reader.toc->entry_count; ++i)
+            {
+                pack_reader_get_entry(&reader, i, &entry);
+                add_at_end(&names, entry.name);
+            }
+        }
+
+        string_set(&var_prefix, to_const_string(package_name));
+        _sanitize_name(&var_prefix);
+
+        stream_format(&stream, "\n#define %s \"%s\"\n", var_prefix.data, package_name.data);
+        stream_format(&stream, "#define %s_file_count %u\n", var_prefix.data, names.size);
+        stream_format(&stream, "[[maybe_unused]] static constexpr const char *%s_files[] = {\n", var_prefix.data);
 
         // find max entry name length
         s64 maxnamelen = 0;
 
-        for (s64 i = 0; i < reader.toc->entry_count; ++i)
+        for_array(name, &names)
         {
-            pack_reader_get_entry(&reader, i, &entry);
-            stream_format(&stream, "    \"%s\",\n", entry.name);
+            stream_format(&stream, "    \"%s\",\n", *name);
 
-            s64 len = string_length(entry.name);
+            s64 len = string_length(*name);
 
             if (len > maxnamelen)
                 maxnamelen = len;
@@ -471,23 +1094,82 @@ static bool _generate_header(arguments *args, error *err)
         char entry_format_str[256] = {0};
         sprintf(entry_format_str, "#define %%s__%%-%lus %%u\n", maxnamelen);
 
-        for (s64 i = 0; i < reader.toc->entry_count; ++i)
+        for (s64 i = 0; i < names.size; ++i)
         {
-            pack_reader_get_entry(&reader, i, &entry);
-
             if (args->verbose)
-                tprint("  adding entry %s\n", entry.name);
+                tprint("  adding entry %s\n", names[i]);
 
-            string_set(&var_name, entry.name);
+            string_set(&var_name, names[i]);
             _sanitize_name(&var_name);
 
             stream_format(&stream, (const char*)entry_format_str, var_prefix.data, var_name.data, i);
         }
+
+        if (!_build_mph(names.data, names.size, &mph, err))
+            return false;
+
+        _write_mph(&stream, var_prefix.data, &mph);
     }
 
     return true;
 }
 
+// an entry that is extracted and the file it is written to
+struct _extract_job
+{
+    s64 entry;
+    string path;
+};
+
+static void free(_extract_job *job)
+{
+    free(&job->path);
+}
+
+// reused for decompressing entries on every extracting thread, freed when the thread exits
+struct _decompress_buffer
+{
+    array<char> data{};
+
+    ~_decompress_buffer() { free(&data); }
+};
+
+static bool _extract_entry(arguments *args, const pack_reader *reader, const _extract_job *job, error *err)
+{
+    pack_reader_entry entry{};
+    pack_reader_get_entry(reader, job->entry, &entry);
+
+    if (args->verbose)
+        printf("  %08lx bytes %s\n", entry.uncompressed_size, job->path.data);
+
+    const char *content = entry.content;
+
+    if ((entry.flags & PACK_TOC_FLAG_COMPRESSED) == PACK_TOC_FLAG_COMPRESSED)
+    {
+        thread_local _decompress_buffer decompressed;
+
+        if (decompressed.data.size < entry.uncompressed_size)
+            resize(&decompressed.data, entry.uncompressed_size);
+
+        if (!pack_reader_read_entry(&entry, decompressed.data.data, decompressed.data.size, err))
+            return false;
+
+        content = decompressed.data.data;
+    }
+
+    io_handle h = io_open(job->path.data, open_mode::WriteTrunc, err);
+
+    if (h == INVALID_IO_HANDLE)
+        return false;
+
+    defer { io_close(h); };
+
+    return io_write(h, content, entry.uncompressed_size, err) != -1;
+}
+
+/* decides which entries are written where and asks about existing files
+   first, then creates every directory once and writes the entries on
+   args->thread_count threads, straight from the mapped package. */
 static bool _extract_package(arguments *args, pack_reader *reader, error *err)
 {
     pack_reader_entry entry{};
@@ -504,6 +1186,15 @@ static bool _extract_package(arguments *args, pack_reader *reader, error *err)
     bool always_overwrite = false;
     bool never_overwrite = false;
 
+    array<_extract_job> jobs{};
+    init(&jobs);
+    defer { free<true>(&jobs); };
+
+    // parent directories of the entries, created once each
+    array<string> parents{};
+    init(&parents);
+    defer { free<true>(&parents); };
+
     if (!fs::exists(&outp) && !fs::create_directories(&outp, fs::permission::User, err))
         return false;
 
@@ -519,13 +1210,18 @@ static bool _extract_package(arguments *args, pack_reader *reader, error *err)
             continue;
         }
 
-        fs::path_set(&epath, outp);
-        fs::path_append(&epath, entry.name);
+        // entries with the same name would be written to the same file at once,
+        // the first one is the one that's found by name.
+        if (pack_reader_get_entry_index_by_name(reader, entry.name) != i)
+        {
+            if (args->verbose)
+                tprint("  skipping entry %d with the same name as an earlier entry: %s\n", i, entry.name);
 
-        fs::parent_path(&epath, &parent);
+            continue;
+        }
 
-        if (!fs::exists(&parent) && !fs::create_directories(&parent, fs::permission::User, err))
-            return false;
+        fs::path_set(&epath, outp);
+        fs::path_append(&epath, entry.name);
 
         if (fs::exists(&epath))
         {
@@ -571,21 +1267,35 @@ static bool _extract_package(arguments *args, pack_reader *reader, error *err)
             }
         }
 
-        if (args->verbose)
-            printf("  %08lx bytes %s\n", entry.size, epath.c_str());
+        _extract_job *job = add_at_end(&jobs);
+        job->entry = i;
+        init(&job->path);
+        string_copy(epath.c_str(), &job->path);
 
-        io_handle h = io_open(epath.c_str(), open_mode::WriteTrunc, err);
-        
-        if (h == INVALID_IO_HANDLE)
-            return false;
+        fs::parent_path(&epath, &parent);
+        string *p = add_at_end(&parents);
+        init(p);
+        string_copy(parent.c_str(), p);
+    }
+
+    std::sort(parents.data, parents.data + parents.size, [](const string &a, const string &b) {
+        return string_compare(a.data, b.data) < 0;
+    });
+
+    for (s64 i = 0; i < parents.size; ++i)
+    {
+        if (i > 0 && string_compare(parents[i].data, parents[i - 1].data) == 0)
+            continue;
 
-        defer { io_close(h); };
+        fs::path_set(&parent, parents[i].data);
 
-        if (io_write(h, entry.content, entry.size, err) == -1)
+        if (!fs::exists(&parent) && !fs::create_directories(&parent, fs::permission::User, err))
             return false;
     }
 
-    return true;
+    return pack_parallel_for(jobs.size, args->thread_count, err, [args, reader, &jobs](s64 i, error *thread_err) {
+        return _extract_entry(args, reader, jobs.data + i, thread_err);
+    });
 }
 
 static bool _extract_packages(arguments *args, error *err)
@@ -609,7 +1319,7 @@ static bool _extract_packages(arguments *args, error *err)
         pack_reader reader{};
         defer { free(&reader); };
 
-        if (!pack_reader_load_from_path(&reader, path->c_str, err))
+        if (!pack_reader_map_from_path(&reader, path->c_str, err))
             return false;
 
         if (!_extract_package(args, &reader, err))
@@ -629,6 +1339,12 @@ static void _print_pack_reader_entry_flags(file_stream *out, const pack_reader_e
         count++;
     }
 
+    if ((entry->flags & PACK_TOC_FLAG_COMPRESSED) == PACK_TOC_FLAG_COMPRESSED)
+    {
+        put(out->handle, 'C');
+        count++;
+    }
+
     stream_format(out, "%.*s", Max(8 - count, (s64)0), "        ");
 }
 
@@ -662,12 +1378,22 @@ static bool _list_package_contents(arguments *args, error *err)
         stream_format(&out, "contents of package %s:\n", input->c_str);
 
         pack_reader reader{};
-        if (!pack_reader_load_from_path(&reader, input->c_str, err))
+        if (!pack_reader_map_from_path(&reader, input->c_str, err))
             return false;
 
         defer { free(&reader); };
 
         stream_format(&out, "% entries found\n", reader.toc->entry_count);
+
+        if (args->verbose)
+        {
+            stream_format(&out, "package version %d\n", (s64)reader.version);
+            stream_format(&out, "entries aligned to %d bytes\n", pack_reader_get_alignment(&reader));
+
+            if (reader.checksums != nullptr)
+                stream_format(&out, "entries have checksums\n");
+        }
+
         pack_reader_entry entry{};
 
         s64 digits = dec_digits(reader.toc->entry_count);
@@ -675,7 +1401,7 @@ static bool _list_package_contents(arguments *args, error *err)
         format(digit_fmt, 15, "  \%0%ldd ", digits);
 
         if (args->verbose)
-            stream_format(&out, "\n  %.*s flags    offset   size     name\n", digits, "n               ");
+            stream_format(&out, "\n  %.*s flags    offset   size     unpacked name\n", digits, "n               ");
         else
             stream_format(&out, "\n  %.*s flags    name\n", digits, "n               ");
 
@@ -686,7 +1412,7 @@ static bool _list_package_contents(arguments *args, error *err)
             _print_pack_reader_entry_flags(&out, &entry);
             
             if (args->verbose)
-                stream_format(&out, " %08x %08x", (char*)(entry.content) - reader.content, entry.size);
+                stream_format(&out, " %08x %08x %08x", entry.offset, entry.size, entry.uncompressed_size);
 
             stream_format(&out, " %s\n", entry.name);
         }
@@ -697,7 +1423,7 @@ static bool _list_package_contents(arguments *args, error *err)
 
 static void _show_help_and_exit()
 {
-    put(packer_NAME R"( [-h] [-v] [-x | -g | -l] [-i] [-b <path>] -o <path> <files...>
+    put(packer_NAME R"( [-h] [-v] [-x | -g | -l] [-i] [-c] [-d] [-u | -a] [--order-profile <file>] [--align <n>] [--format-version <n>] [--checksums] [--verify] [-j <n>] [-b <path>] -o <path> <files...>
   v)"   packer_VERSION R"(
   by )" packer_AUTHOR R"(
 
@@ -708,10 +1434,47 @@ ARGUMENTS:
   -v            Show verbose output.
   -f            Force overwrite any files without prompting.
   -x            Extract instead of pack.
-  -g            Generate a C header file of the entries of a given package.
+  -g            Generate a C header file of the entries of a given package. Given
+                the index file <package>_index instead, generates the header of
+                the package the index would pack, without writing it.
   -l            List the contents of the input files.
   -i            Treat index files as normal files. Used when adding index files to
                 a package.
+  -c            Compress entries when packing. Entries that don't get smaller
+                are stored uncompressed.
+  -d            Deduplicate entries when packing. Entries with identical contents
+                are stored once.
+  -u            Update the output package if it exists: entries whose files did
+                not change since the last update are copied from it instead of
+                being read and compressed again.
+  -a            Append to the output package if it exists: the given files replace
+                entries with the same name, the package is not rewritten.
+  --compact     Rewrite the input packages without the unused ranges left by
+                appending, if enough of them are unused.
+  --compact-threshold <fraction>
+                Fraction of a package that has to be unused for --compact to
+                rewrite it, defaults to 0.25.
+  --order-profile <file>
+                Lay out the entries named in the access profile (written by
+                pack_loader_write_trace) first, in the order they were accessed,
+                so loading them reads the package sequentially. May be given
+                multiple times, entries keep the place of their first profile.
+  --align <n>   Align the contents of entries to n bytes when packing, a power of
+                two from 8 (the default) up to 1048576. Use 4096 for direct I/O
+                and page aligned entries.
+  --format-version <n>
+                Package format to write when packing or compacting, 2 (the
+                default) or 1 for readers that only know version 1. Appending
+                and compacting keep the version of the package by default.
+  --checksums   Store a checksum of every entry when packing, see --verify.
+                Compacting and appending keep the checksums of packages that
+                have them.
+  --verify      Check the entries of the input packages against their checksums
+                and list the corrupted ones.
+  -j <n>        Number of threads reading and compressing entries when packing,
+                writing entries when extracting, or verifying entries with
+                --verify.
+                Defaults to the number of hardware threads.
   -o <path>     The output file / path.
   -b <path>     Specifies the base path, all file paths will be relative to it.
                 Only used in packing, not extracting.
@@ -782,6 +1545,128 @@ static bool _parse_arguments(int argc, char **argv, arguments *args, error *err)
             continue;
         }
 
+        if (arg == "-c"_cs)
+        {
+            args->compress = true;
+            continue;
+        }
+
+        if (arg == "-d"_cs)
+        {
+            args->dedup = true;
+            continue;
+        }
+
+        if (arg == "-u"_cs)
+        {
+            args->update = true;
+            continue;
+        }
+
+        if (arg == "-a"_cs)
+        {
+            args->append = true;
+            continue;
+        }
+
+        if (arg == "--compact"_cs)
+        {
+            args->compact = true;
+            continue;
+        }
+
+        if (arg == "--verify"_cs)
+        {
+            args->verify = true;
+            continue;
+        }
+
+        if (arg == "--checksums"_cs)
+        {
+            args->checksums = true;
+            continue;
+        }
+
+        if (arg == "--compact-threshold"_cs)
+        {
+            const char *narg;
+            _next_arg(narg, argc, argv, i);
+
+            char *end = nullptr;
+            double threshold = strtod(narg, &end);
+
+            if (end == narg || *end != '\0' || !(threshold >= 0.0 && threshold <= 1.0))
+            {
+                format_error(err, 1, "invalid compact threshold '%s'", narg);
+                return false;
+            }
+
+            args->compact_threshold = threshold;
+            continue;
+        }
+
+        if (arg == "--order-profile"_cs)
+        {
+            const char *narg;
+            _next_arg(narg, argc, argv, i);
+            add_at_end(&args->order_profiles, narg);
+            continue;
+        }
+
+        if (arg == "--align"_cs)
+        {
+            const char *narg;
+            _next_arg(narg, argc, argv, i);
+
+            char *end = nullptr;
+            long long n = strtoll(narg, &end, 10);
+
+            if (end == narg || *end != '\0' || n < PACK_DEFAULT_ALIGNMENT || n > PACK_MAX_ALIGNMENT || (n & (n - 1)) != 0)
+            {
+                format_error(err, 1, "invalid alignment '%s', must be a power of two from %d to %d", narg, PACK_DEFAULT_ALIGNMENT, PACK_MAX_ALIGNMENT);
+                return false;
+            }
+
+            args->alignment = (s64)n;
+            continue;
+        }
+
+        if (arg == "--format-version"_cs)
+        {
+            const char *narg;
+            _next_arg(narg, argc, argv, i);
+
+            char *end = nullptr;
+            long n = strtol(narg, &end, 10);
+
+            if (end == narg || *end != '\0' || n < PACK_VERSION_1 || n > PACK_VERSION_2)
+            {
+                format_error(err, 1, "invalid format version '%s', must be %d or %d", narg, PACK_VERSION_1, PACK_VERSION_2);
+                return false;
+            }
+
+            args->format_version = (u32)n;
+            continue;
+        }
+
+        if (arg == "-j"_cs)
+        {
+            const char *narg;
+            _next_arg(narg, argc, argv, i);
+
+            char *end = nullptr;
+            long n = strtol(narg, &end, 10);
+
+            if (end == narg || *end != '\0' || n < 1 || n > PACK_MAX_THREADS)
+            {
+                format_error(err, 1, "invalid thread count '%s'", narg);
+                return false;
+            }
+
+            args->thread_count = (s32)n;
+            continue;
+        }
+
         if (arg == "-o"_cs)
         {
             const char *narg;
@@ -841,10 +1726,18 @@ static bool _main(int argc, char **argv, error *err)
     action_count += args.list ? 1 : 0;
     action_count += args.extract ? 1 : 0;
     action_count += args.generate_header ? 1 : 0;
+    action_count += args.compact ? 1 : 0;
+    action_count += args.verify ? 1 : 0;
 
     if (action_count > 1)
     {
-        set_error(err, 2, "can only do one of extract (-x), generate header (-g) or list (-l)");
+        set_error(err, 2, "can only do one of extract (-x), generate header (-g), list (-l), compact (--compact) or verify (--verify)");
+        return false;
+    }
+
+    if (args.update && args.append)
+    {
+        set_error(err, 3, "can only do one of update (-u) or append (-a)");
         return false;
     }
 
@@ -856,6 +1749,10 @@ static bool _main(int argc, char **argv, error *err)
         ret = _generate_header(&args, err);
     else if (args.extract)
         ret = _extract_packages(&args, err);
+    else if (args.compact)
+        ret = _compact_packages(&args, err);
+    else if (args.verify)
+        ret = _verify_packages(&args, err);
     else
         ret = _pack(&args, err);
 
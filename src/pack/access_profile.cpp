@@ -0,0 +1,141 @@
+#include "shl/assert.hpp"
+#include "shl/memory.hpp"
+#include "shl/defer.hpp"
+#include "shl/format.hpp"
+#include "shl/file_stream.hpp"
+
+#include "pack/access_profile.hpp"
+
+void init(pack_access_profile *profile)
+{
+    assert(profile != nullptr);
+
+    init(&profile->names);
+    init(&profile->times);
+}
+
+void free(pack_access_profile *profile)
+{
+    assert(profile != nullptr);
+
+    free<true>(&profile->names);
+    free(&profile->times);
+}
+
+void pack_access_profile_add(pack_access_profile *profile, const char *name, s64 time)
+{
+    assert(profile != nullptr);
+    assert(name != nullptr);
+
+    string *s = add_at_end(&profile->names);
+    init(s);
+    string_copy(name, s);
+    add_at_end(&profile->times, time);
+}
+
+bool pack_access_profile_read(pack_access_profile *profile, const char *path, error *err)
+{
+    assert(profile != nullptr);
+    assert(path != nullptr);
+
+    memory_stream mem{};
+    defer { free(&mem); };
+
+    if (!read_entire_file(path, &mem, err))
+        return false;
+
+    char *it = mem.data;
+    char *end = mem.data + mem.size;
+    s64 line = 0;
+
+    while (it < end)
+    {
+        char *line_end = it;
+
+        while (line_end < end && *line_end != '\n')
+            line_end += 1;
+
+        line += 1;
+
+        if (line_end > it && line_end[-1] == '\r')
+            line_end[-1] = '\0';
+
+        if (line_end < end)
+            *line_end = '\0';
+
+        char *next = line_end + 1;
+
+        if (it == line_end || *it == '#' || *it == '\0')
+        {
+            it = next;
+            continue;
+        }
+
+        s64 time = 0;
+
+        if (*it < '0' || *it > '9')
+        {
+            format_error(err, 1, "access_profile_read: %s:%d: expected access time", path, line);
+            return false;
+        }
+
+        while (it < line_end && *it >= '0' && *it <= '9')
+        {
+            time = time * 10 + (*it - '0');
+            it += 1;
+        }
+
+        if (it >= line_end || *it != ' ' || it + 1 >= line_end)
+        {
+            format_error(err, 1, "access_profile_read: %s:%d: expected entry name", path, line);
+            return false;
+        }
+
+        it += 1;
+
+        if (line_end == end)
+        {
+            // the last line does not end with a newline and the buffer is not NUL terminated
+            s64 len = line_end - it;
+            char *name = (char*)alloc(len + 1);
+            copy_memory(it, name, len);
+            name[len] = '\0';
+            pack_access_profile_add(profile, name, time);
+            dealloc(name, len + 1);
+        }
+        else
+            pack_access_profile_add(profile, it, time);
+
+        it = next;
+    }
+
+    return true;
+}
+
+bool pack_access_profile_write(const pack_access_profile *profile, const char *path, error *err)
+{
+    assert(profile != nullptr);
+    assert(path != nullptr);
+
+    file_stream out{};
+
+    if (!init(&out, path, open_mode::WriteTrunc, err))
+        return false;
+
+    defer { free(&out); };
+
+    const char *comment = "# pack access profile: <microseconds> <entry name>\n";
+
+    if (write(&out, comment, string_length(comment), err) < 0)
+        return false;
+
+    for (s64 i = 0; i < profile->names.size; ++i)
+    {
+        const_string line = tformat("%d %s\n", profile->times[i], profile->names[i].data);
+
+        if (write(&out, line.c_str, line.size, err) < 0)
+            return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+/* access_profile.hpp
+
+Profiles of the order in which entries are first accessed, recorded by
+pack_loader (see pack_loader_start_trace) and used by pack_writer to lay out
+entries that are accessed together next to each other (see
+pack_writer::order_profile).
+
+A profile file is text with one line per entry in the order the entries were
+first accessed:
+
+    <microseconds since the trace started> <entry name>
+
+Lines starting with # are comments.
+ */
+
+#include "shl/array.hpp"
+#include "shl/string.hpp"
+#include "shl/error.hpp"
+
+struct pack_access_profile
+{
+    array<string> names;
+    array<s64> times; // microseconds since the trace started
+};
+
+void init(pack_access_profile *profile);
+void free(pack_access_profile *profile);
+
+void pack_access_profile_add(pack_access_profile *profile, const char *name, s64 time);
+
+// adds the entries of the profile file at path, e.g. to combine the profiles of
+// multiple runs. entries already in the profile keep their place.
+bool pack_access_profile_read(pack_access_profile *profile, const char *path, error *err = nullptr);
+bool pack_access_profile_write(const pack_access_profile *profile, const char *path, error *err = nullptr);
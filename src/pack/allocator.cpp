@@ -0,0 +1,299 @@
+#include "shl/assert.hpp"
+#include "shl/memory.hpp"
+
+#include "pack/allocator.hpp"
+
+void *pack_alloc(const pack_allocator *allocator, s64 size)
+{
+    if (allocator == nullptr || allocator->alloc == nullptr)
+        return alloc(size);
+
+    return allocator->alloc(allocator->userdata, size);
+}
+
+void pack_dealloc(const pack_allocator *allocator, void *ptr, s64 size)
+{
+    if (ptr == nullptr)
+        return;
+
+    if (allocator == nullptr || allocator->dealloc == nullptr)
+        dealloc(ptr, size);
+    else
+        allocator->dealloc(allocator->userdata, ptr, size);
+}
+
+static void _lock_arena(pack_arena *arena)
+{
+    u32 unlocked = 0;
+
+    while (!arena->lock.compare_exchange_weak(unlocked, 1, std::memory_order_acquire))
+    {
+        arena->lock.wait(1, std::memory_order_relaxed);
+        unlocked = 0;
+    }
+}
+
+static void _unlock_arena(pack_arena *arena)
+{
+    arena->lock.store(0, std::memory_order_release);
+    arena->lock.notify_one();
+}
+
+// bump allocations are aligned to this
+#define _ARENA_ALIGNMENT 16
+
+inline static s64 _align(s64 x)
+{
+    return (x + _ARENA_ALIGNMENT - 1) & ~(s64)(_ARENA_ALIGNMENT - 1);
+}
+
+inline static s64 _header_size()
+{
+    return _align((s64)sizeof(pack_arena_block));
+}
+
+inline static char *_block_data(pack_arena_block *block)
+{
+    return (char*)block + _header_size();
+}
+
+static pack_arena_block *_new_block(pack_arena *arena, s64 size)
+{
+    pack_arena_block *block = (pack_arena_block*)alloc(_header_size() + size);
+    block->prev = nullptr;
+    block->next = nullptr;
+    block->size = size;
+    block->used = 0;
+    arena->reserved_bytes += _header_size() + size;
+
+    return block;
+}
+
+static void _free_block(pack_arena *arena, pack_arena_block *block)
+{
+    arena->reserved_bytes -= _header_size() + block->size;
+    dealloc((void*)block, _header_size() + block->size);
+}
+
+// power of two classes up to PACK_ARENA_MAX_SLAB_SIZE
+#define _SLAB_CLASSES 9
+
+static s64 _class_size(s32 cls)
+{
+    if (cls < _SLAB_CLASSES)
+        return (s64)PACK_ARENA_MIN_SLAB_SIZE << cls;
+
+    // four classes per power of two above PACK_ARENA_MAX_SLAB_SIZE
+    s32 i = cls - _SLAB_CLASSES;
+    s64 base = (s64)PACK_ARENA_MAX_SLAB_SIZE << (i / 4);
+
+    return base + (base / 4) * (i % 4 + 1);
+}
+
+static s32 _size_class(s64 size)
+{
+    s32 cls = 0;
+
+    while (_class_size(cls) < size)
+        cls += 1;
+
+    return cls;
+}
+
+static void *_bump(pack_arena *arena, s64 size)
+{
+    size = _align(size);
+    pack_arena_block *block = arena->blocks;
+
+    if (block == nullptr || block->used + size > block->size)
+    {
+        // blocks after the first one were filled before, except after a reset
+        pack_arena_block *reusable = block != nullptr ? block->next : nullptr;
+
+        while (reusable != nullptr && reusable->used + size > reusable->size)
+            reusable = reusable->next;
+
+        if (reusable != nullptr)
+        {
+            // move it to the front
+            reusable->prev->next = reusable->next;
+
+            if (reusable->next != nullptr)
+                reusable->next->prev = reusable->prev;
+
+            block = reusable;
+        }
+        else
+            block = _new_block(arena, PACK_ARENA_BLOCK_SIZE);
+
+        block->prev = nullptr;
+        block->next = arena->blocks;
+
+        if (arena->blocks != nullptr)
+            arena->blocks->prev = block;
+
+        arena->blocks = block;
+    }
+
+    void *ret = _block_data(block) + block->used;
+    block->used += size;
+
+    return ret;
+}
+
+void init(pack_arena *arena)
+{
+    assert(arena != nullptr);
+
+    fill_memory(arena, 0);
+}
+
+void free(pack_arena *arena)
+{
+    assert(arena != nullptr);
+
+    pack_arena_block *block = arena->blocks;
+
+    while (block != nullptr)
+    {
+        pack_arena_block *next = block->next;
+        _free_block(arena, block);
+        block = next;
+    }
+
+    block = arena->large;
+
+    while (block != nullptr)
+    {
+        pack_arena_block *next = block->next;
+        _free_block(arena, block);
+        block = next;
+    }
+
+    fill_memory(arena, 0);
+}
+
+void *pack_arena_alloc(pack_arena *arena, s64 size)
+{
+    assert(arena != nullptr);
+    assert(size >= 0);
+
+    _lock_arena(arena);
+
+    void *ret = nullptr;
+
+    if (size <= PACK_ARENA_MAX_CLASS_SIZE)
+    {
+        s32 cls = _size_class(size);
+        void *head = arena->free_lists[cls];
+
+        if (head != nullptr)
+        {
+            arena->free_lists[cls] = *(void**)head;
+            ret = head;
+        }
+        else
+            ret = _bump(arena, _class_size(cls));
+
+        arena->allocated_bytes += _class_size(cls);
+    }
+    else
+    {
+        pack_arena_block *block = _new_block(arena, size);
+        block->used = size;
+        block->next = arena->large;
+
+        if (arena->large != nullptr)
+            arena->large->prev = block;
+
+        arena->large = block;
+        arena->allocated_bytes += size;
+        ret = _block_data(block);
+    }
+
+    _unlock_arena(arena);
+
+    return ret;
+}
+
+void pack_arena_dealloc(pack_arena *arena, void *ptr, s64 size)
+{
+    assert(arena != nullptr);
+
+    if (ptr == nullptr)
+        return;
+
+    _lock_arena(arena);
+
+    if (size <= PACK_ARENA_MAX_CLASS_SIZE)
+    {
+        s32 cls = _size_class(size);
+        *(void**)ptr = arena->free_lists[cls];
+        arena->free_lists[cls] = ptr;
+        arena->allocated_bytes -= _class_size(cls);
+    }
+    else
+    {
+        pack_arena_block *block = (pack_arena_block*)((char*)ptr - _header_size());
+
+        if (block->prev != nullptr)
+            block->prev->next = block->next;
+        else
+            arena->large = block->next;
+
+        if (block->next != nullptr)
+            block->next->prev = block->prev;
+
+        arena->allocated_bytes -= size;
+        _free_block(arena, block);
+    }
+
+    _unlock_arena(arena);
+}
+
+void pack_arena_reset(pack_arena *arena)
+{
+    assert(arena != nullptr);
+
+    _lock_arena(arena);
+
+    for (pack_arena_block *block = arena->blocks; block != nullptr; block = block->next)
+        block->used = 0;
+
+    pack_arena_block *block = arena->large;
+
+    while (block != nullptr)
+    {
+        pack_arena_block *next = block->next;
+        _free_block(arena, block);
+        block = next;
+    }
+
+    arena->large = nullptr;
+    fill_memory((void*)arena->free_lists, 0, sizeof(arena->free_lists));
+    arena->allocated_bytes = 0;
+
+    _unlock_arena(arena);
+}
+
+static void *_arena_alloc(void *userdata, s64 size)
+{
+    return pack_arena_alloc((pack_arena*)userdata, size);
+}
+
+static void _arena_dealloc(void *userdata, void *ptr, s64 size)
+{
+    pack_arena_dealloc((pack_arena*)userdata, ptr, size);
+}
+
+pack_allocator pack_arena_allocator(pack_arena *arena)
+{
+    assert(arena != nullptr);
+
+    pack_allocator ret{};
+    ret.alloc = _arena_alloc;
+    ret.dealloc = _arena_dealloc;
+    ret.userdata = (void*)arena;
+
+    return ret;
+}
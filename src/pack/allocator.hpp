@@ -0,0 +1,78 @@
+#pragma once
+
+/* allocator.hpp
+
+Pluggable allocator for entry buffers of pack_loader and pack_writer, and
+pack_arena, a built-in allocator for many small entries that are freed
+together (e.g. when unloading a level).
+
+A zero-initialized pack_allocator uses alloc / dealloc.
+ */
+
+#include <atomic>
+
+#include "shl/number_types.hpp"
+
+struct pack_allocator
+{
+    void *(*alloc)(void *userdata, s64 size);
+    void  (*dealloc)(void *userdata, void *ptr, s64 size);
+    void *userdata;
+};
+
+void *pack_alloc(const pack_allocator *allocator, s64 size);
+void pack_dealloc(const pack_allocator *allocator, void *ptr, s64 size);
+
+#define PACK_ARENA_BLOCK_SIZE     0x100000 // 1 MiB
+#define PACK_ARENA_MIN_SLAB_SIZE  16
+// size classes are powers of two up to this, then four per power of two
+#define PACK_ARENA_MAX_SLAB_SIZE  4096
+// allocations larger than this get their own block
+#define PACK_ARENA_MAX_CLASS_SIZE (PACK_ARENA_BLOCK_SIZE / 4)
+#define PACK_ARENA_SIZE_CLASSES   33       // 16, 32, ..., 4096, 5120, 6144, 7168, 8192, 10240, ..., 256 KiB
+
+// used internally
+struct pack_arena_block
+{
+    pack_arena_block *prev;
+    pack_arena_block *next;
+    s64 size; // usable bytes after the block header
+    s64 used;
+};
+
+/* pack_arena hands out memory from 1 MiB blocks:
+    - sizes up to PACK_ARENA_MAX_CLASS_SIZE are rounded up to a size class
+      (powers of two up to PACK_ARENA_MAX_SLAB_SIZE, then steps of a quarter
+      of a power of two, wasting at most 25%) and bump allocated. freed
+      allocations are kept in a free list per size class and reused, so the
+      memory reserved for them is bounded by the peak use of every class,
+      also when entries are reloaded or evicted over and over.
+    - larger sizes get their own block which is freed right away.
+   pack_arena_reset frees everything at once, keeping the blocks for reuse.
+   it's O(blocks + large allocations), but everything allocated from the
+   arena must not be used anymore, e.g. loaded entries of a pack_loader have
+   to be cleared (O(entries)) and their handles released first.
+   all functions are thread safe.
+ */
+struct pack_arena
+{
+    std::atomic<u32> lock;
+
+    pack_arena_block *blocks; // the block being bump allocated from is first
+    pack_arena_block *large;
+    void *free_lists[PACK_ARENA_SIZE_CLASSES];
+
+    s64 allocated_bytes; // handed out and not freed, rounded up to size classes
+    s64 reserved_bytes;  // all blocks
+};
+
+void init(pack_arena *arena);
+void free(pack_arena *arena);
+
+void *pack_arena_alloc(pack_arena *arena, s64 size);
+void pack_arena_dealloc(pack_arena *arena, void *ptr, s64 size);
+// frees all allocations of the arena, nothing allocated from it may be used afterwards
+void pack_arena_reset(pack_arena *arena);
+
+// an allocator allocating from arena
+pack_allocator pack_arena_allocator(pack_arena *arena);
@@ -0,0 +1,1145 @@
+#include <new>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#include "shl/assert.hpp"
+#include "shl/memory.hpp"
+#include "shl/defer.hpp"
+#include "shl/compare.hpp"
+#include "shl/file_stream.hpp"
+#include "fs/path.hpp"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define PACK_IO_URING 1
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h> // strerror
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#else
+#define PACK_IO_URING 0
+#endif
+
+#include "pack/compression.hpp"
+#include "pack/content_hash.hpp"
+#include "pack/parallel.hpp"
+#include "pack/positional_io.hpp"
+#include "pack/async_loader.hpp"
+
+#define PACK_ASYNC_URING_ENTRIES 64
+// every request uses at most two submissions at once
+#define PACK_ASYNC_URING_MAX_IN_FLIGHT (PACK_ASYNC_URING_ENTRIES / 2)
+// reads are split into chunks of at most this size
+#define PACK_ASYNC_MAX_READ 0x40000000
+
+struct _async_request
+{
+    s64 entry;
+    pack_load_callback callback;
+    void *userdata;
+};
+
+struct _async_completion
+{
+    pack_load_result result;
+    pack_load_callback callback;
+    void *userdata;
+};
+
+#if PACK_IO_URING
+struct _uring
+{
+    int fd;
+    unsigned sq_entries;
+    unsigned to_submit;
+    int error; // errno of the io_uring_enter that failed, the ring is not used after that
+
+    void *sq_ptr;
+    size_t sq_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    void *cq_ptr;
+    size_t cq_size;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    io_uring_cqe *cqes;
+};
+
+struct _uring_request;
+#endif
+
+struct _pack_async_state
+{
+    pack_loader *loader;
+    pack_async_backend backend;
+    io_handle package_handle; // package mode
+
+    std::mutex mutex;
+    std::condition_variable work_available;
+    std::condition_variable completed_available;
+
+    array<_async_request> queue;
+    s64 queue_head;
+    array<_async_completion> completed;
+    s64 completed_head;
+    s64 pending; // submitted, but not retrieved yet
+    bool stop;
+
+    // thread pool
+    s32 thread_count;
+    std::thread threads[PACK_MAX_THREADS];
+
+#if PACK_IO_URING
+    _uring ring;
+    s64 in_flight;
+    _uring_request *requests; // in flight, linked through next / prev
+    array<_uring_request*> deferred_reads; // in flight, the next read did not fit into the ring
+#endif
+};
+
+static const char *_entry_name(pack_loader *loader, s64 n)
+{
+    if (loader->mode == pack_loader_mode::Package)
+    {
+        pack_reader_entry rentry{};
+        pack_reader_get_entry(&loader->reader, n, &rentry);
+        return rentry.name;
+    }
+    else
+        return loader->files.ptr[n];
+}
+
+// moves data into the handle of result, data may be nullptr if loading failed
+static void _complete(_pack_async_state *state, const _async_request *req, pack_entry_data *data, const error *err)
+{
+    _async_completion c{};
+    c.callback = req->callback;
+    c.userdata = req->userdata;
+    c.result.entry = req->entry;
+    c.result.handle.entry.name = _entry_name(state->loader, req->entry);
+
+    // like pack_loader_load_entry, failed loads are accesses too
+    pack_loader_trace_access(state->loader, req->entry);
+
+    if (data != nullptr)
+    {
+        c.result.handle._data = data;
+        c.result.handle.entry.data = data->data;
+        c.result.handle.entry.size = data->size;
+    }
+    else
+        c.result.err = *err;
+
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        add_at_end(&state->completed, c);
+    }
+
+    state->completed_available.notify_all();
+}
+
+static bool _read_package_range(_pack_async_state *state, char *out, s64 size, s64 offset, error *err)
+{
+    s64 bytes_read = pack_read_at(state->package_handle, out, size, offset, err);
+
+    PACK_STATS_IO(state->loader->stats, Max(bytes_read, (s64)0), 1);
+
+    if (bytes_read < 0)
+        return false;
+
+    if (bytes_read != size)
+    {
+        format_error(err, 1, "async_loader: package ends inside entry at %x", offset);
+        return false;
+    }
+
+    return true;
+}
+
+// checks the stored content of package entry n, read to stored, against its
+// checksum if the loader verifies checksums, like pack_loader_load_entry.
+static bool _verify_stored_entry(_pack_async_state *state, s64 n, const pack_reader_entry *rentry, const char *stored, error *err)
+{
+    pack_loader *loader = state->loader;
+
+    if (loader->verified_entries.size == 0)
+        return true;
+
+    std::atomic_ref<u8> verified(loader->verified_entries[n]);
+
+    if (verified.load(std::memory_order_acquire) != 0)
+        return true;
+
+    if (pack_hash(stored, rentry->size) != loader->reader.checksums[n])
+    {
+        format_error(err, 2, "async_loader: entry %d (%s) is corrupted, checksum mismatch", n, rentry->name);
+        return false;
+    }
+
+    verified.store(1, std::memory_order_release);
+
+    return true;
+}
+
+// loads entry n on the calling thread
+static pack_entry_data *_load_entry(_pack_async_state *state, s64 n, error *err)
+{
+    pack_loader *loader = state->loader;
+
+    if (loader->mode == pack_loader_mode::Package)
+    {
+        pack_reader_entry rentry{};
+        pack_reader_get_entry(&loader->reader, n, &rentry);
+
+        pack_entry_data *data = pack_entry_data_create(&state->loader->allocator, rentry.uncompressed_size);
+
+        if ((rentry.flags & PACK_TOC_FLAG_COMPRESSED) != PACK_TOC_FLAG_COMPRESSED)
+        {
+            if (!_read_package_range(state, data->data, rentry.size, rentry.offset, err)
+             || !_verify_stored_entry(state, n, &rentry, data->data, err))
+            {
+                pack_entry_data_release(data);
+                return nullptr;
+            }
+
+            return data;
+        }
+
+        char *compressed = (char*)alloc(rentry.size);
+        defer { dealloc(compressed, rentry.size); };
+
+        if (!_read_package_range(state, compressed, rentry.size, rentry.offset, err)
+         || !_verify_stored_entry(state, n, &rentry, compressed, err)
+         || !pack_decompress(rentry.codec, compressed, rentry.size, data->data, data->size, err))
+        {
+            pack_entry_data_release(data);
+            return nullptr;
+        }
+
+        return data;
+    }
+
+    fs::path entry_path{};
+    defer { fs::free(&entry_path); };
+
+    fs::path_set(&entry_path, &loader->files.base_path);
+    fs::path_append(&entry_path, loader->files.ptr[n]);
+
+    file_stream stream{};
+
+    bool opened = init(&stream, entry_path.c_str(), open_mode::Read, err);
+
+    PACK_STATS_IO(loader->stats, 0, 1);
+
+    if (!opened)
+        return nullptr;
+
+    defer { free(&stream); PACK_STATS_IO(loader->stats, 0, 1); };
+
+    s64 size = get_file_size(&stream, err);
+
+    PACK_STATS_IO(loader->stats, 0, 1);
+
+    if (size < 0)
+        return nullptr;
+
+    pack_entry_data *data = pack_entry_data_create(&state->loader->allocator, size);
+    s64 bytes_read = pack_read_at(stream.handle, data->data, size, 0, err);
+
+    PACK_STATS_IO(loader->stats, Max(bytes_read, (s64)0), 1);
+
+    if (bytes_read != size)
+    {
+        if (bytes_read >= 0)
+            format_error(err, 1, "async_loader: file %s changed size while reading", entry_path.c_str());
+
+        pack_entry_data_release(data);
+        return nullptr;
+    }
+
+    return data;
+}
+
+// thread pool
+
+static void _worker(_pack_async_state *state)
+{
+    while (true)
+    {
+        _async_request req{};
+
+        {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            state->work_available.wait(lock, [state]() { return state->stop || state->queue_head < state->queue.size; });
+
+            if (state->stop)
+                return;
+
+            req = state->queue[state->queue_head];
+            state->queue_head += 1;
+
+            if (state->queue_head == state->queue.size)
+            {
+                clear(&state->queue);
+                state->queue_head = 0;
+            }
+        }
+
+        error err{};
+        pack_entry_data *data = _load_entry(state, req.entry, &err);
+        _complete(state, &req, data, &err);
+    }
+}
+
+static void _start_threads(_pack_async_state *state)
+{
+    state->backend = pack_async_backend::ThreadPool;
+
+    for (s32 t = 0; t < state->thread_count; ++t)
+        state->threads[t] = std::thread(_worker, state);
+
+    state->work_available.notify_all();
+}
+
+// io_uring
+
+#if PACK_IO_URING
+enum class _uring_op : u64
+{
+    Open  = 0,
+    Statx = 1,
+    Read  = 2
+};
+
+struct _uring_request
+{
+    _async_request request;
+    _uring_request *prev;
+    _uring_request *next;
+    s32 ops_in_flight;
+    int error_code; // errno of the first failed operation
+
+    // files mode
+    fs::path path;
+    int fd;
+    struct statx stx;
+
+    // package mode
+    pack_reader_entry rentry;
+    char *compressed; // read buffer of compressed entries
+
+    pack_entry_data *data;
+    char *read_buffer;
+    s64 read_size;
+    s64 read_offset; // offset of the read buffer in the file
+    s64 read_done;
+};
+
+static bool _uring_init(_uring *ring, unsigned entries, error *err)
+{
+    io_uring_params params{};
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+
+    if (fd < 0)
+    {
+        format_error(err, errno, "async_loader: could not set up io_uring: %s", strerror(errno));
+        return false;
+    }
+
+    fill_memory(ring, 0);
+    ring->fd = fd;
+    ring->sq_entries = params.sq_entries;
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+    bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) == IORING_FEAT_SINGLE_MMAP;
+
+    if (single_mmap)
+    {
+        ring->sq_size = Max(ring->sq_size, ring->cq_size);
+        ring->cq_size = ring->sq_size;
+    }
+
+    ring->sq_ptr = mmap(nullptr, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+
+    if (ring->sq_ptr == MAP_FAILED)
+    {
+        format_error(err, errno, "async_loader: could not map io_uring: %s", strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    if (single_mmap)
+        ring->cq_ptr = ring->sq_ptr;
+    else
+    {
+        ring->cq_ptr = mmap(nullptr, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+
+        if (ring->cq_ptr == MAP_FAILED)
+        {
+            format_error(err, errno, "async_loader: could not map io_uring: %s", strerror(errno));
+            munmap(ring->sq_ptr, ring->sq_size);
+            close(fd);
+            return false;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    ring->sqes = (io_uring_sqe*)mmap(nullptr, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+    if (ring->sqes == MAP_FAILED)
+    {
+        format_error(err, errno, "async_loader: could not map io_uring: %s", strerror(errno));
+
+        if (!single_mmap)
+            munmap(ring->cq_ptr, ring->cq_size);
+
+        munmap(ring->sq_ptr, ring->sq_size);
+        close(fd);
+        return false;
+    }
+
+    char *sq = (char*)ring->sq_ptr;
+    ring->sq_head  = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail  = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask  = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+
+    char *cq = (char*)ring->cq_ptr;
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes    = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    return true;
+}
+
+static void _uring_free(_uring *ring)
+{
+    munmap(ring->sqes, ring->sqes_size);
+
+    if (ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_size);
+
+    munmap(ring->sq_ptr, ring->sq_size);
+    close(ring->fd);
+    fill_memory(ring, 0);
+}
+
+// submits queued submissions and waits for min_complete completions.
+// errors other than EAGAIN and EBUSY (out of resources or too many
+// completions that weren't reaped yet) are recorded in ring->error.
+static bool _uring_enter(_uring *ring, unsigned min_complete)
+{
+    while (true)
+    {
+        unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+        int ret = (int)syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, min_complete, flags, nullptr, 0);
+
+        if (ret >= 0)
+        {
+            ring->to_submit -= Min((unsigned)ret, ring->to_submit);
+            return true;
+        }
+
+        if (errno == EINTR)
+            continue;
+
+        if (errno != EAGAIN && errno != EBUSY)
+            ring->error = errno;
+
+        return false;
+    }
+}
+
+// makes sure count submissions can be queued
+static bool _uring_reserve(_uring *ring, unsigned count)
+{
+    unsigned head = std::atomic_ref<unsigned>(*ring->sq_head).load(std::memory_order_acquire);
+
+    if (ring->sq_entries - (*ring->sq_tail - head) >= count)
+        return true;
+
+    if (!_uring_enter(ring, 0))
+        return false;
+
+    head = std::atomic_ref<unsigned>(*ring->sq_head).load(std::memory_order_acquire);
+
+    return ring->sq_entries - (*ring->sq_tail - head) >= count;
+}
+
+static io_uring_sqe *_uring_get_sqe(_uring *ring)
+{
+    unsigned head = std::atomic_ref<unsigned>(*ring->sq_head).load(std::memory_order_acquire);
+    unsigned tail = *ring->sq_tail;
+
+    if (tail - head >= ring->sq_entries)
+    {
+        if (!_uring_enter(ring, 0))
+            return nullptr;
+
+        head = std::atomic_ref<unsigned>(*ring->sq_head).load(std::memory_order_acquire);
+
+        if (tail - head >= ring->sq_entries)
+            return nullptr;
+    }
+
+    unsigned index = tail & *ring->sq_mask;
+    io_uring_sqe *sqe = ring->sqes + index;
+    fill_memory(sqe, 0);
+    ring->sq_array[index] = index;
+
+    return sqe;
+}
+
+static void _uring_push_sqe(_uring *ring)
+{
+    std::atomic_ref<unsigned>(*ring->sq_tail).store(*ring->sq_tail + 1, std::memory_order_release);
+    ring->to_submit += 1;
+}
+
+static u64 _uring_user_data(_uring_request *req, _uring_op op)
+{
+    return (u64)req | (u64)op;
+}
+
+static bool _uring_submit_read(_uring *ring, _uring_request *req)
+{
+    io_uring_sqe *sqe = _uring_get_sqe(ring);
+
+    if (sqe == nullptr)
+        return false;
+
+    s64 chunk = Min(req->read_size - req->read_done, (s64)PACK_ASYNC_MAX_READ);
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = req->fd;
+    sqe->addr = (u64)(req->read_buffer + req->read_done);
+    sqe->len = (u32)chunk;
+    sqe->off = (u64)(req->read_offset + req->read_done);
+    sqe->user_data = _uring_user_data(req, _uring_op::Read);
+    _uring_push_sqe(ring);
+
+    req->ops_in_flight += 1;
+    return true;
+}
+
+static void _uring_finish(_pack_async_state *state, _uring_request *req)
+{
+    pack_loader *loader = state->loader;
+    error err{};
+    pack_entry_data *data = req->data;
+
+    if (req->error_code == EINVAL && req->data == nullptr)
+    {
+        // the kernel does not support opening / querying files with io_uring
+        data = _load_entry(state, req->request.entry, &err);
+    }
+    else if (req->error_code != 0)
+    {
+        format_error(&err, req->error_code, "async_loader: could not load entry %s: %s", _entry_name(loader, req->request.entry), strerror(req->error_code));
+        pack_entry_data_release(data);
+        data = nullptr;
+    }
+    else if (loader->mode == pack_loader_mode::Package)
+    {
+        const char *stored = req->compressed != nullptr ? req->compressed : data->data;
+
+        if (!_verify_stored_entry(state, req->request.entry, &req->rentry, stored, &err)
+         || (req->compressed != nullptr
+          && !pack_decompress(req->rentry.codec, req->compressed, req->rentry.size, data->data, data->size, &err)))
+        {
+            pack_entry_data_release(data);
+            data = nullptr;
+        }
+    }
+
+    if (req->compressed != nullptr)
+        dealloc(req->compressed, req->rentry.size);
+
+    if (loader->mode == pack_loader_mode::Files && req->fd >= 0)
+    {
+        close(req->fd);
+        PACK_STATS_IO(loader->stats, 0, 1);
+    }
+
+    if (req->prev != nullptr)
+        req->prev->next = req->next;
+    else
+        state->requests = req->next;
+
+    if (req->next != nullptr)
+        req->next->prev = req->prev;
+
+    _complete(state, &req->request, data, &err);
+
+    fs::free(&req->path);
+    dealloc(req, sizeof(_uring_request));
+    state->in_flight -= 1;
+}
+
+// returns false if the ring has no room for the request
+static bool _uring_start(_pack_async_state *state, const _async_request *request)
+{
+    pack_loader *loader = state->loader;
+    _uring *ring = &state->ring;
+
+    if (!_uring_reserve(ring, loader->mode == pack_loader_mode::Package ? 1 : 2))
+        return false;
+
+    _uring_request *req = (_uring_request*)alloc(sizeof(_uring_request));
+    fill_memory(req, 0);
+    req->request = *request;
+    req->fd = -1;
+    req->next = state->requests;
+
+    if (state->requests != nullptr)
+        state->requests->prev = req;
+
+    state->requests = req;
+    state->in_flight += 1;
+
+    if (loader->mode == pack_loader_mode::Package)
+    {
+        pack_reader_get_entry(&loader->reader, request->entry, &req->rentry);
+        req->data = pack_entry_data_create(&state->loader->allocator, req->rentry.uncompressed_size);
+        req->fd = state->package_handle;
+        req->read_buffer = req->data->data;
+        req->read_size = req->rentry.size;
+        req->read_offset = req->rentry.offset;
+
+        if ((req->rentry.flags & PACK_TOC_FLAG_COMPRESSED) == PACK_TOC_FLAG_COMPRESSED)
+        {
+            req->compressed = (char*)alloc(req->rentry.size);
+            req->read_buffer = req->compressed;
+        }
+
+        if (req->read_size == 0)
+            _uring_finish(state, req);
+        else if (!_uring_submit_read(ring, req))
+            add_at_end(&state->deferred_reads, req);
+
+        return true;
+    }
+
+    fs::path_set(&req->path, &loader->files.base_path);
+    fs::path_append(&req->path, loader->files.ptr[request->entry]);
+
+    io_uring_sqe *open_sqe = _uring_get_sqe(ring);
+    open_sqe->opcode = IORING_OP_OPENAT;
+    open_sqe->fd = AT_FDCWD;
+    open_sqe->addr = (u64)req->path.c_str();
+    open_sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    open_sqe->user_data = _uring_user_data(req, _uring_op::Open);
+    _uring_push_sqe(ring);
+    req->ops_in_flight += 1;
+
+    io_uring_sqe *statx_sqe = _uring_get_sqe(ring);
+    statx_sqe->opcode = IORING_OP_STATX;
+    statx_sqe->fd = AT_FDCWD;
+    statx_sqe->addr = (u64)req->path.c_str();
+    statx_sqe->len = STATX_SIZE;
+    statx_sqe->off = (u64)&req->stx;
+    statx_sqe->user_data = _uring_user_data(req, _uring_op::Statx);
+    _uring_push_sqe(ring);
+    req->ops_in_flight += 1;
+
+    return true;
+}
+
+static void _uring_complete_op(_pack_async_state *state, _uring_request *req, _uring_op op, s32 res)
+{
+    req->ops_in_flight -= 1;
+
+    PACK_STATS_IO(state->loader->stats, (op == _uring_op::Read && res > 0) ? (s64)res : 0, 1);
+
+    if (res < 0 && res != -EAGAIN && req->error_code == 0)
+        req->error_code = -res;
+
+    switch (op)
+    {
+    case _uring_op::Open:
+        if (res >= 0)
+            req->fd = res;
+        break;
+
+    case _uring_op::Statx:
+        break;
+
+    case _uring_op::Read:
+        if (res == -EAGAIN)
+            break;
+
+        if (res == 0 && req->error_code == 0)
+            req->error_code = EIO; // file shorter than expected
+
+        if (res > 0)
+            req->read_done += res;
+        break;
+    }
+
+    if (req->ops_in_flight > 0)
+        return;
+
+    if (req->error_code == 0)
+    {
+        // files mode, open and statx are done
+        if (req->data == nullptr)
+        {
+            req->data = pack_entry_data_create(&state->loader->allocator, (s64)req->stx.stx_size);
+            req->read_buffer = req->data->data;
+            req->read_size = req->data->size;
+            req->read_offset = 0;
+        }
+
+        if (req->read_done < req->read_size)
+        {
+            // if the ring is full, the read is submitted again by _uring_progress
+            if (!_uring_submit_read(&state->ring, req))
+                add_at_end(&state->deferred_reads, req);
+
+            return;
+        }
+    }
+
+    _uring_finish(state, req);
+}
+
+static s64 _uring_reap(_pack_async_state *state)
+{
+    _uring *ring = &state->ring;
+    unsigned head = *ring->cq_head;
+    s64 count = 0;
+
+    while (true)
+    {
+        unsigned tail = std::atomic_ref<unsigned>(*ring->cq_tail).load(std::memory_order_acquire);
+
+        if (head == tail)
+            break;
+
+        io_uring_cqe *cqe = ring->cqes + (head & *ring->cq_mask);
+        u64 user_data = cqe->user_data;
+        s32 res = cqe->res;
+
+        head += 1;
+        std::atomic_ref<unsigned>(*ring->cq_head).store(head, std::memory_order_release);
+        count += 1;
+
+        _uring_request *req = (_uring_request*)(user_data & ~(u64)3);
+        _uring_complete_op(state, req, (_uring_op)(user_data & 3), res);
+    }
+
+    return count;
+}
+
+// starts queued requests while there is room in the ring
+static void _uring_start_queued(_pack_async_state *state)
+{
+    while (state->in_flight < PACK_ASYNC_URING_MAX_IN_FLIGHT && state->ring.error == 0)
+    {
+        _async_request req{};
+
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+
+            if (state->queue_head >= state->queue.size)
+                return;
+
+            req = state->queue[state->queue_head];
+            state->queue_head += 1;
+
+            if (state->queue_head == state->queue.size)
+            {
+                clear(&state->queue);
+                state->queue_head = 0;
+            }
+        }
+
+        if (!_uring_start(state, &req))
+        {
+            // the ring could not take more submissions, load synchronously
+            error err{};
+            pack_entry_data *data = _load_entry(state, req.entry, &err);
+            _complete(state, &req, data, &err);
+        }
+    }
+}
+
+static bool _has_completed(_pack_async_state *state)
+{
+    std::lock_guard<std::mutex> lock(state->mutex);
+    return state->completed_head < state->completed.size;
+}
+
+static void _uring_submit_deferred_reads(_pack_async_state *state)
+{
+    s64 kept = 0;
+
+    for (s64 i = 0; i < state->deferred_reads.size; ++i)
+    {
+        _uring_request *req = state->deferred_reads[i];
+
+        if (!_uring_submit_read(&state->ring, req))
+        {
+            state->deferred_reads[kept] = req;
+            kept += 1;
+        }
+    }
+
+    state->deferred_reads.size = kept;
+}
+
+/* the ring failed: it is closed, which cancels the operations still in the
+   kernel, the requests in flight fail with the error of the ring and queued
+   requests are loaded by the thread pool from now on.
+ */
+static void _uring_fail(_pack_async_state *state)
+{
+    int code = state->ring.error;
+
+    _uring_free(&state->ring);
+    clear(&state->deferred_reads);
+
+    while (state->requests != nullptr)
+    {
+        _uring_request *req = state->requests;
+
+        if (req->error_code == 0)
+            req->error_code = code;
+
+        _uring_finish(state, req);
+    }
+
+    _start_threads(state);
+}
+
+// submits, reaps and processes completions. if wait is true, blocks until at
+// least one request finished unless nothing is in flight. if the ring fails,
+// the state switches to the thread pool backend.
+static void _uring_progress(_pack_async_state *state, bool wait)
+{
+    bool waited = !wait;
+
+    while (true)
+    {
+        _uring_submit_deferred_reads(state);
+        _uring_start_queued(state);
+
+        if (state->ring.error != 0)
+        {
+            _uring_fail(state);
+            return;
+        }
+
+        unsigned min_complete = 0;
+
+        // deferred reads are not in the kernel, waiting for them would block forever
+        if (!waited && state->in_flight > state->deferred_reads.size && !_has_completed(state))
+            min_complete = 1;
+
+        waited = true;
+
+        if (!_uring_enter(&state->ring, min_complete))
+        {
+            int code = errno;
+
+            // EAGAIN / EBUSY: reaping completions frees kernel resources, try again
+            if (state->ring.error == 0 && _uring_reap(state) > 0)
+                continue;
+
+            if (state->ring.error == 0)
+                state->ring.error = code;
+
+            _uring_fail(state);
+            return;
+        }
+
+        s64 reaped = _uring_reap(state);
+
+        if (reaped == 0 && state->ring.to_submit == 0)
+            return;
+    }
+}
+#endif
+
+static void _destroy_state(_pack_async_state *state)
+{
+    if (state->package_handle != INVALID_IO_HANDLE)
+        io_close(state->package_handle);
+
+    free(&state->queue);
+    free(&state->completed);
+#if PACK_IO_URING
+    free(&state->deferred_reads);
+#endif
+
+    state->~_pack_async_state();
+    dealloc((void*)state, sizeof(_pack_async_state));
+}
+
+bool init(pack_async_loader *async, pack_loader *loader, pack_async_backend backend, s32 thread_count, error *err)
+{
+    assert(async != nullptr);
+    assert(loader != nullptr);
+
+    fill_memory(async, 0);
+    async->loader = loader;
+
+    _pack_async_state *state = new (alloc(sizeof(_pack_async_state))) _pack_async_state{};
+    state->loader = loader;
+    state->package_handle = INVALID_IO_HANDLE;
+    state->thread_count = pack_thread_count(thread_count, PACK_MAX_THREADS);
+    init(&state->queue);
+    init(&state->completed);
+#if PACK_IO_URING
+    init(&state->deferred_reads);
+#endif
+
+    if (loader->mode == pack_loader_mode::Package)
+    {
+        state->package_handle = io_open(loader->package_path.c_str(), open_mode::Read, err);
+
+        if (state->package_handle == INVALID_IO_HANDLE)
+        {
+            _destroy_state(state);
+            return false;
+        }
+    }
+
+    if (backend == pack_async_backend::Default || backend == pack_async_backend::IoUring)
+    {
+#if PACK_IO_URING
+        if (_uring_init(&state->ring, PACK_ASYNC_URING_ENTRIES, backend == pack_async_backend::IoUring ? err : nullptr))
+        {
+            state->backend = pack_async_backend::IoUring;
+            async->backend = state->backend;
+            async->_state = state;
+            return true;
+        }
+#else
+        if (backend == pack_async_backend::IoUring)
+            set_error(err, 1, "async_loader: io_uring is not supported on this platform");
+#endif
+
+        if (backend == pack_async_backend::IoUring)
+        {
+            _destroy_state(state);
+            return false;
+        }
+    }
+
+    _start_threads(state);
+
+    async->backend = state->backend;
+    async->_state = state;
+
+    return true;
+}
+
+void free(pack_async_loader *async)
+{
+    assert(async != nullptr);
+
+    _pack_async_state *state = async->_state;
+
+    if (state == nullptr)
+        return;
+
+    // requests that haven't been started are dropped
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        clear(&state->queue);
+        state->queue_head = 0;
+        state->stop = true;
+    }
+
+#if PACK_IO_URING
+    if (state->backend == pack_async_backend::IoUring)
+    {
+        while (state->in_flight > 0 && state->backend == pack_async_backend::IoUring)
+            _uring_progress(state, true);
+
+        // unless the ring failed while waiting
+        if (state->backend == pack_async_backend::IoUring)
+            _uring_free(&state->ring);
+    }
+#endif
+
+    if (state->backend == pack_async_backend::ThreadPool)
+    {
+        state->work_available.notify_all();
+
+        for (s32 t = 0; t < state->thread_count; ++t)
+            state->threads[t].join();
+    }
+
+    for (s64 i = state->completed_head; i < state->completed.size; ++i)
+        pack_loader_release_entry(&state->completed[i].result.handle);
+
+    _destroy_state(state);
+    fill_memory(async, 0);
+}
+
+bool pack_async_loader_submit(pack_async_loader *async, const s64 *entries, s64 count, pack_load_callback callback, void *userdata, error *err)
+{
+    assert(async != nullptr);
+    assert(async->_state != nullptr);
+    assert(entries != nullptr || count == 0);
+
+    _pack_async_state *state = async->_state;
+    s64 entry_count = pack_loader_entry_count(state->loader);
+
+    for (s64 i = 0; i < count; ++i)
+    {
+        if (entries[i] < 0 || entries[i] >= entry_count)
+        {
+            format_error(err, 1, "async_loader_submit: entry %d out of range (%d entries)", entries[i], entry_count);
+            return false;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+
+        for (s64 i = 0; i < count; ++i)
+        {
+            _async_request *req = add_at_end(&state->queue);
+            req->entry = entries[i];
+            req->callback = callback;
+            req->userdata = userdata;
+        }
+
+        state->pending += count;
+    }
+
+    if (state->backend == pack_async_backend::ThreadPool)
+        state->work_available.notify_all();
+#if PACK_IO_URING
+    else
+    {
+        _uring_progress(state, false);
+        async->backend = state->backend;
+    }
+#endif
+
+    return true;
+}
+
+s64 pack_async_loader_pending(pack_async_loader *async)
+{
+    assert(async != nullptr);
+    assert(async->_state != nullptr);
+
+    std::lock_guard<std::mutex> lock(async->_state->mutex);
+    return async->_state->pending;
+}
+
+// hands out finished results, returns the number of results written to out_results
+static s64 _take_completed(_pack_async_state *state, pack_load_result *out_results, s64 max_results, s64 *out_processed)
+{
+    s64 written = 0;
+    *out_processed = 0;
+
+    while (true)
+    {
+        _async_completion c{};
+
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+
+            if (state->completed_head >= state->completed.size)
+                break;
+
+            c = state->completed[state->completed_head];
+
+            if (c.callback == nullptr && written >= max_results)
+                break;
+
+            state->completed_head += 1;
+            state->pending -= 1;
+
+            if (state->completed_head == state->completed.size)
+            {
+                clear(&state->completed);
+                state->completed_head = 0;
+            }
+        }
+
+        *out_processed += 1;
+
+        // callbacks are called without holding the lock so they may submit more entries
+        if (c.callback != nullptr)
+            c.callback(&c.result, c.userdata);
+        else
+        {
+            out_results[written] = c.result;
+            written += 1;
+        }
+    }
+
+    return written;
+}
+
+s64 pack_async_loader_poll(pack_async_loader *async, pack_load_result *out_results, s64 max_results)
+{
+    assert(async != nullptr);
+    assert(async->_state != nullptr);
+    assert(out_results != nullptr || max_results == 0);
+
+    _pack_async_state *state = async->_state;
+
+#if PACK_IO_URING
+    if (state->backend == pack_async_backend::IoUring)
+    {
+        _uring_progress(state, false);
+        async->backend = state->backend;
+    }
+#endif
+
+    s64 processed = 0;
+    return _take_completed(state, out_results, max_results, &processed);
+}
+
+s64 pack_async_loader_wait(pack_async_loader *async, pack_load_result *out_results, s64 max_results)
+{
+    assert(async != nullptr);
+    assert(async->_state != nullptr);
+    assert(out_results != nullptr || max_results == 0);
+
+    _pack_async_state *state = async->_state;
+
+    while (true)
+    {
+        s64 processed = 0;
+        s64 written = 0;
+
+#if PACK_IO_URING
+        if (state->backend == pack_async_backend::IoUring)
+        {
+            _uring_progress(state, true);
+            async->backend = state->backend;
+        }
+        else
+#endif
+        {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            state->completed_available.wait(lock, [state]() { return state->completed_head < state->completed.size || state->pending == 0; });
+        }
+
+        written = _take_completed(state, out_results, max_results, &processed);
+
+        if (processed > 0 || max_results == 0 || pack_async_loader_pending(async) == 0)
+            return written;
+    }
+}
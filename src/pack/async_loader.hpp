@@ -0,0 +1,76 @@
+#pragma once
+
+/* async_loader.hpp
+
+Loads batches of entries of a pack_loader in the background.
+Entries are submitted as a list of entry numbers and read into buffers owned by
+the results, which are either passed to a callback or retrieved from a
+completion queue with pack_async_loader_poll / pack_async_loader_wait.
+
+On Linux, io_uring is used if the kernel supports it: the files of entries in
+files mode are opened, queried and read, and entry ranges of packages are read,
+without blocking any thread. Otherwise a pool of threads does the same with
+regular (positional) reads. If the ring fails, the entries in flight fail with
+its error and the async loader switches to the thread pool.
+
+With the thread pool, submit, poll and wait may be called from any thread.
+With io_uring, the ring is driven by the thread calling submit, poll, wait and
+free, so they must not be called at the same time from different threads
+(callbacks may submit more entries).
+
+Async loads do not use or fill the entry cache of the pack_loader, and the
+pack_loader must stay loaded until the async loader is freed. If the loader
+verifies checksums (pack_loader.verify_checksums), the stored content read for
+an entry is checked before it is decompressed and corrupted entries fail to
+load, as with pack_loader_load_entry.
+ */
+
+#include "shl/error.hpp"
+#include "pack/pack_loader.hpp"
+
+enum class pack_async_backend
+{
+    Default = 0,    // io_uring if available, otherwise ThreadPool
+    ThreadPool = 1,
+    IoUring = 2
+};
+
+struct pack_load_result
+{
+    s64 entry;
+    pack_entry_handle handle; // release with pack_loader_release_entry
+    error err;                // err.error_code is 0 if the entry was loaded
+};
+
+// called by pack_async_loader_poll / pack_async_loader_wait on the polling
+// thread, the callback takes ownership of result->handle.
+typedef void (*pack_load_callback)(pack_load_result *result, void *userdata);
+
+struct _pack_async_state;
+
+struct pack_async_loader
+{
+    pack_loader *loader;
+    pack_async_backend backend; // the backend in use, changes to ThreadPool if the io_uring fails
+    _pack_async_state *_state;
+};
+
+// thread_count is only used by the thread pool (also when io_uring fails), 0 = number of hardware threads.
+bool init(pack_async_loader *async, pack_loader *loader, pack_async_backend backend = pack_async_backend::Default, s32 thread_count = 0, error *err = nullptr);
+// waits for loads in progress, results that weren't retrieved are released
+void free(pack_async_loader *async);
+
+// queues count entries for loading. if callback is nullptr, the results are
+// retrieved with pack_async_loader_poll / pack_async_loader_wait.
+bool pack_async_loader_submit(pack_async_loader *async, const s64 *entries, s64 count, pack_load_callback callback = nullptr, void *userdata = nullptr, error *err = nullptr);
+
+// number of submitted entries whose results haven't been retrieved yet
+s64 pack_async_loader_pending(pack_async_loader *async);
+
+// calls the callbacks of finished entries and writes up to max_results
+// results of finished entries without callbacks to out_results.
+// returns the number of results written, does not block.
+s64 pack_async_loader_poll(pack_async_loader *async, pack_load_result *out_results, s64 max_results);
+
+// same as poll, but blocks until at least one entry finished, unless nothing is pending.
+s64 pack_async_loader_wait(pack_async_loader *async, pack_load_result *out_results, s64 max_results);
@@ -0,0 +1,261 @@
+
+#include "shl/assert.hpp"
+#include "shl/memory.hpp"
+#include "shl/compare.hpp"
+#include "pack/package.hpp"
+#include "pack/compression.hpp"
+
+#define LZ4_MIN_MATCH      4
+#define LZ4_LAST_LITERALS  5  // the last 5 bytes are always literals
+#define LZ4_MATCH_LIMIT    12 // the last match must start at least 12 bytes before the end
+#define LZ4_MAX_OFFSET     65535
+#define LZ4_HASH_BITS      12
+
+inline static u32 _read32(const char *p)
+{
+    u32 ret;
+    copy_memory(p, &ret, sizeof(u32));
+    return ret;
+}
+
+inline static u32 _lz4_hash(u32 x)
+{
+    return (x * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+// writes the extra length bytes of a literal or match length >= 15
+inline static bool _lz4_write_length(char **op, char *oend, s64 len)
+{
+    while (len >= 255)
+    {
+        if (*op >= oend)
+            return false;
+
+        *(*op)++ = (char)255;
+        len -= 255;
+    }
+
+    if (*op >= oend)
+        return false;
+
+    *(*op)++ = (char)len;
+    return true;
+}
+
+static bool _lz4_write_sequence(char **op, char *oend, const char *literals, s64 literal_count, s64 offset, s64 match_length)
+{
+    if (*op >= oend)
+        return false;
+
+    char *token = (*op)++;
+    u8 t = (u8)(Min(literal_count, (s64)15) << 4);
+
+    if (literal_count >= 15 && !_lz4_write_length(op, oend, literal_count - 15))
+        return false;
+
+    if (oend - *op < literal_count)
+        return false;
+
+    copy_memory(literals, *op, literal_count);
+    *op += literal_count;
+
+    // last sequence, literals only
+    if (match_length == 0)
+    {
+        *token = (char)t;
+        return true;
+    }
+
+    if (oend - *op < 2)
+        return false;
+
+    *(*op)++ = (char)(offset & 0xff);
+    *(*op)++ = (char)((offset >> 8) & 0xff);
+
+    s64 ml = match_length - LZ4_MIN_MATCH;
+    t |= (u8)Min(ml, (s64)15);
+    *token = (char)t;
+
+    if (ml >= 15 && !_lz4_write_length(op, oend, ml - 15))
+        return false;
+
+    return true;
+}
+
+static s64 _lz4_compress(const char *in, s64 in_size, char *out, s64 out_size)
+{
+    s64 table[1 << LZ4_HASH_BITS];
+    fill_memory((void*)table, 0xff, sizeof(table));
+
+    char *op = out;
+    char *oend = out + out_size;
+    s64 anchor = 0;
+    s64 ip = 0;
+
+    while (ip + LZ4_MATCH_LIMIT < in_size)
+    {
+        u32 seq = _read32(in + ip);
+        u32 h = _lz4_hash(seq);
+        s64 ref = table[h];
+        table[h] = ip;
+
+        if (ref < 0 || ip - ref > LZ4_MAX_OFFSET || _read32(in + ref) != seq)
+        {
+            ip += 1;
+            continue;
+        }
+
+        s64 len = LZ4_MIN_MATCH;
+        s64 match_end = in_size - LZ4_LAST_LITERALS;
+
+        while (ip + len < match_end && in[ref + len] == in[ip + len])
+            len += 1;
+
+        if (!_lz4_write_sequence(&op, oend, in + anchor, ip - anchor, ip - ref, len))
+            return -1;
+
+        ip += len;
+        anchor = ip;
+    }
+
+    if (!_lz4_write_sequence(&op, oend, in + anchor, in_size - anchor, 0, 0))
+        return -1;
+
+    return op - out;
+}
+
+// reads the extra length bytes of a literal or match length of 15
+inline static bool _lz4_read_length(const u8 **ip, const u8 *iend, s64 *len)
+{
+    u8 b;
+
+    do
+    {
+        if (*ip >= iend)
+            return false;
+
+        b = *(*ip)++;
+        *len += b;
+    }
+    while (b == 255);
+
+    return true;
+}
+
+static bool _lz4_decompress(const char *in, s64 in_size, char *out, s64 out_size)
+{
+    const u8 *ip = (const u8*)in;
+    const u8 *iend = ip + in_size;
+    char *op = out;
+    char *oend = out + out_size;
+
+    while (ip < iend)
+    {
+        u8 token = *ip++;
+        s64 literal_count = token >> 4;
+
+        if (literal_count == 15 && !_lz4_read_length(&ip, iend, &literal_count))
+            return false;
+
+        if (iend - ip < literal_count || oend - op < literal_count)
+            return false;
+
+        copy_memory(ip, op, literal_count);
+        ip += literal_count;
+        op += literal_count;
+
+        // the last sequence has no match
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return false;
+
+        s64 offset = (s64)ip[0] | ((s64)ip[1] << 8);
+        ip += 2;
+
+        if (offset == 0 || offset > op - out)
+            return false;
+
+        s64 match_length = token & 15;
+
+        if (match_length == 15 && !_lz4_read_length(&ip, iend, &match_length))
+            return false;
+
+        match_length += LZ4_MIN_MATCH;
+
+        if (oend - op < match_length)
+            return false;
+
+        const char *match = op - offset;
+
+        if (offset >= match_length)
+        {
+            copy_memory(match, op, match_length);
+            op += match_length;
+        }
+        else
+        {
+            // overlapping match, repeats the last offset bytes
+            for (s64 i = 0; i < match_length; ++i)
+                *op++ = *match++;
+        }
+    }
+
+    return op == oend;
+}
+
+s64 pack_compress_bound(u32 codec, s64 size)
+{
+    if (codec == PACK_CODEC_LZ4)
+        return size + size / 255 + 16;
+
+    return size;
+}
+
+s64 pack_compress(u32 codec, const char *in, s64 in_size, char *out, s64 out_size)
+{
+    assert(in != nullptr || in_size == 0);
+    assert(out != nullptr);
+
+    if (codec == PACK_CODEC_LZ4)
+        return _lz4_compress(in, in_size, out, out_size);
+
+    if (in_size > out_size)
+        return -1;
+
+    copy_memory(in, out, in_size);
+    return in_size;
+}
+
+bool pack_decompress(u32 codec, const char *in, s64 in_size, char *out, s64 out_size, error *err)
+{
+    assert(in != nullptr || in_size == 0);
+    assert(out != nullptr || out_size == 0);
+
+    if (codec == PACK_CODEC_NONE)
+    {
+        if (in_size != out_size)
+        {
+            format_error(err, 1, "decompress: stored size (%x) does not match size (%x)", in_size, out_size);
+            return false;
+        }
+
+        copy_memory(in, out, in_size);
+        return true;
+    }
+
+    if (codec == PACK_CODEC_LZ4)
+    {
+        if (!_lz4_decompress(in, in_size, out, out_size))
+        {
+            set_error(err, 2, "decompress: corrupted LZ4 data");
+            return false;
+        }
+
+        return true;
+    }
+
+    format_error(err, 3, "decompress: unknown codec %u", codec);
+    return false;
+}
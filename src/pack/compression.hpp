@@ -0,0 +1,22 @@
+#pragma once
+
+/* compression.hpp
+
+Codecs for compressing package entries.
+PACK_CODEC_LZ4 writes the LZ4 block format using a small, greedy in-tree
+compressor which favours speed over ratio. Decompression checks all bounds,
+so corrupted entries fail instead of reading or writing out of bounds.
+ */
+
+#include "shl/number_types.hpp"
+#include "shl/error.hpp"
+
+// maximum size of the compressed output of size bytes of input
+s64 pack_compress_bound(u32 codec, s64 size);
+
+// returns the size of the compressed data in out, or -1 if the compressed
+// data would not fit into out_size bytes (e.g. because the input is not compressible).
+s64 pack_compress(u32 codec, const char *in, s64 in_size, char *out, s64 out_size);
+
+// decompresses exactly out_size bytes into out
+bool pack_decompress(u32 codec, const char *in, s64 in_size, char *out, s64 out_size, error *err = nullptr);
@@ -0,0 +1,163 @@
+#include "shl/assert.hpp"
+#include "shl/memory.hpp"
+
+#include "pack/content_hash.hpp"
+
+#define _PRIME1 0x9e3779b185ebca87ull
+#define _PRIME2 0xc2b2ae3d27d4eb4full
+#define _PRIME3 0x165667b19e3779f9ull
+#define _PRIME4 0x85ebca77c2b2ae63ull
+#define _PRIME5 0x27d4eb2f165667c5ull
+
+inline static u64 _rotl(u64 x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+inline static u64 _read64(const u8 *p)
+{
+    u64 x;
+    copy_memory(p, &x, sizeof(u64));
+    return x;
+}
+
+inline static u32 _read32(const u8 *p)
+{
+    u32 x;
+    copy_memory(p, &x, sizeof(u32));
+    return x;
+}
+
+inline static u64 _round(u64 acc, u64 input)
+{
+    acc += input * _PRIME2;
+    acc = _rotl(acc, 31);
+    return acc * _PRIME1;
+}
+
+inline static u64 _merge_round(u64 acc, u64 val)
+{
+    acc ^= _round(0, val);
+    return acc * _PRIME1 + _PRIME4;
+}
+
+inline static void _consume_stripe(u64 *acc, const u8 *p)
+{
+    acc[0] = _round(acc[0], _read64(p));
+    acc[1] = _round(acc[1], _read64(p + 8));
+    acc[2] = _round(acc[2], _read64(p + 16));
+    acc[3] = _round(acc[3], _read64(p + 24));
+}
+
+void pack_hash_init(pack_hash_state *state, u64 seed)
+{
+    assert(state != nullptr);
+
+    fill_memory(state, 0);
+    state->seed = seed;
+    state->acc[0] = seed + _PRIME1 + _PRIME2;
+    state->acc[1] = seed + _PRIME2;
+    state->acc[2] = seed;
+    state->acc[3] = seed - _PRIME1;
+}
+
+void pack_hash_update(pack_hash_state *state, const void *data, s64 size)
+{
+    assert(state != nullptr);
+    assert(size >= 0);
+
+    const u8 *p = (const u8*)data;
+    const u8 *end = p + size;
+    state->total_size += (u64)size;
+
+    if (state->buffered + size < 32)
+    {
+        if (size > 0)
+            copy_memory(p, state->buffer + state->buffered, size);
+
+        state->buffered += (s32)size;
+        return;
+    }
+
+    if (state->buffered > 0)
+    {
+        s32 fill = 32 - state->buffered;
+        copy_memory(p, state->buffer + state->buffered, fill);
+        _consume_stripe(state->acc, state->buffer);
+        p += fill;
+        state->buffered = 0;
+    }
+
+    while (end - p >= 32)
+    {
+        _consume_stripe(state->acc, p);
+        p += 32;
+    }
+
+    if (p < end)
+    {
+        copy_memory(p, state->buffer, end - p);
+        state->buffered = (s32)(end - p);
+    }
+}
+
+u64 pack_hash_finish(const pack_hash_state *state)
+{
+    assert(state != nullptr);
+
+    u64 h;
+
+    if (state->total_size >= 32)
+    {
+        h = _rotl(state->acc[0], 1) + _rotl(state->acc[1], 7) + _rotl(state->acc[2], 12) + _rotl(state->acc[3], 18);
+        h = _merge_round(h, state->acc[0]);
+        h = _merge_round(h, state->acc[1]);
+        h = _merge_round(h, state->acc[2]);
+        h = _merge_round(h, state->acc[3]);
+    }
+    else
+        h = state->seed + _PRIME5;
+
+    h += state->total_size;
+
+    const u8 *p = state->buffer;
+    const u8 *end = p + state->buffered;
+
+    while (end - p >= 8)
+    {
+        h ^= _round(0, _read64(p));
+        h = _rotl(h, 27) * _PRIME1 + _PRIME4;
+        p += 8;
+    }
+
+    if (end - p >= 4)
+    {
+        h ^= (u64)_read32(p) * _PRIME1;
+        h = _rotl(h, 23) * _PRIME2 + _PRIME3;
+        p += 4;
+    }
+
+    while (p < end)
+    {
+        h ^= (u64)(*p) * _PRIME5;
+        h = _rotl(h, 11) * _PRIME1;
+        p += 1;
+    }
+
+    h ^= h >> 33;
+    h *= _PRIME2;
+    h ^= h >> 29;
+    h *= _PRIME3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+u64 pack_hash(const void *data, s64 size, u64 seed)
+{
+    pack_hash_state state;
+    pack_hash_init(&state, seed);
+    pack_hash_update(&state, data, size);
+
+    return pack_hash_finish(&state);
+}
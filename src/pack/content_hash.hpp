@@ -0,0 +1,25 @@
+#pragma once
+
+/* content_hash.hpp
+
+Fast non-cryptographic 64 bit hash of entry contents (XXH64), used by
+pack_writer to find entries with identical contents.
+ */
+
+#include "shl/number_types.hpp"
+
+struct pack_hash_state
+{
+    u64 acc[4];
+    u64 total_size;
+    u8  buffer[32];
+    s32 buffered;
+    u64 seed;
+};
+
+void pack_hash_init(pack_hash_state *state, u64 seed = 0);
+void pack_hash_update(pack_hash_state *state, const void *data, s64 size);
+u64  pack_hash_finish(const pack_hash_state *state);
+
+// hash of size bytes at data, same as init + update + finish
+u64 pack_hash(const void *data, s64 size, u64 seed = 0);
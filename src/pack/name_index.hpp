@@ -0,0 +1,68 @@
+#pragma once
+
+/* name_index.hpp
+
+Hashing and probing of the name index of packages, used by pack_writer to
+write the index and by pack_reader to look up entries by name.
+ */
+
+#include "shl/number_types.hpp"
+#include "pack/package.hpp"
+
+// FNV-1a, 64 bit
+constexpr inline u64 pack_name_hash(const char *name, s64 len)
+{
+    u64 hash = 0xcbf29ce484222325ull;
+
+    for (s64 i = 0; i < len; ++i)
+    {
+        hash ^= (u8)name[i];
+        hash *= 0x00000100000001b3ull;
+    }
+
+    return hash;
+}
+
+// keeps the load factor at or below 0.5
+constexpr inline s64 pack_name_index_slot_count(s64 entry_count)
+{
+    s64 count = 8;
+
+    while (count < entry_count * 2)
+        count *= 2;
+
+    return count;
+}
+
+constexpr inline u32 pack_name_index_hash_tag(u64 hash)
+{
+    return (u32)(hash >> 32);
+}
+
+/* Probes the index for the name with the given hash.
+   NameEquals(u32 entry) is called for every slot whose hash matches.
+   Returns the slot of the entry if found, the empty slot at which the
+   name would be inserted, or nullptr if the index is full.
+ */
+template<typename NameEquals>
+inline package_name_index_slot *pack_name_index_probe(package_name_index_slot *slots, s64 slot_count, u64 hash, NameEquals name_equals)
+{
+    u32 tag = pack_name_index_hash_tag(hash);
+    u64 mask = (u64)slot_count - 1;
+    u64 i = hash & mask;
+
+    for (s64 probes = 0; probes < slot_count; ++probes)
+    {
+        package_name_index_slot *slot = slots + i;
+
+        if (slot->entry == PACK_INDEX_EMPTY_SLOT)
+            return slot;
+
+        if (slot->hash == tag && name_equals(slot->entry))
+            return slot;
+
+        i = (i + 1) & mask;
+    }
+
+    return nullptr;
+}
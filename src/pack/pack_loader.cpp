@@ -2,8 +2,21 @@
 #include "shl/file_stream.hpp"
 #include "shl/memory.hpp"
 #include "shl/assert.hpp"
+#include "shl/defer.hpp"
+#include "shl/compare.hpp"
+#include "shl/format.hpp"
 #include "fs/path.hpp"
+#include <algorithm>
+#include <chrono>
 
+#if defined(__linux__)
+#include <errno.h>
+#include <string.h> // strerror
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+#include "pack/name_index.hpp"
 #include "pack/pack_loader.hpp"
 
 void init(pack_loader *loader)
@@ -13,50 +26,250 @@ void init(pack_loader *loader)
     fill_memory(loader, 0);
 }
 
+static void _free_watcher(pack_file_watcher *watcher)
+{
+#if defined(__linux__)
+    if (watcher->watching)
+        close(watcher->fd);
+#endif
+
+    free(&watcher->directories);
+    free(&watcher->watch_descriptors);
+    free(&watcher->entry_directories);
+    free(&watcher->entry_index);
+    free(&watcher->next_same_entry);
+    fill_memory(watcher, 0);
+}
+
 void free(pack_loader *loader)
 {
     assert(loader != nullptr);
 
     if (loader->mode == pack_loader_mode::Package)
+    {
+        for_array(entry, &loader->decompressed_entries)
+            if (entry->data != nullptr)
+                pack_dealloc(&loader->allocator, (void*)entry->data, entry->size + 1);
+
+        free(&loader->decompressed_entries);
+        free(&loader->verified_entries);
         free(&loader->reader);
+        fs::free(&loader->package_path);
+    }
     else
     {
         fs::free(&loader->files.base_path);
-        fs::free(&loader->files._entry_path);
         pack_loader_clear_loaded_file_entries(loader);
         free(&loader->files.loaded_entries);
+        _free_watcher(&loader->files.watcher);
+    }
+
+    free(&loader->trace.slots);
+
+    if (loader->stats != nullptr)
+    {
+        free(loader->stats);
+        dealloc(loader->stats, sizeof(pack_stats));
     }
 
     fill_memory(loader, 0);
 }
 
+// the statistics of the loader, created when first needed. nullptr if
+// compiled without PACK_STATS.
+static pack_stats *_get_stats(pack_loader *loader)
+{
+#if PACK_STATS
+    if (loader->stats == nullptr)
+    {
+        loader->stats = (pack_stats*)alloc(sizeof(pack_stats));
+        init(loader->stats);
+    }
+#endif
+
+    return loader->stats;
+}
+
+pack_entry_data *pack_entry_data_create(const pack_allocator *allocator, s64 size)
+{
+    pack_entry_data *data = (pack_entry_data*)pack_alloc(allocator, (s64)sizeof(pack_entry_data) + size + 1);
+    fill_memory(data, 0);
+    data->refcount.store(1, std::memory_order_relaxed);
+    data->data = (char*)(data + 1);
+    data->data[size] = '\0';
+    data->size = size;
+
+    if (allocator != nullptr)
+        data->allocator = *allocator;
+
+    return data;
+}
+
+void pack_entry_data_release(pack_entry_data *data)
+{
+    if (data == nullptr)
+        return;
+
+    if (data->refcount.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+
+    pack_allocator allocator = data->allocator;
+    pack_dealloc(&allocator, (void*)data, (s64)sizeof(pack_entry_data) + data->size + 1);
+}
+
+static void _lock_slot(pack_file_slot *slot)
+{
+    u32 unlocked = 0;
+
+    while (!slot->lock.compare_exchange_weak(unlocked, 1, std::memory_order_acquire))
+    {
+        slot->lock.wait(1, std::memory_order_relaxed);
+        unlocked = 0;
+    }
+}
+
+static bool _try_lock_slot(pack_file_slot *slot)
+{
+    u32 unlocked = 0;
+    return slot->lock.compare_exchange_strong(unlocked, 1, std::memory_order_acquire);
+}
+
+static void _unlock_slot(pack_file_slot *slot)
+{
+    slot->lock.store(0, std::memory_order_release);
+    slot->lock.notify_one();
+}
+
+// evicts entries until the cache fits its budget, or nothing can be evicted.
+// only one thread evicts at a time, others return right away.
+static void _evict_file_entries(pack_loader *loader)
+{
+    pack_file_cache *cache = &loader->files.cache;
+
+    if (cache->budget <= 0 || loader->files.count == 0)
+        return;
+
+    u32 unlocked = 0;
+
+    if (!cache->evict_lock.compare_exchange_strong(unlocked, 1, std::memory_order_acquire))
+        return;
+
+    // two full sweeps clear every referenced bit once, after which anything
+    // that's still not evictable is pinned, acquired or locked.
+    s64 steps = loader->files.count * 2;
+
+    while (cache->resident_bytes.load(std::memory_order_relaxed) > cache->budget && steps > 0)
+    {
+        steps -= 1;
+
+        pack_file_slot *slot = loader->files.loaded_entries.data + cache->hand;
+        cache->hand = (cache->hand + 1) % loader->files.count;
+
+        if (!_try_lock_slot(slot))
+            continue;
+
+        pack_entry_data *data = slot->data;
+
+        if (data == nullptr || slot->pins > 0 || data->refcount.load(std::memory_order_acquire) > 1)
+        {
+            _unlock_slot(slot);
+            continue;
+        }
+
+        if (slot->referenced)
+        {
+            slot->referenced = false;
+            _unlock_slot(slot);
+            continue;
+        }
+
+        slot->data = nullptr;
+        _unlock_slot(slot);
+
+        cache->resident_bytes -= data->size;
+        cache->evictions += 1;
+        pack_entry_data_release(data);
+    }
+
+    cache->evict_lock.store(0, std::memory_order_release);
+}
+
 void pack_loader_clear_loaded_file_entries(pack_loader *loader)
 {
     assert(loader != nullptr);
 
-    for_array(entry, &loader->files.loaded_entries)
-        if (entry->data != nullptr)
-            dealloc((void*)entry->data, entry->size);
-    
-    fill_memory((void*)loader->files.loaded_entries.data, 0, sizeof(pack_file_entry) * loader->files.count);
+    // entries still acquired by handles are freed when they're released.
+    // pins are kept.
+    for_array(slot, &loader->files.loaded_entries)
+    {
+        pack_entry_data_release(slot->data);
+        slot->data = nullptr;
+        slot->dirty = false;
+        slot->referenced = false;
+    }
+
+    loader->files.cache.resident_bytes = 0;
 }
 
 bool pack_loader_load_package_file(pack_loader *loader, const char *filename, error *err)
 {
     assert(loader != nullptr);
 
+    pack_allocator allocator = loader->allocator;
+    bool verify_checksums = loader->verify_checksums;
+    pack_stats *stats = _get_stats(loader);
+    loader->stats = nullptr;
     free(loader);
+    loader->allocator = allocator;
+    loader->verify_checksums = verify_checksums;
+    loader->stats = stats;
+
+    PACK_STATS_SCOPE(stats, pack_stat_op::Open, -1);
 
     loader->mode = pack_loader_mode::Package;
-    return pack_reader_load_from_path(&loader->reader, filename, err);
+    loader->reader.stats = stats;
+
+    if (!pack_reader_map_from_path(&loader->reader, filename, err))
+        return false;
+
+    fs::path_set(&loader->package_path, filename);
+
+    s64 entry_count = loader->reader.toc->entry_count;
+    resize(&loader->decompressed_entries, entry_count);
+    fill_memory((void*)loader->decompressed_entries.data, 0, sizeof(pack_file_entry) * entry_count);
+
+    // sizes are set here so that loading only has to publish the data
+    for (s64 i = 0; i < entry_count; ++i)
+    {
+        pack_reader_entry rentry{};
+        pack_reader_get_entry(&loader->reader, i, &rentry);
+        loader->decompressed_entries[i].size = rentry.uncompressed_size;
+    }
+
+    if (loader->verify_checksums && loader->reader.checksums != nullptr)
+    {
+        resize(&loader->verified_entries, entry_count);
+        fill_memory((void*)loader->verified_entries.data, 0, sizeof(u8) * entry_count);
+    }
+
+    return true;
 }
 
-void pack_loader_load_files(pack_loader *loader, const char **files, s64 file_count, const char *base_path)
+void pack_loader_load_files(pack_loader *loader, const char *const *files, s64 file_count, const char *base_path)
 {
     assert(loader != nullptr);
     assert(files != nullptr);
 
+    pack_allocator allocator = loader->allocator;
+    bool verify_checksums = loader->verify_checksums;
+    pack_stats *stats = _get_stats(loader);
+    loader->stats = nullptr;
     free(loader);
+    loader->allocator = allocator;
+    loader->verify_checksums = verify_checksums;
+    loader->stats = stats;
+
+    PACK_STATS_SCOPE(stats, pack_stat_op::Open, -1);
 
     loader->mode = pack_loader_mode::Files;
     loader->files.ptr = files;
@@ -68,7 +281,293 @@ void pack_loader_load_files(pack_loader *loader, const char **files, s64 file_co
         fs::path_set(&loader->files.base_path, ".");
 
     resize(&loader->files.loaded_entries, file_count);
-    fill_memory((void*)loader->files.loaded_entries.data, 0, sizeof(pack_file_entry) * loader->files.count);
+    fill_memory((void*)loader->files.loaded_entries.data, 0, sizeof(pack_file_slot) * loader->files.count);
+}
+
+#if defined(__linux__)
+// the index key of an entry is its file name and the index of its directory
+static u64 _watch_key(s32 directory, const char *name, s64 name_size)
+{
+    return pack_name_hash(name, name_size) ^ ((u64)(directory + 1) * 0x9e3779b97f4a7c15ull);
+}
+
+static const char *_entry_file_name(pack_file_watcher *watcher, const char *path, s64 n)
+{
+    const_string dir = watcher->directories[watcher->entry_directories[n]];
+    return dir.size == 0 ? path : path + dir.size + 1;
+}
+
+static package_name_index_slot *_watch_probe(pack_loader *loader, s32 directory, const char *name, s64 name_size)
+{
+    pack_file_watcher *watcher = &loader->files.watcher;
+    u64 hash = _watch_key(directory, name, name_size);
+
+    return pack_name_index_probe(watcher->entry_index.data, watcher->entry_index.size, hash, [loader, watcher, directory, name, name_size](u32 other) {
+        const char *other_name = _entry_file_name(watcher, loader->files.ptr[other], other);
+
+        return watcher->entry_directories[other] == directory
+            && string_length(other_name) == name_size
+            && string_compare(other_name, name, name_size) == 0;
+    });
+}
+
+#define PACK_WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE | IN_ATTRIB | IN_MOVE_SELF)
+
+// adds an inotify watch for directory dir of the entries, returns the watch descriptor or -1
+static int _watch_directory(pack_loader *loader, const_string dir, error *err)
+{
+    fs::path dir_path{};
+    defer { fs::free(&dir_path); };
+
+    fs::path_set(&dir_path, &loader->files.base_path);
+
+    if (dir.size > 0)
+    {
+        string dir_str{};
+        defer { free(&dir_str); };
+        string_set(&dir_str, dir);
+        fs::path_append(&dir_path, dir_str.data);
+    }
+
+    int wd = inotify_add_watch(loader->files.watcher.fd, dir_path.c_str(), PACK_WATCH_EVENTS);
+
+    if (wd < 0)
+        format_error(err, errno, "loader_watch_files: could not watch %s: %s", dir_path.c_str(), strerror(errno));
+
+    return wd;
+}
+
+// marks entry e for reloading and adds it to out if it's not in out from first on
+static void _mark_entry_changed(pack_loader *loader, s64 e, array<s64> *out, s64 first)
+{
+    pack_file_slot *fslot = loader->files.loaded_entries.data + e;
+    _lock_slot(fslot);
+    fslot->dirty = true;
+    _unlock_slot(fslot);
+
+    for (s64 c = first; c < out->size; ++c)
+        if (out->data[c] == e)
+            return;
+
+    add_at_end(out, e);
+}
+
+/* the watch of directory d is gone (the directory was deleted, moved or its
+   file system unmounted) or directory d was not there the last time. the
+   directory is watched again if it exists, and all of its entries are marked
+   as changed because their files may have changed while it wasn't watched. */
+static void _rewatch_directory(pack_loader *loader, s64 d, array<s64> *out, s64 first)
+{
+    pack_file_watcher *watcher = &loader->files.watcher;
+    bool was_watched = watcher->watch_descriptors[d] >= 0;
+
+    if (was_watched)
+        inotify_rm_watch(watcher->fd, watcher->watch_descriptors[d]);
+
+    watcher->watch_descriptors[d] = _watch_directory(loader, watcher->directories[d], nullptr);
+
+    // still missing, its entries were already reported when it went away
+    if (!was_watched && watcher->watch_descriptors[d] < 0)
+        return;
+
+    for (s64 e = 0; e < loader->files.count; ++e)
+        if (watcher->entry_directories[e] == d)
+            _mark_entry_changed(loader, e, out, first);
+}
+#endif
+
+bool pack_loader_watch_files(pack_loader *loader, error *err)
+{
+    assert(loader != nullptr);
+    assert(loader->mode == pack_loader_mode::Files);
+
+    pack_file_watcher *watcher = &loader->files.watcher;
+
+    if (watcher->watching)
+        return true;
+
+#if defined(__linux__)
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (fd < 0)
+    {
+        format_error(err, errno, "loader_watch_files: could not initialize inotify: %s", strerror(errno));
+        return false;
+    }
+
+    watcher->watching = true;
+    watcher->fd = fd;
+
+    s64 count = loader->files.count;
+    resize(&watcher->entry_directories, count);
+    resize(&watcher->next_same_entry, count);
+
+    s64 slot_count = pack_name_index_slot_count(count);
+    resize(&watcher->entry_index, slot_count);
+    fill_memory((void*)watcher->entry_index.data, 0xff, sizeof(package_name_index_slot) * slot_count);
+
+    for (s64 i = 0; i < count; ++i)
+    {
+        const char *path = loader->files.ptr[i];
+        s64 dir_size = 0;
+
+        for (s64 c = 0; path[c] != '\0'; ++c)
+            if (path[c] == '/')
+                dir_size = c;
+
+        const_string dir{path, dir_size};
+        s32 directory = -1;
+
+        // entries are usually grouped by directory, so search from the end
+        for (s64 d = watcher->directories.size - 1; d >= 0; --d)
+        {
+            if (watcher->directories[d].size == dir.size && string_compare(watcher->directories[d].c_str, dir.c_str, dir.size) == 0)
+            {
+                directory = (s32)d;
+                break;
+            }
+        }
+
+        if (directory < 0)
+        {
+            int wd = _watch_directory(loader, dir, err);
+
+            if (wd < 0)
+            {
+                _free_watcher(watcher);
+                return false;
+            }
+
+            directory = (s32)watcher->directories.size;
+            add_at_end(&watcher->directories, dir);
+            add_at_end(&watcher->watch_descriptors, wd);
+        }
+
+        watcher->entry_directories[i] = directory;
+
+        const char *name = _entry_file_name(watcher, path, i);
+        s64 name_size = string_length(name);
+        package_name_index_slot *slot = _watch_probe(loader, directory, name, name_size);
+
+        watcher->next_same_entry[i] = -1;
+
+        if (slot == nullptr)
+            continue;
+
+        if (slot->entry != PACK_INDEX_EMPTY_SLOT)
+        {
+            s64 last = slot->entry;
+
+            while (watcher->next_same_entry[last] >= 0)
+                last = watcher->next_same_entry[last];
+
+            watcher->next_same_entry[last] = i;
+            continue;
+        }
+
+        slot->hash = pack_name_index_hash_tag(_watch_key(directory, name, name_size));
+        slot->entry = (u32)i;
+    }
+
+    return true;
+#else
+    set_error(err, 1, "loader_watch_files: watching files is not supported on this platform");
+    return false;
+#endif
+}
+
+bool pack_loader_poll_changes(pack_loader *loader, array<s64> *out_changed_entries, error *err)
+{
+    assert(loader != nullptr);
+    assert(loader->mode == pack_loader_mode::Files);
+    assert(out_changed_entries != nullptr);
+
+    pack_file_watcher *watcher = &loader->files.watcher;
+
+    if (!watcher->watching)
+    {
+        set_error(err, 1, "loader_poll_changes: files are not watched, call pack_loader_watch_files first");
+        return false;
+    }
+
+#if defined(__linux__)
+    s64 first_changed = out_changed_entries->size;
+    alignas(inotify_event) char buf[4096];
+
+    // directories that were gone last time may have been created again
+    for (s64 d = 0; d < watcher->watch_descriptors.size; ++d)
+        if (watcher->watch_descriptors[d] < 0)
+            _rewatch_directory(loader, d, out_changed_entries, first_changed);
+
+    while (true)
+    {
+        ssize_t len = read(watcher->fd, buf, sizeof(buf));
+
+        if (len < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+
+            format_error(err, errno, "loader_poll_changes: could not read inotify events: %s", strerror(errno));
+            return false;
+        }
+
+        for (char *p = buf; p < buf + len;)
+        {
+            inotify_event *ev = (inotify_event*)p;
+            p += sizeof(inotify_event) + ev->len;
+
+            // events were lost, any file may have changed
+            if ((ev->mask & IN_Q_OVERFLOW) == IN_Q_OVERFLOW)
+            {
+                for (s64 e = 0; e < loader->files.count; ++e)
+                    _mark_entry_changed(loader, e, out_changed_entries, first_changed);
+
+                continue;
+            }
+
+            s32 directory = -1;
+
+            for (s64 d = 0; d < watcher->watch_descriptors.size; ++d)
+            {
+                if (watcher->watch_descriptors[d] == ev->wd)
+                {
+                    directory = (s32)d;
+                    break;
+                }
+            }
+
+            if (directory < 0)
+                continue;
+
+            // the watched directory itself went away (IN_DELETE_SELF is followed by IN_IGNORED)
+            if ((ev->mask & (IN_IGNORED | IN_MOVE_SELF)) != 0)
+            {
+                _rewatch_directory(loader, directory, out_changed_entries, first_changed);
+                continue;
+            }
+
+            if (ev->len == 0)
+                continue;
+
+            package_name_index_slot *slot = _watch_probe(loader, directory, ev->name, string_length(ev->name));
+
+            if (slot == nullptr || slot->entry == PACK_INDEX_EMPTY_SLOT)
+                continue;
+
+            // entries with the same path are chained after the indexed one
+            for (s64 e = slot->entry; e >= 0; e = watcher->next_same_entry[e])
+                _mark_entry_changed(loader, e, out_changed_entries, first_changed);
+        }
+    }
+
+    return true;
+#else
+    return false;
+#endif
 }
 
 s64 pack_loader_entry_count(pack_loader *loader)
@@ -81,111 +580,454 @@ s64 pack_loader_entry_count(pack_loader *loader)
         return loader->files.count;
 }
 
-bool pack_loader_load_entry(pack_loader *loader, s64 n, pack_entry *out_entry, error *err)
+// verifies package entry n the first time it is loaded, threads loading the
+// same entry at once may each verify it.
+static bool _verify_package_entry(pack_loader *loader, s64 n, error *err)
 {
-    assert(loader != nullptr);
+    if (loader->verified_entries.size == 0)
+        return true;
 
-    if (loader->mode == pack_loader_mode::Package)
-    {
-        assert(n < loader->reader.toc->entry_count);
+    std::atomic_ref<u8> verified(loader->verified_entries[n]);
+
+    if (verified.load(std::memory_order_acquire) != 0)
+        return true;
 
+    bool ok = false;
+
+    if (!pack_reader_verify_entry(&loader->reader, n, &ok, err))
+        return false;
+
+    if (!ok)
+    {
         pack_reader_entry rentry{};
         pack_reader_get_entry(&loader->reader, n, &rentry);
+        format_error(err, 2, "loader_load_entry: entry %d (%s) is corrupted, checksum mismatch", n, rentry.name);
+        return false;
+    }
+
+    verified.store(1, std::memory_order_release);
+
+    return true;
+}
+
+static bool _load_package_entry(pack_loader *loader, s64 n, pack_entry *out_entry, error *err)
+{
+    assert(n < loader->reader.toc->entry_count);
+
+    if (!_verify_package_entry(loader, n, err))
+        return false;
 
+    pack_reader_entry rentry{};
+    pack_reader_get_entry(&loader->reader, n, &rentry);
+
+    out_entry->name = rentry.name;
+
+    if ((rentry.flags & PACK_TOC_FLAG_COMPRESSED) != PACK_TOC_FLAG_COMPRESSED)
+    {
         out_entry->data = rentry.content;
         out_entry->size = rentry.size;
-        out_entry->name = rentry.name;
+        return true;
     }
-    else
-    {
-        assert(n >= 0);
-        assert(n < loader->files.count);
-        assert(n < loader->files.loaded_entries.size);
-        assert(loader->files.count == loader->files.loaded_entries.size);
 
-        fs::path_set(&loader->files._entry_path, &loader->files.base_path);
-        fs::path_append(&loader->files._entry_path, loader->files.ptr[n]);
-        pack_file_entry *loaded_entry = loader->files.loaded_entries.data + n;
-        io_handle fh;
+    pack_file_entry *decompressed = loader->decompressed_entries.data + n;
+    std::atomic_ref<char*> published(decompressed->data);
+    char *data = published.load(std::memory_order_acquire);
 
-        fh = io_open(loader->files._entry_path.c_str(), open_mode::Read, err);
+    if (data == nullptr)
+    {
+        // threads loading the same entry at once each decompress it,
+        // the first one to publish its buffer wins.
+        char *ours = (char*)pack_alloc(&loader->allocator, rentry.uncompressed_size + 1);
 
-        if (fh == INVALID_IO_HANDLE)
+        if (!pack_reader_read_entry(&rentry, ours, rentry.uncompressed_size, err))
+        {
+            pack_dealloc(&loader->allocator, ours, rentry.uncompressed_size + 1);
             return false;
+        }
 
-        defer { io_close(fh); };
+        ours[rentry.uncompressed_size] = '\0';
 
-        s64 timestamp = 0;
-        fs::filesystem_info info{};
+        if (published.compare_exchange_strong(data, ours, std::memory_order_acq_rel, std::memory_order_acquire))
+            data = ours;
+        else
+            pack_dealloc(&loader->allocator, ours, rentry.uncompressed_size + 1);
+    }
 
-        if (!fs::query_filesystem(fh, &info, fs::query_flag::FileTimes, err))
-            return false;
+    out_entry->data = data;
+    out_entry->size = decompressed->size;
 
-#if Windows
-        timestamp = (s64)info.detail.file_times.last_write_time;
-#else
-        timestamp = info.stx_mtime.tv_sec;
-#endif
+    return true;
+}
+
+// returns the current contents of file entry n with a reference added for the caller
+static pack_entry_data *_acquire_file_entry(pack_loader *loader, s64 n, error *err)
+{
+    assert(n >= 0);
+    assert(n < loader->files.count);
+    assert(n < loader->files.loaded_entries.size);
+    assert(loader->files.count == loader->files.loaded_entries.size);
 
-        out_entry->name = loader->files.ptr[n];
+    pack_file_slot *slot = loader->files.loaded_entries.data + n;
 
-        if (loaded_entry->data != nullptr)
+    // while watching, cached entries are only reloaded when they changed
+    if (loader->files.watcher.watching)
+    {
+        _lock_slot(slot);
+        pack_entry_data *cached = slot->data;
+
+        if (cached != nullptr && !slot->dirty)
         {
-            if (loaded_entry->timestamp >= timestamp)
-            {
-                out_entry->data = loaded_entry->data;
-                out_entry->size = loaded_entry->size;
-                return true;
-            }
-            else
-            {
-                dealloc((void*)loaded_entry->data, loaded_entry->size);
-                fill_memory(loaded_entry, 0);
-                loaded_entry->data = nullptr;
-            }
+            cached->refcount.fetch_add(1, std::memory_order_relaxed);
+            slot->referenced = true;
         }
+        else
+            cached = nullptr;
 
-        if (loaded_entry->data == nullptr)
+        _unlock_slot(slot);
+
+        if (cached != nullptr)
         {
-            file_stream fstream{};
-            fstream.handle = fh;
+            loader->files.cache.hits += 1;
+            return cached;
+        }
+    }
 
-            s64 fsize = get_file_size(&fstream, err);
+    fs::path entry_path{};
+    defer { fs::free(&entry_path); };
 
-            if (fsize < 0)
-                return false;
-            
-            loaded_entry->data = (char*)alloc(fsize+1);
-            loaded_entry->size = fsize;
+    fs::path_set(&entry_path, &loader->files.base_path);
+    fs::path_append(&entry_path, loader->files.ptr[n]);
+    io_handle fh;
 
-            if (!read_entire_file(&fstream, loaded_entry->data, fsize, err))
-                return false;
+    fh = io_open(entry_path.c_str(), open_mode::Read, err);
+
+    PACK_STATS_IO(loader->stats, 0, 1);
+
+    if (fh == INVALID_IO_HANDLE)
+        return nullptr;
+
+    defer { io_close(fh); PACK_STATS_IO(loader->stats, 0, 1); };
+
+    s64 timestamp = 0;
+    fs::filesystem_info info{};
+
+    bool queried = fs::query_filesystem(fh, &info, fs::query_flag::FileTimes, err);
+
+    PACK_STATS_IO(loader->stats, 0, 1);
+
+    if (!queried)
+        return nullptr;
+
+#if Windows
+    timestamp = (s64)info.detail.file_times.last_write_time;
+#else
+    timestamp = info.stx_mtime.tv_sec;
+#endif
+
+    _lock_slot(slot);
+
+    pack_entry_data *current = slot->data;
+
+    if (current != nullptr && !slot->dirty && current->timestamp >= timestamp)
+    {
+        current->refcount.fetch_add(1, std::memory_order_relaxed);
+        slot->referenced = true;
+        _unlock_slot(slot);
+
+        loader->files.cache.hits += 1;
+        return current;
+    }
+
+    file_stream fstream{};
+    fstream.handle = fh;
+
+    s64 fsize = get_file_size(&fstream, err);
+
+    PACK_STATS_IO(loader->stats, 0, 1);
+
+    if (fsize < 0)
+    {
+        _unlock_slot(slot);
+        return nullptr;
+    }
+
+    pack_entry_data *loaded = pack_entry_data_create(&loader->allocator, fsize);
 
-            loaded_entry->data[fsize] = '\0';
+    bool read = read_entire_file(&fstream, loaded->data, fsize, err);
 
-            loaded_entry->timestamp = timestamp;
+    PACK_STATS_IO(loader->stats, read ? fsize : 0, 1);
+
+    if (!read)
+    {
+        pack_entry_data_release(loaded);
+        _unlock_slot(slot);
+        return nullptr;
+    }
+
+    loaded->timestamp = timestamp;
+    loaded->refcount.store(2, std::memory_order_relaxed); // slot and caller
+
+    // the previous contents stay alive until their last handle is released
+    slot->data = loaded;
+    slot->dirty = false;
+    slot->referenced = true;
+    _unlock_slot(slot);
+
+    pack_file_cache *cache = &loader->files.cache;
+    cache->misses += 1;
+    cache->resident_bytes += fsize - (current != nullptr ? current->size : 0);
+    pack_entry_data_release(current);
+
+    // the new entry can't be evicted while the caller holds it
+    _evict_file_entries(loader);
+
+    return loaded;
+}
+
+bool pack_loader_prefetch(pack_loader *loader, const s64 *entries, s64 count, error *err)
+{
+    assert(loader != nullptr);
+    assert(entries != nullptr || count == 0);
+
+    if (loader->mode == pack_loader_mode::Package)
+        return pack_reader_advise_entries(&loader->reader, entries, count, pack_advice::WillNeed, err);
+
+    fs::path entry_path{};
+    defer { fs::free(&entry_path); };
+
+    for (s64 i = 0; i < count; ++i)
+    {
+        s64 n = entries[i];
+        assert(n >= 0 && n < loader->files.count);
+
+        pack_file_slot *slot = loader->files.loaded_entries.data + n;
+
+        // loaded entries are only read again if they changed
+        _lock_slot(slot);
+        bool loaded = slot->data != nullptr && !slot->dirty;
+        _unlock_slot(slot);
+
+        if (loaded)
+            continue;
+
+        fs::path_set(&entry_path, &loader->files.base_path);
+        fs::path_append(&entry_path, loader->files.ptr[n]);
+
+        io_handle fh = io_open(entry_path.c_str(), open_mode::Read);
+
+        if (fh == INVALID_IO_HANDLE)
+            continue;
+
+        bool ok = pack_advise_at(fh, 0, 0, pack_advice::WillNeed, err);
+        io_close(fh);
+
+        if (!ok)
+            return false;
+    }
+
+    return true;
+}
+
+bool pack_loader_release(pack_loader *loader, const s64 *entries, s64 count, error *err)
+{
+    assert(loader != nullptr);
+    assert(entries != nullptr || count == 0);
+
+    if (loader->mode == pack_loader_mode::Package)
+        return pack_reader_advise_entries(&loader->reader, entries, count, pack_advice::DontNeed, err);
+
+    pack_file_cache *cache = &loader->files.cache;
+
+    for (s64 i = 0; i < count; ++i)
+    {
+        s64 n = entries[i];
+        assert(n >= 0 && n < loader->files.count);
+
+        pack_file_slot *slot = loader->files.loaded_entries.data + n;
+        _lock_slot(slot);
+
+        pack_entry_data *data = slot->data;
+
+        if (data == nullptr || slot->pins > 0 || data->refcount.load(std::memory_order_acquire) > 1)
+        {
+            _unlock_slot(slot);
+            continue;
         }
 
-        out_entry->data = loaded_entry->data;
-        out_entry->size = loaded_entry->size;
+        slot->data = nullptr;
+        slot->referenced = false;
+        _unlock_slot(slot);
+
+        cache->resident_bytes -= data->size;
+        pack_entry_data_release(data);
     }
 
     return true;
 }
 
+static s64 _trace_time()
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return (s64)std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
+
+// only the first access of an entry is recorded
+inline static void _trace_access(pack_loader *loader, s64 n)
+{
+    pack_access_trace *trace = &loader->trace;
+
+    // acquire pairs with the release in pack_loader_start_trace, the slots are set up before
+    if (!trace->tracing.load(std::memory_order_acquire))
+        return;
+
+    pack_trace_slot *slot = trace->slots.data + n;
+
+    if (slot->order.load(std::memory_order_relaxed) != 0)
+        return;
+
+    s64 order = trace->accesses.fetch_add(1, std::memory_order_relaxed) + 1;
+    s64 expected = 0;
+
+    if (slot->order.compare_exchange_strong(expected, order, std::memory_order_relaxed))
+        slot->time.store(_trace_time() - trace->start_time, std::memory_order_relaxed);
+}
+
+void pack_loader_trace_access(pack_loader *loader, s64 n)
+{
+    assert(loader != nullptr);
+
+    _trace_access(loader, n);
+}
+
+bool pack_loader_load_entry(pack_loader *loader, s64 n, pack_entry *out_entry, error *err)
+{
+    assert(loader != nullptr);
+
+    PACK_STATS_SCOPE(loader->stats, pack_stat_op::LoadEntry, n);
+    _trace_access(loader, n);
+
+    if (loader->mode == pack_loader_mode::Package)
+        return _load_package_entry(loader, n, out_entry, err);
+
+    pack_entry_data *data = _acquire_file_entry(loader, n, err);
+
+    if (data == nullptr)
+        return false;
+
+    // the slot keeps the entry alive until it's reloaded or cleared
+    out_entry->name = loader->files.ptr[n];
+    out_entry->data = data->data;
+    out_entry->size = data->size;
+    pack_entry_data_release(data);
+
+    return true;
+}
+
+bool pack_loader_acquire_entry(pack_loader *loader, s64 n, pack_entry_handle *out, error *err)
+{
+    assert(loader != nullptr);
+    assert(out != nullptr);
+
+    out->_data = nullptr;
+
+    PACK_STATS_SCOPE(loader->stats, pack_stat_op::LoadEntry, n);
+    _trace_access(loader, n);
+
+    if (loader->mode == pack_loader_mode::Package)
+        return _load_package_entry(loader, n, &out->entry, err);
+
+    pack_entry_data *data = _acquire_file_entry(loader, n, err);
+
+    if (data == nullptr)
+        return false;
+
+    out->_data = data;
+    out->entry.name = loader->files.ptr[n];
+    out->entry.data = data->data;
+    out->entry.size = data->size;
+
+    return true;
+}
+
+void pack_loader_release_entry(pack_entry_handle *handle)
+{
+    assert(handle != nullptr);
+
+    pack_entry_data_release(handle->_data);
+    fill_memory(handle, 0);
+}
+
+void pack_loader_set_cache_budget(pack_loader *loader, s64 budget)
+{
+    assert(loader != nullptr);
+    assert(loader->mode == pack_loader_mode::Files);
+    assert(budget >= 0);
+
+    loader->files.cache.budget = budget;
+    _evict_file_entries(loader);
+}
+
+void pack_loader_pin_entry(pack_loader *loader, s64 n)
+{
+    assert(loader != nullptr);
+    assert(loader->mode == pack_loader_mode::Files);
+    assert(n >= 0 && n < loader->files.count);
+
+    pack_file_slot *slot = loader->files.loaded_entries.data + n;
+    _lock_slot(slot);
+    slot->pins += 1;
+    _unlock_slot(slot);
+}
+
+void pack_loader_unpin_entry(pack_loader *loader, s64 n)
+{
+    assert(loader != nullptr);
+    assert(loader->mode == pack_loader_mode::Files);
+    assert(n >= 0 && n < loader->files.count);
+
+    pack_file_slot *slot = loader->files.loaded_entries.data + n;
+    _lock_slot(slot);
+    assert(slot->pins > 0);
+    slot->pins -= 1;
+    _unlock_slot(slot);
+
+    _evict_file_entries(loader);
+}
+
+void pack_loader_get_cache_stats(pack_loader *loader, pack_loader_cache_stats *out)
+{
+    assert(loader != nullptr);
+    assert(out != nullptr);
+
+    fill_memory(out, 0);
+
+    if (loader->mode != pack_loader_mode::Files)
+        return;
+
+    pack_file_cache *cache = &loader->files.cache;
+    out->hits = cache->hits.load();
+    out->misses = cache->misses.load();
+    out->evictions = cache->evictions.load();
+    out->resident_bytes = cache->resident_bytes.load();
+}
+
 const char *pack_loader_entry_name(pack_loader *loader, s64 entry, error *err)
 {
     assert(loader != nullptr);
     assert(entry >= 0);
 
+    // looking up the name can't fail, err is kept for compatibility
+    (void)err;
+
     if (loader->mode == pack_loader_mode::Package)
     {
-        pack_entry ent{};
+        assert(entry < loader->reader.toc->entry_count);
 
-        if (!pack_loader_load_entry(loader, entry, &ent, err))
-            return nullptr;
+        // no need to load (and decompress) the entry for its name
+        pack_reader_entry rentry{};
+        pack_reader_get_entry(&loader->reader, entry, &rentry);
 
-        return ent.name;
+        return rentry.name;
     }
     else
     {
@@ -193,3 +1035,198 @@ const char *pack_loader_entry_name(pack_loader *loader, s64 entry, error *err)
         return loader->files.ptr[entry];
     }
 }
+
+void pack_loader_start_trace(pack_loader *loader)
+{
+    assert(loader != nullptr);
+
+    pack_access_trace *trace = &loader->trace;
+    s64 entry_count = pack_loader_entry_count(loader);
+
+    resize(&trace->slots, entry_count);
+    fill_memory((void*)trace->slots.data, 0, sizeof(pack_trace_slot) * entry_count);
+    trace->accesses.store(0, std::memory_order_relaxed);
+    trace->start_time = _trace_time();
+    trace->tracing.store(true, std::memory_order_release);
+}
+
+void pack_loader_stop_trace(pack_loader *loader)
+{
+    assert(loader != nullptr);
+
+    loader->trace.tracing.store(false, std::memory_order_release);
+}
+
+void pack_loader_get_trace(pack_loader *loader, pack_access_profile *out)
+{
+    assert(loader != nullptr);
+    assert(out != nullptr);
+
+    pack_access_trace *trace = &loader->trace;
+
+    array<s64> accessed{};
+    init(&accessed);
+    defer { free(&accessed); };
+
+    for (s64 i = 0; i < trace->slots.size; ++i)
+        if (trace->slots[i].order.load(std::memory_order_relaxed) != 0)
+            add_at_end(&accessed, i);
+
+    std::sort(accessed.data, accessed.data + accessed.size, [trace](s64 a, s64 b) {
+        return trace->slots[a].order.load(std::memory_order_relaxed) < trace->slots[b].order.load(std::memory_order_relaxed);
+    });
+
+    for_array(i, &accessed)
+        pack_access_profile_add(out, pack_loader_entry_name(loader, *i), trace->slots[*i].time.load(std::memory_order_relaxed));
+}
+
+bool pack_loader_write_trace(pack_loader *loader, const char *path, error *err)
+{
+    assert(loader != nullptr);
+    assert(path != nullptr);
+
+    pack_access_profile profile{};
+    init(&profile);
+    defer { free(&profile); };
+
+    pack_loader_get_trace(loader, &profile);
+
+    return pack_access_profile_write(&profile, path, err);
+}
+
+void pack_loader_get_stats(pack_loader *loader, pack_loader_stats *out)
+{
+    assert(loader != nullptr);
+    assert(out != nullptr);
+
+    fill_memory(out, 0);
+
+    if (loader->stats != nullptr)
+    {
+        pack_stats_get(loader->stats, out);
+        out->enabled = true;
+    }
+    else
+        out->enabled = PACK_STATS != 0;
+
+    if (loader->mode == pack_loader_mode::Files)
+    {
+        out->cache_hits = loader->files.cache.hits.load(std::memory_order_relaxed);
+        out->cache_misses = loader->files.cache.misses.load(std::memory_order_relaxed);
+    }
+}
+
+void pack_loader_reset_stats(pack_loader *loader)
+{
+    assert(loader != nullptr);
+
+    if (loader->stats != nullptr)
+        pack_stats_reset(loader->stats);
+}
+
+void pack_loader_start_event_trace(pack_loader *loader, s64 max_events)
+{
+    assert(loader != nullptr);
+
+    pack_stats *stats = _get_stats(loader);
+
+    if (stats == nullptr)
+        return;
+
+    pack_stats_start_events(stats, max_events);
+}
+
+void pack_loader_stop_event_trace(pack_loader *loader)
+{
+    assert(loader != nullptr);
+
+    if (loader->stats != nullptr)
+        pack_stats_stop_events(loader->stats);
+}
+
+// appends s as a JSON string
+static void _append_json_string(array<char> *out, const char *s)
+{
+    add_at_end(out, '"');
+
+    for (; *s != '\0'; ++s)
+    {
+        char c = *s;
+
+        if (c == '"' || c == '\\')
+        {
+            add_at_end(out, '\\');
+            add_at_end(out, c);
+        }
+        else if ((u8)c < 0x20)
+        {
+            const_string escaped = tformat("\\u%04x", (s32)(u8)c);
+            add_at_end(out, escaped.c_str, escaped.size);
+        }
+        else
+            add_at_end(out, c);
+    }
+
+    add_at_end(out, '"');
+}
+
+static void _append(array<char> *out, const_string s)
+{
+    add_at_end(out, s.c_str, s.size);
+}
+
+bool pack_loader_write_event_trace(pack_loader *loader, const char *path, error *err)
+{
+    assert(loader != nullptr);
+    assert(path != nullptr);
+
+    pack_stats *stats = loader->stats;
+
+    if (stats == nullptr)
+    {
+        format_error(err, 1, "loader_write_event_trace: no events recorded%s", PACK_STATS ? "" : ", compiled without PACK_STATS");
+        return false;
+    }
+
+    s64 count = Min(stats->event_count.load(std::memory_order_acquire), stats->event_capacity);
+    s64 entry_count = pack_loader_entry_count(loader);
+
+    array<char> json{};
+    init(&json);
+    defer { free(&json); };
+
+    _append(&json, to_const_string("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"));
+
+    for (s64 i = 0; i < count; ++i)
+    {
+        pack_trace_event *event = stats->events + i;
+
+        // timestamps are in microseconds
+        _append(&json, tformat("%s{\"name\":\"%s\",\"cat\":\"pack\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%d.%03d,\"dur\":%d.%03d",
+                               i > 0 ? ",\n" : "",
+                               pack_stat_op_name(event->op),
+                               event->thread,
+                               event->start_ns / 1000, (s32)(event->start_ns % 1000),
+                               event->duration_ns / 1000, (s32)(event->duration_ns % 1000)));
+
+        if (event->entry >= 0 && event->entry < entry_count)
+        {
+            _append(&json, tformat(",\"args\":{\"entry\":%d,\"name\":", event->entry));
+            _append_json_string(&json, pack_loader_entry_name(loader, event->entry));
+            add_at_end(&json, '}');
+        }
+
+        add_at_end(&json, '}');
+    }
+
+    _append(&json, to_const_string("\n]}\n"));
+
+    file_stream out{};
+
+    if (!init(&out, path, open_mode::WriteTrunc, err))
+        return false;
+
+    defer { free(&out); };
+
+    return write(&out, json.data, json.size, err) >= 0;
+}
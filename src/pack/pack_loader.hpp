@@ -7,9 +7,15 @@ An abstraction over pack_reader, with the ability to load entries from either a
 package file, or from individual files from a list of file paths.
  */
 
+#include <atomic>
+
 #include "shl/array.hpp"
+#include "shl/string.hpp"
 #include "fs/path.hpp"
+#include "pack/allocator.hpp"
+#include "pack/access_profile.hpp"
 #include "pack/pack_reader.hpp"
+#include "pack/stats.hpp"
 
 /* pack_loader has two different modes for loading:
     Package: load resources from a .pack package file or
@@ -36,38 +42,257 @@ struct pack_file_entry
     s64 timestamp;
 };
 
+// refcounted contents of an entry loaded from a file, shared by the loader
+// and pack_entry_handles. freed when the last reference is released.
+struct pack_entry_data
+{
+    std::atomic<s64> refcount;
+    char *data; // NUL terminated, allocated together with this struct
+    s64 size;
+    s64 timestamp;
+    pack_allocator allocator;
+};
+
+// used internally
+pack_entry_data *pack_entry_data_create(const pack_allocator *allocator, s64 size);
+// used internally, frees data when the last reference is released
+void pack_entry_data_release(pack_entry_data *data);
+
+// used internally, files mode. lock is held while the entry is (re)loaded.
+struct pack_file_slot
+{
+    std::atomic<u32> lock;
+    pack_entry_data *data; // the slot holds one reference
+    bool dirty;            // set by pack_loader_poll_changes, reloaded on next load
+    bool referenced;       // set when loaded, cleared by the eviction clock
+    s32 pins;              // pinned entries are never evicted
+};
+
+struct pack_loader_cache_stats
+{
+    s64 hits;
+    s64 misses;
+    s64 evictions;
+    s64 resident_bytes;
+};
+
+/* used internally, files mode. when the size of the loaded entries exceeds
+   budget, entries that are not pinned or acquired are evicted using the
+   CLOCK algorithm (second chance): the hand sweeps over the slots, clearing
+   the referenced bit of entries that were used since the last sweep and
+   evicting the first one that wasn't.
+ */
+struct pack_file_cache
+{
+    s64 budget; // in bytes, 0 = unlimited
+    std::atomic<u32> evict_lock;
+    s64 hand;
+
+    std::atomic<s64> hits;
+    std::atomic<s64> misses;
+    std::atomic<s64> evictions;
+    std::atomic<s64> resident_bytes;
+};
+
+// used internally, files mode with pack_loader_watch_files.
+struct pack_file_watcher
+{
+    bool watching;
+    int fd; // inotify instance
+
+    // directories of entries relative to the base path, pointing into the
+    // entry paths, with their inotify watch descriptors.
+    array<const_string> directories;
+    array<int> watch_descriptors;
+
+    // directory of every entry and an index of (directory, file name) -> entry
+    array<s32> entry_directories;
+    array<package_name_index_slot> entry_index;
+    array<s64> next_same_entry; // next entry with the same path, -1 if none
+};
+
+// used internally, the first access of an entry while tracing
+struct pack_trace_slot
+{
+    std::atomic<s64> order; // 0 = not accessed yet
+    std::atomic<s64> time;  // microseconds since the trace started
+};
+
+// used internally, see pack_loader_start_trace
+struct pack_access_trace
+{
+    std::atomic<bool> tracing;
+    s64 start_time; // microseconds, steady clock
+    std::atomic<s64> accesses;
+    array<pack_trace_slot> slots;
+};
+
+/* an entry acquired with pack_loader_acquire_entry, entry.data stays valid
+   until the handle is released, even if the entry is reloaded or the loader
+   is freed in the meantime (files mode).
+   in package mode entry.data is valid as long as the loader is.
+ */
+struct pack_entry_handle
+{
+    pack_entry entry;
+    pack_entry_data *_data; // nullptr in package mode
+};
+
 struct pack_loader
 {
     pack_loader_mode mode;
 
+    // loaded entries and decompressed entries are allocated with this, may be
+    // set before loading a package / files and is kept when loading.
+    // when using an arena, clear the loaded entries before resetting it.
+    pack_allocator allocator;
+
+    // package mode, if set and the package has checksums, the stored content
+    // of every entry is checked against its checksum when it is first loaded
+    // and loading a corrupted entry fails. may be set before loading a package
+    // and is kept when loading.
+    bool verify_checksums;
+
     union
     {
         pack_reader reader;
 
         struct 
         {
-            const char **ptr;
+            const char *const *ptr;
             s64 count;
             fs::path base_path;
-            fs::path _entry_path;
-            array<pack_file_entry> loaded_entries;
+            array<pack_file_slot> loaded_entries;
+            pack_file_watcher watcher;
+            pack_file_cache cache;
         } files;
     };
+
+    // package mode, the path of the package file
+    fs::path package_path;
+
+    // package mode, compressed entries are decompressed into these buffers
+    // when first loaded and kept until the loader is freed. data is
+    // published atomically so loading entries needs no locks.
+    array<pack_file_entry> decompressed_entries;
+
+    // package mode with verify_checksums, 1 for entries that were verified
+    array<u8> verified_entries;
+
+    pack_access_trace trace;
+
+    // nullptr unless compiled with PACK_STATS, kept when loading. see
+    // pack_loader_get_stats.
+    pack_stats *stats;
 };
 
+#define PACK_DEFAULT_MAX_TRACE_EVENTS 0x10000
+
 void init(pack_loader *loader);
 void free(pack_loader *loader);
 
 void pack_loader_clear_loaded_file_entries(pack_loader *loader);
 
+// maps the package file, entries are paged in from disk when they are first accessed
 bool pack_loader_load_package_file(pack_loader *loader, const char *filename, error *err = nullptr);
-void pack_loader_load_files(pack_loader *loader, const char **files, s64 file_count, const char *base_path = nullptr);
+void pack_loader_load_files(pack_loader *loader, const char *const *files, s64 file_count, const char *base_path = nullptr);
+
+/* files mode: watches the directories of the entries for changes (inotify,
+   Linux only). while watching, loading a cached entry does not touch the
+   file system at all; entries are only reloaded after pack_loader_poll_changes
+   reported them as changed.
+ */
+bool pack_loader_watch_files(pack_loader *loader, error *err = nullptr);
 
-// once either a package file or files are loaded, use this to get individual entries
+// adds the entries whose files changed since the last poll to out_changed_entries
+// (each entry once) and marks them for reloading. does not block.
+// if events were lost (inotify queue overflow) all entries are reported. if a
+// watched directory goes away, its entries are reported, and again once it
+// exists again.
+bool pack_loader_poll_changes(pack_loader *loader, array<s64> *out_changed_entries, error *err = nullptr);
+
+// once either a package file or files are loaded, use this to get individual entries.
+// in files mode, out->data is freed when the entry is reloaded because the file
+// changed or when it is evicted from the cache, use pack_loader_acquire_entry
+// when loading from multiple threads or pin the entry to keep it.
 bool pack_loader_load_entry(pack_loader *loader, s64 entry, pack_entry *out, error *err = nullptr);
 
+/* thread safe version of pack_loader_load_entry, may be called from any number
+   of threads at once (but not concurrently with loading a package / files,
+   clearing or freeing the loader).
+   package mode: lock-free.
+   files mode: only loads of the same entry wait for each other.
+   every acquired handle must be released with pack_loader_release_entry.
+ */
+bool pack_loader_acquire_entry(pack_loader *loader, s64 entry, pack_entry_handle *out, error *err = nullptr);
+void pack_loader_release_entry(pack_entry_handle *handle);
+
 s64 pack_loader_entry_count(pack_loader *loader);
 
+// files mode: limits the bytes of loaded entries kept in memory, 0 = unlimited (default).
+// evicts entries right away if the budget is already exceeded.
+void pack_loader_set_cache_budget(pack_loader *loader, s64 budget);
+// files mode: pinned entries are never evicted, pins are counted.
+void pack_loader_pin_entry(pack_loader *loader, s64 entry);
+void pack_loader_unpin_entry(pack_loader *loader, s64 entry);
+void pack_loader_get_cache_stats(pack_loader *loader, pack_loader_cache_stats *out);
+
+/* hints that the given entries will be loaded soon, e.g. the entries of the
+   next level while the current one is running, so loading them later does
+   not wait for the disk. does not block on I/O.
+   package mode: the pages of the entries are read ahead into the page cache,
+   see pack_reader_advise_entries.
+   files mode: the files of the entries are read ahead, files that can't be
+   opened are skipped (loading them reports the error).
+ */
+bool pack_loader_prefetch(pack_loader *loader, const s64 *entries, s64 count, error *err = nullptr);
+
+/* hints that the given entries are not needed anymore.
+   package mode: the mapped pages of the entries are dropped and read again
+   if the entries are loaded again. decompressed entries keep their buffers.
+   files mode: loaded entries that are not pinned or acquired are dropped
+   from the cache, like evicted entries.
+ */
+bool pack_loader_release(pack_loader *loader, const s64 *entries, s64 count, error *err = nullptr);
+
+/* records the order and time of the first access of every entry loaded with
+   pack_loader_load_entry, pack_loader_acquire_entry or a pack_async_loader
+   (when the load completes) until the trace is stopped, e.g. during startup.
+   the recorded profile can be passed to packer --order-profile to lay out the
+   package in that order.
+   start the trace after loading a package / files, loading clears the trace.
+   don't restart a running trace while other threads load entries.
+   recording is lock-free and one atomic load per access once an entry was seen.
+ */
+void pack_loader_start_trace(pack_loader *loader);
+void pack_loader_stop_trace(pack_loader *loader);
+// used internally, records an access of entry n if tracing
+void pack_loader_trace_access(pack_loader *loader, s64 n);
+// adds the traced entries to out in the order they were first accessed
+void pack_loader_get_trace(pack_loader *loader, pack_access_profile *out);
+bool pack_loader_write_trace(pack_loader *loader, const char *path, error *err = nullptr);
+
+/* statistics of the loader and its reader since the first package / files
+   were loaded (or pack_loader_reset_stats): latency histograms of opening,
+   parsing, loading entries and looking up names, bytes read, I/O calls and
+   files mode cache hits and misses.
+   only recorded when compiled with PACK_STATS (out->enabled), otherwise
+   only the cache hits and misses are set. recording is lock-free.
+ */
+void pack_loader_get_stats(pack_loader *loader, pack_loader_stats *out);
+void pack_loader_reset_stats(pack_loader *loader);
+
+/* records every instrumented call (with its thread, start and duration) until
+   max_events were recorded or the trace is stopped. the recorded events can be
+   written as Chrome trace JSON, which chrome://tracing and Perfetto open, to
+   see which entries were loaded during a stall. does nothing if compiled
+   without PACK_STATS.
+ */
+void pack_loader_start_event_trace(pack_loader *loader, s64 max_events = PACK_DEFAULT_MAX_TRACE_EVENTS);
+void pack_loader_stop_event_trace(pack_loader *loader);
+// stop the trace first, calls that are still running are not recorded afterwards
+bool pack_loader_write_event_trace(pack_loader *loader, const char *path, error *err = nullptr);
+
 // the name of the entry is stored in pack_entry, HOWEVER if the mode is file,
 // pack_loader_load_entry will load the entry from disk, so if we only want the name,
 // we'd load the entry for no reason. This function does not load the entry from disk and
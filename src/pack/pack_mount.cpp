@@ -0,0 +1,364 @@
+#include "shl/assert.hpp"
+#include "shl/memory.hpp"
+#include "shl/defer.hpp"
+#include "fs/path.hpp"
+
+#include "pack/name_index.hpp"
+#include "pack/pack_mount.hpp"
+
+void init(pack_mount_table *table)
+{
+    assert(table != nullptr);
+
+    fill_memory(table, 0);
+    init(&table->mounts);
+    init(&table->entries);
+    init(&table->name_index);
+}
+
+static void _free_mount(pack_mount *mount)
+{
+    free(&mount->loader);
+    free<true>(&mount->file_names);
+    free(&mount->file_ptrs);
+    dealloc((void*)mount, sizeof(pack_mount));
+}
+
+void free(pack_mount_table *table)
+{
+    assert(table != nullptr);
+
+    for_array(mount, &table->mounts)
+        if (*mount != nullptr)
+            _free_mount(*mount);
+
+    free(&table->mounts);
+    free(&table->entries);
+    free(&table->name_index);
+
+    fill_memory(table, 0);
+}
+
+static const char *_entry_name(pack_mount *mount, s64 entry)
+{
+    pack_loader *loader = &mount->loader;
+
+    if (loader->mode == pack_loader_mode::Package)
+    {
+        pack_reader_entry rentry{};
+        pack_reader_get_entry(&loader->reader, entry, &rentry);
+        return rentry.name;
+    }
+
+    return loader->files.ptr[entry];
+}
+
+static const char *_table_entry_name(const pack_mount_table *table, u32 entry)
+{
+    const pack_mount_entry *e = table->entries.data + entry;
+    return _entry_name(table->mounts[e->mount], e->entry);
+}
+
+static package_name_index_slot *_probe(const pack_mount_table *table, const char *name)
+{
+    u64 hash = pack_name_hash(name, string_length(name));
+
+    return pack_name_index_probe(table->name_index.data, table->name_index.size, hash, [table, name](u32 other) {
+        return string_compare(_table_entry_name(table, other), name) == 0;
+    });
+}
+
+// merges the entries of all mounts, the entries of mounts with higher priority
+// (or mounted later) are added first and hide the entries with the same name.
+static void _rebuild_index(pack_mount_table *table)
+{
+    array<s32> order{};
+    init(&order);
+    defer { free(&order); };
+
+    s64 total = 0;
+
+    for (s32 m = 0; m < (s32)table->mounts.size; ++m)
+    {
+        if (table->mounts[m] == nullptr)
+            continue;
+
+        // insertion sort, there are few mounts
+        s64 i = order.size;
+        add_at_end(&order, m);
+
+        while (i > 0)
+        {
+            pack_mount *a = table->mounts[order[i - 1]];
+            pack_mount *b = table->mounts[m];
+
+            if (a->priority > b->priority || (a->priority == b->priority && a->order > b->order))
+                break;
+
+            order[i] = order[i - 1];
+            i -= 1;
+        }
+
+        order[i] = m;
+        total += pack_loader_entry_count(&table->mounts[m]->loader);
+    }
+
+    clear(&table->entries);
+    resize(&table->name_index, pack_name_index_slot_count(total));
+    fill_memory((void*)table->name_index.data, 0xff, sizeof(package_name_index_slot) * table->name_index.size);
+
+    for_array(m, &order)
+    {
+        pack_mount *mount = table->mounts[*m];
+        s64 count = pack_loader_entry_count(&mount->loader);
+
+        for (s64 i = 0; i < count; ++i)
+        {
+            const char *name = _entry_name(mount, i);
+            package_name_index_slot *slot = _probe(table, name);
+
+            assert(slot != nullptr);
+
+            if (slot->entry != PACK_INDEX_EMPTY_SLOT)
+                continue;
+
+            slot->hash = pack_name_index_hash_tag(pack_name_hash(name, string_length(name)));
+            slot->entry = (u32)table->entries.size;
+
+            pack_mount_entry *entry = add_at_end(&table->entries);
+            entry->mount = *m;
+            entry->entry = i;
+        }
+    }
+}
+
+static pack_mount *_new_mount(pack_mount_table *table, s32 priority)
+{
+    pack_mount *mount = (pack_mount*)alloc(sizeof(pack_mount));
+    fill_memory(mount, 0);
+    init(&mount->loader);
+    init(&mount->file_names);
+    init(&mount->file_ptrs);
+    mount->priority = priority;
+    mount->order = table->next_order++;
+
+    return mount;
+}
+
+static s32 _add_mount(pack_mount_table *table, pack_mount *mount, s32 *out_mount)
+{
+    s32 id = -1;
+
+    for (s32 m = 0; m < (s32)table->mounts.size; ++m)
+    {
+        if (table->mounts[m] == nullptr)
+        {
+            id = m;
+            break;
+        }
+    }
+
+    if (id < 0)
+    {
+        id = (s32)table->mounts.size;
+        add_at_end(&table->mounts, (pack_mount*)nullptr);
+    }
+
+    table->mounts[id] = mount;
+    _rebuild_index(table);
+
+    if (out_mount != nullptr)
+        *out_mount = id;
+
+    return id;
+}
+
+bool pack_mount_package(pack_mount_table *table, const char *path, s32 priority, s32 *out_mount, error *err)
+{
+    assert(table != nullptr);
+    assert(path != nullptr);
+
+    pack_mount *mount = _new_mount(table, priority);
+
+    if (!pack_loader_load_package_file(&mount->loader, path, err))
+    {
+        _free_mount(mount);
+        return false;
+    }
+
+    _add_mount(table, mount, out_mount);
+
+    return true;
+}
+
+// loads the names of the mount as files
+static void _load_mount_files(pack_mount *mount, const char *base_path)
+{
+    resize(&mount->file_ptrs, mount->file_names.size);
+
+    for (s64 i = 0; i < mount->file_names.size; ++i)
+        mount->file_ptrs[i] = mount->file_names[i].data;
+
+    pack_loader_load_files(&mount->loader, mount->file_ptrs.data, mount->file_ptrs.size, base_path);
+}
+
+bool pack_mount_files(pack_mount_table *table, const char *const *files, s64 file_count, const char *base_path, s32 priority, s32 *out_mount, error *err)
+{
+    assert(table != nullptr);
+    assert(files != nullptr || file_count == 0);
+
+    (void)err;
+
+    pack_mount *mount = _new_mount(table, priority);
+
+    for (s64 i = 0; i < file_count; ++i)
+    {
+        string *name = add_at_end(&mount->file_names);
+        init(name);
+        string_copy(files[i], name);
+    }
+
+    _load_mount_files(mount, base_path);
+    _add_mount(table, mount, out_mount);
+
+    return true;
+}
+
+// symlinks to directories are not followed, they may form cycles
+static void _add_directory_files(pack_mount *mount, const fs::path *base, fs::const_fs_string dir)
+{
+    fs::path relative{};
+    defer { fs::free(&relative); };
+
+    for_path(it, dir, fs::iterate_option::Fullpaths)
+    {
+        if (fs::is_directory(it->path))
+        {
+            if (!fs::is_symlink(it->path))
+                _add_directory_files(mount, base, it->path);
+
+            continue;
+        }
+
+        if (!fs::is_file(it->path))
+            continue;
+
+        fs::relative_path(base, it->path, &relative);
+
+        string *name = add_at_end(&mount->file_names);
+        init(name);
+        string_copy(relative.c_str(), name);
+    }
+}
+
+bool pack_mount_directory(pack_mount_table *table, const char *path, s32 priority, s32 *out_mount, error *err)
+{
+    assert(table != nullptr);
+    assert(path != nullptr);
+
+    fs::path base{};
+    defer { fs::free(&base); };
+
+    if (!fs::weakly_canonical_path(path, &base, err))
+        return false;
+
+    if (!fs::is_directory(&base))
+    {
+        format_error(err, 1, "mount_directory: not a directory: %s", base.c_str());
+        return false;
+    }
+
+    pack_mount *mount = _new_mount(table, priority);
+
+    _add_directory_files(mount, &base, fs::const_fs_string(base.c_str(), base.size));
+    _load_mount_files(mount, base.c_str());
+    _add_mount(table, mount, out_mount);
+
+    return true;
+}
+
+void pack_unmount(pack_mount_table *table, s32 mount)
+{
+    assert(table != nullptr);
+    assert(mount >= 0 && mount < (s32)table->mounts.size);
+
+    if (table->mounts[mount] == nullptr)
+        return;
+
+    _free_mount(table->mounts[mount]);
+    table->mounts[mount] = nullptr;
+    _rebuild_index(table);
+}
+
+pack_loader *pack_mount_get_loader(pack_mount_table *table, s32 mount)
+{
+    assert(table != nullptr);
+    assert(mount >= 0 && mount < (s32)table->mounts.size);
+    assert(table->mounts[mount] != nullptr);
+
+    return &table->mounts[mount]->loader;
+}
+
+s64 pack_mount_entry_count(const pack_mount_table *table)
+{
+    assert(table != nullptr);
+
+    return table->entries.size;
+}
+
+s64 pack_mount_find_entry(const pack_mount_table *table, const char *name)
+{
+    assert(table != nullptr);
+    assert(name != nullptr);
+
+    if (table->name_index.size == 0)
+        return -1;
+
+    package_name_index_slot *slot = _probe(table, name);
+
+    if (slot == nullptr || slot->entry == PACK_INDEX_EMPTY_SLOT)
+        return -1;
+
+    return (s64)slot->entry;
+}
+
+s32 pack_mount_entry_mount(const pack_mount_table *table, s64 entry)
+{
+    assert(table != nullptr);
+    assert(entry >= 0 && entry < table->entries.size);
+
+    return table->entries[entry].mount;
+}
+
+bool pack_mount_load_entry(pack_mount_table *table, s64 entry, pack_entry *out, error *err)
+{
+    assert(table != nullptr);
+    assert(entry >= 0 && entry < table->entries.size);
+
+    pack_mount_entry *e = table->entries.data + entry;
+
+    return pack_loader_load_entry(&table->mounts[e->mount]->loader, e->entry, out, err);
+}
+
+bool pack_mount_load_entry(pack_mount_table *table, const char *name, pack_entry *out, error *err)
+{
+    s64 entry = pack_mount_find_entry(table, name);
+
+    if (entry < 0)
+    {
+        format_error(err, 1, "mount_load_entry: no entry named %s", name);
+        return false;
+    }
+
+    return pack_mount_load_entry(table, entry, out, err);
+}
+
+bool pack_mount_acquire_entry(pack_mount_table *table, s64 entry, pack_entry_handle *out, error *err)
+{
+    assert(table != nullptr);
+    assert(entry >= 0 && entry < table->entries.size);
+
+    pack_mount_entry *e = table->entries.data + entry;
+
+    return pack_loader_acquire_entry(&table->mounts[e->mount]->loader, e->entry, out, err);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+/* pack_mount.hpp
+
+A mount table stacking several packages and loose files, e.g. a base package,
+DLC and patch packages, and a directory of loose files on top for modding or
+development.
+
+Every mount has a priority; when multiple mounts contain an entry with the same
+name, the entry of the mount with the highest priority is used (the mount that
+was mounted last if priorities are equal).
+A merged name index over all mounts is built when mounting, so looking up an
+entry by name is O(1) regardless of the number of mounts.
+
+Entry numbers of the mount table refer to the merged entries and change when
+mounting or unmounting, look entries up by name with pack_mount_find_entry
+after changing the mounts.
+ */
+
+#include "shl/array.hpp"
+#include "shl/string.hpp"
+#include "shl/error.hpp"
+#include "pack/package.hpp"
+#include "pack/pack_loader.hpp"
+
+// used internally
+struct pack_mount
+{
+    pack_loader loader;
+    s32 priority;
+    s64 order; // mount order
+
+    // names of files mounts, loader.files.ptr points to file_ptrs
+    array<string> file_names;
+    array<const char*> file_ptrs;
+};
+
+// used internally, the entry of a mount an entry of the table resolves to
+struct pack_mount_entry
+{
+    s32 mount;
+    s64 entry;
+};
+
+struct pack_mount_table
+{
+    array<pack_mount*> mounts; // nullptr for unmounted mounts, indices are mount ids
+    array<pack_mount_entry> entries;
+    array<package_name_index_slot> name_index;
+    s64 next_order;
+};
+
+void init(pack_mount_table *table);
+void free(pack_mount_table *table);
+
+// mounts the package file at path, out_mount is set to the id of the mount if not nullptr.
+bool pack_mount_package(pack_mount_table *table, const char *path, s32 priority, s32 *out_mount = nullptr, error *err = nullptr);
+// mounts files relative to base_path, names of the entries are the given file paths.
+bool pack_mount_files(pack_mount_table *table, const char *const *files, s64 file_count, const char *base_path, s32 priority, s32 *out_mount = nullptr, error *err = nullptr);
+// mounts all files in the directory at path and its subdirectories, names of
+// the entries are the paths of the files relative to path. symlinks to files
+// are followed, symlinks to directories are skipped.
+bool pack_mount_directory(pack_mount_table *table, const char *path, s32 priority, s32 *out_mount = nullptr, error *err = nullptr);
+void pack_unmount(pack_mount_table *table, s32 mount);
+
+// the loader of a mount, e.g. to watch a mounted directory for changes
+pack_loader *pack_mount_get_loader(pack_mount_table *table, s32 mount);
+
+// number of distinct entry names over all mounts
+s64 pack_mount_entry_count(const pack_mount_table *table);
+// returns the entry with the given name, or -1 if no mount has one
+s64 pack_mount_find_entry(const pack_mount_table *table, const char *name);
+// the mount an entry is loaded from
+s32 pack_mount_entry_mount(const pack_mount_table *table, s64 entry);
+
+// see pack_loader_load_entry
+bool pack_mount_load_entry(pack_mount_table *table, s64 entry, pack_entry *out, error *err = nullptr);
+bool pack_mount_load_entry(pack_mount_table *table, const char *name, pack_entry *out, error *err = nullptr);
+
+// see pack_loader_acquire_entry, may be called from multiple threads while no
+// mounts are added or removed.
+bool pack_mount_acquire_entry(pack_mount_table *table, s64 entry, pack_entry_handle *out, error *err = nullptr);
@@ -3,7 +3,24 @@
 #include "shl/error.hpp"
 #include "shl/memory.hpp"
 #include "shl/streams.hpp"
+#include "shl/defer.hpp"
+#include "shl/compare.hpp"
+#include <algorithm>
 
+#if Windows
+#include <windows.h>
+#else
+#include <errno.h>
+#include <string.h> // strerror
+#include <sys/mman.h>
+#include <unistd.h> // sysconf
+#endif
+
+#include "pack/compression.hpp"
+#include "pack/content_hash.hpp"
+#include "pack/parallel.hpp"
+#include "pack/name_index.hpp"
+#include "pack/positional_io.hpp"
 #include "pack/pack_reader.hpp"
 
 void init(pack_reader *reader)
@@ -18,11 +35,41 @@ void free(pack_reader *reader)
     assert(reader != nullptr);
 
     if (reader->content != nullptr)
-        dealloc(reader->content, reader->content_size);
+    {
+        if (reader->storage == pack_reader_storage::Mapped)
+        {
+#if Windows
+            UnmapViewOfFile(reader->content);
+#else
+            munmap(reader->content, reader->content_size);
+#endif
+        }
+        else
+            dealloc(reader->content, reader->content_size);
+    }
+
+    if (reader->storage == pack_reader_storage::Streamed && reader->handle != INVALID_IO_HANDLE)
+        io_close(reader->handle);
+
+    if (reader->has_direct_handle)
+        io_close(reader->direct_handle);
+
+    free(&reader->_built_name_index);
 
     fill_memory(reader, 0);
 }
 
+// pointer to the byte at offset of the package, which must be within content
+inline static char *_package_ptr(const pack_reader *reader, s64 offset)
+{
+    return reader->content + (offset - reader->content_offset);
+}
+
+inline static s64 _package_size(const pack_reader *reader)
+{
+    return reader->content_offset + reader->content_size;
+}
+
 bool pack_reader_load(pack_reader *reader, const char *data, s64 size, error *err)
 {
     assert(reader != nullptr);
@@ -30,6 +77,7 @@ bool pack_reader_load(pack_reader *reader, const char *data, s64 size, error *er
     
     reader->content = (char*)alloc(size);
     reader->content_size = size;
+    reader->storage = pack_reader_storage::Memory;
 
     copy_memory(data, reader->content, size);
 
@@ -52,8 +100,11 @@ bool pack_reader_load_from_path(pack_reader *reader, const char *path, error *er
     if (!read_entire_file(path, &mem, err))
         return false;
 
+    PACK_STATS_IO(reader->stats, mem.size, 1);
+
     reader->content = mem.data;
     reader->content_size = mem.size;
+    reader->storage = pack_reader_storage::Memory;
 
     if (!pack_reader_parse(reader, err))
     {
@@ -64,94 +115,1115 @@ bool pack_reader_load_from_path(pack_reader *reader, const char *path, error *er
     return true;
 }
 
-bool pack_reader_parse(pack_reader *reader, error *err)
+bool pack_reader_map_from_path(pack_reader *reader, const char *path, error *err)
 {
     assert(reader != nullptr);
-    assert(reader->content != nullptr);
+    assert(path != nullptr);
+
+    io_handle h = io_open(path, open_mode::Read, err);
+
+    PACK_STATS_IO(reader->stats, 0, 1);
+
+    if (h == INVALID_IO_HANDLE)
+        return false;
+
+    // the mapping stays valid after the handle is closed
+    defer { io_close(h); PACK_STATS_IO(reader->stats, 0, 1); };
+
+    file_stream stream{};
+    stream.handle = h;
 
-    if (reader->content_size < (s64)sizeof(package_header))
+    s64 size = get_file_size(&stream, err);
+
+    PACK_STATS_IO(reader->stats, 0, 1);
+
+    if (size < 0)
+        return false;
+
+    if (size < (s64)sizeof(package_header))
     {
-        format_error(err, 1, "reader_parse: package content (%x) smaller than header (%x)", reader->content_size, (s64)sizeof(package_header));
+        format_error(err, 1, "reader_map: package %s (%x) smaller than header (%x)", path, size, (s64)sizeof(package_header));
         return false;
     }
 
-    reader->header = (package_header*)reader->content;
+#if Windows
+    HANDLE mapping = CreateFileMappingA((HANDLE)h, nullptr, PAGE_READONLY, 0, 0, nullptr);
 
-    if (string_compare(reader->header->magic, PACK_HEADER_MAGIC, string_length(PACK_HEADER_MAGIC)) != 0)
+    if (mapping == nullptr)
     {
-        set_error(err, 2, "read_package: invalid package magic number");
+        format_error(err, (int)GetLastError(), "reader_map: could not create mapping of %s", path);
         return false;
     }
 
-    // TODO: version
-    // TODO: flags
+    defer { CloseHandle(mapping); };
 
-    s64 toc_pos = reader->header->toc_offset;
+    void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
 
-    if (toc_pos >= reader->content_size - (s64)sizeof(package_toc))
+    if (data == nullptr)
     {
-        format_error(err, 3, "reader_parse: toc position (%x + %x) outside bounds of package (%x)", toc_pos, (s64)sizeof(package_toc), reader->content_size);
+        format_error(err, (int)GetLastError(), "reader_map: could not map %s", path);
         return false;
     }
+#else
+    void *data = mmap(nullptr, size, PROT_READ, MAP_SHARED, h, 0);
 
-    reader->toc = (package_toc*)(reader->content + toc_pos);
+    PACK_STATS_IO(reader->stats, 0, 1);
 
-    if (string_compare(reader->toc->magic, PACK_TOC_MAGIC, string_length(PACK_TOC_MAGIC)) != 0)
+    if (data == MAP_FAILED)
     {
-        set_error(err, 4, "reader_parse: invalid toc magic number");
+        format_error(err, errno, "reader_map: could not map %s: %s", path, strerror(errno));
+        return false;
+    }
+#endif
+
+    reader->content = (char*)data;
+    reader->content_size = size;
+    reader->storage = pack_reader_storage::Mapped;
+
+    if (!pack_reader_parse(reader, err))
+    {
+        free(reader);
+        return false;
+    }
+
+    return true;
+}
+
+bool pack_reader_stream_from_path(pack_reader *reader, const char *path, error *err)
+{
+    assert(reader != nullptr);
+    assert(path != nullptr);
+
+    io_handle h = io_open(path, open_mode::Read, err);
+
+    PACK_STATS_IO(reader->stats, 0, 1);
+
+    if (h == INVALID_IO_HANDLE)
+        return false;
+
+    reader->handle = h;
+    reader->storage = pack_reader_storage::Streamed;
+
+    file_stream stream{};
+    stream.handle = h;
+
+    s64 size = get_file_size(&stream, err);
+
+    PACK_STATS_IO(reader->stats, 0, 1);
+
+    if (size < 0)
+    {
+        free(reader);
+        return false;
+    }
+
+    package_header *header = &reader->_streamed_header;
+
+    s64 header_read = 0;
+
+    if (size >= (s64)sizeof(package_header))
+    {
+        header_read = pack_read_at(h, header, sizeof(package_header), 0, err);
+        PACK_STATS_IO(reader->stats, Max(header_read, (s64)0), 1);
+    }
+
+    if (header_read != (s64)sizeof(package_header))
+    {
+        format_error(err, 1, "reader_stream: package %s (%x) smaller than header (%x)", path, size, (s64)sizeof(package_header));
+        free(reader);
+        return false;
+    }
+
+    // the name table is followed by the toc and the optional sections, which
+    // are the only parts read.
+    s64 start = Min(header->names_offset, header->toc_offset);
+
+    if (start < (s64)sizeof(package_header) || start >= size)
+    {
+        format_error(err, 3, "reader_stream: name table / toc position (%x) outside bounds of package (%x)", start, size);
+        free(reader);
+        return false;
+    }
+
+    reader->content_offset = start;
+    reader->content_size = size - start;
+    reader->content = (char*)alloc(reader->content_size);
+
+    s64 bytes_read = pack_read_at(h, reader->content, reader->content_size, start, err);
+
+    PACK_STATS_IO(reader->stats, Max(bytes_read, (s64)0), 1);
+
+    if (bytes_read != reader->content_size)
+    {
+        format_error(err, 1, "reader_stream: could not read %x bytes at %x of %s", reader->content_size, start, path);
+        free(reader);
+        return false;
+    }
+
+    if (!pack_reader_parse(reader, err))
+    {
+        free(reader);
         return false;
     }
 
     return true;
 }
 
-static void _get_package_entry_from_toc(const pack_reader *reader, const package_toc_entry *toc_entry, pack_reader_entry *entry)
+/* the fields of toc entry n of either version. names of version 2 packages are
+   length prefixed and \0 terminated, version 1 names are only \0 terminated. */
+static inline u64 _toc_offset(const pack_reader *reader, s64 n)
 {
-    entry->name = reader->content + toc_entry->name_offset;
-    entry->content = reader->content + toc_entry->offset;
-    entry->size =  toc_entry->size;
-    entry->flags = toc_entry->flags;
+    return reader->version == PACK_VERSION_1 ? reader->toc_entries[n].offset : reader->toc_offsets[n];
 }
 
-static package_toc_entry *_get_toc_entry(const pack_reader *reader, s64 n)
+static inline s64 _toc_size(const pack_reader *reader, s64 n)
 {
-    return (package_toc_entry*)(reader->content + reader->header->toc_offset + sizeof(package_toc) + n * sizeof(package_toc_entry));
+    return reader->version == PACK_VERSION_1 ? reader->toc_entries[n].size : reader->toc_sizes[n];
 }
 
-void pack_reader_get_entry(const pack_reader *reader, s64 n, pack_reader_entry *out_entry)
+static inline u64 _toc_flags(const pack_reader *reader, s64 n)
 {
-    assert(reader != nullptr);
-    assert(out_entry != nullptr);
-    assert(n < reader->toc->entry_count);
+    return reader->version == PACK_VERSION_1 ? reader->toc_entries[n].flags : (u64)reader->toc_flags[n];
+}
 
-    package_toc_entry *toc_entry = _get_toc_entry(reader, n);
-    _get_package_entry_from_toc(reader, toc_entry, out_entry);
+static inline const char *_toc_name_v2(const pack_reader *reader, s64 n)
+{
+    return _package_ptr(reader, reader->header->names_offset + reader->toc_name_offsets[n]);
 }
 
-bool pack_reader_get_entry_by_name(const pack_reader *reader, const char *name, pack_reader_entry *out_entry)
+static inline s64 _toc_name_length_v2(const char *name_record)
 {
-    assert(reader != nullptr);
-    assert(reader->toc != nullptr);
-    assert(out_entry != nullptr);
-    assert(name != nullptr);
+    package_name_length len;
+    copy_memory(name_record, &len, sizeof(len));
+    return (s64)len;
+}
 
-    package_toc_entry *toc_entry = nullptr;
-    s64 len = string_length(name);
-    bool found = false;
+static inline const char *_toc_name(const pack_reader *reader, s64 n)
+{
+    if (reader->version == PACK_VERSION_1)
+        return _package_ptr(reader, reader->toc_entries[n].name_offset);
+
+    return _toc_name_v2(reader, n) + sizeof(package_name_length);
+}
+
+// hash is pack_name_hash(name, len)
+static inline bool _toc_name_equals(const pack_reader *reader, s64 n, const char *name, s64 len, u64 hash)
+{
+    if (reader->version == PACK_VERSION_1)
+        return string_compare(_package_ptr(reader, reader->toc_entries[n].name_offset), name) == 0;
+
+    if (reader->toc_hashes[n] != hash)
+        return false;
+
+    const char *record = _toc_name_v2(reader, n);
+
+    return _toc_name_length_v2(record) == len
+        && string_compare(record + sizeof(package_name_length), name, len) == 0;
+}
+
+static bool _parse_name_index(pack_reader *reader, s64 *pos, error *err)
+{
+    s64 index_pos = (*pos + 7) & ~(s64)7;
+
+    if (index_pos + (s64)sizeof(package_name_index) > _package_size(reader))
+    {
+        format_error(err, 6, "reader_parse: name index position (%x) outside bounds of package (%x)", index_pos, _package_size(reader));
+        return false;
+    }
+
+    package_name_index *index = (package_name_index*)_package_ptr(reader, index_pos);
+
+    if (string_compare(index->magic, PACK_INDEX_MAGIC, string_length(PACK_INDEX_MAGIC)) != 0)
+    {
+        set_error(err, 7, "reader_parse: invalid name index magic number");
+        return false;
+    }
+
+    s64 slot_count = index->slot_count;
+
+    if (slot_count <= 0
+     || (slot_count & (slot_count - 1)) != 0
+     || slot_count > (_package_size(reader) - index_pos - (s64)sizeof(package_name_index)) / (s64)sizeof(package_name_index_slot))
+    {
+        format_error(err, 8, "reader_parse: invalid name index slot count %x", slot_count);
+        return false;
+    }
+
+    reader->name_index = (package_name_index_slot*)(index + 1);
+    reader->name_index_slot_count = slot_count;
+
+    *pos = index_pos + (s64)sizeof(package_name_index) + slot_count * (s64)sizeof(package_name_index_slot);
+
+    return true;
+}
+
+static bool _parse_entry_info(pack_reader *reader, s64 *pos, error *err)
+{
+    s64 info_pos = (*pos + 7) & ~(s64)7;
+
+    if (info_pos + (s64)sizeof(package_entry_info_table) > _package_size(reader))
+    {
+        format_error(err, 9, "reader_parse: entry info position (%x) outside bounds of package (%x)", info_pos, _package_size(reader));
+        return false;
+    }
+
+    package_entry_info_table *table = (package_entry_info_table*)_package_ptr(reader, info_pos);
+
+    if (string_compare(table->magic, PACK_INFO_MAGIC, string_length(PACK_INFO_MAGIC)) != 0)
+    {
+        set_error(err, 10, "reader_parse: invalid entry info magic number");
+        return false;
+    }
+
+    s64 end = info_pos + (s64)sizeof(package_entry_info_table) + reader->toc->entry_count * (s64)sizeof(package_entry_info);
+
+    if (table->entry_count != reader->toc->entry_count || end > _package_size(reader))
+    {
+        format_error(err, 11, "reader_parse: invalid entry info count %x", table->entry_count);
+        return false;
+    }
+
+    reader->entry_info = (package_entry_info*)(table + 1);
+    *pos = end;
+
+    return true;
+}
+
+static bool _parse_checksums(pack_reader *reader, s64 *pos, error *err)
+{
+    s64 checksum_pos = (*pos + 7) & ~(s64)7;
+
+    if (checksum_pos + (s64)sizeof(package_checksum_table) > _package_size(reader))
+    {
+        format_error(err, 15, "reader_parse: checksums position (%x) outside bounds of package (%x)", checksum_pos, _package_size(reader));
+        return false;
+    }
+
+    package_checksum_table *table = (package_checksum_table*)_package_ptr(reader, checksum_pos);
+
+    if (string_compare(table->magic, PACK_CHECKSUM_MAGIC, string_length(PACK_CHECKSUM_MAGIC)) != 0)
+    {
+        set_error(err, 16, "reader_parse: invalid checksums magic number");
+        return false;
+    }
+
+    s64 end = checksum_pos + (s64)sizeof(package_checksum_table) + reader->toc->entry_count * (s64)sizeof(u64);
+
+    if (table->entry_count != reader->toc->entry_count || end > _package_size(reader))
+    {
+        format_error(err, 17, "reader_parse: invalid checksums count %x", table->entry_count);
+        return false;
+    }
+
+    reader->checksums = (u64*)(table + 1);
+    *pos = end;
+
+    return true;
+}
+
+static bool _parse_source_info(pack_reader *reader, s64 *pos, error *err)
+{
+    s64 source_pos = (*pos + 7) & ~(s64)7;
+
+    if (source_pos + (s64)sizeof(package_source_info_table) > _package_size(reader))
+    {
+        format_error(err, 12, "reader_parse: source info position (%x) outside bounds of package (%x)", source_pos, _package_size(reader));
+        return false;
+    }
+
+    package_source_info_table *table = (package_source_info_table*)_package_ptr(reader, source_pos);
+
+    if (string_compare(table->magic, PACK_SOURCE_MAGIC, string_length(PACK_SOURCE_MAGIC)) != 0)
+    {
+        set_error(err, 13, "reader_parse: invalid source info magic number");
+        return false;
+    }
+
+    s64 end = source_pos + (s64)sizeof(package_source_info_table) + reader->toc->entry_count * (s64)sizeof(package_source_info);
+
+    if (table->entry_count != reader->toc->entry_count || end > _package_size(reader))
+    {
+        format_error(err, 14, "reader_parse: invalid source info count %x", table->entry_count);
+        return false;
+    }
 
-    for (s64 i = 0; i < reader->toc->entry_count; ++i)
+    reader->source_info = (package_source_info*)(table + 1);
+    *pos = end;
+
+    return true;
+}
+
+// packages written before the name index existed get their index built in memory
+static void _build_name_index(pack_reader *reader)
+{
+    s64 entry_count = reader->toc->entry_count;
+    s64 slot_count = pack_name_index_slot_count(entry_count);
+
+    resize(&reader->_built_name_index, slot_count);
+    fill_memory((void*)reader->_built_name_index.data, 0xff, sizeof(package_name_index_slot) * slot_count);
+
+    reader->name_index = reader->_built_name_index.data;
+    reader->name_index_slot_count = slot_count;
+
+    for (s64 i = 0; i < entry_count; ++i)
+    {
+        const char *name = _toc_name(reader, i);
+        s64 len = string_length(name);
+
+        // version 2 packages have the hashes already
+        u64 hash = reader->version == PACK_VERSION_1 ? pack_name_hash(name, len) : reader->toc_hashes[i];
+
+        package_name_index_slot *slot = pack_name_index_probe(reader->name_index, slot_count, hash, [reader, name, len, hash](u32 other) {
+            return _toc_name_equals(reader, other, name, len, hash);
+        });
+
+        if (slot == nullptr || slot->entry != PACK_INDEX_EMPTY_SLOT)
+            continue;
+
+        slot->hash = pack_name_index_hash_tag(hash);
+        slot->entry = (u32)i;
+    }
+}
+
+// e.g. packages that were cut off while downloading
+static bool _check_entry_bounds(const pack_reader *reader, s64 n, error *err)
+{
+    u64 offset = _toc_offset(reader, n);
+    s64 size = _toc_size(reader, n);
+
+    if (size < 0 || (s64)offset < 0 || (s64)offset + size > _package_size(reader))
+    {
+        format_error(err, 18, "reader_parse: entry %d (%x + %x) outside bounds of package (%x)", n, offset, size, _package_size(reader));
+        return false;
+    }
+
+    return true;
+}
+
+static bool _parse_toc_v1(pack_reader *reader, s64 toc_pos, s64 *toc_end, error *err)
+{
+    if (string_compare(reader->toc->magic, PACK_TOC_MAGIC, string_length(PACK_TOC_MAGIC)) != 0)
+    {
+        set_error(err, 4, "reader_parse: invalid toc magic number");
+        return false;
+    }
+
+    s64 entry_count = reader->toc->entry_count;
+
+    if (entry_count < 0 || entry_count > (_package_size(reader) - toc_pos - (s64)sizeof(package_toc)) / (s64)sizeof(package_toc_entry))
+    {
+        format_error(err, 5, "reader_parse: toc entries (%x) outside bounds of package (%x)", entry_count, _package_size(reader));
+        return false;
+    }
+
+    reader->toc_entries = (package_toc_entry*)(reader->toc + 1);
+    *toc_end = toc_pos + (s64)sizeof(package_toc) + entry_count * (s64)sizeof(package_toc_entry);
+
+    s64 names_end = (s64)reader->header->names_offset + reader->header->names_size;
+
+    if (entry_count > 0
+     && (reader->header->names_size <= 0 || (s64)reader->header->names_offset < reader->content_offset
+      || names_end > _package_size(reader) || *_package_ptr(reader, names_end - 1) != '\0'))
+    {
+        format_error(err, 19, "reader_parse: invalid name table (%x + %x)", reader->header->names_offset, reader->header->names_size);
+        return false;
+    }
+
+    for (s64 i = 0; i < entry_count; ++i)
     {
-        _get_toc_entry(reader, i);
-        const char *tocname = reader->content + toc_entry->name_offset;
+        if (!_check_entry_bounds(reader, i, err))
+            return false;
+
+        u64 name_offset = reader->toc_entries[i].name_offset;
 
-        if (string_compare(tocname, name, len) == 0)
+        if (name_offset < reader->header->names_offset || (s64)name_offset >= names_end)
         {
-            _get_package_entry_from_toc(reader, toc_entry, out_entry);
-            found = true;
-            break;
+            format_error(err, 19, "reader_parse: name of entry %d (%x) outside of name table", i, name_offset);
+            return false;
         }
     }
 
-    return found;
+    return true;
 }
 
+static bool _parse_toc_v2(pack_reader *reader, s64 toc_pos, s64 *toc_end, error *err)
+{
+    if (string_compare(reader->toc->magic, PACK_TOC_V2_MAGIC, string_length(PACK_TOC_V2_MAGIC)) != 0)
+    {
+        set_error(err, 4, "reader_parse: invalid toc magic number");
+        return false;
+    }
+
+    s64 entry_count = reader->toc->entry_count;
+
+    if (entry_count < 0 || entry_count > (_package_size(reader) - toc_pos - (s64)sizeof(package_toc)) / (s64)PACK_TOC_V2_ENTRY_SIZE)
+    {
+        format_error(err, 5, "reader_parse: toc entries (%x) outside bounds of package (%x)", entry_count, _package_size(reader));
+        return false;
+    }
+
+    char *arrays = (char*)(reader->toc + 1);
+    reader->toc_hashes       = (u64*)arrays;
+    reader->toc_offsets      = (u64*)(arrays + entry_count * (s64)sizeof(u64));
+    reader->toc_sizes        = (s64*)(arrays + entry_count * (s64)(2 * sizeof(u64)));
+    reader->toc_name_offsets = (u32*)(arrays + entry_count * (s64)(3 * sizeof(u64)));
+    reader->toc_flags        = (u32*)(arrays + entry_count * (s64)(3 * sizeof(u64) + sizeof(u32)));
+    *toc_end = toc_pos + (s64)sizeof(package_toc) + entry_count * (s64)PACK_TOC_V2_ENTRY_SIZE;
+
+    s64 names_size = reader->header->names_size;
+
+    if (entry_count > 0
+     && (names_size <= 0 || (s64)reader->header->names_offset < reader->content_offset
+      || (s64)reader->header->names_offset + names_size > _package_size(reader)))
+    {
+        format_error(err, 19, "reader_parse: invalid string pool (%x + %x)", reader->header->names_offset, names_size);
+        return false;
+    }
+
+    for (s64 i = 0; i < entry_count; ++i)
+    {
+        if (!_check_entry_bounds(reader, i, err))
+            return false;
+
+        // the length prefix, the name and its \0 have to be inside the pool
+        s64 name_offset = (s64)reader->toc_name_offsets[i];
+
+        if (name_offset + (s64)sizeof(package_name_length) >= names_size)
+        {
+            format_error(err, 19, "reader_parse: name of entry %d (%x) outside of string pool", i, name_offset);
+            return false;
+        }
+
+        const char *record = _toc_name_v2(reader, i);
+        s64 len = _toc_name_length_v2(record);
+
+        if (len >= names_size - name_offset - (s64)sizeof(package_name_length)
+         || record[sizeof(package_name_length) + len] != '\0')
+        {
+            format_error(err, 19, "reader_parse: name of entry %d (%x + %x) outside of string pool", i, name_offset, len);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool pack_reader_parse(pack_reader *reader, error *err)
+{
+    assert(reader != nullptr);
+    assert(reader->content != nullptr);
+
+    PACK_STATS_SCOPE(reader->stats, pack_stat_op::Parse, -1);
+
+    if (_package_size(reader) < (s64)sizeof(package_header))
+    {
+        format_error(err, 1, "reader_parse: package content (%x) smaller than header (%x)", _package_size(reader), (s64)sizeof(package_header));
+        return false;
+    }
+
+    if (reader->storage == pack_reader_storage::Streamed)
+        reader->header = &reader->_streamed_header;
+    else
+        reader->header = (package_header*)reader->content;
+
+    if (string_compare(reader->header->magic, PACK_HEADER_MAGIC, string_length(PACK_HEADER_MAGIC)) != 0)
+    {
+        set_error(err, 2, "read_package: invalid package magic number");
+        return false;
+    }
+
+    // TODO: flags
+
+    s64 toc_pos = reader->header->toc_offset;
+
+    if (toc_pos < reader->content_offset || toc_pos >= _package_size(reader) - (s64)sizeof(package_toc))
+    {
+        format_error(err, 3, "reader_parse: toc position (%x + %x) outside bounds of package (%x)", toc_pos, (s64)sizeof(package_toc), _package_size(reader));
+        return false;
+    }
+
+    reader->toc = (package_toc*)_package_ptr(reader, toc_pos);
+    reader->version = reader->header->version;
+    reader->toc_entries = nullptr;
+    reader->toc_hashes = nullptr;
+    reader->toc_offsets = nullptr;
+    reader->toc_sizes = nullptr;
+    reader->toc_name_offsets = nullptr;
+    reader->toc_flags = nullptr;
+
+    s64 toc_end = 0;
+
+    switch (reader->version)
+    {
+    case PACK_VERSION_1:
+        if (!_parse_toc_v1(reader, toc_pos, &toc_end, err))
+            return false;
+        break;
+
+    case PACK_VERSION_2:
+        if (!_parse_toc_v2(reader, toc_pos, &toc_end, err))
+            return false;
+        break;
+
+    default:
+        format_error(err, 20, "reader_parse: unsupported package version %d", (s64)reader->version);
+        return false;
+    }
+
+    // optional sections after the toc
+    s64 pos = toc_end;
+
+    if ((reader->header->flags & PACK_FLAG_NAME_INDEX) == PACK_FLAG_NAME_INDEX)
+    {
+        if (!_parse_name_index(reader, &pos, err))
+            return false;
+    }
+    else
+        _build_name_index(reader);
+
+    reader->entry_info = nullptr;
+
+    if ((reader->header->flags & PACK_FLAG_ENTRY_INFO) == PACK_FLAG_ENTRY_INFO)
+    {
+        if (!_parse_entry_info(reader, &pos, err))
+            return false;
+    }
+
+    reader->source_info = nullptr;
+
+    if ((reader->header->flags & PACK_FLAG_SOURCE_INFO) == PACK_FLAG_SOURCE_INFO)
+    {
+        if (!_parse_source_info(reader, &pos, err))
+            return false;
+    }
+
+    reader->checksums = nullptr;
+
+    if ((reader->header->flags & PACK_FLAG_CHECKSUMS) == PACK_FLAG_CHECKSUMS)
+    {
+        if (!_parse_checksums(reader, &pos, err))
+            return false;
+    }
+
+    return true;
+}
+
+static void _get_package_entry_from_toc(const pack_reader *reader, s64 n, pack_reader_entry *entry)
+{
+    entry->name = _toc_name(reader, n);
+    entry->content = nullptr;
+    entry->size = _toc_size(reader, n);
+    entry->offset = _toc_offset(reader, n);
+
+    if (reader->storage != pack_reader_storage::Streamed)
+        entry->content = reader->content + entry->offset;
+
+    entry->flags = _toc_flags(reader, n);
+    entry->codec = PACK_CODEC_NONE;
+    entry->uncompressed_size = entry->size;
+
+    if (reader->entry_info != nullptr)
+    {
+        entry->codec = reader->entry_info[n].codec;
+        entry->uncompressed_size = reader->entry_info[n].uncompressed_size;
+    }
+}
+
+void pack_reader_get_entry(const pack_reader *reader, s64 n, pack_reader_entry *out_entry)
+{
+    assert(reader != nullptr);
+    assert(out_entry != nullptr);
+    assert(n < reader->toc->entry_count);
+
+    _get_package_entry_from_toc(reader, n, out_entry);
+}
+
+bool pack_reader_get_entry_by_name(const pack_reader *reader, const char *name, pack_reader_entry *out_entry)
+{
+    assert(out_entry != nullptr);
+
+    s64 n = pack_reader_get_entry_index_by_name(reader, name);
+
+    if (n < 0)
+        return false;
+
+    _get_package_entry_from_toc(reader, n, out_entry);
+
+    return true;
+}
+
+s64 pack_reader_get_entry_index_by_name(const pack_reader *reader, const char *name)
+{
+    assert(reader != nullptr);
+    assert(reader->toc != nullptr);
+    assert(name != nullptr);
+
+    assert(reader->name_index != nullptr);
+
+    PACK_STATS_SCOPE(reader->stats, pack_stat_op::Lookup, -1);
+
+    s64 len = string_length(name);
+    u64 hash = pack_name_hash(name, len);
+
+    package_name_index_slot *slot = pack_name_index_probe(reader->name_index, reader->name_index_slot_count, hash, [reader, name, len, hash](u32 other) {
+        return other < reader->toc->entry_count
+            && _toc_name_equals(reader, other, name, len, hash);
+    });
+
+    if (slot == nullptr || slot->entry == PACK_INDEX_EMPTY_SLOT)
+        return -1;
+
+    return (s64)slot->entry;
+}
+
+
+bool pack_reader_read_entry(const pack_reader_entry *entry, char *out, s64 out_size, error *err)
+{
+    assert(entry != nullptr);
+    assert(out != nullptr || out_size == 0);
+
+    if (out_size < entry->uncompressed_size)
+    {
+        format_error(err, 1, "reader_read_entry: buffer (%x) smaller than entry %s (%x)", out_size, entry->name, entry->uncompressed_size);
+        return false;
+    }
+
+    if ((entry->flags & PACK_TOC_FLAG_COMPRESSED) != PACK_TOC_FLAG_COMPRESSED)
+    {
+        copy_memory(entry->content, out, entry->size);
+        return true;
+    }
+
+    return pack_decompress(entry->codec, entry->content, entry->size, out, entry->uncompressed_size, err);
+}
+
+s64 pack_reader_read_entry_range(const pack_reader *reader, const pack_reader_entry *entry, s64 offset, char *out, s64 size, error *err)
+{
+    assert(reader != nullptr);
+    assert(entry != nullptr);
+    assert(out != nullptr || size == 0);
+
+    if (offset < 0 || offset > entry->size)
+    {
+        format_error(err, 1, "reader_read_entry_range: offset %x outside of entry %s (%x)", offset, entry->name, entry->size);
+        return -1;
+    }
+
+    size = Min(size, entry->size - offset);
+
+    if (reader->storage != pack_reader_storage::Streamed)
+    {
+        copy_memory(entry->content + offset, out, size);
+        return size;
+    }
+
+    s64 bytes_read = pack_read_at(reader->handle, out, size, entry->offset + offset, err);
+
+    PACK_STATS_IO(reader->stats, Max(bytes_read, (s64)0), 1);
+
+    if (bytes_read >= 0 && bytes_read != size)
+    {
+        format_error(err, 1, "reader_read_entry_range: package ends inside entry %s", entry->name);
+        return -1;
+    }
+
+    return bytes_read;
+}
+
+bool pack_reader_read_entry(const pack_reader *reader, const pack_reader_entry *entry, char *out, s64 out_size, error *err)
+{
+    assert(reader != nullptr);
+    assert(entry != nullptr);
+
+    if (reader->storage != pack_reader_storage::Streamed)
+        return pack_reader_read_entry(entry, out, out_size, err);
+
+    if (out_size < entry->uncompressed_size)
+    {
+        format_error(err, 1, "reader_read_entry: buffer (%x) smaller than entry %s (%x)", out_size, entry->name, entry->uncompressed_size);
+        return false;
+    }
+
+    if ((entry->flags & PACK_TOC_FLAG_COMPRESSED) != PACK_TOC_FLAG_COMPRESSED)
+        return pack_reader_read_entry_range(reader, entry, 0, out, entry->size, err) >= 0;
+
+    // compressed content is read to a temporary buffer
+    char *compressed = (char*)alloc(entry->size);
+    defer { dealloc(compressed, entry->size); };
+
+    if (pack_reader_read_entry_range(reader, entry, 0, compressed, entry->size, err) < 0)
+        return false;
+
+    return pack_decompress(entry->codec, compressed, entry->size, out, entry->uncompressed_size, err);
+}
+
+#define _HASH_CHUNK_SIZE 0x100000
+
+bool pack_reader_hash_entry(const pack_reader *reader, const pack_reader_entry *entry, u64 *out_hash, error *err)
+{
+    assert(reader != nullptr);
+    assert(entry != nullptr);
+    assert(out_hash != nullptr);
+
+    if (reader->storage != pack_reader_storage::Streamed)
+    {
+        *out_hash = pack_hash(entry->content, entry->size);
+        return true;
+    }
+
+    s64 buf_size = Min((s64)_HASH_CHUNK_SIZE, entry->size);
+    char *buf = (char*)alloc(Max(buf_size, (s64)1));
+    defer { dealloc(buf, Max(buf_size, (s64)1)); };
+
+    pack_hash_state state;
+    pack_hash_init(&state);
+
+    for (s64 offset = 0; offset < entry->size; offset += buf_size)
+    {
+        s64 read = pack_reader_read_entry_range(reader, entry, offset, buf, buf_size, err);
+
+        if (read < 0)
+            return false;
+
+        if (read == 0)
+        {
+            format_error(err, 1, "reader_hash_entry: package ends before the end of entry %s", entry->name);
+            return false;
+        }
+
+        pack_hash_update(&state, buf, read);
+    }
+
+    *out_hash = pack_hash_finish(&state);
+
+    return true;
+}
+
+bool pack_reader_verify_entry(const pack_reader *reader, s64 n, bool *out_ok, error *err)
+{
+    assert(reader != nullptr);
+    assert(reader->checksums != nullptr);
+    assert(n >= 0 && n < reader->toc->entry_count);
+    assert(out_ok != nullptr);
+
+    pack_reader_entry entry{};
+    pack_reader_get_entry(reader, n, &entry);
+
+    u64 hash = 0;
+
+    if (!pack_reader_hash_entry(reader, &entry, &hash, err))
+        return false;
+
+    *out_ok = hash == reader->checksums[n];
+
+    return true;
+}
+
+bool pack_reader_verify(const pack_reader *reader, s32 thread_count, array<s64> *out_corrupted, error *err)
+{
+    assert(reader != nullptr);
+
+    if (reader->checksums == nullptr)
+    {
+        set_error(err, 1, "reader_verify: package has no checksums");
+        return false;
+    }
+
+    s64 entry_count = reader->toc->entry_count;
+
+    array<bool> corrupted{};
+    init(&corrupted, entry_count);
+    defer { free(&corrupted); };
+
+    bool ok = pack_parallel_for(entry_count, thread_count, err, [reader, &corrupted](s64 i, error *thread_err) {
+        bool entry_ok = false;
+
+        if (!pack_reader_verify_entry(reader, i, &entry_ok, thread_err))
+            return false;
+
+        corrupted[i] = !entry_ok;
+
+        return true;
+    });
+
+    if (!ok)
+        return false;
+
+    s64 corrupted_count = 0;
+    s64 first = -1;
+
+    for (s64 i = 0; i < entry_count; ++i)
+    {
+        if (!corrupted[i])
+            continue;
+
+        if (first < 0)
+            first = i;
+
+        corrupted_count += 1;
+
+        if (out_corrupted != nullptr)
+            add_at_end(out_corrupted, i);
+    }
+
+    if (corrupted_count > 0)
+    {
+        pack_reader_entry entry{};
+        pack_reader_get_entry(reader, first, &entry);
+        format_error(err, 2, "reader_verify: %d corrupted entries, first: %s", corrupted_count, entry.name);
+        return false;
+    }
+
+    return true;
+}
+
+s64 pack_reader_get_alignment(const pack_reader *reader)
+{
+    assert(reader != nullptr);
+    assert(reader->header != nullptr);
+
+    return pack_header_alignment(reader->header->flags);
+}
+
+bool pack_reader_open_direct(pack_reader *reader, const char *path, error *err)
+{
+    assert(reader != nullptr);
+    assert(path != nullptr);
+
+    bool unbuffered = false;
+    io_handle h = pack_open_direct(path, &unbuffered, err);
+
+    PACK_STATS_IO(reader->stats, 0, 1);
+
+    if (h == INVALID_IO_HANDLE)
+        return false;
+
+    if (reader->has_direct_handle)
+        io_close(reader->direct_handle);
+
+    reader->direct_handle = h;
+    reader->has_direct_handle = true;
+    reader->direct_unbuffered = unbuffered;
+
+    return true;
+}
+
+inline static s64 _direct_start(const pack_reader_entry *entry)
+{
+    return entry->offset & ~(s64)(PACK_DIRECT_IO_ALIGNMENT - 1);
+}
+
+inline static s64 _direct_end(const pack_reader_entry *entry)
+{
+    return (entry->offset + entry->size + PACK_DIRECT_IO_ALIGNMENT - 1) & ~(s64)(PACK_DIRECT_IO_ALIGNMENT - 1);
+}
+
+s64 pack_reader_direct_buffer_size(const pack_reader_entry *entry)
+{
+    assert(entry != nullptr);
+
+    return _direct_end(entry) - _direct_start(entry);
+}
+
+bool pack_reader_read_entry_direct(const pack_reader *reader, const pack_reader_entry *entry, char *out, s64 out_size, error *err)
+{
+    assert(reader != nullptr);
+    assert(entry != nullptr);
+    assert(reader->has_direct_handle);
+    assert(((u64)out & (PACK_DIRECT_IO_ALIGNMENT - 1)) == 0);
+
+    s64 start = _direct_start(entry);
+    s64 size = _direct_end(entry) - start;
+
+    if (out_size < size)
+    {
+        format_error(err, 1, "reader_read_entry_direct: buffer size %x is less than %x", out_size, size);
+        return false;
+    }
+
+    s64 read = pack_read_direct_at(reader->direct_handle, out, size, start, err);
+
+    PACK_STATS_IO(reader->stats, Max(read, (s64)0), 1);
+
+    if (read < 0)
+        return false;
+
+    s64 skipped = entry->offset - start;
+
+    if (read < skipped + entry->size)
+    {
+        format_error(err, 1, "reader_read_entry_direct: package ends before the end of entry %s", entry->name);
+        return false;
+    }
+
+    if (skipped > 0)
+        move_memory(out + skipped, out, entry->size);
+
+    return true;
+}
+
+struct _byte_range
+{
+    s64 start;
+    s64 end;
+};
+
+static s64 _page_size()
+{
+#if Windows
+    SYSTEM_INFO info{};
+    GetSystemInfo(&info);
+    return (s64)info.dwPageSize;
+#else
+    return (s64)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+static bool _advise_range(const pack_reader *reader, _byte_range range, pack_advice advice, error *err)
+{
+    s64 size = range.end - range.start;
+
+    if (reader->storage == pack_reader_storage::Streamed)
+        return pack_advise_at(reader->handle, range.start, size, advice, err);
+
+#if Windows
+    // there is no equivalent of MADV_DONTNEED for read-only views
+    if (advice == pack_advice::WillNeed)
+    {
+        WIN32_MEMORY_RANGE_ENTRY entry{};
+        entry.VirtualAddress = (void*)(reader->content + range.start);
+        entry.NumberOfBytes = (SIZE_T)size;
+
+        if (!PrefetchVirtualMemory(GetCurrentProcess(), 1, &entry, 0))
+        {
+            format_error(err, (int)GetLastError(), "reader_advise_entries: could not prefetch %x bytes at %x", size, range.start);
+            return false;
+        }
+    }
+#else
+    int adv = advice == pack_advice::WillNeed ? MADV_WILLNEED : MADV_DONTNEED;
+
+    if (madvise((void*)(reader->content + range.start), (size_t)size, adv) != 0)
+    {
+        format_error(err, errno, "reader_advise_entries: could not advise %x bytes at %x: %s", size, range.start, strerror(errno));
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+bool pack_reader_advise_entries(const pack_reader *reader, const s64 *entries, s64 count, pack_advice advice, error *err)
+{
+    assert(reader != nullptr);
+    assert(entries != nullptr || count == 0);
+
+    if (reader->storage == pack_reader_storage::Memory || count == 0)
+        return true;
+
+    s64 page_size = _page_size();
+    s64 package_size = pack_reader_get_package_size(reader);
+
+    array<_byte_range> ranges{};
+    init(&ranges);
+    defer { free(&ranges); };
+
+    for (s64 i = 0; i < count; ++i)
+    {
+        assert(entries[i] >= 0 && entries[i] < reader->toc->entry_count);
+
+        pack_reader_entry entry{};
+        pack_reader_get_entry(reader, entries[i], &entry);
+
+        if (entry.size <= 0)
+            continue;
+
+        // madvise needs page aligned addresses, mappings start at a page
+        _byte_range *range = add_at_end(&ranges);
+        range->start = entry.offset & ~(page_size - 1);
+        range->end = Min(package_size, (entry.offset + entry.size + page_size - 1) & ~(page_size - 1));
+    }
+
+    if (ranges.size == 0)
+        return true;
+
+    std::sort(ranges.data, ranges.data + ranges.size, [](const _byte_range &a, const _byte_range &b) {
+        return a.start < b.start;
+    });
+
+    _byte_range current = ranges[0];
+
+    for (s64 i = 1; i < ranges.size; ++i)
+    {
+        if (ranges[i].start <= current.end)
+        {
+            current.end = Max(current.end, ranges[i].end);
+            continue;
+        }
+
+        if (!_advise_range(reader, current, advice, err))
+            return false;
+
+        current = ranges[i];
+    }
+
+    return _advise_range(reader, current, advice, err);
+}
+
+s64 pack_reader_get_package_size(const pack_reader *reader)
+{
+    assert(reader != nullptr);
+
+    return _package_size(reader);
+}
+
+struct _content_range
+{
+    s64 start;
+    s64 end;
+};
+
+s64 pack_reader_get_used_size(const pack_reader *reader)
+{
+    assert(reader != nullptr);
+    assert(reader->toc != nullptr);
+
+    // the name table, toc and following sections are written last
+    s64 tables_pos = (s64)reader->header->toc_offset;
+
+    if ((s64)reader->header->names_offset >= (s64)sizeof(package_header))
+        tables_pos = Min(tables_pos, (s64)reader->header->names_offset);
+
+    s64 used = (s64)sizeof(package_header) + (_package_size(reader) - tables_pos);
+
+    // entries may share their content
+    s64 entry_count = reader->toc->entry_count;
+
+    array<_content_range> ranges{};
+    init(&ranges, entry_count);
+    defer { free(&ranges); };
+
+    for (s64 i = 0; i < entry_count; ++i)
+    {
+        ranges[i].start = (s64)_toc_offset(reader, i);
+        ranges[i].end = ranges[i].start + _toc_size(reader, i);
+    }
+
+    std::sort(ranges.data, ranges.data + entry_count, [](const _content_range &a, const _content_range &b) {
+        return a.start < b.start;
+    });
+
+    s64 covered_until = 0;
+
+    for_array(range, &ranges)
+    {
+        s64 start = Max(range->start, covered_until);
+
+        if (range->end > start)
+            used += range->end - start;
+
+        covered_until = Max(covered_until, range->end);
+    }
+
+    return used;
+}
@@ -10,24 +10,89 @@ Use pack_loader instead to load files from a package.
 */
 
 #include "shl/error.hpp"
+#include "shl/array.hpp"
+#include "shl/io.hpp"
 
 #include "pack/package.hpp"
+#include "pack/positional_io.hpp"
+#include "pack/stats.hpp"
 
 struct pack_reader_entry
 {
     const char *name;
     u64 flags;
 
-    char *content;
-    s64   size;
+    char *content; // nullptr if the reader is streamed, use pack_reader_read_entry
+    s64   size;    // size of content, the compressed size if compressed
+    s64   offset;  // offset of content in the package
+
+    u32 codec;  // PACK_CODEC_NONE unless flags has PACK_TOC_FLAG_COMPRESSED
+    s64 uncompressed_size;
+};
+
+/* how the content of a pack_reader is held:
+    Memory: content is a heap copy of the package, freed with dealloc.
+    Mapped: content is a read-only memory mapping of the package file,
+            pages are only read from disk when accessed and are shared
+            with other processes mapping the same package.
+    Streamed: content only holds the name table, toc and the sections
+            following it, entries are read from the open package file
+            with pack_reader_read_entry(_range) into caller buffers.
+ */
+enum class pack_reader_storage
+{
+    Memory = 0,
+    Mapped = 1,
+    Streamed = 2
 };
 
 struct pack_reader
 {
     char *content;
     s64 content_size;
+    s64 content_offset; // offset of content in the package, 0 unless streamed
     package_header  *header; // pointer into content
     package_toc     *toc;    // ditto
+    pack_reader_storage storage;
+    u32 version; // of the package, PACK_VERSION_1 or PACK_VERSION_2
+
+    // version 1 packages: the toc entries, pointer into content
+    package_toc_entry *toc_entries;
+
+    // version 2 packages: the toc arrays, pointers into content
+    u64 *toc_hashes;
+    u64 *toc_offsets;
+    s64 *toc_sizes;
+    u32 *toc_name_offsets; // relative to header->names_offset
+    u32 *toc_flags;
+
+    // name index, points into content if the package has one, otherwise
+    // to _built_name_index which is built when parsing.
+    package_name_index_slot *name_index;
+    s64 name_index_slot_count;
+    array<package_name_index_slot> _built_name_index;
+
+    // pointer into content, nullptr if the package has no entry info
+    package_entry_info *entry_info;
+
+    // pointer into content, nullptr if the package has no source info
+    package_source_info *source_info;
+
+    // pointer into content, nullptr if the package has no checksums
+    u64 *checksums;
+
+    // only used when streamed
+    io_handle handle;
+    package_header _streamed_header;
+
+    // only used after pack_reader_open_direct
+    io_handle direct_handle;
+    bool has_direct_handle;
+    bool direct_unbuffered; // false if the file system does not support direct I/O
+
+    // if set and compiled with PACK_STATS, parsing, lookups and reads are
+    // recorded here. set by pack_loader, may be set before opening a package.
+    pack_stats *stats;
 };
 
 void init(pack_reader *reader);
@@ -36,11 +101,97 @@ void free(pack_reader *reader);
 // data will be copied
 bool pack_reader_load(pack_reader *reader, const char *data, s64 size, error *err);
 bool pack_reader_load_from_path(pack_reader *reader, const char *path, error *err);
+// maps the package file instead of reading it, only the header and toc are
+// touched when parsing. entries are read from disk when they are accessed.
+bool pack_reader_map_from_path(pack_reader *reader, const char *path, error *err);
+
+// reads only the header, name table and toc (and following sections) of the
+// package file and keeps it open, memory use does not depend on the size of
+// the entries. entries are read with pack_reader_read_entry(_range).
+bool pack_reader_stream_from_path(pack_reader *reader, const char *path, error *err);
 
 // after loading, parse checks if the loaded content is correct, and sets member pointers
 bool pack_reader_parse(pack_reader *reader, error *err);
 
 // Gets the nth package entry
 void pack_reader_get_entry(const pack_reader *reader, s64 n, pack_reader_entry *out_entry);
-// Gets the first entry with the given name, returns false if not found, true if found
+// Gets the first entry with the given name, returns false if not found, true if found.
+// Uses the name index of the package, lookups are O(1).
 bool pack_reader_get_entry_by_name(const pack_reader *reader, const char *name, pack_reader_entry *out_entry);
+// Returns the number of the first entry with the given name, or -1 if not found.
+s64 pack_reader_get_entry_index_by_name(const pack_reader *reader, const char *name);
+
+// Copies or decompresses the content of entry to out, out_size must be at least
+// entry->uncompressed_size.
+bool pack_reader_read_entry(const pack_reader_entry *entry, char *out, s64 out_size, error *err = nullptr);
+// Same as above, but also reads the content from the package file if the reader is streamed.
+bool pack_reader_read_entry(const pack_reader *reader, const pack_reader_entry *entry, char *out, s64 out_size, error *err = nullptr);
+
+// Reads up to size bytes of the stored content of entry (the compressed content
+// if compressed) starting at offset within the entry to out, for reading large
+// entries in chunks. Returns the number of bytes read, which is less than size
+// at the end of the entry, or -1 on error.
+s64 pack_reader_read_entry_range(const pack_reader *reader, const pack_reader_entry *entry, s64 offset, char *out, s64 size, error *err = nullptr);
+
+// XXH64 of the stored content of entry (the compressed content if compressed),
+// the checksum of the entry if the package has checksums.
+bool pack_reader_hash_entry(const pack_reader *reader, const pack_reader_entry *entry, u64 *out_hash, error *err = nullptr);
+
+// checks the stored content of entry n against its checksum, out_ok is set to
+// false if they differ. the package must have checksums.
+bool pack_reader_verify_entry(const pack_reader *reader, s64 n, bool *out_ok, error *err = nullptr);
+
+/* checks the stored contents of all entries against their checksums on
+   thread_count threads (0 = number of hardware threads). returns false if the
+   package has no checksums, reading fails or any entry is corrupted, in which
+   case the corrupted entries are added to out_corrupted if it's not nullptr.
+   entries are hashed with XXH64, which runs at several GB/s per thread, so
+   verifying is mostly bound by reading the package.
+ */
+bool pack_reader_verify(const pack_reader *reader, s32 thread_count = 0, array<s64> *out_corrupted = nullptr, error *err = nullptr);
+
+/* hints that the contents of the given entries will be accessed soon
+   (pack_advice::WillNeed) or are not needed anymore (DontNeed), e.g. to read
+   the entries of the next level into the page cache in the background.
+   the byte ranges of the entries are sorted and ranges on the same or
+   adjacent pages are coalesced, so every contiguous run of entries is a single
+   madvise (mapped) or posix_fadvise (streamed) call. does nothing for readers
+   loaded into memory. contents stay valid either way.
+ */
+bool pack_reader_advise_entries(const pack_reader *reader, const s64 *entries, s64 count, pack_advice advice, error *err = nullptr);
+
+/* alignment of the contents of all entries in the package (at least 8, see
+   pack_writer.alignment). entry contents of mapped readers are aligned to it
+   in memory up to the page size because mappings start at a page; readers
+   loaded into memory only guarantee the alignment of alloc.
+ */
+s64 pack_reader_get_alignment(const pack_reader *reader);
+
+/* opens the package file at path (the file the reader was loaded from) again
+   for direct I/O with pack_reader_read_entry_direct, which reads entries
+   without going through the page cache, e.g. for streaming large assets that
+   are only read once. see pack_open_direct.
+ */
+bool pack_reader_open_direct(pack_reader *reader, const char *path, error *err = nullptr);
+
+// size of the buffer pack_reader_read_entry_direct needs for entry: the stored
+// size extended to PACK_DIRECT_IO_ALIGNMENT boundaries on both sides.
+s64 pack_reader_direct_buffer_size(const pack_reader_entry *entry);
+
+/* reads the stored content of entry (the compressed content if compressed) to
+   out with direct I/O, after pack_reader_open_direct. out must be aligned to
+   PACK_DIRECT_IO_ALIGNMENT and hold pack_reader_direct_buffer_size(entry)
+   bytes. entries aligned to PACK_DIRECT_IO_ALIGNMENT (packer --align 4096) are
+   read straight into out, other entries are read together with the
+   surrounding blocks and moved to the start of out.
+ */
+bool pack_reader_read_entry_direct(const pack_reader *reader, const pack_reader_entry *entry, char *out, s64 out_size, error *err = nullptr);
+
+// size of the package file (or data) the reader was loaded from
+s64 pack_reader_get_package_size(const pack_reader *reader);
+
+// bytes of the package used by the header, the contents of its entries, the
+// name table, toc and following sections. less than the package size by the
+// ranges of replaced entries and old tables if the package was appended to
+// (see pack_writer_append_to_file), and by alignment padding.
+s64 pack_reader_get_used_size(const pack_reader *reader);
@@ -3,8 +3,18 @@
 #include "shl/error.hpp"
 #include "shl/defer.hpp"
 #include "shl/memory.hpp"
+#include "shl/compare.hpp"
 #include "shl/streams.hpp"
+#include <string.h> // memcmp
+#include <algorithm>
+#include <condition_variable>
+
 #include "pack/package.hpp"
+#include "fs/path.hpp"
+#include "pack/compression.hpp"
+#include "pack/content_hash.hpp"
+#include "pack/parallel.hpp"
+#include "pack/name_index.hpp"
 #include "pack/pack_writer.hpp"
 
 void init(pack_writer_entry *entry)
@@ -21,15 +31,50 @@ void free(pack_writer_entry *entry)
 
     free(&entry->name);
 
-    if (entry->type == pack_writer_entry_type::Memory)
+    if (entry->type != pack_writer_entry_type::Memory)
+        return; // package entries only own their name
+
+    if (entry->allocator.alloc != nullptr)
+        pack_dealloc(&entry->allocator, (void*)entry->memory.data, entry->memory.size);
+    else
         free(&entry->memory);
 }
 
+static void _init_entry_memory(pack_writer *writer, pack_writer_entry *entry, s64 size)
+{
+    entry->type = pack_writer_entry_type::Memory;
+    entry->allocator = writer->allocator;
+
+    if (entry->allocator.alloc != nullptr)
+    {
+        entry->memory.data = (char*)pack_alloc(&entry->allocator, size);
+        entry->memory.size = size;
+    }
+    else
+        init(&entry->memory, size);
+}
+
 void init(pack_writer *writer)
 {
     assert(writer != nullptr);
 
     init(&writer->entries);
+    writer->codec = PACK_CODEC_NONE;
+    writer->alignment = PACK_DEFAULT_ALIGNMENT;
+    writer->thread_count = 0;
+    writer->version = 0;
+    fill_memory(&writer->allocator, 0);
+    writer->dedup = false;
+    writer->dedup_entries = 0;
+    writer->dedup_saved_bytes = 0;
+    writer->previous = nullptr;
+    writer->record_sources = false;
+    writer->reused_entries = 0;
+    writer->reused_bytes = 0;
+    writer->checksums = false;
+    writer->order_profile = nullptr;
+    writer->ordered_entries = 0;
+    fill_memory((void*)writer->copied_bytes, 0, sizeof(writer->copied_bytes));
 }
 
 void free(pack_writer *writer)
@@ -52,6 +97,8 @@ bool pack_writer_add_file(pack_writer *writer, const char *path, const char *nam
     pack_writer_entry *entry = add_at_end(&writer->entries);
     init(entry);
     entry->flags = PACK_TOC_FLAG_FILE;
+    entry->codec = writer->codec;
+    entry->alignment = writer->alignment;
     string_copy(name, &entry->name);
 
     file_stream stream{};
@@ -74,8 +121,7 @@ bool pack_writer_add_file(pack_writer *writer, const char *path, const char *nam
     }
     else
     {
-        entry->type = pack_writer_entry_type::Memory;
-        init(&entry->memory, fsize);
+        _init_entry_memory(writer, entry, fsize);
 
         if (!read_entire_file(&stream, entry->memory.data, fsize, err))
             return false;
@@ -84,6 +130,24 @@ bool pack_writer_add_file(pack_writer *writer, const char *path, const char *nam
     return true;
 }
 
+void pack_writer_add_file_entry(pack_writer *writer, const char *path, const char *name, s64 size)
+{
+    assert(writer != nullptr);
+    assert(path != nullptr);
+    assert(name != nullptr);
+    assert(size >= 0);
+
+    pack_writer_entry *entry = add_at_end(&writer->entries);
+    init(entry);
+    entry->flags = PACK_TOC_FLAG_FILE;
+    entry->codec = writer->codec;
+    entry->alignment = writer->alignment;
+    entry->type = pack_writer_entry_type::File;
+    entry->file.path = path;
+    entry->file.size = (u64)size;
+    string_copy(name, &entry->name);
+}
+
 void pack_writer_add_entry(pack_writer *writer, pack_writer_entry *entry)
 {
     assert(writer != nullptr);
@@ -102,11 +166,12 @@ void pack_writer_add_entry(pack_writer *writer, const char *str, const char *nam
     pack_writer_entry *entry = add_at_end(&writer->entries);
     init(entry);
     entry->flags = PACK_TOC_NO_FLAGS;
-    entry->type = pack_writer_entry_type::Memory;
+    entry->codec = writer->codec;
+    entry->alignment = writer->alignment;
     string_copy(name, &entry->name);
 
     s64 len = string_length(str);
-    init(&entry->memory, len);
+    _init_entry_memory(writer, entry, len);
     copy_memory(str, entry->memory.data, len);
 }
 
@@ -119,195 +184,1511 @@ void pack_writer_add_entry(pack_writer *writer, void *data, s64 size, const char
     pack_writer_entry *entry = add_at_end(&writer->entries);
     init(entry);
     entry->flags = PACK_TOC_NO_FLAGS;
-    entry->type = pack_writer_entry_type::Memory;
+    entry->codec = writer->codec;
+    entry->alignment = writer->alignment;
     string_copy(name, &entry->name);
 
-    init(&entry->memory, size);
+    _init_entry_memory(writer, entry, size);
     copy_memory(data, entry->memory.data, size);
 }
 
-static bool _write_entry(file_stream *out, pack_writer_entry *entry, error *err)
+void pack_writer_add_package_entry(pack_writer *writer, const pack_reader *reader, s64 n)
+{
+    assert(writer != nullptr);
+    assert(reader != nullptr);
+    assert(n >= 0 && n < reader->toc->entry_count);
+
+    pack_reader_entry rentry{};
+    pack_reader_get_entry(reader, n, &rentry);
+
+    pack_writer_entry *entry = add_at_end(&writer->entries);
+    init(entry);
+    entry->flags = rentry.flags & ~(u64)PACK_TOC_FLAG_COMPRESSED;
+    entry->type = pack_writer_entry_type::Package;
+    entry->codec = rentry.codec;
+    entry->alignment = writer->alignment;
+    entry->package.reader = reader;
+    entry->package.index = n;
+    string_copy(rentry.name, &entry->name);
+}
+
+void pack_writer_add_package_entries(pack_writer *writer, const pack_reader *reader)
+{
+    assert(writer != nullptr);
+    assert(reader != nullptr);
+
+    for (s64 i = 0; i < reader->toc->entry_count; ++i)
+        pack_writer_add_package_entry(writer, reader, i);
+}
+
+inline static void _get_package_entry(pack_writer_entry *entry, pack_reader_entry *out)
+{
+    pack_reader_get_entry(entry->package.reader, entry->package.index, out);
+}
+
+// uncompressed size
+inline static s64 _entry_size(pack_writer_entry *entry)
 {
     if (entry->type == pack_writer_entry_type::Memory)
+        return entry->memory.size;
+    else if (entry->type == pack_writer_entry_type::File)
+        return entry->file.size;
+
+    pack_reader_entry rentry{};
+    _get_package_entry(entry, &rentry);
+
+    return rentry.uncompressed_size;
+}
+
+// size of the entry in the package if known before writing, otherwise -1
+inline static s64 _known_stored_size(pack_writer_entry *entry)
+{
+    if (entry->type == pack_writer_entry_type::Package)
     {
-        write(out, entry->memory.data, entry->memory.size);
+        pack_reader_entry rentry{};
+        _get_package_entry(entry, &rentry);
+
+        return rentry.size;
     }
-    else
-    {
-        // Lazy file writing, we read the entire file to memory then just write that
-        file_stream stream{};
-        defer { free(&stream); };
 
-        if (!init(&stream, entry->file.path, open_mode::Read, err))
-            return false;
+    if (entry->codec == PACK_CODEC_NONE)
+        return _entry_size(entry);
 
-        s64 size = get_file_size(&stream, err);
+    return -1;
+}
 
-        if (size < 0)
-            return false;
-        
-        memory_stream mem{};
-        defer { free(&mem); };
+inline static s64 _align8(s64 x)
+{
+    return (x + 7) & ~(s64)7;
+}
 
-        if (!read_entire_file(&stream, &mem, err))
-            return false;
+inline static s64 _align_to(s64 x, s64 alignment)
+{
+    return (x + alignment - 1) & ~(alignment - 1);
+}
 
-        write(out, mem.data, mem.size);
-    }
+inline static s64 _entry_alignment(const pack_writer_entry *entry)
+{
+    assert(entry->alignment == 0 || (entry->alignment & (entry->alignment - 1)) == 0);
+    assert(entry->alignment <= PACK_MAX_ALIGNMENT);
 
-    return true;
+    return Max(entry->alignment, (s64)PACK_DEFAULT_ALIGNMENT);
 }
 
-inline static s64 _entry_size(pack_writer_entry *entry)
+// reads the contents of an entry in chunks, used by deduplication
+struct _entry_reader
+{
+    pack_writer_entry *entry;
+    io_handle handle; // file entries
+};
+
+static bool _open_entry(_entry_reader *reader, pack_writer_entry *entry, error *err)
 {
+    reader->entry = entry;
+    reader->handle = INVALID_IO_HANDLE;
+
     if (entry->type == pack_writer_entry_type::Memory)
-        return entry->memory.size;
-    else
-        return entry->file.size;
+        return true;
+
+    reader->handle = io_open(entry->file.path, open_mode::Read, err);
+
+    return reader->handle != INVALID_IO_HANDLE;
 }
 
-bool pack_writer_write_to_file(pack_writer *writer, const char *out_path, error *err)
+static void _close_entry(_entry_reader *reader)
 {
-    assert(writer != nullptr);
-    assert(out_path != nullptr);
+    if (reader->handle != INVALID_IO_HANDLE)
+        io_close(reader->handle);
 
-    io_handle h = io_open(out_path, open_mode::WriteTrunc, err);
-    defer { io_close(h); };
+    reader->handle = INVALID_IO_HANDLE;
+}
 
-    if (h == INVALID_IO_HANDLE)
-        return false;
+// returns a pointer to size bytes of the entry at offset, buf is used for file entries
+static const char *_read_entry_chunk(_entry_reader *reader, s64 offset, char *buf, s64 size, error *err)
+{
+    if (reader->entry->type == pack_writer_entry_type::Memory)
+        return reader->entry->memory.data + offset;
 
-    return pack_writer_write_to_file(writer, h, 0, err);
+    s64 read = pack_read_at(reader->handle, buf, size, offset, err);
+
+    if (read < 0)
+        return nullptr;
+
+    if (read < size)
+    {
+        format_error(err, 1, "write_to_file: file %s changed size since it was added", reader->entry->file.path);
+        return nullptr;
+    }
+
+    return buf;
 }
 
-bool pack_writer_write_to_file(pack_writer *writer, io_handle h, s64 offset, error *err)
+#define _DEDUP_CHUNK_SIZE PACK_COPY_BUFFER_SIZE
+
+static bool _hash_entry(pack_writer_entry *entry, u64 *out_hash, error *err)
 {
-    assert(writer != nullptr);
-    assert(h != INVALID_IO_HANDLE);
+    _entry_reader reader{};
 
-    /* This writes everything directly to the handle because if the entries
-       are quite large, building up a single buffer to write to the handle at
-       once would be quite difficult.
-       So for simplicity, this just writes directly to the handle.
-    */
+    if (!_open_entry(&reader, entry, err))
+        return false;
 
-    s64 entry_count = writer->entries.size;
+    defer { _close_entry(&reader); };
 
-    package_header header{};
-    string_copy(PACK_HEADER_MAGIC, header.magic, 4);
-    header.version = PACK_VERSION;
-    header.flags = PACK_NO_FLAGS;
+    char *buf = (char*)alloc(_DEDUP_CHUNK_SIZE);
+    defer { dealloc(buf, _DEDUP_CHUNK_SIZE); };
 
-    header.toc_offset = 0;   // placeholder
-    header.names_offset = 0; // placeholder
-    header.names_size = 0;   // placeholder
-    
-    file_stream _out{};
-    _out.handle = h;
-    file_stream *out = &_out;
+    pack_hash_state state;
+    pack_hash_init(&state);
+
+    s64 size = _entry_size(entry);
+
+    for (s64 offset = 0; offset < size; offset += _DEDUP_CHUNK_SIZE)
+    {
+        s64 chunk_size = Min((s64)_DEDUP_CHUNK_SIZE, size - offset);
+        const char *chunk = _read_entry_chunk(&reader, offset, buf, chunk_size, err);
+
+        if (chunk == nullptr)
+            return false;
+
+        pack_hash_update(&state, chunk, chunk_size);
+    }
 
-    if (io_seek(h, offset, IO_SEEK_SET, err) < 0)
+    *out_hash = pack_hash_finish(&state);
+
+    return true;
+}
+
+// a and b have the same size
+static bool _entries_equal(pack_writer_entry *a, pack_writer_entry *b, bool *out_equal, error *err)
+{
+    _entry_reader ra{};
+    _entry_reader rb{};
+
+    if (!_open_entry(&ra, a, err))
         return false;
 
-    // write header
-    if (write(out, &header, err) < 0)
+    defer { _close_entry(&ra); };
+
+    if (!_open_entry(&rb, b, err))
         return false;
 
-    // write the entry contents
-    array<s64> content_offsets{};
-    init(&content_offsets, entry_count);
-    defer { free(&content_offsets); };
+    defer { _close_entry(&rb); };
 
-    for (s64 i = 0; i < entry_count; ++i)
+    char *buf = (char*)alloc(2 * _DEDUP_CHUNK_SIZE);
+    defer { dealloc(buf, 2 * _DEDUP_CHUNK_SIZE); };
+
+    s64 size = _entry_size(a);
+    *out_equal = true;
+
+    for (s64 offset = 0; offset < size; offset += _DEDUP_CHUNK_SIZE)
     {
-        pack_writer_entry *entry = writer->entries.data + i;
-        content_offsets[i] = tell(out, err);
+        s64 chunk_size = Min((s64)_DEDUP_CHUNK_SIZE, size - offset);
+        const char *ca = _read_entry_chunk(&ra, offset, buf, chunk_size, err);
 
-        if (!_write_entry(out, entry, err))
+        if (ca == nullptr)
             return false;
 
-        if (seek_next_alignment(out, 8, err) < 0)
+        const char *cb = _read_entry_chunk(&rb, offset, buf + _DEDUP_CHUNK_SIZE, chunk_size, err);
+
+        if (cb == nullptr)
             return false;
+
+        if (memcmp(ca, cb, chunk_size) != 0)
+        {
+            *out_equal = false;
+            return true;
+        }
     }
 
-    // write the name table
-    s64 name_table_pos = tell(out, err);
+    return true;
+}
 
-    if (name_table_pos < 0)
-        return false;
+// package entries are only shared with entries that share their content in the package
+inline static bool _dedupable(pack_writer_entry *entry)
+{
+    return entry->type != pack_writer_entry_type::Package && _entry_size(entry) > 0;
+}
 
-    if (write_at(out, &name_table_pos, offset_of(package_header, names_offset), err) < 0)
-        return false;
+/* sets duplicate_of[i] to the first entry with the same contents as entry i.
+   empty entries and package entries are not deduplicated.
+ */
+static bool _find_duplicates(pack_writer *writer, s64 *duplicate_of, error *err)
+{
+    s64 count = writer->entries.size;
+
+    array<u64> hashes{};
+    init(&hashes, count);
+    defer { free(&hashes); };
+
+    bool ok = pack_parallel_for(count, writer->thread_count, err, [writer, &hashes](s64 i, error *thread_err) {
+        hashes[i] = 0;
 
-    if (seek(out, name_table_pos, IO_SEEK_SET, err) < 0)
+        if (!_dedupable(writer->entries.data + i))
+            return true;
+
+        return _hash_entry(writer->entries.data + i, hashes.data + i, thread_err);
+    });
+
+    if (!ok)
         return false;
 
-    array<s64> name_offsets{};
-    init(&name_offsets, entry_count);
-    defer { free(&name_offsets); };
+    // entries with the same size and hash end up next to each other, ordered by index
+    array<s64> order{};
+    init(&order, count);
+    defer { free(&order); };
 
-    for (s64 i = 0; i < entry_count; ++i)
+    for (s64 i = 0; i < count; ++i)
+        order[i] = i;
+
+    std::sort(order.data, order.data + count, [writer, &hashes](s64 a, s64 b) {
+        s64 size_a = _entry_size(writer->entries.data + a);
+        s64 size_b = _entry_size(writer->entries.data + b);
+
+        if (size_a != size_b)
+            return size_a < size_b;
+
+        if (hashes[a] != hashes[b])
+            return hashes[a] < hashes[b];
+
+        return a < b;
+    });
+
+    s64 first = -1;
+
+    for (s64 k = 0; k < count; ++k)
     {
-        name_offsets[i] = tell(out, err);
+        s64 i = order[k];
+
+        if (first >= 0
+         && _dedupable(writer->entries.data + i)
+         && _dedupable(writer->entries.data + first)
+         && _entry_size(writer->entries.data + i) == _entry_size(writer->entries.data + first)
+         && hashes[i] == hashes[first])
+            duplicate_of[i] = first;
+        else
+            first = i;
+    }
 
-        string *name = &writer->entries[i].name;
+    // confirm the matches, a hash collision is written as its own entry
+    return pack_parallel_for(count, writer->thread_count, err, [writer, duplicate_of](s64 i, error *thread_err) {
+        if (duplicate_of[i] < 0)
+            return true;
 
-        if (write(out, name->data, name->size + 1, err) < 0)
+        bool equal = false;
+
+        if (!_entries_equal(writer->entries.data + i, writer->entries.data + duplicate_of[i], &equal, thread_err))
             return false;
+
+        if (!equal)
+            duplicate_of[i] = -1;
+
+        return true;
+    });
+}
+
+// sets duplicate_of[i] to the first package entry with the same content in the same package
+static void _find_shared_package_entries(pack_writer *writer, s64 *duplicate_of)
+{
+    array<s64> order{};
+    init(&order);
+    defer { free(&order); };
+
+    for (s64 i = 0; i < writer->entries.size; ++i)
+        if (writer->entries[i].type == pack_writer_entry_type::Package)
+            add_at_end(&order, i);
+
+    auto content = [writer](s64 i) {
+        pack_reader_entry rentry{};
+        _get_package_entry(writer->entries.data + i, &rentry);
+        return rentry;
+    };
+
+    std::sort(order.data, order.data + order.size, [writer, &content](s64 a, s64 b) {
+        const pack_reader *reader_a = writer->entries[a].package.reader;
+        const pack_reader *reader_b = writer->entries[b].package.reader;
+
+        if (reader_a != reader_b)
+            return reader_a < reader_b;
+
+        s64 offset_a = content(a).offset;
+        s64 offset_b = content(b).offset;
+
+        if (offset_a != offset_b)
+            return offset_a < offset_b;
+
+        return a < b;
+    });
+
+    for (s64 k = 1; k < order.size; ++k)
+    {
+        s64 i = order[k];
+        s64 first = duplicate_of[order[k - 1]] >= 0 ? duplicate_of[order[k - 1]] : order[k - 1];
+
+        pack_reader_entry rentry = content(i);
+        pack_reader_entry rfirst = content(first);
+
+        if (writer->entries[i].package.reader == writer->entries[first].package.reader
+         && rentry.offset == rfirst.offset
+         && rentry.size == rfirst.size
+         && rentry.flags == rfirst.flags)
+            duplicate_of[i] = first;
     }
+}
 
-    s64 npos = tell(out, err);
-    
-    if (npos < 0)
-        return false;
+// shared by the threads writing entries
+struct _entry_write_state
+{
+    pack_writer *writer;
+    io_handle handle;
+    const pack_reader *in_place; // package entries of this reader are already in the file
+    const s64 *duplicate_of; // nullptr if no entries share their content
+    package_source_info *sources; // nullptr if not recording sources
+    u64 *checksums; // nullptr if not writing checksums
+    s64 *offsets;
+    s64 *sizes;
+    u64 *flags;
+
+    // contents are laid out in this order, layout[p] is the entry at position
+    // p and positions[i] the position of entry i.
+    const s64 *layout;
+    const s64 *positions;
+
+    // alignment of each entry, entries sharing their content with another
+    // entry raise its alignment to theirs.
+    const s64 *alignments;
+
+    /* the offsets of the entries at the first known_count positions (up until
+       the first entry with a codec) are computed before writing because their
+       sizes are known. offsets of the following entries are given out in
+       layout order once the (compressed) size of an entry is known.
+     */
+    s64 known_count;
+
+    std::mutex mutex;
+    std::condition_variable offset_assigned;
+    s64 next_entry; // position of the next entry to get an offset
+    s64 next_offset;
+
+    // set under mutex so waiting threads wake up, read without it by threads
+    // about to write another entry
+    std::atomic<bool> failed;
+
+    std::atomic<s64> copied_bytes[PACK_COPY_METHOD_COUNT];
+    std::atomic<s64> reused_entries;
+    std::atomic<s64> reused_bytes;
+};
+
+static void _entry_write_failed(_entry_write_state *state)
+{
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->failed = true;
+    }
 
-    assert(name_table_pos <= npos);
-    s64 name_table_size = npos - name_table_pos;
+    state->offset_assigned.notify_all();
+}
 
-    if (write_at(out, &name_table_size, offset_of(package_header, names_size), err) < 0)
-        return false;
+// entries that are not written, their offsets are set after writing
+inline static bool _takes_no_space(_entry_write_state *state, s64 i)
+{
+    if (state->duplicate_of != nullptr && state->duplicate_of[i] >= 0)
+        return true;
 
-    if (seek(out, npos, IO_SEEK_SET, err) < 0)
-        return false;
+    pack_writer_entry *entry = state->writer->entries.data + i;
 
-    if (seek_next_alignment(out, 8) < 0)
-        return false;
+    return entry->type == pack_writer_entry_type::Package
+        && entry->package.reader == state->in_place;
+}
 
-    // write the toc
-    s64 toc_pos = tell(out, err);
+// returns false if writing another entry failed
+static bool _assign_entry_offset(_entry_write_state *state, s64 i)
+{
+    s64 position = state->positions[i];
 
-    if (toc_pos < 0)
+    if (position < state->known_count)
+        return true;
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->offset_assigned.wait(lock, [state, position]() { return state->next_entry == position || state->failed; });
+
+    if (state->failed)
         return false;
 
-    if (write_at(out, &toc_pos, offset_of(package_header, toc_offset), err) < 0)
+    if (_takes_no_space(state, i))
+        state->offsets[i] = state->next_offset;
+    else
+    {
+        state->offsets[i] = _align_to(state->next_offset, state->alignments[i]);
+        state->next_offset = _align8(state->offsets[i] + state->sizes[i]);
+    }
+
+    state->next_entry += 1;
+
+    lock.unlock();
+    state->offset_assigned.notify_all();
+
+    return true;
+}
+
+static bool _file_mtime(const char *path, s64 *out_mtime, error *err)
+{
+    io_handle h = io_open(path, open_mode::Read, err);
+
+    if (h == INVALID_IO_HANDLE)
         return false;
 
-    if (seek(out, toc_pos, IO_SEEK_SET, err) < 0)
+    defer { io_close(h); };
+
+    fs::filesystem_info info{};
+
+    if (!fs::query_filesystem(h, &info, fs::query_flag::FileTimes, err))
         return false;
 
-    package_toc toc{};
-    string_copy(PACK_TOC_MAGIC, toc.magic, 4);
-    toc._padding = 0;
-    toc.entry_count = entry_count;
+#if Windows
+    *out_mtime = (s64)info.detail.file_times.last_write_time;
+#else
+    *out_mtime = (s64)info.stx_mtime.tv_sec * 1000000000 + (s64)info.stx_mtime.tv_nsec;
+#endif
 
-    if (write(out, &toc, err) < 0)
+    return true;
+}
+
+// checksum of the stored content of entry n of reader
+static bool _stored_checksum(const pack_reader *reader, s64 n, u64 *out_checksum, error *err)
+{
+    if (reader->checksums != nullptr)
+    {
+        *out_checksum = reader->checksums[n];
+        return true;
+    }
+
+    pack_reader_entry rentry{};
+    pack_reader_get_entry(reader, n, &rentry);
+
+    return pack_reader_hash_entry(reader, &rentry, out_checksum, err);
+}
+
+/* records the source of file entry i and copies the stored entry from the
+   previous package if the source file has the same size and codec as before,
+   and either the same last write time or the same contents.
+ */
+static bool _reuse_previous_entry(_entry_write_state *state, s64 i, bool *out_reused, error *err)
+{
+    pack_writer *writer = state->writer;
+    pack_writer_entry *entry = writer->entries.data + i;
+    package_source_info *source = state->sources + i;
+    *out_reused = false;
+
+    source->size = (s64)entry->file.size;
+    source->codec = entry->codec;
+
+    if (!_file_mtime(entry->file.path, &source->mtime, err))
         return false;
 
-    // u64 toc_entry_pos = toc_pos + sizeof(toc);
-    
-    for (s64 i = 0; i < entry_count; ++i)
+    const pack_reader *previous = writer->previous;
+    s64 p = -1;
+
+    if (previous != nullptr && previous->source_info != nullptr)
+        p = pack_reader_get_entry_index_by_name(previous, entry->name.data);
+
+    const package_source_info *old = p >= 0 ? previous->source_info + p : nullptr;
+
+    if (old != nullptr && (old->size != source->size || old->codec != source->codec))
+        old = nullptr;
+
+    if (old != nullptr && old->mtime == source->mtime)
+        source->hash = old->hash;
+    else
     {
-        pack_writer_entry *entry = writer->entries.data + i;
-        package_toc_entry toc_entry{};
-        toc_entry.offset = content_offsets[i];
-        toc_entry.size = _entry_size(entry);
-        toc_entry.name_offset = name_offsets[i];
-        toc_entry.flags = entry->flags;
+        // changed files are read again when writing them, from the page cache
+        if (!_hash_entry(entry, &source->hash, err))
+            return false;
 
-        if (write(out, &toc_entry, err) < 0)
+        if (old != nullptr && old->hash != source->hash)
+            old = nullptr;
+    }
+
+    if (old == nullptr)
+        return true;
+
+    pack_reader_entry rentry{};
+    pack_reader_get_entry(previous, p, &rentry);
+
+    state->sizes[i] = rentry.size;
+    state->flags[i] = entry->flags | (rentry.flags & PACK_TOC_FLAG_COMPRESSED);
+    *out_reused = true;
+
+    if (!_assign_entry_offset(state, i))
+        return true; // the entry that failed reports the error
+
+    if (previous->storage == pack_reader_storage::Streamed)
+    {
+        s64 copied[PACK_COPY_METHOD_COUNT] = {};
+
+        if (!pack_copy_at(previous->handle, rentry.offset, state->handle, state->offsets[i], rentry.size, copied, err))
             return false;
+
+        for (int m = 0; m < PACK_COPY_METHOD_COUNT; ++m)
+            state->copied_bytes[m] += copied[m];
     }
+    else if (pack_write_at(state->handle, rentry.content, rentry.size, state->offsets[i], err) < 0)
+        return false;
+
+    state->reused_entries += 1;
+    state->reused_bytes += rentry.size;
+
+    if (state->checksums != nullptr)
+        return _stored_checksum(previous, p, state->checksums + i, err);
 
     return true;
 }
 
+// uncompressed lazy files are copied without reading them into memory
+static bool _copy_file_entry(_entry_write_state *state, s64 i, error *err)
+{
+    pack_writer_entry *entry = state->writer->entries.data + i;
+
+    file_stream stream{};
+
+    if (!init(&stream, entry->file.path, open_mode::Read, err))
+        return false;
+
+    defer { free(&stream); };
+
+    s64 size = get_file_size(&stream, err);
+
+    if (size < 0)
+        return false;
+
+    if (size != (s64)entry->file.size)
+    {
+        format_error(err, 1, "write_to_file: file %s changed size (%x -> %x) since it was added", entry->file.path, entry->file.size, size);
+        return false;
+    }
+
+    state->sizes[i] = size;
+    state->flags[i] = entry->flags;
+
+    if (!_assign_entry_offset(state, i))
+        return true; // the entry that failed reports the error
+
+    s64 copied[PACK_COPY_METHOD_COUNT] = {};
+
+    if (!pack_copy_at(stream.handle, 0, state->handle, state->offsets[i], size, copied, err))
+        return false;
+
+    for (int m = 0; m < PACK_COPY_METHOD_COUNT; ++m)
+        state->copied_bytes[m] += copied[m];
+
+    if (state->checksums != nullptr)
+    {
+        // the content is the file, which was hashed already if recording sources
+        if (state->sources != nullptr)
+            state->checksums[i] = state->sources[i].hash;
+        else if (!_hash_entry(entry, state->checksums + i, err))
+            return false;
+    }
+
+    return true;
+}
+
+// copies the stored content of a package entry
+static bool _copy_package_entry(_entry_write_state *state, s64 i, error *err)
+{
+    pack_writer_entry *entry = state->writer->entries.data + i;
+    const pack_reader *reader = entry->package.reader;
+
+    pack_reader_entry rentry{};
+    _get_package_entry(entry, &rentry);
+
+    state->sizes[i] = rentry.size;
+    state->flags[i] = entry->flags | (rentry.flags & PACK_TOC_FLAG_COMPRESSED);
+
+    if (!_assign_entry_offset(state, i))
+        return true; // the entry that failed reports the error
+
+    if (reader->storage == pack_reader_storage::Streamed)
+    {
+        s64 copied[PACK_COPY_METHOD_COUNT] = {};
+
+        if (!pack_copy_at(reader->handle, rentry.offset, state->handle, state->offsets[i], rentry.size, copied, err))
+            return false;
+
+        for (int m = 0; m < PACK_COPY_METHOD_COUNT; ++m)
+            state->copied_bytes[m] += copied[m];
+    }
+    else if (pack_write_at(state->handle, rentry.content, rentry.size, state->offsets[i], err) < 0)
+        return false;
+
+    if (state->checksums != nullptr)
+        return _stored_checksum(reader, entry->package.index, state->checksums + i, err);
+
+    return true;
+}
+
+static bool _write_entry(_entry_write_state *state, s64 i, error *err)
+{
+    pack_writer_entry *entry = state->writer->entries.data + i;
+
+    // duplicates take no space, they get the offset of the first entry after writing
+    if (_takes_no_space(state, i))
+    {
+        state->sizes[i] = 0;
+        state->flags[i] = entry->flags;
+        _assign_entry_offset(state, i);
+        return true;
+    }
+
+    if (entry->type == pack_writer_entry_type::Package)
+        return _copy_package_entry(state, i, err);
+
+    if (state->sources != nullptr && entry->type == pack_writer_entry_type::File)
+    {
+        bool reused = false;
+
+        if (!_reuse_previous_entry(state, i, &reused, err))
+            return false;
+
+        if (reused)
+            return true;
+    }
+
+    const char *data = nullptr;
+    s64 size = 0;
+
+    memory_stream mem{};
+    defer { free(&mem); };
+
+    if (entry->type == pack_writer_entry_type::File && entry->codec == PACK_CODEC_NONE)
+        return _copy_file_entry(state, i, err);
+
+    if (entry->type == pack_writer_entry_type::Memory)
+    {
+        data = entry->memory.data;
+        size = entry->memory.size;
+    }
+    else
+    {
+        // Lazy file writing, we read the entire file to memory then just write that
+        if (!read_entire_file(entry->file.path, &mem, err))
+            return false;
+
+        data = mem.data;
+        size = mem.size;
+
+        if (size != (s64)entry->file.size)
+        {
+            format_error(err, 1, "write_to_file: file %s changed size (%x -> %x) since it was added", entry->file.path, entry->file.size, size);
+            return false;
+        }
+    }
+
+    state->sizes[i] = size;
+    state->flags[i] = entry->flags;
+
+    // compressed if it gets smaller, otherwise written as is
+    char *compressed = nullptr;
+    s64 bound = 0;
+    defer { if (compressed != nullptr) dealloc(compressed, bound); };
+
+    if (entry->codec != PACK_CODEC_NONE && size > 0)
+    {
+        bound = pack_compress_bound(entry->codec, size);
+        compressed = (char*)alloc(bound);
+
+        s64 compressed_size = pack_compress(entry->codec, data, size, compressed, size - 1);
+
+        if (compressed_size >= 0)
+        {
+            data = compressed;
+            state->sizes[i] = compressed_size;
+            state->flags[i] |= PACK_TOC_FLAG_COMPRESSED;
+        }
+    }
+
+    if (state->checksums != nullptr)
+        state->checksums[i] = pack_hash(data, state->sizes[i]);
+
+    if (!_assign_entry_offset(state, i))
+        return true; // the entry that failed reports the error
+
+    return pack_write_at(state->handle, data, state->sizes[i], state->offsets[i], err) >= 0;
+}
+
+bool pack_writer_write_to_file(pack_writer *writer, const char *out_path, error *err)
+{
+    assert(writer != nullptr);
+    assert(out_path != nullptr);
+
+    io_handle h = io_open(out_path, open_mode::WriteTrunc, err);
+    defer { io_close(h); };
+
+    if (h == INVALID_IO_HANDLE)
+        return false;
+
+    return pack_writer_write_to_file(writer, h, 0, err);
+}
+
+/* entries named in the order profile come first, in the order they were first
+   accessed, so entries that are loaded together (e.g. during startup) are
+   read sequentially. the other entries follow in entry order.
+   returns the number of entries placed by the profile.
+ */
+static s64 _layout_entries(pack_writer *writer, s64 *layout)
+{
+    s64 entry_count = writer->entries.size;
+    const pack_access_profile *profile = writer->order_profile;
+
+    if (profile == nullptr || profile->names.size == 0 || entry_count == 0)
+    {
+        for (s64 i = 0; i < entry_count; ++i)
+            layout[i] = i;
+
+        return 0;
+    }
+
+    array<package_name_index_slot> slots{};
+    init(&slots, pack_name_index_slot_count(entry_count));
+    defer { free(&slots); };
+
+    fill_memory((void*)slots.data, 0xff, sizeof(package_name_index_slot) * slots.size);
+
+    // entries with the same name: the first one is laid out by the profile
+    for (s64 i = 0; i < entry_count; ++i)
+    {
+        string *name = &writer->entries[i].name;
+        u64 hash = pack_name_hash(name->data, name->size);
+
+        package_name_index_slot *slot = pack_name_index_probe(slots.data, slots.size, hash, [writer, name](u32 other) {
+            return string_compare(to_const_string(writer->entries[other].name), to_const_string(name)) == 0;
+        });
+
+        if (slot->entry != PACK_INDEX_EMPTY_SLOT)
+            continue;
+
+        slot->hash = pack_name_index_hash_tag(hash);
+        slot->entry = (u32)i;
+    }
+
+    array<bool> placed{};
+    init(&placed, entry_count);
+    defer { free(&placed); };
+
+    fill_memory((void*)placed.data, 0, sizeof(bool) * entry_count);
+
+    s64 count = 0;
+
+    for_array(pname, &profile->names)
+    {
+        u64 hash = pack_name_hash(pname->data, pname->size);
+
+        package_name_index_slot *slot = pack_name_index_probe(slots.data, slots.size, hash, [writer, pname](u32 other) {
+            return string_compare(to_const_string(writer->entries[other].name), to_const_string(pname)) == 0;
+        });
+
+        if (slot == nullptr || slot->entry == PACK_INDEX_EMPTY_SLOT || placed[slot->entry])
+            continue;
+
+        placed[slot->entry] = true;
+        layout[count] = slot->entry;
+        count += 1;
+    }
+
+    s64 ordered = count;
+
+    for (s64 i = 0; i < entry_count; ++i)
+    {
+        if (placed[i])
+            continue;
+
+        layout[count] = i;
+        count += 1;
+    }
+
+    return ordered;
+}
+
+// sets flag in the header and moves to the aligned start of the section
+static bool _begin_section(file_stream *out, package_header *header, u64 flag, error *err)
+{
+    header->flags |= flag;
+
+    return seek_next_alignment(out, 8, err) >= 0;
+}
+
+// writes the name table and toc of a version 1 package at the current position
+static bool _write_toc_v1(pack_writer *writer, file_stream *out, package_header *header, const s64 *offsets, const s64 *sizes, const u64 *flags, error *err)
+{
+    s64 entry_count = writer->entries.size;
+    s64 name_table_pos = tell(out, err);
+
+    if (name_table_pos < 0)
+        return false;
+
+    header->names_offset = name_table_pos;
+
+    array<s64> name_offsets{};
+    init(&name_offsets, entry_count);
+    defer { free(&name_offsets); };
+
+    for (s64 i = 0; i < entry_count; ++i)
+    {
+        name_offsets[i] = tell(out, err);
+
+        string *name = &writer->entries[i].name;
+
+        if (write(out, name->data, name->size + 1, err) < 0)
+            return false;
+    }
+
+    s64 npos = tell(out, err);
+    
+    if (npos < 0)
+        return false;
+
+    assert(name_table_pos <= npos);
+    header->names_size = npos - name_table_pos;
+
+    if (seek_next_alignment(out, 8) < 0)
+        return false;
+
+    s64 toc_pos = tell(out, err);
+
+    if (toc_pos < 0)
+        return false;
+
+    header->toc_offset = toc_pos;
+
+    package_toc toc{};
+    string_copy(PACK_TOC_MAGIC, toc.magic, 4);
+    toc._padding = 0;
+    toc.entry_count = entry_count;
+
+    if (write(out, &toc, err) < 0)
+        return false;
+
+    for (s64 i = 0; i < entry_count; ++i)
+    {
+        package_toc_entry toc_entry{};
+        toc_entry.offset = offsets[i];
+        toc_entry.size = sizes[i];
+        toc_entry.name_offset = name_offsets[i];
+        toc_entry.flags = flags[i];
+
+        if (write(out, &toc_entry, err) < 0)
+            return false;
+    }
+
+    return true;
+}
+
+// writes the string pool and toc of a version 2 package at the current position
+static bool _write_toc_v2(pack_writer *writer, file_stream *out, package_header *header, const u64 *hashes, const s64 *offsets, const s64 *sizes, const u64 *flags, error *err)
+{
+    s64 entry_count = writer->entries.size;
+
+    if (seek_next_alignment(out, 8, err) < 0)
+        return false;
+
+    s64 pool_pos = tell(out, err);
+
+    if (pool_pos < 0)
+        return false;
+
+    header->names_offset = pool_pos;
+
+    // the names are written in one go
+    s64 pool_size = 0;
+
+    for_array(entry, &writer->entries)
+        pool_size += (s64)sizeof(package_name_length) + entry->name.size + 1;
+
+    if (pool_size > (s64)0xffffffff)
+    {
+        format_error(err, 1, "write_to_file: entry names (%x bytes) do not fit in a version 2 string pool", pool_size);
+        return false;
+    }
+
+    array<char> pool{};
+    init(&pool, pool_size);
+    defer { free(&pool); };
+
+    array<u32> name_offsets{};
+    init(&name_offsets, entry_count);
+    defer { free(&name_offsets); };
+
+    s64 pos = 0;
+
+    for (s64 i = 0; i < entry_count; ++i)
+    {
+        string *name = &writer->entries[i].name;
+        package_name_length len = (package_name_length)name->size;
+
+        name_offsets[i] = (u32)pos;
+        copy_memory(&len, pool.data + pos, sizeof(len));
+        pos += sizeof(len);
+        copy_memory(name->data, pool.data + pos, name->size);
+        pos += name->size;
+        pool[pos] = '\0';
+        pos += 1;
+    }
+
+    if (pool_size > 0 && write(out, pool.data, pool_size, err) < 0)
+        return false;
+
+    header->names_size = pool_size;
+
+    if (seek_next_alignment(out, 8, err) < 0)
+        return false;
+
+    s64 toc_pos = tell(out, err);
+
+    if (toc_pos < 0)
+        return false;
+
+    header->toc_offset = toc_pos;
+
+    package_toc toc{};
+    string_copy(PACK_TOC_V2_MAGIC, toc.magic, 4);
+    toc._padding = 0;
+    toc.entry_count = entry_count;
+
+    if (write(out, &toc, err) < 0)
+        return false;
+
+    if (entry_count == 0)
+        return true;
+
+    array<u32> toc_flags{};
+    init(&toc_flags, entry_count);
+    defer { free(&toc_flags); };
+
+    for (s64 i = 0; i < entry_count; ++i)
+        toc_flags[i] = (u32)flags[i];
+
+    if (write(out, hashes, sizeof(u64) * entry_count, err) < 0
+     || write(out, offsets, sizeof(s64) * entry_count, err) < 0
+     || write(out, sizes, sizeof(s64) * entry_count, err) < 0
+     || write(out, name_offsets.data, sizeof(u32) * entry_count, err) < 0
+     || write(out, toc_flags.data, sizeof(u32) * entry_count, err) < 0)
+        return false;
+
+    return true;
+}
+
+/* writes the package of writer to h at offset. if in_place is set, h is the
+   package file of in_place and is appended to: package entries of in_place
+   are not written again, and the header is only written at the end, after
+   everything else is flushed.
+ */
+static bool _write_package(pack_writer *writer, io_handle h, s64 offset, const pack_reader *in_place, error *err)
+{
+    /* This writes everything directly to the handle because if the entries
+       are quite large, building up a single buffer to write to the handle at
+       once would be quite difficult.
+       So for simplicity, this just writes directly to the handle.
+    */
+
+    s64 entry_count = writer->entries.size;
+
+    package_header header{};
+    string_copy(PACK_HEADER_MAGIC, header.magic, 4);
+    header.version = writer->version == PACK_VERSION_1 ? PACK_VERSION_1 : PACK_VERSION_2;
+    header.flags = PACK_FLAG_NAME_INDEX;
+
+    // set while writing, the header is written last
+    header.toc_offset = 0;
+    header.names_offset = 0;
+    header.names_size = 0;
+    
+    file_stream _out{};
+    _out.handle = h;
+    file_stream *out = &_out;
+
+    if (in_place == nullptr)
+    {
+        if (io_seek(h, offset, IO_SEEK_SET, err) < 0)
+            return false;
+
+        // placeholder
+        if (write(out, &header, err) < 0)
+            return false;
+    }
+    else if (io_seek(h, 0, IO_SEEK_END, err) < 0)
+        return false;
+
+    // write the entry contents
+    array<s64> content_offsets{};
+    init(&content_offsets, entry_count);
+    defer { free(&content_offsets); };
+
+    // size and flags of the written entries, may differ from the entries if compressed
+    array<s64> content_sizes{};
+    init(&content_sizes, entry_count);
+    defer { free(&content_sizes); };
+
+    array<u64> content_flags{};
+    init(&content_flags, entry_count);
+    defer { free(&content_flags); };
+
+    s64 entries_pos = tell(out, err);
+
+    if (entries_pos < 0)
+        return false;
+
+    array<s64> duplicate_of{};
+    defer { free(&duplicate_of); };
+
+    writer->dedup_entries = 0;
+    writer->dedup_saved_bytes = 0;
+    writer->reused_entries = 0;
+    writer->reused_bytes = 0;
+
+    // sources of the entries, file entries fill theirs when they are written
+    array<package_source_info> sources{};
+    defer { free(&sources); };
+
+    if (writer->record_sources || writer->previous != nullptr)
+    {
+        init(&sources, entry_count);
+        fill_memory((void*)sources.data, 0, sizeof(package_source_info) * entry_count);
+    }
+
+    bool any_package_entries = false;
+
+    for_array(entry, &writer->entries)
+        if (entry->type == pack_writer_entry_type::Package)
+            any_package_entries = true;
+
+    if (writer->dedup || any_package_entries)
+    {
+        init(&duplicate_of, entry_count);
+
+        for (s64 i = 0; i < entry_count; ++i)
+            duplicate_of[i] = -1;
+
+        if (writer->dedup && !_find_duplicates(writer, duplicate_of.data, err))
+            return false;
+
+        _find_shared_package_entries(writer, duplicate_of.data);
+    }
+
+    array<s64> layout{};
+    init(&layout, entry_count);
+    defer { free(&layout); };
+
+    array<s64> positions{};
+    init(&positions, entry_count);
+    defer { free(&positions); };
+
+    writer->ordered_entries = _layout_entries(writer, layout.data);
+
+    for (s64 p = 0; p < entry_count; ++p)
+        positions[layout[p]] = p;
+
+    array<s64> alignments{};
+    init(&alignments, entry_count);
+    defer { free(&alignments); };
+
+    for (s64 i = 0; i < entry_count; ++i)
+        alignments[i] = _entry_alignment(writer->entries.data + i);
+
+    if (duplicate_of.size > 0)
+        for (s64 i = 0; i < entry_count; ++i)
+            if (duplicate_of[i] >= 0)
+                alignments[duplicate_of[i]] = Max(alignments[duplicate_of[i]], alignments[i]);
+
+    // checksums of the stored contents of the entries
+    array<u64> checksums{};
+    defer { free(&checksums); };
+
+    if (writer->checksums)
+        init(&checksums, entry_count);
+
+    _entry_write_state state{};
+    state.writer = writer;
+    state.handle = h;
+    state.in_place = in_place;
+    state.duplicate_of = duplicate_of.size > 0 ? duplicate_of.data : nullptr;
+    state.sources = sources.size > 0 ? sources.data : nullptr;
+    state.checksums = checksums.size > 0 ? checksums.data : nullptr;
+    state.offsets = content_offsets.data;
+    state.sizes = content_sizes.data;
+    state.flags = content_flags.data;
+    state.layout = layout.data;
+    state.positions = positions.data;
+    state.alignments = alignments.data;
+    state.next_offset = _align8(entries_pos);
+
+    while (state.known_count < entry_count && _known_stored_size(writer->entries.data + layout[state.known_count]) >= 0)
+    {
+        s64 i = layout[state.known_count];
+        content_offsets[i] = state.next_offset;
+
+        if (!_takes_no_space(&state, i))
+        {
+            content_offsets[i] = _align_to(state.next_offset, alignments[i]);
+            state.next_offset = _align8(content_offsets[i] + _known_stored_size(writer->entries.data + i));
+        }
+
+        state.known_count += 1;
+    }
+
+    state.next_entry = state.known_count;
+
+    // entries are read, compressed and written with positional writes on multiple threads
+    bool ok = pack_parallel_for(entry_count, writer->thread_count, err, [&state](s64 p, error *thread_err) {
+        if (state.failed.load(std::memory_order_relaxed))
+            return true;
+
+        if (!_write_entry(&state, state.layout[p], thread_err))
+        {
+            _entry_write_failed(&state);
+            return false;
+        }
+
+        return true;
+    });
+
+    for (int m = 0; m < PACK_COPY_METHOD_COUNT; ++m)
+        writer->copied_bytes[m] = state.copied_bytes[m];
+
+    writer->reused_entries = state.reused_entries;
+    writer->reused_bytes = state.reused_bytes;
+
+    if (!ok)
+        return false;
+
+    // package entries of in_place stay where they are
+    for (s64 i = 0; i < entry_count; ++i)
+    {
+        pack_writer_entry *entry = writer->entries.data + i;
+
+        if (entry->type != pack_writer_entry_type::Package
+         || entry->package.reader != in_place
+         || (state.duplicate_of != nullptr && duplicate_of[i] >= 0))
+            continue;
+
+        pack_reader_entry rentry{};
+        _get_package_entry(entry, &rentry);
+
+        content_offsets[i] = rentry.offset;
+        content_sizes[i] = rentry.size;
+        content_flags[i] = entry->flags | (rentry.flags & PACK_TOC_FLAG_COMPRESSED);
+
+        if (state.checksums != nullptr && !_stored_checksum(in_place, entry->package.index, state.checksums + i, err))
+            return false;
+    }
+
+    // package entries keep their sources
+    if (state.sources != nullptr)
+    {
+        for (s64 i = 0; i < entry_count; ++i)
+        {
+            pack_writer_entry *entry = writer->entries.data + i;
+
+            if (entry->type == pack_writer_entry_type::Package && entry->package.reader->source_info != nullptr)
+                state.sources[i] = entry->package.reader->source_info[entry->package.index];
+        }
+    }
+
+    if (state.duplicate_of != nullptr)
+    {
+        for (s64 i = 0; i < entry_count; ++i)
+        {
+            s64 first = duplicate_of[i];
+
+            if (first < 0)
+                continue;
+
+            content_offsets[i] = content_offsets[first];
+            content_sizes[i] = content_sizes[first];
+            content_flags[i] |= content_flags[first] & PACK_TOC_FLAG_COMPRESSED;
+
+            if (state.checksums != nullptr)
+                state.checksums[i] = state.checksums[first];
+
+            if (writer->entries[i].type == pack_writer_entry_type::Package)
+                continue;
+
+            if (state.sources != nullptr)
+            {
+                state.sources[i] = state.sources[first];
+                state.sources[i].codec = writer->entries[i].codec;
+
+                if (writer->entries[i].type != pack_writer_entry_type::File)
+                    fill_memory(state.sources + i, 0);
+            }
+
+            writer->dedup_entries += 1;
+            writer->dedup_saved_bytes += content_sizes[first];
+        }
+    }
+
+    // the alignment all entries have, entries of in_place keep theirs
+    s64 min_alignment = PACK_MAX_ALIGNMENT;
+
+    for (s64 i = 0; i < entry_count; ++i)
+    {
+        if (!_takes_no_space(&state, i))
+            min_alignment = Min(min_alignment, alignments[i]);
+        else if (in_place != nullptr && (state.duplicate_of == nullptr || duplicate_of[i] < 0))
+            min_alignment = Min(min_alignment, pack_header_alignment(in_place->header->flags));
+    }
+
+    if (entry_count == 0)
+        min_alignment = PACK_DEFAULT_ALIGNMENT;
+
+    if (min_alignment > PACK_DEFAULT_ALIGNMENT)
+    {
+        u64 alignment_log2 = 0;
+
+        while (((s64)1 << alignment_log2) < min_alignment)
+            alignment_log2 += 1;
+
+        header.flags |= alignment_log2 << PACK_FLAG_ALIGNMENT_SHIFT;
+    }
+
+    bool any_compressed = false;
+
+    for (s64 i = 0; i < entry_count; ++i)
+        if ((content_flags[i] & PACK_TOC_FLAG_COMPRESSED) == PACK_TOC_FLAG_COMPRESSED)
+            any_compressed = true;
+
+    // write the name table or string pool and the toc
+    if (seek(out, state.next_offset, IO_SEEK_SET, err) < 0)
+        return false;
+
+    array<u64> name_hashes{};
+    init(&name_hashes, entry_count);
+    defer { free(&name_hashes); };
+
+    for (s64 i = 0; i < entry_count; ++i)
+    {
+        string *name = &writer->entries[i].name;
+        name_hashes[i] = pack_name_hash(name->data, name->size);
+    }
+
+    if (header.version == PACK_VERSION_1)
+    {
+        if (!_write_toc_v1(writer, out, &header, content_offsets.data, content_sizes.data, content_flags.data, err))
+            return false;
+    }
+    else if (!_write_toc_v2(writer, out, &header, name_hashes.data, content_offsets.data, content_sizes.data, content_flags.data, err))
+        return false;
+
+    // write the name index, the first entry with a name is the one that's found
+    package_name_index index{};
+    string_copy(PACK_INDEX_MAGIC, index.magic, 4);
+    index._padding = 0;
+    index.slot_count = pack_name_index_slot_count(entry_count);
+
+    array<package_name_index_slot> slots{};
+    init(&slots, index.slot_count);
+    defer { free(&slots); };
+
+    fill_memory((void*)slots.data, 0xff, sizeof(package_name_index_slot) * index.slot_count);
+
+    for (s64 i = 0; i < entry_count; ++i)
+    {
+        string *name = &writer->entries[i].name;
+        u64 hash = name_hashes[i];
+
+        package_name_index_slot *slot = pack_name_index_probe(slots.data, index.slot_count, hash, [writer, name](u32 other) {
+            string *other_name = &writer->entries[other].name;
+            return other_name->size == name->size
+                && string_compare(other_name->data, name->data, name->size) == 0;
+        });
+
+        assert(slot != nullptr);
+
+        if (slot->entry != PACK_INDEX_EMPTY_SLOT)
+            continue;
+
+        slot->hash = pack_name_index_hash_tag(hash);
+        slot->entry = (u32)i;
+    }
+
+    if (seek_next_alignment(out, 8, err) < 0)
+        return false;
+
+    if (write(out, &index, err) < 0)
+        return false;
+
+    if (write(out, slots.data, sizeof(package_name_index_slot) * index.slot_count, err) < 0)
+        return false;
+
+    // write the entry info, only needed if any entry is compressed
+    if (any_compressed)
+    {
+        if (!_begin_section(out, &header, PACK_FLAG_ENTRY_INFO, err))
+            return false;
+
+        package_entry_info_table info_table{};
+        string_copy(PACK_INFO_MAGIC, info_table.magic, 4);
+        info_table._padding = 0;
+        info_table.entry_count = entry_count;
+
+        if (write(out, &info_table, err) < 0)
+            return false;
+
+        for (s64 i = 0; i < entry_count; ++i)
+        {
+            // duplicates are stored with the codec of the entry they share contents with
+            s64 stored = (state.duplicate_of != nullptr && duplicate_of[i] >= 0) ? duplicate_of[i] : i;
+            pack_writer_entry *entry = writer->entries.data + stored;
+            package_entry_info info{};
+            info.uncompressed_size = _entry_size(entry);
+            info.codec = (content_flags[i] & PACK_TOC_FLAG_COMPRESSED) ? entry->codec : PACK_CODEC_NONE;
+            info._padding = 0;
+
+            if (write(out, &info, err) < 0)
+                return false;
+        }
+    }
+
+    // write the source info
+    if (state.sources != nullptr)
+    {
+        if (!_begin_section(out, &header, PACK_FLAG_SOURCE_INFO, err))
+            return false;
+
+        package_source_info_table source_table{};
+        string_copy(PACK_SOURCE_MAGIC, source_table.magic, 4);
+        source_table._padding = 0;
+        source_table.entry_count = entry_count;
+
+        if (write(out, &source_table, err) < 0)
+            return false;
+
+        if (write(out, sources.data, sizeof(package_source_info) * entry_count, err) < 0)
+            return false;
+    }
+
+    // write the checksums
+    if (state.checksums != nullptr)
+    {
+        if (!_begin_section(out, &header, PACK_FLAG_CHECKSUMS, err))
+            return false;
+
+        package_checksum_table checksum_table{};
+        string_copy(PACK_CHECKSUM_MAGIC, checksum_table.magic, 4);
+        checksum_table._padding = 0;
+        checksum_table.entry_count = entry_count;
+
+        if (write(out, &checksum_table, err) < 0)
+            return false;
+
+        if (write(out, checksums.data, sizeof(u64) * entry_count, err) < 0)
+            return false;
+    }
+
+    // an appended package only becomes visible once everything it points to is on disk
+    if (in_place != nullptr && !pack_flush(h, err))
+        return false;
+
+    if (write_at(out, &header, offset, err) < 0)
+        return false;
+
+    if (in_place != nullptr && !pack_flush(h, err))
+        return false;
+
+    return true;
+}
+
+bool pack_writer_write_to_file(pack_writer *writer, io_handle h, s64 offset, error *err)
+{
+    assert(writer != nullptr);
+    assert(h != INVALID_IO_HANDLE);
+
+    return _write_package(writer, h, offset, nullptr, err);
+}
+
+bool pack_writer_append_to_file(pack_writer *writer, const char *path, error *err)
+{
+    assert(writer != nullptr);
+    assert(path != nullptr);
+
+    pack_reader existing{};
+    init(&existing);
+    defer { free(&existing); };
+
+    if (!pack_reader_stream_from_path(&existing, path, err))
+        return false;
+
+    io_handle h = io_open(path, open_mode::Write, err);
+
+    if (h == INVALID_IO_HANDLE)
+        return false;
+
+    defer { io_close(h); };
+
+    // the entries of the updated package: the existing entries, replaced by
+    // entries of writer with the same name, followed by the other entries of writer.
+    // entries of writer are copied shallowly and stay owned by writer.
+    pack_writer combined = *writer;
+    init(&combined.entries);
+
+    // a package keeps its version unless another one is requested, so
+    // readers of version 1 packages can still read them after patching
+    if (combined.version == 0)
+        combined.version = existing.version;
+
+    // a package with checksums keeps them
+    combined.checksums = writer->checksums || existing.checksums != nullptr;
+    defer {
+        for_array(entry, &combined.entries)
+            if (entry->type == pack_writer_entry_type::Package)
+                free(entry);
+
+        free(&combined.entries);
+    };
+
+    s64 existing_count = existing.toc->entry_count;
+
+    array<s64> replaced_by{};
+    init(&replaced_by, existing_count);
+    defer { free(&replaced_by); };
+
+    for (s64 i = 0; i < existing_count; ++i)
+        replaced_by[i] = -1;
+
+    array<bool> replaces{};
+    init(&replaces, writer->entries.size);
+    defer { free(&replaces); };
+
+    for (s64 i = 0; i < writer->entries.size; ++i)
+    {
+        s64 n = pack_reader_get_entry_index_by_name(&existing, writer->entries[i].name.data);
+        replaces[i] = n >= 0 && replaced_by[n] < 0;
+
+        if (replaces[i])
+            replaced_by[n] = i;
+    }
+
+    for (s64 n = 0; n < existing_count; ++n)
+    {
+        if (replaced_by[n] >= 0)
+            add_at_end(&combined.entries, writer->entries[replaced_by[n]]);
+        else
+            pack_writer_add_package_entry(&combined, &existing, n);
+    }
+
+    for (s64 i = 0; i < writer->entries.size; ++i)
+        if (!replaces[i])
+            add_at_end(&combined.entries, writer->entries[i]);
+
+    bool ok = _write_package(&combined, h, 0, &existing, err);
+
+    for (int m = 0; m < PACK_COPY_METHOD_COUNT; ++m)
+        writer->copied_bytes[m] = combined.copied_bytes[m];
+
+    writer->dedup_entries = combined.dedup_entries;
+    writer->dedup_saved_bytes = combined.dedup_saved_bytes;
+    writer->reused_entries = combined.reused_entries;
+    writer->reused_bytes = combined.reused_bytes;
+    writer->ordered_entries = combined.ordered_entries;
+
+    return ok;
+}
+
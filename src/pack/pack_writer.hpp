@@ -9,12 +9,17 @@ Used to create package files from code.
 #include "shl/string.hpp"
 #include "shl/array.hpp"
 #include "shl/memory_stream.hpp"
+#include "pack/allocator.hpp"
+#include "pack/access_profile.hpp"
 #include "pack/package.hpp"
+#include "pack/pack_reader.hpp"
+#include "pack/positional_io.hpp"
 
 enum class pack_writer_entry_type
 {
     Memory,
-    File // loaded lazily when writing
+    File,   // loaded lazily when writing
+    Package // stored content of an entry of a pack_reader, copied as is when writing
 };
 
 struct pack_writer_file
@@ -23,17 +28,27 @@ struct pack_writer_file
     u64 size;
 };
 
+struct pack_writer_package_entry
+{
+    const pack_reader *reader;
+    s64 index;
+};
+
 struct pack_writer_entry
 {
     // name, usually path
     string name;
     u64 flags;
     pack_writer_entry_type type;
+    u32 codec; // PACK_CODEC_*, entry is stored uncompressed if it doesn't get smaller
+    s64 alignment; // of the content in the package, power of two, 0 = PACK_DEFAULT_ALIGNMENT
+    pack_allocator allocator; // memory entries added by pack_writer are allocated with this
 
     union
     {
         memory_stream memory;
         pack_writer_file file;
+        pack_writer_package_entry package;
     };
 };
 
@@ -43,6 +58,59 @@ void free(pack_writer_entry *entry);
 struct pack_writer
 {
     array<pack_writer_entry> entries;
+    u32 codec; // codec of entries added after setting this, PACK_CODEC_NONE by default
+
+    // alignment of the contents of entries added after setting this, a power of
+    // two up to PACK_MAX_ALIGNMENT, PACK_DEFAULT_ALIGNMENT (8) by default.
+    // e.g. PACK_DIRECT_IO_ALIGNMENT for direct I/O or page aligned entries.
+    // the smallest alignment of all entries is recorded in the header.
+    s64 alignment;
+    s32 thread_count; // threads reading and compressing entries when writing, 0 = number of hardware threads
+
+    // format of the written package, 0 (the default) = PACK_VERSION for new
+    // packages and the version of the package for pack_writer_append_to_file.
+    // packages written with PACK_VERSION_1 can also be read by readers from before version 2.
+    u32 version;
+
+    pack_allocator allocator; // memory of entries added after setting this, alloc / dealloc by default
+
+    // entries with identical contents are written once and share their offset.
+    // contents are hashed before writing and matches are confirmed by comparing them.
+    bool dedup;
+
+    // entries that were not written because of dedup and their size during the last write
+    s64 dedup_entries;
+    s64 dedup_saved_bytes;
+
+    // if set, file entries whose source file has the same size, codec and last
+    // write time (or contents) as the source of the entry with the same name in
+    // previous are copied from previous instead of being read and compressed
+    // again. previous needs source info (see record_sources), it may be streamed
+    // and must not be the file being written.
+    const pack_reader *previous;
+
+    // writes the size, last write time and hash of the source files of file
+    // entries to the package. always done if previous is set.
+    bool record_sources;
+
+    // entries copied from previous and their stored size during the last write
+    s64 reused_entries;
+    s64 reused_bytes;
+
+    // writes the XXH64 of the stored content of every entry to the package,
+    // see pack_reader_verify and pack_loader.verify_checksums.
+    bool checksums;
+
+    // if set, the contents of the entries named in the profile are laid out
+    // first, in the order they were first accessed, followed by the other
+    // entries in entry order. entry numbers do not change.
+    const pack_access_profile *order_profile;
+
+    // entries laid out by order_profile during the last write
+    s64 ordered_entries;
+
+    // bytes of uncompressed lazy file entries copied by each pack_copy_method during the last write
+    s64 copied_bytes[PACK_COPY_METHOD_COUNT];
 };
 
 void init(pack_writer *writer);
@@ -50,6 +118,10 @@ void free(pack_writer *writer);
 
 bool pack_writer_add_file(pack_writer *writer, const char *path, bool lazy = true, error *err = nullptr);
 bool pack_writer_add_file(pack_writer *writer, const char *path, const char *name, bool lazy = true, error *err = nullptr);
+// adds a lazily loaded file whose size is already known, e.g. from a directory
+// walk, without opening it. path must stay valid until the writer is written,
+// the size is checked when the file is written.
+void pack_writer_add_file_entry(pack_writer *writer, const char *path, const char *name, s64 size);
 
 void pack_writer_add_entry(pack_writer *writer, pack_writer_entry *entry);
 void pack_writer_add_entry(pack_writer *writer, const char *str, const char *name = "");
@@ -61,5 +133,24 @@ inline void pack_writer_add_entry(pack_writer *writer, T *data, const char *name
     pack_writer_add_entry(writer, reinterpret_cast<void*>(data), sizeof(T), name);
 }
 
+// adds entry n of reader with its name. the stored content is copied without
+// decompressing it, entries of reader that share their content still do.
+// reader must stay loaded until the writer is written.
+void pack_writer_add_package_entry(pack_writer *writer, const pack_reader *reader, s64 n);
+// adds all entries of reader, e.g. to compact a package that was appended to
+void pack_writer_add_package_entries(pack_writer *writer, const pack_reader *reader);
+
 bool pack_writer_write_to_file(pack_writer *writer, const char *out_path, error *err = nullptr);
 bool pack_writer_write_to_file(pack_writer *writer, io_handle handle, s64 offset = 0, error *err = nullptr);
+
+/* updates the package at path in place without rewriting it: entries of writer
+   replace the entries of the package with the same name (keeping their entry
+   numbers), other entries of writer are added after the entries of the package.
+   only the contents of the entries of writer, a new name table, toc and the
+   following sections are appended to the file. once they are flushed to disk,
+   the header is written with a single write, so readers opening the package
+   see either the old or the new entries. the ranges of replaced entries and of
+   the old tables stay in the file until it is compacted, see
+   pack_reader_get_used_size and pack_writer_add_package_entries.
+ */
+bool pack_writer_append_to_file(pack_writer *writer, const char *path, error *err = nullptr);
@@ -5,6 +5,11 @@
 
 #define PACK_HEADER_MAGIC   "pack"
 #define PACK_TOC_MAGIC      "toc0"
+#define PACK_TOC_V2_MAGIC   "toc2"
+#define PACK_INDEX_MAGIC    "idx0"
+#define PACK_INFO_MAGIC     "inf0"
+#define PACK_SOURCE_MAGIC   "src0"
+#define PACK_CHECKSUM_MAGIC "sum0"
 
 /* pack structure:
     [header
@@ -32,10 +37,114 @@
       ]
       [entry 2 ...]
     ]
+    [name index (only if PACK_FLAG_NAME_INDEX is set, aligned at 8 bytes)
+      4 bytes index magic "idx0"
+      4 bytes padding
+      8 bytes number of slots (power of two)
+      [slots
+        4 bytes upper 32 bits of the name hash
+        4 bytes entry index, PACK_INDEX_EMPTY_SLOT if slot is empty
+      ]
+    ]
+
+    [entry info (only if PACK_FLAG_ENTRY_INFO is set, aligned at 8 bytes)
+      4 bytes info magic "inf0"
+      4 bytes padding
+      8 bytes number of entries (same as toc)
+      [info of entry 1
+        8 bytes uncompressed size
+        4 bytes codec
+        4 bytes padding
+      ]
+      [info of entry 2 ...]
+    ]
+
+    [source info (only if PACK_FLAG_SOURCE_INFO is set, aligned at 8 bytes)
+      4 bytes source magic "src0"
+      4 bytes padding
+      8 bytes number of entries (same as toc)
+      [source of entry 1, all 0 if the entry is not a file
+        8 bytes size of the source file
+        8 bytes last write time of the source file
+        8 bytes hash of the source file contents (see pack/content_hash.hpp)
+        4 bytes codec the entry was added with
+        4 bytes padding
+      ]
+      [source of entry 2 ...]
+    ]
+
+    [checksums (only if PACK_FLAG_CHECKSUMS is set, aligned at 8 bytes)
+      4 bytes checksum magic "sum0"
+      4 bytes padding
+      8 bytes number of entries (same as toc)
+      [8 bytes checksum of entry 1]
+      [checksum of entry 2 ...]
+    ]
+
+   version 2 (PACK_VERSION_2) packages replace the name table and the toc
+   entries with a string pool and a toc made of one array per field, the
+   header and all other sections are the same:
+    [string pool (aligned at 8 bytes)
+      [name 1
+        4 bytes length of the name, without the \0
+        name, followed by \0
+      ]
+      [name 2 ...] (not aligned)
+    ]
+    [table of contents (aligned at 8 bytes)
+      4 bytes toc magic "toc2"
+      4 bytes padding
+      8 bytes number of toc entries (n)
+      n * 8 bytes name hashes (pack_name_hash, see pack/name_index.hpp)
+      n * 8 bytes content offsets
+      n * 8 bytes content sizes
+      n * 4 bytes name offsets, relative to the start of the string pool
+      n * 4 bytes flags
+    ]
+   the header fields names_offset and names_size describe the string pool.
+   lookups and scans only touch the arrays of the fields they need, e.g. the
+   name hashes are compared before any name is, and names are compared by
+   length first.
+
+   the name index is an open addressing table with linear probing, the first
+   slot of a name is (pack_name_hash(name) & (slot count - 1)).
+   see pack/name_index.hpp.
+
+   entries with PACK_TOC_FLAG_COMPRESSED are stored compressed, the toc entry
+   size is the compressed size and the entry info contains the codec and the
+   uncompressed size. entries that don't get smaller are stored uncompressed.
+
+   the source info is used when repacking to find entries whose source files
+   did not change, see pack_writer.previous.
+
+   checksums are the XXH64 (seed 0, see pack/content_hash.hpp) of the stored
+   content of the entries, i.e. the compressed content if compressed.
+
+   bits 8-15 of the header flags (PACK_FLAG_ALIGNMENT_MASK) are the log2 of
+   the alignment of all entry contents in the package, 0 for 8 bytes.
+   entries may be aligned further, see pack_writer.alignment.
  */
 
-#define PACK_VERSION  0x00000001
+#define PACK_VERSION_1 0x00000001
+#define PACK_VERSION_2 0x00000002
+#define PACK_VERSION   PACK_VERSION_2 // written by default
 #define PACK_NO_FLAGS 0
+#define PACK_FLAG_NAME_INDEX 0x01u
+#define PACK_FLAG_ENTRY_INFO 0x02u
+#define PACK_FLAG_SOURCE_INFO 0x04u
+#define PACK_FLAG_CHECKSUMS   0x08u
+#define PACK_FLAG_ALIGNMENT_MASK  0xff00u
+#define PACK_FLAG_ALIGNMENT_SHIFT 8
+
+#define PACK_DEFAULT_ALIGNMENT 8
+#define PACK_MAX_ALIGNMENT     0x100000 // 1 MiB
+
+// the alignment of entry contents recorded in the header flags
+constexpr inline s64 pack_header_alignment(u64 flags)
+{
+    u64 shift = (flags & PACK_FLAG_ALIGNMENT_MASK) >> PACK_FLAG_ALIGNMENT_SHIFT;
+    return shift == 0 ? PACK_DEFAULT_ALIGNMENT : ((s64)1 << shift);
+}
 
 struct package_header
 {
@@ -54,9 +163,11 @@ struct package_toc
     s64 entry_count;
 };
 
-#define PACK_TOC_NO_FLAGS  0x00u
-#define PACK_TOC_FLAG_FILE 0x01u
+#define PACK_TOC_NO_FLAGS        0x00u
+#define PACK_TOC_FLAG_FILE       0x01u
+#define PACK_TOC_FLAG_COMPRESSED 0x02u
 
+// version 1
 struct package_toc_entry
 {
     u64 offset;
@@ -64,3 +175,63 @@ struct package_toc_entry
     u64 name_offset;
     u64 flags;
 };
+
+// version 2, the size of the arrays following package_toc per entry
+#define PACK_TOC_V2_ENTRY_SIZE (3 * sizeof(u64) + 2 * sizeof(u32))
+// version 2, length prefix of names in the string pool
+typedef u32 package_name_length;
+
+#define PACK_INDEX_EMPTY_SLOT 0xffffffffu
+
+struct package_name_index
+{
+    char magic[4];
+    u32 _padding;
+    s64 slot_count;
+};
+
+struct package_name_index_slot
+{
+    u32 hash;
+    u32 entry;
+};
+
+#define PACK_CODEC_NONE 0
+#define PACK_CODEC_LZ4  1
+
+struct package_entry_info_table
+{
+    char magic[4];
+    u32 _padding;
+    s64 entry_count;
+};
+
+struct package_entry_info
+{
+    s64 uncompressed_size;
+    u32 codec;
+    u32 _padding;
+};
+
+struct package_source_info_table
+{
+    char magic[4];
+    u32 _padding;
+    s64 entry_count;
+};
+
+struct package_source_info
+{
+    s64 size;
+    s64 mtime;
+    u64 hash;
+    u32 codec;
+    u32 _padding;
+};
+
+struct package_checksum_table
+{
+    char magic[4];
+    u32 _padding;
+    s64 entry_count;
+};
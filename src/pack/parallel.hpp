@@ -0,0 +1,94 @@
+#pragma once
+
+/* parallel.hpp
+
+Used internally to spread work over multiple threads.
+ */
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "shl/number_types.hpp"
+#include "shl/error.hpp"
+
+#define PACK_MAX_THREADS 64
+
+// number of threads to use for a requested thread count, 0 = number of hardware threads
+inline s32 pack_thread_count(s32 requested, s64 work_count)
+{
+    s64 count = requested;
+
+    if (count <= 0)
+        count = (s64)std::thread::hardware_concurrency();
+
+    if (count > work_count)
+        count = work_count;
+
+    if (count > PACK_MAX_THREADS)
+        count = PACK_MAX_THREADS;
+
+    if (count < 1)
+        count = 1;
+
+    return (s32)count;
+}
+
+/* Calls fn(s64 i, error *err) -> bool for every i in [0, count) on up to
+   thread_count threads, indices are handed out in ascending order.
+   Stops handing out indices once a call returns false, and returns false
+   with err set to the error of the first failed call.
+   With one thread, everything runs on the calling thread.
+ */
+template<typename F>
+bool pack_parallel_for(s64 count, s32 thread_count, error *err, F fn)
+{
+    s32 threads = pack_thread_count(thread_count, count);
+
+    if (threads == 1)
+    {
+        for (s64 i = 0; i < count; ++i)
+            if (!fn(i, err))
+                return false;
+
+        return true;
+    }
+
+    std::atomic<s64> next{0};
+    std::atomic<bool> failed{false};
+    std::mutex error_mutex;
+
+    auto worker = [&]() {
+        error thread_err{};
+
+        while (!failed.load(std::memory_order_relaxed))
+        {
+            s64 i = next.fetch_add(1);
+
+            if (i >= count)
+                break;
+
+            if (!fn(i, &thread_err))
+            {
+                std::lock_guard<std::mutex> lock(error_mutex);
+
+                if (!failed.exchange(true) && err != nullptr)
+                    *err = thread_err;
+
+                break;
+            }
+        }
+    };
+
+    std::thread pool[PACK_MAX_THREADS];
+
+    for (s32 t = 1; t < threads; ++t)
+        pool[t] = std::thread(worker);
+
+    worker();
+
+    for (s32 t = 1; t < threads; ++t)
+        pool[t].join();
+
+    return !failed.load();
+}
@@ -0,0 +1,358 @@
+
+#include "shl/assert.hpp"
+#include "shl/compare.hpp"
+
+#if Windows
+#include <windows.h>
+#else
+#include <errno.h>
+#include <string.h> // strerror
+#include <fcntl.h> // open
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <fcntl.h> // posix_fadvise
+#include <sys/sendfile.h>
+#include <mutex>
+#endif
+
+#include "pack/positional_io.hpp"
+
+// reads once, up to size bytes (less per call on Windows), 0 at the end of the file
+static s64 _read_once_at(io_handle h, void *buf, s64 size, s64 offset, error *err)
+{
+    while (true)
+    {
+#if Windows
+        s64 chunk = Min(size, (s64)0x40000000);
+
+        OVERLAPPED ov{};
+        ov.Offset = (DWORD)(offset & 0xffffffff);
+        ov.OffsetHigh = (DWORD)(offset >> 32);
+        DWORD bytes_read = 0;
+
+        if (!ReadFile((HANDLE)h, (char*)buf, (DWORD)chunk, &bytes_read, &ov))
+        {
+            DWORD code = GetLastError();
+
+            if (code == ERROR_HANDLE_EOF)
+                return 0;
+
+            format_error(err, (int)code, "read_at: could not read %x bytes at %x", chunk, offset);
+            return -1;
+        }
+#else
+        ssize_t bytes_read = pread(h, (char*)buf, (size_t)size, (off_t)offset);
+
+        if (bytes_read < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            format_error(err, errno, "read_at: could not read %x bytes at %x: %s", size, offset, strerror(errno));
+            return -1;
+        }
+#endif
+
+        return (s64)bytes_read;
+    }
+}
+
+s64 pack_read_at(io_handle h, void *buf, s64 size, s64 offset, error *err)
+{
+    assert(buf != nullptr || size == 0);
+
+    s64 done = 0;
+
+    while (done < size)
+    {
+        s64 bytes_read = _read_once_at(h, (char*)buf + done, size - done, offset + done, err);
+
+        if (bytes_read < 0)
+            return -1;
+
+        if (bytes_read == 0)
+            break;
+
+        done += bytes_read;
+    }
+
+    return done;
+}
+
+s64 pack_write_at(io_handle h, const void *buf, s64 size, s64 offset, error *err)
+{
+    assert(buf != nullptr || size == 0);
+
+    s64 done = 0;
+
+    while (done < size)
+    {
+        s64 chunk = size - done;
+
+#if Windows
+        if (chunk > 0x40000000)
+            chunk = 0x40000000;
+
+        OVERLAPPED ov{};
+        ov.Offset = (DWORD)((offset + done) & 0xffffffff);
+        ov.OffsetHigh = (DWORD)((offset + done) >> 32);
+        DWORD bytes_written = 0;
+
+        if (!WriteFile((HANDLE)h, (const char*)buf + done, (DWORD)chunk, &bytes_written, &ov))
+        {
+            format_error(err, (int)GetLastError(), "write_at: could not write %x bytes at %x", chunk, offset + done);
+            return -1;
+        }
+#else
+        ssize_t bytes_written = pwrite(h, (const char*)buf + done, (size_t)chunk, (off_t)(offset + done));
+
+        if (bytes_written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            format_error(err, errno, "write_at: could not write %x bytes at %x: %s", chunk, offset + done, strerror(errno));
+            return -1;
+        }
+#endif
+
+        done += (s64)bytes_written;
+    }
+
+    return done;
+}
+
+io_handle pack_open_direct(const char *path, bool *out_unbuffered, error *err)
+{
+    assert(path != nullptr);
+    assert(out_unbuffered != nullptr);
+
+    *out_unbuffered = true;
+
+#if Windows
+    HANDLE h = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, nullptr);
+
+    if (h == INVALID_HANDLE_VALUE)
+    {
+        format_error(err, (int)GetLastError(), "open_direct: could not open %s", path);
+        return INVALID_IO_HANDLE;
+    }
+
+    return (io_handle)h;
+#else
+    int flags = O_RDONLY;
+
+#if defined(__linux__)
+    flags |= O_DIRECT;
+#else
+    *out_unbuffered = false;
+#endif
+
+    int fd = open(path, flags);
+
+#if defined(__linux__)
+    if (fd < 0 && errno == EINVAL)
+    {
+        *out_unbuffered = false;
+        fd = open(path, O_RDONLY);
+    }
+#endif
+
+    if (fd < 0)
+    {
+        format_error(err, errno, "open_direct: could not open %s: %s", path, strerror(errno));
+        return INVALID_IO_HANDLE;
+    }
+
+    return (io_handle)fd;
+#endif
+}
+
+s64 pack_read_direct_at(io_handle h, void *buf, s64 size, s64 offset, error *err)
+{
+    assert(buf != nullptr || size == 0);
+
+    s64 done = 0;
+
+    while (done < size)
+    {
+        s64 bytes_read = _read_once_at(h, (char*)buf + done, size - done, offset + done, err);
+
+        if (bytes_read < 0)
+            return -1;
+
+        done += bytes_read;
+
+        // a short read is the end of the file, reading on would not be aligned
+        if (bytes_read == 0 || done % PACK_DIRECT_IO_ALIGNMENT != 0)
+            break;
+    }
+
+    return done;
+}
+
+bool pack_flush(io_handle h, error *err)
+{
+#if Windows
+    if (!FlushFileBuffers((HANDLE)h))
+    {
+        format_error(err, (int)GetLastError(), "flush: could not flush file");
+        return false;
+    }
+#else
+    while (fdatasync(h) != 0)
+    {
+        if (errno == EINTR)
+            continue;
+
+        format_error(err, errno, "flush: could not flush file: %s", strerror(errno));
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+bool pack_advise_at(io_handle h, s64 offset, s64 size, pack_advice advice, error *err)
+{
+#if defined(__linux__)
+    int adv = advice == pack_advice::WillNeed ? POSIX_FADV_WILLNEED : POSIX_FADV_DONTNEED;
+    int ret = posix_fadvise(h, (off_t)offset, (off_t)size, adv);
+
+    if (ret != 0)
+    {
+        format_error(err, ret, "advise_at: could not advise %x bytes at %x: %s", size, offset, strerror(ret));
+        return false;
+    }
+#else
+    (void)h;
+    (void)offset;
+    (void)size;
+    (void)advice;
+    (void)err;
+#endif
+
+    return true;
+}
+
+const char *pack_copy_method_name(pack_copy_method method)
+{
+    switch (method)
+    {
+    case pack_copy_method::CopyFileRange: return "copy_file_range";
+    case pack_copy_method::Sendfile:      return "sendfile";
+    case pack_copy_method::Buffer:        return "buffer";
+    }
+
+    return "unknown";
+}
+
+#if defined(__linux__)
+// sendfile writes at the file position of out, so only one thread may use it at once
+static std::mutex _sendfile_mutex;
+
+// errors that mean the method is not supported for the given files
+static bool _copy_unsupported(int code)
+{
+    return code == ENOSYS || code == EXDEV || code == EINVAL || code == EOPNOTSUPP;
+}
+#endif
+
+bool pack_copy_at(io_handle in, s64 in_offset, io_handle out, s64 out_offset, s64 size, s64 *out_copied, error *err)
+{
+    assert(out_copied != nullptr);
+
+    s64 done = 0;
+
+#if defined(__linux__)
+    while (done < size)
+    {
+        loff_t off_in = (loff_t)(in_offset + done);
+        loff_t off_out = (loff_t)(out_offset + done);
+        ssize_t copied = copy_file_range(in, &off_in, out, &off_out, (size_t)(size - done), 0);
+
+        if (copied < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if (_copy_unsupported(errno))
+                break;
+
+            format_error(err, errno, "copy_at: could not copy %x bytes at %x: %s", size - done, in_offset + done, strerror(errno));
+            return false;
+        }
+
+        if (copied == 0)
+            break;
+
+        done += (s64)copied;
+        out_copied[(int)pack_copy_method::CopyFileRange] += (s64)copied;
+    }
+
+    if (done < size)
+    {
+        std::lock_guard<std::mutex> lock(_sendfile_mutex);
+
+        if (lseek(out, (off_t)(out_offset + done), SEEK_SET) < 0)
+        {
+            format_error(err, errno, "copy_at: could not seek to %x: %s", out_offset + done, strerror(errno));
+            return false;
+        }
+
+        while (done < size)
+        {
+            off_t off_in = (off_t)(in_offset + done);
+            ssize_t copied = sendfile(out, in, &off_in, (size_t)(size - done));
+
+            if (copied < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                if (_copy_unsupported(errno))
+                    break;
+
+                format_error(err, errno, "copy_at: could not send %x bytes at %x: %s", size - done, in_offset + done, strerror(errno));
+                return false;
+            }
+
+            if (copied == 0)
+                break;
+
+            done += (s64)copied;
+            out_copied[(int)pack_copy_method::Sendfile] += (s64)copied;
+        }
+    }
+#endif
+
+    char buffer[PACK_COPY_BUFFER_SIZE];
+
+    while (done < size)
+    {
+        s64 chunk = Min(size - done, (s64)PACK_COPY_BUFFER_SIZE);
+        s64 bytes_read = pack_read_at(in, buffer, chunk, in_offset + done, err);
+
+        if (bytes_read < 0)
+            return false;
+
+        if (bytes_read == 0)
+            break;
+
+        if (pack_write_at(out, buffer, bytes_read, out_offset + done, err) < 0)
+            return false;
+
+        done += bytes_read;
+        out_copied[(int)pack_copy_method::Buffer] += bytes_read;
+    }
+
+    if (done < size)
+    {
+        format_error(err, 1, "copy_at: unexpected end of input after %x of %x bytes", done, size);
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+/* positional_io.hpp
+
+Reading and writing at offsets of files without moving the file position,
+so multiple threads may read or write the same handle at once.
+Used internally.
+ */
+
+#include "shl/io.hpp"
+#include "shl/error.hpp"
+
+// reads until size bytes are read or the end of the file is reached,
+// returns the number of bytes read or -1 on error.
+s64 pack_read_at(io_handle h, void *buf, s64 size, s64 offset, error *err = nullptr);
+
+// writes all size bytes, returns size or -1 on error.
+s64 pack_write_at(io_handle h, const void *buf, s64 size, s64 offset, error *err = nullptr);
+
+// offsets, sizes and buffers of direct I/O reads are multiples of this
+#define PACK_DIRECT_IO_ALIGNMENT 4096
+
+/* opens the file at path for reading with direct I/O, bypassing the page
+   cache (O_DIRECT on Linux, FILE_FLAG_NO_BUFFERING on Windows). if the file
+   system does not support direct I/O, the file is opened normally and
+   out_unbuffered is set to false.
+ */
+io_handle pack_open_direct(const char *path, bool *out_unbuffered, error *err = nullptr);
+
+// like pack_read_at, but stops after a short read (the end of the file) so
+// that every read of a direct I/O handle stays aligned.
+s64 pack_read_direct_at(io_handle h, void *buf, s64 size, s64 offset, error *err = nullptr);
+
+// waits until everything written to h is on disk
+bool pack_flush(io_handle h, error *err = nullptr);
+
+enum class pack_advice
+{
+    WillNeed = 0, // will be read soon, read ahead into the page cache
+    DontNeed = 1  // not needed anymore, may be dropped from memory
+};
+
+// hints size bytes at offset of h (posix_fadvise). only a hint, does nothing
+// on platforms without it.
+bool pack_advise_at(io_handle h, s64 offset, s64 size, pack_advice advice, error *err = nullptr);
+
+enum class pack_copy_method
+{
+    CopyFileRange = 0, // copy_file_range, within the kernel, may share extents on btrfs / XFS
+    Sendfile = 1,      // sendfile, within the kernel
+    Buffer = 2         // pack_read_at / pack_write_at through a fixed size buffer
+};
+
+#define PACK_COPY_METHOD_COUNT 3
+#define PACK_COPY_BUFFER_SIZE 0x10000
+
+const char *pack_copy_method_name(pack_copy_method method);
+
+/* copies size bytes at in_offset of in to out_offset of out, trying
+   copy_file_range, then sendfile, then a buffer on the stack (only the
+   buffer on platforms other than Linux).
+   out_copied[method] is incremented by the number of bytes copied by each method.
+   fails if in ends before size bytes are copied.
+ */
+bool pack_copy_at(io_handle in, s64 in_offset, io_handle out, s64 out_offset, s64 size, s64 *out_copied, error *err = nullptr);
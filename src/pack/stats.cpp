@@ -0,0 +1,193 @@
+#include <chrono>
+#include <thread>
+
+#include "shl/assert.hpp"
+#include "shl/memory.hpp"
+
+#include "pack/stats.hpp"
+
+const char *pack_stat_op_name(pack_stat_op op)
+{
+    switch (op)
+    {
+    case pack_stat_op::Open:      return "open";
+    case pack_stat_op::Parse:     return "parse";
+    case pack_stat_op::LoadEntry: return "load_entry";
+    case pack_stat_op::Lookup:    return "lookup";
+    }
+
+    return "unknown";
+}
+
+void init(pack_stats *stats)
+{
+    assert(stats != nullptr);
+
+    fill_memory(stats, 0);
+}
+
+void free(pack_stats *stats)
+{
+    assert(stats != nullptr);
+
+    if (stats->events != nullptr)
+        dealloc(stats->events, sizeof(pack_trace_event) * stats->event_capacity);
+
+    fill_memory(stats, 0);
+}
+
+s64 pack_stats_now()
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return (s64)std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+static s32 _thread_id()
+{
+    static std::atomic<s32> next_id{1};
+    thread_local s32 id = next_id.fetch_add(1, std::memory_order_relaxed);
+
+    return id;
+}
+
+static s32 _bucket(s64 ns)
+{
+    s32 b = 0;
+
+    while (ns > 1 && b < PACK_STAT_BUCKET_COUNT - 1)
+    {
+        ns >>= 1;
+        b += 1;
+    }
+
+    return b;
+}
+
+void pack_stats_record(pack_stats *stats, pack_stat_op op, s64 entry, s64 start_ns)
+{
+    assert(stats != nullptr);
+
+    s64 end_ns = pack_stats_now();
+    s64 duration = end_ns - start_ns;
+    pack_stats_histogram *h = stats->latency + (s32)op;
+
+    h->count.fetch_add(1, std::memory_order_relaxed);
+    h->total_ns.fetch_add(duration, std::memory_order_relaxed);
+    h->buckets[_bucket(duration)].fetch_add(1, std::memory_order_relaxed);
+
+    s64 max = h->max_ns.load(std::memory_order_relaxed);
+
+    while (duration > max && !h->max_ns.compare_exchange_weak(max, duration, std::memory_order_relaxed))
+        ;
+
+    // seq_cst with the store of tracing in _stop_recording: either this
+    // thread sees tracing off or the stopping thread waits for it.
+    stats->recorders.fetch_add(1, std::memory_order_seq_cst);
+
+    if (stats->tracing.load(std::memory_order_seq_cst))
+    {
+        // once full, event_count keeps counting the dropped events
+        s64 i = stats->event_count.fetch_add(1, std::memory_order_relaxed);
+
+        if (i < stats->event_capacity)
+        {
+            pack_trace_event *event = stats->events + i;
+            event->op = op;
+            event->thread = _thread_id();
+            event->entry = entry;
+            event->start_ns = start_ns - stats->trace_start_ns;
+            event->duration_ns = duration;
+        }
+    }
+
+    stats->recorders.fetch_sub(1, std::memory_order_release);
+}
+
+void pack_stats_add_io(pack_stats *stats, s64 bytes_read, s64 io_calls)
+{
+    assert(stats != nullptr);
+
+    stats->bytes_read.fetch_add(bytes_read, std::memory_order_relaxed);
+    stats->io_calls.fetch_add(io_calls, std::memory_order_relaxed);
+}
+
+void pack_stats_reset(pack_stats *stats)
+{
+    assert(stats != nullptr);
+
+    for (s32 op = 0; op < PACK_STAT_OP_COUNT; ++op)
+    {
+        pack_stats_histogram *h = stats->latency + op;
+        h->count = 0;
+        h->total_ns = 0;
+        h->max_ns = 0;
+
+        for (s32 b = 0; b < PACK_STAT_BUCKET_COUNT; ++b)
+            h->buckets[b] = 0;
+    }
+
+    stats->bytes_read = 0;
+    stats->io_calls = 0;
+}
+
+void pack_stats_get(const pack_stats *stats, pack_loader_stats *out)
+{
+    assert(stats != nullptr);
+    assert(out != nullptr);
+
+    for (s32 op = 0; op < PACK_STAT_OP_COUNT; ++op)
+    {
+        const pack_stats_histogram *h = stats->latency + op;
+        pack_latency_histogram *o = out->latency + op;
+        o->count = h->count.load(std::memory_order_relaxed);
+        o->total_ns = h->total_ns.load(std::memory_order_relaxed);
+        o->max_ns = h->max_ns.load(std::memory_order_relaxed);
+
+        for (s32 b = 0; b < PACK_STAT_BUCKET_COUNT; ++b)
+            o->buckets[b] = h->buckets[b].load(std::memory_order_relaxed);
+    }
+
+    out->bytes_read = stats->bytes_read.load(std::memory_order_relaxed);
+    out->io_calls = stats->io_calls.load(std::memory_order_relaxed);
+
+    s64 events = stats->event_count.load(std::memory_order_relaxed);
+    out->trace_events = events < stats->event_capacity ? events : stats->event_capacity;
+    out->dropped_trace_events = events - out->trace_events;
+}
+
+// turns tracing off and waits until no thread is writing an event
+static void _stop_recording(pack_stats *stats)
+{
+    stats->tracing.store(false, std::memory_order_seq_cst);
+
+    while (stats->recorders.load(std::memory_order_seq_cst) != 0)
+        std::this_thread::yield();
+}
+
+void pack_stats_start_events(pack_stats *stats, s64 max_events)
+{
+    assert(stats != nullptr);
+    assert(max_events > 0);
+
+    _stop_recording(stats);
+
+    if (stats->event_capacity != max_events)
+    {
+        if (stats->events != nullptr)
+            dealloc(stats->events, sizeof(pack_trace_event) * stats->event_capacity);
+
+        stats->events = (pack_trace_event*)alloc(sizeof(pack_trace_event) * max_events);
+        stats->event_capacity = max_events;
+    }
+
+    stats->event_count.store(0, std::memory_order_relaxed);
+    stats->trace_start_ns = pack_stats_now();
+    stats->tracing.store(true, std::memory_order_release);
+}
+
+void pack_stats_stop_events(pack_stats *stats)
+{
+    assert(stats != nullptr);
+
+    _stop_recording(stats);
+}
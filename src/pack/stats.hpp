@@ -0,0 +1,130 @@
+#pragma once
+
+/* stats.hpp
+
+Opt-in instrumentation of pack_loader and pack_reader: latency histograms of
+opening packages, parsing, loading entries and looking up names, bytes read,
+I/O calls, and a trace of individual calls that can be written as Chrome
+trace / Perfetto JSON (see pack_loader_write_event_trace).
+
+Instrumentation is compiled in when PACK_STATS is defined to 1 (the PACK_STATS
+CMake option). Otherwise the PACK_STATS_* macros expand to nothing and
+pack_loader_get_stats returns zeroes with enabled = false. The layout of
+pack_loader and pack_reader is the same either way.
+ */
+
+#include <atomic>
+
+#include "shl/number_types.hpp"
+
+#ifndef PACK_STATS
+#define PACK_STATS 0
+#endif
+
+enum class pack_stat_op : s32
+{
+    Open,      // pack_loader_load_package_file / pack_loader_load_files
+    Parse,     // pack_reader_parse
+    LoadEntry, // pack_loader_load_entry / pack_loader_acquire_entry
+    Lookup     // pack_reader_get_entry_index_by_name
+};
+
+#define PACK_STAT_OP_COUNT 4
+
+// bucket b counts calls that took [2^b, 2^(b+1)) nanoseconds, the last bucket
+// everything longer.
+#define PACK_STAT_BUCKET_COUNT 40
+
+const char *pack_stat_op_name(pack_stat_op op);
+
+struct pack_latency_histogram
+{
+    s64 count;
+    s64 total_ns;
+    s64 max_ns;
+    s64 buckets[PACK_STAT_BUCKET_COUNT];
+};
+
+// a snapshot of the statistics of a loader, see pack_loader_get_stats
+struct pack_loader_stats
+{
+    bool enabled; // false if compiled without PACK_STATS
+    pack_latency_histogram latency[PACK_STAT_OP_COUNT];
+    s64 bytes_read;  // bytes read with read calls, pages of mapped packages are not counted
+    // open, stat, read, mmap and close calls, counted where they are made
+    // (also by pack_async_loader). shl helpers reading a whole file count once.
+    s64 io_calls;
+    s64 cache_hits;  // files mode, see pack_loader_get_cache_stats
+    s64 cache_misses;
+    s64 trace_events;         // events recorded since the event trace was started
+    s64 dropped_trace_events; // events that did not fit
+};
+
+// used internally
+struct pack_stats_histogram
+{
+    std::atomic<s64> count;
+    std::atomic<s64> total_ns;
+    std::atomic<s64> max_ns;
+    std::atomic<s64> buckets[PACK_STAT_BUCKET_COUNT];
+};
+
+// used internally, a single instrumented call
+struct pack_trace_event
+{
+    pack_stat_op op;
+    s32 thread;
+    s64 entry; // -1 if the call was not about an entry
+    s64 start_ns;
+    s64 duration_ns;
+};
+
+// used internally, owned by a pack_loader and shared with its reader
+struct pack_stats
+{
+    pack_stats_histogram latency[PACK_STAT_OP_COUNT];
+    std::atomic<s64> bytes_read;
+    std::atomic<s64> io_calls;
+
+    // events are appended lock-free until the buffer is full. recorders counts
+    // the threads recording an event, the buffer is only replaced (or read)
+    // when tracing is off and it is zero.
+    std::atomic<bool> tracing;
+    std::atomic<s32> recorders;
+    s64 trace_start_ns;
+    pack_trace_event *events;
+    s64 event_capacity;
+    std::atomic<s64> event_count;
+};
+
+void init(pack_stats *stats);
+void free(pack_stats *stats);
+
+// nanoseconds, steady clock
+s64 pack_stats_now();
+// records a call of op that started at start_ns and ends now
+void pack_stats_record(pack_stats *stats, pack_stat_op op, s64 entry, s64 start_ns);
+void pack_stats_add_io(pack_stats *stats, s64 bytes_read, s64 io_calls);
+// clears the counters, keeps the event trace
+void pack_stats_reset(pack_stats *stats);
+void pack_stats_get(const pack_stats *stats, pack_loader_stats *out);
+
+// starts recording events, previously recorded events are discarded. may be
+// called while calls are being recorded, waits for the events being written.
+void pack_stats_start_events(pack_stats *stats, s64 max_events);
+// stops recording events and waits for the events being written
+void pack_stats_stop_events(pack_stats *stats);
+
+#if PACK_STATS
+// stats may be nullptr, the call is recorded when the enclosing scope ends
+#define PACK_STATS_SCOPE(Stats, Op, Entry)\
+    pack_stats *_pack_stats_ptr = (Stats);\
+    s64 _pack_stats_start = _pack_stats_ptr != nullptr ? pack_stats_now() : 0;\
+    defer { if (_pack_stats_ptr != nullptr) pack_stats_record(_pack_stats_ptr, (Op), (Entry), _pack_stats_start); }
+
+#define PACK_STATS_IO(Stats, BytesRead, IoCalls)\
+    { if ((Stats) != nullptr) pack_stats_add_io((Stats), (BytesRead), (IoCalls)); }
+#else
+#define PACK_STATS_SCOPE(Stats, Op, Entry)
+#define PACK_STATS_IO(Stats, BytesRead, IoCalls)
+#endif
@@ -1,13 +1,23 @@
 
+#include <thread>
+
+#if defined(__linux__)
+#include <sys/stat.h> // mkdir
+#include <unistd.h>   // unlink, rmdir
+#endif
+
 #include "t1/t1.hpp"
 #include "fs/path.hpp"
 #include "shl/error.hpp"
 #include "shl/print.hpp"
 #include "shl/string.hpp"
 #include "shl/defer.hpp"
+#include "shl/io.hpp"
 #include "pack/pack_writer.hpp"
 #include "pack/pack_reader.hpp"
 #include "pack/pack_loader.hpp"
+#include "pack/async_loader.hpp"
+#include "pack/pack_mount.hpp"
 
 #include "testpack.h"
 
@@ -129,6 +139,14 @@ define_test(pack_writer_writes_files)
     assert_equal(pack_writer_write_to_file(&writer, out_file, &err), true);
     assert_equal(err.error_code, 0);
 
+    // lazy files are copied without being read into memory
+    s64 copied = 0;
+
+    for (int m = 0; m < PACK_COPY_METHOD_COUNT; ++m)
+        copied += writer.copied_bytes[m];
+
+    assert_equal(copied, (s64)writer.entries[0].file.size);
+
     pack_reader reader{};
     defer { free(&reader); };
 
@@ -153,6 +171,520 @@ define_test(pack_writer_writes_files)
 #endif
 }
 
+define_test(pack_writer_writes_file_entries_of_known_size)
+{
+    error err{};
+    pack_writer sized{};
+    defer { free(&sized); };
+
+    assert_equal(pack_writer_add_file(&sized, test_file1, true, &err), true);
+    s64 size = (s64)sized.entries[0].file.size;
+
+    pack_writer writer{};
+    defer { free(&writer); };
+
+    pack_writer_add_file_entry(&writer, test_file1, "file", size);
+    assert_equal(pack_writer_write_to_file(&writer, out_file, &err), true);
+    assert_equal(err.error_code, 0);
+
+    pack_reader reader{};
+    defer { free(&reader); };
+
+    assert_equal(pack_reader_load_from_path(&reader, out_file, &err), true);
+
+    pack_reader_entry entry{};
+    pack_reader_get_entry(&reader, 0, &entry);
+
+    assert_equal(string_compare(entry.name, "file"_cs), 0);
+    assert_flag_set(entry.flags, PACK_TOC_FLAG_FILE);
+    assert_equal(entry.size, size);
+
+    // a size that doesn't match the file is an error when writing
+    pack_writer wrong{};
+    defer { free(&wrong); };
+
+    pack_writer_add_file_entry(&wrong, test_file1, "file", size + 1);
+    assert_equal(pack_writer_write_to_file(&wrong, out_file, &err), false);
+    assert_not_equal(err.error_code, 0);
+}
+
+define_test(pack_reader_maps_package_file)
+{
+    error err{};
+    pack_writer writer{};
+    defer { free(&writer); };
+
+    const char *value = "mapped content";
+    const char *name = "mapped";
+
+    pack_writer_add_entry(&writer, value, name);
+
+    assert_equal(pack_writer_write_to_file(&writer, out_file, &err), true);
+    assert_equal(err.error_code, 0);
+
+    pack_reader reader{};
+    defer { free(&reader); };
+
+    assert_equal(pack_reader_map_from_path(&reader, out_file, &err), true);
+    assert_equal(err.error_code, 0);
+    assert_equal(reader.storage, pack_reader_storage::Mapped);
+
+    assert_equal(reader.toc->entry_count, 1);
+
+    pack_reader_entry entry{};
+    pack_reader_get_entry(&reader, 0, &entry);
+
+    assert_equal(string_compare(entry.name, name), 0);
+    assert_equal(entry.size, string_length(value));
+    assert_equal(string_compare(entry.content, value, string_length(value)), 0);
+}
+
+define_test(pack_reader_streams_package_file)
+{
+    error err{};
+    pack_writer writer{};
+    defer { free(&writer); };
+
+    char compressible[1024];
+
+    for (s64 i = 0; i < 1024; ++i)
+        compressible[i] = "abcd"[i % 4];
+
+    const char *value = "hello world";
+
+    pack_writer_add_entry(&writer, value, "hello");
+    writer.codec = PACK_CODEC_LZ4;
+    pack_writer_add_entry(&writer, compressible, 1024, "compressible");
+
+    assert_equal(pack_writer_write_to_file(&writer, out_file, &err), true);
+
+    pack_reader reader{};
+    defer { free(&reader); };
+
+    assert_equal(pack_reader_stream_from_path(&reader, out_file, &err), true);
+    assert_equal(err.error_code, 0);
+    assert_equal(reader.storage, pack_reader_storage::Streamed);
+    assert_equal(reader.toc->entry_count, 2);
+
+    // only the name table and everything after it is in memory
+    assert_equal(reader.content_offset, (s64)reader.header->names_offset);
+
+    pack_reader_entry entry{};
+    char out[1024];
+
+    assert_equal(pack_reader_get_entry_by_name(&reader, "hello", &entry), true);
+    assert_equal(entry.content, nullptr);
+    assert_equal(pack_reader_read_entry(&reader, &entry, out, 1024, &err), true);
+    assert_equal(string_compare(out, value, string_length(value)), 0);
+
+    // chunked reads
+    assert_equal(pack_reader_read_entry_range(&reader, &entry, 6, out, 3, &err), 3);
+    assert_equal(string_compare(out, "wor", 3), 0);
+    assert_equal(pack_reader_read_entry_range(&reader, &entry, 9, out, 100, &err), entry.size - 9);
+
+    assert_equal(pack_reader_get_entry_by_name(&reader, "compressible", &entry), true);
+    assert_flag_set(entry.flags, PACK_TOC_FLAG_COMPRESSED);
+    assert_equal(pack_reader_read_entry(&reader, &entry, out, 1024, &err), true);
+    assert_equal(string_compare(out, compressible, 1024), 0);
+}
+
+define_test(pack_reader_gets_entry_by_name)
+{
+    error err{};
+    pack_writer writer{};
+    defer { free(&writer); };
+
+    pack_writer_add_entry(&writer, "first", "a");
+    pack_writer_add_entry(&writer, "second", "ab");
+    pack_writer_add_entry(&writer, "third", "abc");
+    pack_writer_add_entry(&writer, "duplicate", "ab");
+
+    assert_equal(pack_writer_write_to_file(&writer, out_file, &err), true);
+    assert_equal(err.error_code, 0);
+
+    pack_reader reader{};
+    defer { free(&reader); };
+
+    assert_equal(pack_reader_load_from_path(&reader, out_file, &err), true);
+    assert_equal(err.error_code, 0);
+    assert_flag_set(reader.header->flags, PACK_FLAG_NAME_INDEX);
+
+    pack_reader_entry entry{};
+
+    assert_equal(pack_reader_get_entry_by_name(&reader, "ab", &entry), true);
+    assert_equal(string_compare(entry.content, "second", 6), 0);
+
+    assert_equal(pack_reader_get_entry_by_name(&reader, "abc", &entry), true);
+    assert_equal(string_compare(entry.content, "third", 5), 0);
+
+    assert_equal(pack_reader_get_entry_by_name(&reader, "abcd", &entry), false);
+    assert_equal(pack_reader_get_entry_by_name(&reader, "", &entry), false);
+}
+
+define_test(pack_reader_gets_entry_by_name_without_name_index)
+{
+    error err{};
+    pack_reader reader{};
+    defer { free(&reader); };
+
+    // testpack.pack was written before packages had a name index
+    assert_equal(pack_reader_load_from_path(&reader, testpack_pack, &err), true);
+    assert_equal(err.error_code, 0);
+    assert_equal(reader.header->flags & PACK_FLAG_NAME_INDEX, 0u);
+
+    pack_reader_entry entry{};
+
+    assert_equal(pack_reader_get_entry_by_name(&reader, "test_file.txt", &entry), true);
+    assert_equal(entry.size, 21);
+    assert_equal(pack_reader_get_entry_by_name(&reader, "test_file", &entry), false);
+}
+
+define_test(pack_reader_reads_package_versions)
+{
+    error err{};
+
+    char compressible[1024];
+
+    for (s64 i = 0; i < 1024; ++i)
+        compressible[i] = "abcd"[i % 4];
+
+    u32 versions[] = {PACK_VERSION_1, PACK_VERSION_2};
+
+    for (u32 version : versions)
+    {
+        {
+            pack_writer writer{};
+            defer { free(&writer); };
+
+            writer.version = version;
+            pack_writer_add_entry(&writer, "first", "a");
+            pack_writer_add_entry(&writer, "second", "ab");
+            pack_writer_add_entry(&writer, "", "empty");
+            writer.codec = PACK_CODEC_LZ4;
+            pack_writer_add_entry(&writer, compressible, 1024, "compressible");
+
+            assert_equal(pack_writer_write_to_file(&writer, out_file, &err), true);
+            assert_equal(err.error_code, 0);
+        }
+
+        // appending keeps the version of the package
+        {
+            pack_writer writer{};
+            init(&writer);
+            defer { free(&writer); };
+
+            pack_writer_add_entry(&writer, "appended", "appended");
+            assert_equal(pack_writer_append_to_file(&writer, out_file, &err), true);
+            assert_equal(err.error_code, 0);
+        }
+
+        pack_reader reader{};
+        defer { free(&reader); };
+
+        for (s32 mode = 0; mode < 2; ++mode)
+        {
+            free(&reader);
+
+            if (mode == 0)
+                assert_equal(pack_reader_map_from_path(&reader, out_file, &err), true);
+            else
+                assert_equal(pack_reader_stream_from_path(&reader, out_file, &err), true);
+
+            assert_equal(reader.version, version);
+            assert_equal(reader.header->version, version);
+            assert_equal(reader.toc->entry_count, 5);
+            assert_equal(reader.toc_hashes != nullptr, version == PACK_VERSION_2);
+            assert_equal(pack_reader_get_entry_index_by_name(&reader, "appended"), 4);
+
+            pack_reader_entry entry{};
+            char out[1024];
+
+            pack_reader_get_entry(&reader, 1, &entry);
+            assert_equal(string_compare(entry.name, "ab"), 0);
+            assert_equal(entry.size, 6);
+
+            assert_equal(pack_reader_get_entry_index_by_name(&reader, "a"), 0);
+            assert_equal(pack_reader_get_entry_index_by_name(&reader, "empty"), 2);
+            assert_equal(pack_reader_get_entry_index_by_name(&reader, "abc"), -1);
+
+            assert_equal(pack_reader_get_entry_by_name(&reader, "empty", &entry), true);
+            assert_equal(entry.size, 0);
+
+            assert_equal(pack_reader_get_entry_by_name(&reader, "compressible", &entry), true);
+            assert_flag_set(entry.flags, PACK_TOC_FLAG_COMPRESSED);
+            assert_equal(pack_reader_read_entry(&reader, &entry, out, 1024, &err), true);
+            assert_equal(string_compare(out, compressible, 1024), 0);
+        }
+    }
+
+    // unknown versions are rejected
+    {
+        u32 version = 3;
+        io_handle h = io_open(out_file, open_mode::Write);
+        assert_equal(pack_write_at(h, &version, sizeof(version), 4) >= 0, true);
+        io_close(h);
+
+        pack_reader reader{};
+        defer { free(&reader); };
+
+        assert_equal(pack_reader_load_from_path(&reader, out_file, &err), false);
+        assert_equal(err.error_code, 20);
+        err.error_code = 0;
+    }
+}
+
+define_test(pack_writer_compresses_entries)
+{
+    error err{};
+    pack_writer writer{};
+    defer { free(&writer); };
+
+    char compressible[1024];
+
+    for (s64 i = 0; i < 1024; ++i)
+        compressible[i] = "abcd"[i % 4];
+
+    u32 value = 8;
+
+    writer.codec = PACK_CODEC_LZ4;
+    pack_writer_add_entry(&writer, compressible, 1024, "compressible");
+    pack_writer_add_entry(&writer, &value, "incompressible");
+
+    assert_equal(pack_writer_write_to_file(&writer, out_file, &err), true);
+    assert_equal(err.error_code, 0);
+
+    pack_reader reader{};
+    defer { free(&reader); };
+
+    assert_equal(pack_reader_load_from_path(&reader, out_file, &err), true);
+    assert_equal(err.error_code, 0);
+    assert_flag_set(reader.header->flags, PACK_FLAG_ENTRY_INFO);
+
+    pack_reader_entry entry{};
+    char out[1024];
+
+    pack_reader_get_entry(&reader, 0, &entry);
+    assert_flag_set(entry.flags, PACK_TOC_FLAG_COMPRESSED);
+    assert_equal(entry.codec, (u32)PACK_CODEC_LZ4);
+    assert_equal(entry.uncompressed_size, 1024);
+    assert_equal(entry.size < 1024, true);
+    assert_equal(pack_reader_read_entry(&entry, out, 1024, &err), true);
+    assert_equal(string_compare(out, compressible, 1024), 0);
+
+    // stays uncompressed because it doesn't get smaller
+    pack_reader_get_entry(&reader, 1, &entry);
+    assert_equal(entry.flags & PACK_TOC_FLAG_COMPRESSED, 0u);
+    assert_equal(entry.codec, (u32)PACK_CODEC_NONE);
+    assert_equal(entry.size, (s64)sizeof(value));
+    assert_equal(*(u32*)(entry.content), value);
+
+    pack_loader loader{};
+    defer { free(&loader); };
+
+    assert_equal(pack_loader_load_package_file(&loader, out_file, &err), true);
+
+    pack_entry lentry{};
+    assert_equal(pack_loader_load_entry(&loader, 0, &lentry, &err), true);
+    assert_equal(err.error_code, 0);
+    assert_equal(lentry.size, 1024);
+    assert_equal(string_compare(lentry.data, compressible, 1024), 0);
+}
+
+define_test(pack_writer_deduplicates_entries)
+{
+    error err{};
+    pack_writer writer{};
+    defer { free(&writer); };
+
+    char compressible[1024];
+
+    for (s64 i = 0; i < 1024; ++i)
+        compressible[i] = "abcd"[i % 4];
+
+    char different[1024];
+    copy_memory(compressible, different, 1024);
+    different[1000] = 'x';
+
+    writer.dedup = true;
+    writer.codec = PACK_CODEC_LZ4;
+    pack_writer_add_entry(&writer, compressible, 1024, "first");
+    writer.codec = PACK_CODEC_NONE;
+    pack_writer_add_entry(&writer, different, 1024, "different");
+    pack_writer_add_entry(&writer, compressible, 1024, "copy");
+    assert_equal(pack_writer_add_file(&writer, test_file1, "file", true, &err), true);
+    assert_equal(pack_writer_add_file(&writer, test_file1, "file copy", true, &err), true);
+
+    assert_equal(pack_writer_write_to_file(&writer, out_file, &err), true);
+    assert_equal(err.error_code, 0);
+    assert_equal(writer.dedup_entries, 2);
+
+    pack_reader reader{};
+    defer { free(&reader); };
+
+    assert_equal(pack_reader_load_from_path(&reader, out_file, &err), true);
+
+    pack_reader_entry first{};
+    pack_reader_entry entry{};
+    char out[1024];
+
+    pack_reader_get_entry(&reader, 0, &first);
+    s64 saved = first.size;
+    pack_reader_get_entry(&reader, 1, &entry);
+    assert_not_equal(entry.offset, first.offset);
+
+    // the copy shares the compressed contents of the first entry
+    pack_reader_get_entry(&reader, 2, &entry);
+    assert_equal(entry.offset, first.offset);
+    assert_flag_set(entry.flags, PACK_TOC_FLAG_COMPRESSED);
+    assert_equal(entry.codec, (u32)PACK_CODEC_LZ4);
+    assert_equal(pack_reader_read_entry(&entry, out, 1024, &err), true);
+    assert_equal(string_compare(out, compressible, 1024), 0);
+
+    pack_reader_get_entry(&reader, 3, &first);
+    pack_reader_get_entry(&reader, 4, &entry);
+    assert_equal(entry.offset, first.offset);
+    assert_equal(entry.size, first.size);
+    assert_flag_set(entry.flags, PACK_TOC_FLAG_FILE);
+    assert_equal(writer.dedup_saved_bytes, saved + first.size);
+}
+
+define_test(pack_writer_appends_to_package)
+{
+    error err{};
+
+    {
+        pack_writer writer{};
+        defer { free(&writer); };
+
+        pack_writer_add_entry(&writer, "first entry", "one");
+        pack_writer_add_entry(&writer, "second entry", "two");
+        assert_equal(pack_writer_write_to_file(&writer, out_file, &err), true);
+    }
+
+    pack_reader old{};
+    defer { free(&old); };
+    assert_equal(pack_reader_load_from_path(&old, out_file, &err), true);
+
+    pack_reader_entry old_entry{};
+    pack_reader_get_entry(&old, 0, &old_entry);
+    s64 old_size = pack_reader_get_package_size(&old);
+
+    {
+        pack_writer writer{};
+        defer { free(&writer); };
+
+        pack_writer_add_entry(&writer, "third entry", "three");
+        pack_writer_add_entry(&writer, "replaced second entry", "two");
+        assert_equal(pack_writer_append_to_file(&writer, out_file, &err), true);
+        assert_equal(err.error_code, 0);
+    }
+
+    pack_reader reader{};
+    defer { free(&reader); };
+    assert_equal(pack_reader_load_from_path(&reader, out_file, &err), true);
+    assert_equal(reader.toc->entry_count, 3);
+
+    // existing entries keep their number and content
+    pack_reader_entry entry{};
+    pack_reader_get_entry(&reader, 0, &entry);
+    assert_equal(entry.offset, old_entry.offset);
+    assert_equal(string_compare(entry.name, "one"), 0);
+
+    pack_reader_get_entry(&reader, 1, &entry);
+    assert_equal(string_compare(entry.name, "two"), 0);
+    assert_equal(string_compare(entry.content, "replaced second entry", entry.size), 0);
+    assert_equal(entry.offset >= old_size, true);
+
+    pack_reader_get_entry(&reader, 2, &entry);
+    assert_equal(string_compare(entry.name, "three"), 0);
+
+    // the old entry and tables are unused
+    s64 size = pack_reader_get_package_size(&reader);
+    assert_equal(pack_reader_get_used_size(&reader) < size, true);
+
+    fs::path compacted_file{};
+    defer { fs::free(&compacted_file); };
+    fs::path_set(&compacted_file, out_path);
+    fs::path_append(&compacted_file, "compacted.pack");
+
+    {
+        pack_writer writer{};
+        defer { free(&writer); };
+
+        pack_writer_add_package_entries(&writer, &reader);
+        assert_equal(pack_writer_write_to_file(&writer, compacted_file.c_str(), &err), true);
+    }
+
+    pack_reader compacted{};
+    defer { free(&compacted); };
+    assert_equal(pack_reader_load_from_path(&compacted, compacted_file.c_str(), &err), true);
+    assert_equal(compacted.toc->entry_count, 3);
+    assert_equal(pack_reader_get_package_size(&compacted) < size, true);
+
+    pack_reader_get_entry(&compacted, 1, &entry);
+    assert_equal(string_compare(entry.content, "replaced second entry", entry.size), 0);
+}
+
+define_test(pack_writer_writes_entries_in_parallel)
+{
+    error err{};
+    pack_writer writer{};
+    defer { free(&writer); };
+
+    writer.thread_count = 4;
+
+    s64 values[64];
+    char compressible[64][256];
+
+    for (s64 i = 0; i < 64; ++i)
+    {
+        values[i] = i;
+
+        for (s64 j = 0; j < 256; ++j)
+            compressible[i][j] = (char)('a' + (i + j / 16) % 26);
+    }
+
+    // uncompressed entries first so their offsets are known before writing
+    for (s64 i = 0; i < 64; ++i)
+        pack_writer_add_entry(&writer, values + i);
+
+    writer.codec = PACK_CODEC_LZ4;
+
+    for (s64 i = 0; i < 64; ++i)
+    {
+        pack_writer_add_entry(&writer, compressible[i], 256);
+        pack_writer_add_entry(&writer, values + i);
+    }
+
+    assert_equal(pack_writer_write_to_file(&writer, out_file, &err), true);
+    assert_equal(err.error_code, 0);
+
+    pack_reader reader{};
+    defer { free(&reader); };
+
+    assert_equal(pack_reader_load_from_path(&reader, out_file, &err), true);
+    assert_equal(err.error_code, 0);
+    assert_equal(reader.toc->entry_count, 64 * 3);
+
+    pack_reader_entry entry{};
+    char out[256];
+
+    for (s64 i = 0; i < 64; ++i)
+    {
+        pack_reader_get_entry(&reader, i, &entry);
+        assert_equal(*(s64*)(entry.content), i);
+
+        pack_reader_get_entry(&reader, 64 + i * 2, &entry);
+        assert_flag_set(entry.flags, PACK_TOC_FLAG_COMPRESSED);
+        assert_equal(pack_reader_read_entry(&entry, out, 256, &err), true);
+        assert_equal(string_compare(out, compressible[i], 256), 0);
+
+        pack_reader_get_entry(&reader, 64 + i * 2 + 1, &entry);
+        assert_equal(entry.size, (s64)sizeof(s64));
+        assert_equal(*(s64*)(entry.content), i);
+    }
+}
+
 define_test(pack_loader_loads_package_file)
 {
     error err{};
@@ -223,6 +755,1050 @@ define_test(pack_loader_loads_files)
 #endif
 }
 
+define_test(pack_loader_acquires_entries_from_multiple_threads)
+{
+    error err{};
+    pack_writer writer{};
+    defer { free(&writer); };
+
+    char compressible[1024];
+
+    for (s64 i = 0; i < 1024; ++i)
+        compressible[i] = "abcd"[i % 4];
+
+    writer.codec = PACK_CODEC_LZ4;
+    pack_writer_add_entry(&writer, compressible, 1024, "compressible");
+    assert_equal(pack_writer_write_to_file(&writer, out_file, &err), true);
+
+    pack_loader loader{};
+    defer { free(&loader); };
+
+    // package mode
+    assert_equal(pack_loader_load_package_file(&loader, out_file, &err), true);
+
+    std::atomic<s64> failures = 0;
+    std::thread threads[8];
+
+    for (std::thread &t : threads)
+        t = std::thread([&loader, &failures, &compressible]() {
+            pack_entry_handle handle{};
+
+            if (!pack_loader_acquire_entry(&loader, 0, &handle)
+             || handle.entry.size != 1024
+             || string_compare(handle.entry.data, compressible, 1024) != 0)
+                failures += 1;
+
+            pack_loader_release_entry(&handle);
+        });
+
+    for (std::thread &t : threads)
+        t.join();
+
+    assert_equal(failures.load(), 0);
+
+    // files mode
+    pack_loader_load_files(&loader, testpack_pack_files, testpack_pack_file_count);
+
+    for (std::thread &t : threads)
+        t = std::thread([&loader, &failures]() {
+            pack_entry_handle handle{};
+
+            if (!pack_loader_acquire_entry(&loader, testpack_pack__test_file_txt, &handle)
+             || string_compare(handle.entry.data, "This is a test file.", 20) != 0)
+                failures += 1;
+
+            pack_loader_release_entry(&handle);
+        });
+
+    for (std::thread &t : threads)
+        t.join();
+
+    assert_equal(failures.load(), 0);
+
+    // handles keep their entry alive after the loader releases it
+    pack_entry_handle handle{};
+    assert_equal(pack_loader_acquire_entry(&loader, testpack_pack__test_file_txt, &handle, &err), true);
+    pack_loader_clear_loaded_file_entries(&loader);
+    assert_equal(string_compare(handle.entry.data, "This is a test file.", 20), 0);
+    pack_loader_release_entry(&handle);
+}
+
+static void _check_async_loads(pack_loader *loader, pack_async_backend backend, const char *compressible, s64 *failures)
+{
+    pack_async_loader async{};
+
+    if (!init(&async, loader, backend))
+    {
+        // io_uring may not be available
+        *failures += (backend != pack_async_backend::IoUring);
+        return;
+    }
+
+    defer { free(&async); };
+
+    s64 count = pack_loader_entry_count(loader);
+    s64 entries[64];
+
+    for (s64 i = 0; i < count; ++i)
+        entries[i] = i;
+
+    if (!pack_async_loader_submit(&async, entries, count))
+        *failures += 1;
+
+    pack_load_result results[64];
+    s64 done = 0;
+
+    while (pack_async_loader_pending(&async) > 0)
+        done += pack_async_loader_wait(&async, results + done, 64 - done);
+
+    if (done != count)
+        *failures += 1;
+
+    for (s64 i = 0; i < done; ++i)
+    {
+        pack_load_result *result = results + i;
+
+        if (result->err.error_code != 0 || result->handle.entry.data[result->handle.entry.size] != '\0')
+            *failures += 1;
+        else if (loader->mode == pack_loader_mode::Package
+              && (result->handle.entry.size != 1024 || string_compare(result->handle.entry.data, compressible + result->entry, 1024 - result->entry) != 0))
+            *failures += 1;
+        else if (loader->mode == pack_loader_mode::Files
+              && string_compare(result->handle.entry.data, "This is a test file.", 20) != 0)
+            *failures += 1;
+
+        pack_loader_release_entry(&result->handle);
+    }
+
+    // callbacks are called when polling
+    s64 callback_count = 0;
+
+    if (!pack_async_loader_submit(&async, entries, 1, [](pack_load_result *result, void *userdata) {
+            *(s64*)userdata += 1;
+            pack_loader_release_entry(&result->handle);
+        }, &callback_count))
+        *failures += 1;
+
+    while (pack_async_loader_pending(&async) > 0)
+        pack_async_loader_wait(&async, nullptr, 0);
+
+    if (callback_count != 1)
+        *failures += 1;
+}
+
+define_test(async_loader_loads_entries)
+{
+    error err{};
+    pack_writer writer{};
+    defer { free(&writer); };
+
+    char compressible[1024 + 16];
+
+    for (s64 i = 0; i < 1024 + 16; ++i)
+        compressible[i] = "abcd"[i % 4];
+
+    // every 4th entry starts with the same data, half of them are compressed
+    for (s64 i = 0; i < 16; ++i)
+    {
+        writer.codec = (i % 2 == 0) ? PACK_CODEC_LZ4 : PACK_CODEC_NONE;
+        pack_writer_add_entry(&writer, compressible + i, 1024);
+    }
+
+    assert_equal(pack_writer_write_to_file(&writer, out_file, &err), true);
+
+    pack_loader loader{};
+    defer { free(&loader); };
+
+    assert_equal(pack_loader_load_package_file(&loader, out_file, &err), true);
+
+    s64 failures = 0;
+    _check_async_loads(&loader, pack_async_backend::ThreadPool, compressible, &failures);
+    assert_equal(failures, 0);
+    _check_async_loads(&loader, pack_async_backend::IoUring, compressible, &failures);
+    assert_equal(failures, 0);
+
+    pack_loader_load_files(&loader, testpack_pack_files, testpack_pack_file_count);
+
+    _check_async_loads(&loader, pack_async_backend::ThreadPool, compressible, &failures);
+    assert_equal(failures, 0);
+    _check_async_loads(&loader, pack_async_backend::IoUring, compressible, &failures);
+    assert_equal(failures, 0);
+}
+
+static void _write_test_file(const char *path, const char *content)
+{
+    io_handle h = io_open(path, open_mode::WriteTrunc);
+    io_write(h, content, string_length(content));
+    io_close(h);
+}
+
+define_test(pack_writer_reuses_unchanged_entries)
+{
+    error err{};
+
+    fs::path same_file{};
+    fs::path changed_file{};
+    fs::path previous_file{};
+    defer { fs::free(&same_file); fs::free(&changed_file); fs::free(&previous_file); };
+
+    fs::path_set(&same_file, out_path);
+    fs::path_append(&same_file, "repack_same.txt");
+    fs::path_set(&changed_file, out_path);
+    fs::path_append(&changed_file, "repack_changed.txt");
+    fs::path_set(&previous_file, out_path);
+    fs::path_append(&previous_file, "previous.pack");
+
+    _write_test_file(same_file.c_str(), "stays the same");
+    _write_test_file(changed_file.c_str(), "old contents");
+
+    {
+        pack_writer writer{};
+        defer { free(&writer); };
+
+        writer.record_sources = true;
+        assert_equal(pack_writer_add_file(&writer, same_file.c_str(), "same", true, &err), true);
+        assert_equal(pack_writer_add_file(&writer, changed_file.c_str(), "changed", true, &err), true);
+        assert_equal(pack_writer_write_to_file(&writer, previous_file.c_str(), &err), true);
+        assert_equal(writer.reused_entries, 0);
+    }
+
+    _write_test_file(changed_file.c_str(), "new, longer contents");
+
+    pack_reader previous{};
+    defer { free(&previous); };
+
+    assert_equal(pack_reader_stream_from_path(&previous, previous_file.c_str(), &err), true);
+    assert_not_equal(previous.source_info, nullptr);
+
+    pack_writer writer{};
+    defer { free(&writer); };
+
+    writer.previous = &previous;
+    assert_equal(pack_writer_add_file(&writer, same_file.c_str(), "same", true, &err), true);
+    assert_equal(pack_writer_add_file(&writer, changed_file.c_str(), "changed", true, &err), true);
+    assert_equal(pack_writer_write_to_file(&writer, out_file, &err), true);
+    assert_equal(err.error_code, 0);
+
+    assert_equal(writer.reused_entries, 1);
+    assert_equal(writer.reused_bytes, 14);
+
+    pack_reader reader{};
+    defer { free(&reader); };
+
+    assert_equal(pack_reader_load_from_path(&reader, out_file, &err), true);
+    assert_not_equal(reader.source_info, nullptr);
+
+    pack_reader_entry entry{};
+    assert_equal(pack_reader_get_entry_by_name(&reader, "same", &entry), true);
+    assert_equal(string_compare(entry.content, "stays the same", 14), 0);
+    assert_equal(pack_reader_get_entry_by_name(&reader, "changed", &entry), true);
+    assert_equal(string_compare(entry.content, "new, longer contents", 20), 0);
+    assert_equal(reader.source_info[1].size, 20);
+}
+
+define_test(pack_loader_evicts_entries_over_budget)
+{
+    error err{};
+    const char *files[] = {"cache_a.txt", "cache_b.txt", "cache_c.txt"};
+
+    fs::path file_path{};
+    defer { fs::free(&file_path); };
+
+    for (const char *file : files)
+    {
+        fs::path_set(&file_path, out_path);
+        fs::path_append(&file_path, file);
+        _write_test_file(file_path.c_str(), "0123456789");
+    }
+
+    pack_loader loader{};
+    defer { free(&loader); };
+
+    pack_loader_load_files(&loader, files, 3, out_path.c_str());
+    pack_loader_set_cache_budget(&loader, 25);
+
+    pack_entry entry{};
+    pack_loader_cache_stats stats{};
+
+    assert_equal(pack_loader_load_entry(&loader, 0, &entry, &err), true);
+    assert_equal(pack_loader_load_entry(&loader, 1, &entry, &err), true);
+    assert_equal(pack_loader_load_entry(&loader, 1, &entry, &err), true);
+    pack_loader_get_cache_stats(&loader, &stats);
+    assert_equal(stats.hits, 1);
+    assert_equal(stats.misses, 2);
+    assert_equal(stats.evictions, 0);
+    assert_equal(stats.resident_bytes, 20);
+
+    // doesn't fit, the least recently used entry goes
+    assert_equal(pack_loader_load_entry(&loader, 2, &entry, &err), true);
+    pack_loader_get_cache_stats(&loader, &stats);
+    assert_equal(stats.evictions, 1);
+    assert_equal(stats.resident_bytes, 20);
+    assert_equal(loader.files.loaded_entries[0].data, nullptr);
+
+    // pinned entries stay
+    pack_loader_pin_entry(&loader, 1);
+    assert_equal(pack_loader_load_entry(&loader, 0, &entry, &err), true);
+    assert_equal(pack_loader_load_entry(&loader, 2, &entry, &err), true);
+    assert_equal(pack_loader_load_entry(&loader, 0, &entry, &err), true);
+    pack_loader_get_cache_stats(&loader, &stats);
+    assert_not_equal(loader.files.loaded_entries[1].data, nullptr);
+    assert_equal(stats.resident_bytes <= 25, true);
+
+    // acquired entries stay as well
+    pack_entry_handle handle{};
+    assert_equal(pack_loader_acquire_entry(&loader, 2, &handle, &err), true);
+    pack_loader_set_cache_budget(&loader, 1);
+    assert_not_equal(loader.files.loaded_entries[2].data, nullptr);
+    pack_loader_release_entry(&handle);
+
+    // nothing is pinned or acquired anymore
+    pack_loader_unpin_entry(&loader, 1);
+    pack_loader_get_cache_stats(&loader, &stats);
+    assert_equal(stats.resident_bytes, 0);
+}
+
+define_test(pack_loader_allocates_entries_from_arena)
+{
+    error err{};
+    const char *files[] = {"arena_a.txt", "arena_b.txt"};
+
+    fs::path file_path{};
+    defer { fs::free(&file_path); };
+
+    for (const char *file : files)
+    {
+        fs::path_set(&file_path, out_path);
+        fs::path_append(&file_path, file);
+        _write_test_file(file_path.c_str(), "arena entry");
+    }
+
+    pack_arena arena{};
+    init(&arena);
+    defer { free(&arena); };
+
+    // freed allocations are reused by allocations of the same size class
+    void *small = pack_arena_alloc(&arena, 100);
+    pack_arena_dealloc(&arena, small, 100);
+    assert_equal(pack_arena_alloc(&arena, 120), small);
+    pack_arena_dealloc(&arena, small, 120);
+    assert_equal(arena.allocated_bytes, 0);
+
+    void *medium = pack_arena_alloc(&arena, 100000);
+    s64 medium_reserved = arena.reserved_bytes;
+    pack_arena_dealloc(&arena, medium, 100000);
+    assert_equal(arena.allocated_bytes, 0);
+
+    for (s32 i = 0; i < 64; ++i)
+    {
+        void *p = pack_arena_alloc(&arena, 99000 + i);
+        assert_equal(p, medium);
+        pack_arena_dealloc(&arena, p, 99000 + i);
+    }
+
+    assert_equal(arena.reserved_bytes, medium_reserved);
+
+    pack_loader loader{};
+    defer { free(&loader); };
+
+    loader.allocator = pack_arena_allocator(&arena);
+    pack_loader_load_files(&loader, files, 2, out_path.c_str());
+
+    pack_entry entry{};
+    assert_equal(pack_loader_load_entry(&loader, 1, &entry, &err), true);
+    assert_equal(string_compare(entry.data, "arena entry"), 0);
+    assert_not_equal(arena.allocated_bytes, 0);
+
+    pack_loader_clear_loaded_file_entries(&loader);
+    assert_equal(arena.allocated_bytes, 0);
+    s64 reserved = arena.reserved_bytes;
+
+    // after a reset the blocks are reused
+    assert_equal(pack_loader_load_entry(&loader, 0, &entry, &err), true);
+    pack_loader_clear_loaded_file_entries(&loader);
+    pack_arena_reset(&arena);
+    assert_equal(arena.reserved_bytes, reserved);
+
+    // the allocator is kept when loading again
+    pack_loader_load_files(&loader, files, 2, out_path.c_str());
+    assert_equal(loader.allocator.userdata, (void*)&arena);
+}
+
+define_test(pack_writer_orders_entries_by_access_profile)
+{
+    error err{};
+    const char *names[] = {"a", "b", "c", "d"};
+
+    {
+        pack_writer writer{};
+        defer { free(&writer); };
+
+        for (const char *name : names)
+            pack_writer_add_entry(&writer, "profiled entry", name);
+
+        assert_equal(pack_writer_write_to_file(&writer, out_file, &err), true);
+    }
+
+    pack_access_profile profile{};
+    init(&profile);
+    defer { free(&profile); };
+
+    {
+        pack_loader loader{};
+        defer { free(&loader); };
+
+        assert_equal(pack_loader_load_package_file(&loader, out_file, &err), true);
+
+        pack_entry entry{};
+        pack_loader_start_trace(&loader);
+        assert_equal(pack_loader_load_entry(&loader, 2, &entry, &err), true);
+        assert_equal(pack_loader_load_entry(&loader, 0, &entry, &err), true);
+        assert_equal(pack_loader_load_entry(&loader, 2, &entry, &err), true);
+
+        // async loads are traced too
+        {
+            pack_async_loader async{};
+            assert_equal(init(&async, &loader, pack_async_backend::Default, 1, &err), true);
+            defer { free(&async); };
+
+            s64 async_entry = 1;
+            pack_load_result result{};
+            assert_equal(pack_async_loader_submit(&async, &async_entry, 1), true);
+
+            while (pack_async_loader_pending(&async) > 0)
+                pack_async_loader_wait(&async, &result, 1);
+
+            assert_equal(result.err.error_code, 0);
+            pack_loader_release_entry(&result.handle);
+        }
+
+        pack_loader_stop_trace(&loader);
+        assert_equal(pack_loader_load_entry(&loader, 3, &entry, &err), true);
+
+        fs::path profile_file{};
+        defer { fs::free(&profile_file); };
+        fs::path_set(&profile_file, out_path);
+        fs::path_append(&profile_file, "access.profile");
+
+        assert_equal(pack_loader_write_trace(&loader, profile_file.c_str(), &err), true);
+        assert_equal(pack_access_profile_read(&profile, profile_file.c_str(), &err), true);
+    }
+
+    assert_equal(profile.names.size, 3);
+    assert_equal(string_compare(profile.names[0].data, "c"), 0);
+    assert_equal(string_compare(profile.names[1].data, "a"), 0);
+    assert_equal(string_compare(profile.names[2].data, "b"), 0);
+    assert_equal(profile.times[0] <= profile.times[1], true);
+
+    {
+        pack_writer writer{};
+        defer { free(&writer); };
+
+        for (const char *name : names)
+            pack_writer_add_entry(&writer, name, name);
+
+        writer.order_profile = &profile;
+        assert_equal(pack_writer_write_to_file(&writer, out_file, &err), true);
+        assert_equal(writer.ordered_entries, 3);
+    }
+
+    pack_reader reader{};
+    defer { free(&reader); };
+    assert_equal(pack_reader_load_from_path(&reader, out_file, &err), true);
+
+    // entry numbers stay the same, contents are laid out c, a, b, d
+    pack_reader_entry entries[4]{};
+
+    for (s64 i = 0; i < 4; ++i)
+    {
+        pack_reader_get_entry(&reader, i, entries + i);
+        assert_equal(string_compare(entries[i].name, names[i]), 0);
+        assert_equal(string_compare(entries[i].content, names[i], entries[i].size), 0);
+    }
+
+    assert_equal(entries[2].offset < entries[0].offset, true);
+    assert_equal(entries[0].offset < entries[1].offset, true);
+    assert_equal(entries[1].offset < entries[3].offset, true);
+}
+
+define_test(pack_loader_prefetches_and_releases_entries)
+{
+    error err{};
+
+    {
+        pack_writer writer{};
+        defer { free(&writer); };
+
+        pack_writer_add_entry(&writer, "prefetched one", "one");
+        pack_writer_add_entry(&writer, "prefetched two", "two");
+        pack_writer_add_entry(&writer, "prefetched three", "three");
+        assert_equal(pack_writer_write_to_file(&writer, out_file, &err), true);
+    }
+
+    s64 entries[] = {2, 0, 1};
+
+    pack_loader loader{};
+    defer { free(&loader); };
+
+    assert_equal(pack_loader_load_package_file(&loader, out_file, &err), true);
+    assert_equal(pack_loader_prefetch(&loader, entries, 3, &err), true);
+
+    pack_entry entry{};
+    assert_equal(pack_loader_load_entry(&loader, 2, &entry, &err), true);
+    assert_equal(pack_loader_release(&loader, entries, 3, &err), true);
+
+    // released pages are read again
+    assert_equal(pack_loader_load_entry(&loader, 2, &entry, &err), true);
+    assert_equal(string_compare(entry.data, "prefetched three", entry.size), 0);
+
+    pack_reader streamed{};
+    defer { free(&streamed); };
+    assert_equal(pack_reader_stream_from_path(&streamed, out_file, &err), true);
+    assert_equal(pack_reader_advise_entries(&streamed, entries, 3, pack_advice::WillNeed, &err), true);
+
+    // files mode: released entries are dropped unless pinned
+    const char *files[] = {"prefetch_file.txt", "missing_file.txt"};
+    pack_loader_load_files(&loader, files, 2, out_path.c_str());
+
+    fs::path file_path{};
+    defer { fs::free(&file_path); };
+    fs::path_set(&file_path, out_path);
+    fs::path_append(&file_path, "prefetch_file.txt");
+    _write_test_file(file_path.c_str(), "released entry");
+
+    assert_equal(pack_loader_prefetch(&loader, entries + 2, 1, &err), true);
+    assert_equal(pack_loader_load_entry(&loader, 0, &entry, &err), true);
+
+    pack_loader_cache_stats stats{};
+    pack_loader_get_cache_stats(&loader, &stats);
+    assert_not_equal(stats.resident_bytes, 0);
+
+    pack_loader_pin_entry(&loader, 0);
+    assert_equal(pack_loader_release(&loader, entries + 2, 1, &err), true);
+    s64 zero = 0;
+    assert_equal(pack_loader_release(&loader, &zero, 1, &err), true);
+    pack_loader_get_cache_stats(&loader, &stats);
+    assert_not_equal(stats.resident_bytes, 0);
+
+    pack_loader_unpin_entry(&loader, 0);
+    assert_equal(pack_loader_release(&loader, &zero, 1, &err), true);
+    pack_loader_get_cache_stats(&loader, &stats);
+    assert_equal(stats.resident_bytes, 0);
+}
+
+define_test(pack_writer_aligns_entries)
+{
+    error err{};
+    const char *compressible = "aligned aligned aligned aligned aligned aligned aligned aligned";
+
+    {
+        pack_writer writer{};
+        defer { free(&writer); };
+
+        writer.alignment = PACK_DIRECT_IO_ALIGNMENT;
+        pack_writer_add_entry(&writer, "first aligned entry", "a");
+        writer.codec = PACK_CODEC_LZ4;
+        pack_writer_add_entry(&writer, compressible, "b");
+        writer.codec = PACK_CODEC_NONE;
+        pack_writer_add_entry(&writer, "third aligned entry", "c");
+        assert_equal(pack_writer_write_to_file(&writer, out_file, &err), true);
+    }
+
+    pack_reader reader{};
+    defer { free(&reader); };
+    assert_equal(pack_reader_map_from_path(&reader, out_file, &err), true);
+    assert_equal(pack_reader_get_alignment(&reader), PACK_DIRECT_IO_ALIGNMENT);
+
+    pack_reader_entry entry{};
+
+    for (s64 i = 0; i < 3; ++i)
+    {
+        pack_reader_get_entry(&reader, i, &entry);
+        assert_equal(entry.offset % PACK_DIRECT_IO_ALIGNMENT, 0);
+        assert_equal((u64)entry.content % PACK_DIRECT_IO_ALIGNMENT, 0ull);
+    }
+
+    // direct reads of aligned and unaligned entries
+    alignas(PACK_DIRECT_IO_ALIGNMENT) static char buffer[PACK_DIRECT_IO_ALIGNMENT * 2];
+
+    assert_equal(pack_reader_open_direct(&reader, out_file, &err), true);
+    pack_reader_get_entry(&reader, 2, &entry);
+    assert_equal(pack_reader_direct_buffer_size(&entry), (s64)PACK_DIRECT_IO_ALIGNMENT);
+    assert_equal(pack_reader_read_entry_direct(&reader, &entry, buffer, sizeof(buffer), &err), true);
+    assert_equal(string_compare(buffer, "third aligned entry", entry.size), 0);
+
+    {
+        pack_writer writer{};
+        defer { free(&writer); };
+
+        pack_writer_add_entry(&writer, "unaligned entry", "a");
+        writer.alignment = 64;
+        pack_writer_add_entry(&writer, "entry aligned to 64", "b");
+        assert_equal(pack_writer_write_to_file(&writer, out_file, &err), true);
+    }
+
+    free(&reader);
+    assert_equal(pack_reader_load_from_path(&reader, out_file, &err), true);
+    assert_equal(pack_reader_get_alignment(&reader), PACK_DEFAULT_ALIGNMENT);
+
+    pack_reader_get_entry(&reader, 1, &entry);
+    assert_equal(entry.offset % 64, 0);
+
+    assert_equal(pack_reader_open_direct(&reader, out_file, &err), true);
+    pack_reader_get_entry(&reader, 0, &entry);
+    assert_not_equal(entry.offset % PACK_DIRECT_IO_ALIGNMENT, 0);
+    assert_equal(pack_reader_read_entry_direct(&reader, &entry, buffer, sizeof(buffer), &err), true);
+    assert_equal(string_compare(buffer, "unaligned entry", entry.size), 0);
+}
+
+// loads entries 1 and 3 of the package of pack_reader_verifies_entry_checksums,
+// entry 3 is corrupted.
+static void _check_async_verification(pack_loader *loader, pack_async_backend backend, const char *compressible, s64 *failures)
+{
+    pack_async_loader async{};
+
+    if (!init(&async, loader, backend))
+    {
+        *failures += (backend != pack_async_backend::IoUring);
+        return;
+    }
+
+    defer { free(&async); };
+
+    s64 entries[2] = {1, 3};
+
+    if (!pack_async_loader_submit(&async, entries, 2))
+        *failures += 1;
+
+    pack_load_result results[2];
+    s64 done = 0;
+
+    while (pack_async_loader_pending(&async) > 0)
+        done += pack_async_loader_wait(&async, results + done, 2 - done);
+
+    if (done != 2)
+        *failures += 1;
+
+    for (s64 i = 0; i < done; ++i)
+    {
+        pack_load_result *result = results + i;
+
+        if (result->entry == 3)
+            *failures += (result->err.error_code != 2);
+        else if (result->err.error_code != 0 || string_compare(result->handle.entry.data, compressible) != 0)
+            *failures += 1;
+
+        pack_loader_release_entry(&result->handle);
+    }
+}
+
+define_test(pack_reader_verifies_entry_checksums)
+{
+    error err{};
+    const char *compressible = "checked checked checked checked checked checked checked checked";
+
+    {
+        pack_writer writer{};
+        defer { free(&writer); };
+
+        writer.checksums = true;
+        writer.dedup = true;
+        pack_writer_add_entry(&writer, "first checked entry", "a");
+        writer.codec = PACK_CODEC_LZ4;
+        pack_writer_add_entry(&writer, compressible, "b");
+        writer.codec = PACK_CODEC_NONE;
+        pack_writer_add_entry(&writer, "first checked entry", "c");
+        pack_writer_add_entry(&writer, "third checked entry", "d");
+        assert_equal(pack_writer_write_to_file(&writer, out_file, &err), true);
+    }
+
+    pack_reader reader{};
+    defer { free(&reader); };
+    assert_equal(pack_reader_stream_from_path(&reader, out_file, &err), true);
+    assert_not_equal(reader.checksums, (u64*)nullptr);
+    assert_equal(reader.checksums[0], reader.checksums[2]);
+    assert_equal(pack_reader_verify(&reader, 2, nullptr, &err), true);
+
+    // flip a byte of the last entry
+    pack_reader_entry entry{};
+    pack_reader_get_entry(&reader, 3, &entry);
+
+    io_handle h = io_open(out_file, open_mode::Write);
+    assert_equal(pack_write_at(h, "T", 1, entry.offset) >= 0, true);
+    io_close(h);
+
+    free(&reader);
+    assert_equal(pack_reader_stream_from_path(&reader, out_file, &err), true);
+
+    array<s64> corrupted{};
+    init(&corrupted);
+    defer { free(&corrupted); };
+
+    assert_equal(pack_reader_verify(&reader, 2, &corrupted, &err), false);
+    assert_equal(corrupted.size, 1);
+    assert_equal(corrupted[0], 3);
+
+    bool ok = false;
+    assert_equal(pack_reader_verify_entry(&reader, 1, &ok, &err), true);
+    assert_equal(ok, true);
+
+    // the loader only fails to load the corrupted entry
+    pack_loader loader{};
+    defer { free(&loader); };
+    loader.verify_checksums = true;
+    assert_equal(pack_loader_load_package_file(&loader, out_file, &err), true);
+
+    pack_entry loaded{};
+    assert_equal(pack_loader_load_entry(&loader, 1, &loaded, &err), true);
+    assert_equal(string_compare(loaded.data, compressible), 0);
+    assert_equal(pack_loader_load_entry(&loader, 3, &loaded, &err), false);
+
+    // so do async loads
+    s64 failures = 0;
+    _check_async_verification(&loader, pack_async_backend::ThreadPool, compressible, &failures);
+    assert_equal(failures, 0);
+    _check_async_verification(&loader, pack_async_backend::IoUring, compressible, &failures);
+    assert_equal(failures, 0);
+
+    // packages without checksums can't be verified
+    {
+        pack_writer writer{};
+        defer { free(&writer); };
+
+        pack_writer_add_entry(&writer, "unchecked entry", "a");
+        assert_equal(pack_writer_write_to_file(&writer, out_file, &err), true);
+    }
+
+    free(&reader);
+    assert_equal(pack_reader_stream_from_path(&reader, out_file, &err), true);
+    assert_equal(reader.checksums, (u64*)nullptr);
+    assert_equal(pack_reader_verify(&reader, 0, nullptr, &err), false);
+}
+
+define_test(pack_loader_records_stats)
+{
+    error err{};
+
+    {
+        pack_writer writer{};
+        defer { free(&writer); };
+
+        pack_writer_add_entry(&writer, "first stats entry", "a");
+        pack_writer_add_entry(&writer, "second stats entry", "b");
+        assert_equal(pack_writer_write_to_file(&writer, out_file, &err), true);
+    }
+
+    pack_loader loader{};
+    defer { free(&loader); };
+
+    pack_loader_start_event_trace(&loader, 2);
+    assert_equal(pack_loader_load_package_file(&loader, out_file, &err), true);
+
+    pack_entry entry{};
+    assert_equal(pack_loader_load_entry(&loader, 0, &entry, &err), true);
+    assert_equal(pack_loader_load_entry(&loader, 1, &entry, &err), true);
+    assert_equal(pack_reader_get_entry_index_by_name(&loader.reader, "b"), 1);
+    pack_loader_stop_event_trace(&loader);
+
+    pack_loader_stats stats{};
+    pack_loader_get_stats(&loader, &stats);
+
+    if (!stats.enabled)
+    {
+        // compiled without PACK_STATS
+        assert_equal(stats.latency[(s32)pack_stat_op::LoadEntry].count, 0);
+        assert_equal(pack_loader_write_event_trace(&loader, out_file, &err), false);
+        return;
+    }
+
+    assert_equal(stats.latency[(s32)pack_stat_op::Open].count, 1);
+    assert_equal(stats.latency[(s32)pack_stat_op::Parse].count, 1);
+    assert_equal(stats.latency[(s32)pack_stat_op::LoadEntry].count, 2);
+    assert_equal(stats.latency[(s32)pack_stat_op::Lookup].count, 1);
+    assert_equal(stats.io_calls > 0, true);
+
+    s64 bucketed = 0;
+
+    for (s32 b = 0; b < PACK_STAT_BUCKET_COUNT; ++b)
+        bucketed += stats.latency[(s32)pack_stat_op::LoadEntry].buckets[b];
+
+    assert_equal(bucketed, 2);
+
+    // open, parse, two loads and the lookup, only two fit
+    assert_equal(stats.trace_events, 2);
+    assert_equal(stats.dropped_trace_events, 3);
+
+    fs::path trace_file{};
+    defer { fs::free(&trace_file); };
+    fs::path_set(&trace_file, out_path);
+    fs::path_append(&trace_file, "events.json");
+    assert_equal(pack_loader_write_event_trace(&loader, trace_file.c_str(), &err), true);
+
+    // async loads read from their own handle of the package, one read per entry
+    {
+        pack_async_loader async{};
+        assert_equal(init(&async, &loader, pack_async_backend::ThreadPool, 1, &err), true);
+        defer { free(&async); };
+
+        s64 io_calls = stats.io_calls;
+        s64 bytes_read = stats.bytes_read;
+        s64 entries[2] = {0, 1};
+        assert_equal(pack_async_loader_submit(&async, entries, 2), true);
+
+        pack_load_result results[2];
+        s64 done = 0;
+
+        while (pack_async_loader_pending(&async) > 0)
+            done += pack_async_loader_wait(&async, results + done, 2 - done);
+
+        for (s64 i = 0; i < done; ++i)
+            pack_loader_release_entry(&results[i].handle);
+
+        pack_loader_get_stats(&loader, &stats);
+        assert_equal(stats.io_calls, io_calls + 2);
+        assert_equal(stats.bytes_read, bytes_read + (s64)string_length("first stats entry") + (s64)string_length("second stats entry"));
+    }
+
+    pack_loader_reset_stats(&loader);
+    pack_loader_get_stats(&loader, &stats);
+    assert_equal(stats.latency[(s32)pack_stat_op::LoadEntry].count, 0);
+}
+
+define_test(pack_mount_overlays_packages_and_files)
+{
+    error err{};
+
+    fs::path patch_file{};
+    defer { fs::free(&patch_file); };
+    fs::path_set(&patch_file, out_path);
+    fs::path_append(&patch_file, "patch.pack");
+
+    {
+        pack_writer writer{};
+        defer { free(&writer); };
+
+        pack_writer_add_entry(&writer, "base one", "one");
+        pack_writer_add_entry(&writer, "base two", "two");
+        assert_equal(pack_writer_write_to_file(&writer, out_file, &err), true);
+    }
+
+    {
+        pack_writer writer{};
+        defer { free(&writer); };
+
+        pack_writer_add_entry(&writer, "patch two", "two");
+        pack_writer_add_entry(&writer, "patch three", "three");
+        assert_equal(pack_writer_write_to_file(&writer, patch_file.c_str(), &err), true);
+    }
+
+    fs::path loose_file{};
+    defer { fs::free(&loose_file); };
+    fs::path_set(&loose_file, out_path);
+    fs::path_append(&loose_file, "mount_loose.txt");
+    _write_test_file(loose_file.c_str(), "loose three");
+
+    pack_mount_table table{};
+    init(&table);
+    defer { free(&table); };
+
+    s32 base = -1;
+    s32 patch = -1;
+    s32 loose = -1;
+    const char *loose_files[] = {"mount_loose.txt"};
+
+    // mounted in reverse priority order, priority decides
+    assert_equal(pack_mount_package(&table, patch_file.c_str(), 1, &patch, &err), true);
+    assert_equal(pack_mount_package(&table, out_file, 0, &base, &err), true);
+    assert_equal(pack_mount_files(&table, loose_files, 1, out_path.c_str(), 2, &loose, &err), true);
+    assert_equal(pack_mount_entry_count(&table), 4);
+
+    pack_entry entry{};
+    assert_equal(pack_mount_load_entry(&table, "one", &entry, &err), true);
+    assert_equal(string_compare(entry.data, "base one", entry.size), 0);
+
+    assert_equal(pack_mount_load_entry(&table, "two", &entry, &err), true);
+    assert_equal(string_compare(entry.data, "patch two", entry.size), 0);
+
+    s64 loose_entry = pack_mount_find_entry(&table, "mount_loose.txt");
+    assert_not_equal(loose_entry, -1);
+    assert_equal(pack_mount_entry_mount(&table, loose_entry), loose);
+    assert_equal(pack_mount_find_entry(&table, "four"), -1);
+
+    // unmounting uncovers the hidden entries
+    pack_unmount(&table, patch);
+    assert_equal(pack_mount_entry_count(&table), 3);
+    assert_equal(pack_mount_find_entry(&table, "three"), -1);
+    assert_equal(pack_mount_load_entry(&table, "two", &entry, &err), true);
+    assert_equal(string_compare(entry.data, "base two", entry.size), 0);
+
+    // equal priority: mounted last wins
+    assert_equal(pack_mount_package(&table, patch_file.c_str(), 0, &patch, &err), true);
+    assert_equal(pack_mount_load_entry(&table, "two", &entry, &err), true);
+    assert_equal(string_compare(entry.data, "patch two", entry.size), 0);
+    assert_equal(pack_mount_load_entry(&table, "four", &entry, &err), false);
+}
+
+#if defined(__linux__)
+define_test(pack_mount_directory_skips_symlinked_directories)
+{
+    error err{};
+
+    fs::path dir{};
+    defer { fs::free(&dir); };
+    fs::path sub{};
+    defer { fs::free(&sub); };
+    fs::path file{};
+    defer { fs::free(&file); };
+    fs::path loop{};
+    defer { fs::free(&loop); };
+
+    fs::path_set(&dir, out_path);
+    fs::path_append(&dir, "mounted_dir");
+    fs::path_set(&sub, dir);
+    fs::path_append(&sub, "sub");
+    fs::path_set(&file, sub);
+    fs::path_append(&file, "file.txt");
+    fs::path_set(&loop, sub);
+    fs::path_append(&loop, "loop");
+
+    mkdir(dir.c_str(), 0755);
+    mkdir(sub.c_str(), 0755);
+    _write_test_file(file.c_str(), "mounted");
+
+    // sub/loop -> .. would recurse forever if followed
+    assert_equal(symlink("..", loop.c_str()), 0);
+
+    defer
+    {
+        unlink(loop.c_str());
+        unlink(file.c_str());
+        rmdir(sub.c_str());
+        rmdir(dir.c_str());
+    };
+
+    pack_mount_table table{};
+    init(&table);
+    defer { free(&table); };
+
+    assert_equal(pack_mount_directory(&table, dir.c_str(), 0, nullptr, &err), true);
+    assert_equal(pack_mount_entry_count(&table), 1);
+
+    pack_entry entry{};
+    assert_equal(pack_mount_load_entry(&table, "sub/file.txt", &entry, &err), true);
+    assert_equal(string_compare(entry.data, "mounted"), 0);
+}
+
+define_test(pack_loader_reloads_changed_watched_files)
+{
+    error err{};
+
+    fs::path watched_file{};
+    defer { fs::free(&watched_file); };
+
+    fs::path_set(&watched_file, out_path);
+    fs::path_append(&watched_file, "watched.txt");
+
+    _write_test_file(watched_file.c_str(), "one");
+
+    const char *files[] = {"watched.txt", "test_file.txt"};
+
+    pack_loader loader{};
+    defer { free(&loader); };
+
+    pack_loader_load_files(&loader, files, 2, out_path.c_str());
+    assert_equal(pack_loader_watch_files(&loader, &err), true);
+    assert_equal(err.error_code, 0);
+
+    pack_entry entry{};
+    assert_equal(pack_loader_load_entry(&loader, 0, &entry, &err), true);
+    assert_equal(string_compare(entry.data, "one"), 0);
+
+    _write_test_file(watched_file.c_str(), "two!");
+
+    // nothing is reloaded until the change is polled
+    assert_equal(pack_loader_load_entry(&loader, 0, &entry, &err), true);
+    assert_equal(string_compare(entry.data, "one"), 0);
+
+    array<s64> changed{};
+    defer { free(&changed); };
+
+    assert_equal(pack_loader_poll_changes(&loader, &changed, &err), true);
+    assert_equal(changed.size, 1);
+    assert_equal(changed[0], 0);
+
+    assert_equal(pack_loader_load_entry(&loader, 0, &entry, &err), true);
+    assert_equal(string_compare(entry.data, "two!"), 0);
+
+    clear(&changed);
+    assert_equal(pack_loader_poll_changes(&loader, &changed, &err), true);
+    assert_equal(changed.size, 0);
+}
+
+define_test(pack_loader_reloads_files_of_recreated_watched_directories)
+{
+    error err{};
+
+    fs::path dir{};
+    defer { fs::free(&dir); };
+    fs::path watched_file{};
+    defer { fs::free(&watched_file); };
+
+    fs::path_set(&dir, out_path);
+    fs::path_append(&dir, "watched_dir");
+    fs::path_set(&watched_file, dir);
+    fs::path_append(&watched_file, "file.txt");
+
+    mkdir(dir.c_str(), 0755);
+    _write_test_file(watched_file.c_str(), "one");
+
+    const char *files[] = {"watched_dir/file.txt", "test_file.txt"};
+
+    pack_loader loader{};
+    defer { free(&loader); };
+
+    pack_loader_load_files(&loader, files, 2, out_path.c_str());
+    assert_equal(pack_loader_watch_files(&loader, &err), true);
+
+    pack_entry entry{};
+    assert_equal(pack_loader_load_entry(&loader, 0, &entry, &err), true);
+
+    array<s64> changed{};
+    defer { free(&changed); };
+
+    // the directory goes away, its entries are reported once
+    unlink(watched_file.c_str());
+    rmdir(dir.c_str());
+
+    assert_equal(pack_loader_poll_changes(&loader, &changed, &err), true);
+    assert_equal(changed.size, 1);
+    assert_equal(changed[0], 0);
+
+    clear(&changed);
+    assert_equal(pack_loader_poll_changes(&loader, &changed, &err), true);
+    assert_equal(changed.size, 0);
+
+    // and again once it's back, changes after that are seen as usual
+    mkdir(dir.c_str(), 0755);
+    _write_test_file(watched_file.c_str(), "two!");
+
+    assert_equal(pack_loader_poll_changes(&loader, &changed, &err), true);
+    assert_equal(changed.size, 1);
+    assert_equal(pack_loader_load_entry(&loader, 0, &entry, &err), true);
+    assert_equal(string_compare(entry.data, "two!"), 0);
+
+    _write_test_file(watched_file.c_str(), "three");
+
+    clear(&changed);
+    assert_equal(pack_loader_poll_changes(&loader, &changed, &err), true);
+    assert_equal(changed.size, 1);
+    assert_equal(pack_loader_load_entry(&loader, 0, &entry, &err), true);
+    assert_equal(string_compare(entry.data, "three"), 0);
+
+    unlink(watched_file.c_str());
+    rmdir(dir.c_str());
+}
+#endif
+
 define_test(pack_loader_entry_name_gets_entry_name)
 {
     error err{};
@@ -239,4 +1815,16 @@ define_test(pack_loader_entry_name_gets_entry_name)
     assert_equal(to_const_string(name), to_const_string(testpack_pack_files[testpack_pack__test_file_txt]));
 }
 
+define_test(generated_header_gets_entry_index)
+{
+    static_assert(testpack_pack_entry_index("test_file.txt") == testpack_pack__test_file_txt);
+    static_assert(testpack_pack_entry_index("test_file") == -1);
+
+    for (s64 i = 0; i < testpack_pack_file_count; ++i)
+        assert_equal(testpack_pack_entry_index(testpack_pack_files[i]), i);
+
+    assert_equal(testpack_pack_entry_index(""), -1);
+    assert_equal(testpack_pack_entry_index("test_file.txt2"), -1);
+}
+
 define_test_main(setup, cleanup);
@@ -1,11 +1,74 @@
-// this file was generated by pack packer v0.8.0
+// this file was generated by pack packer v0.8.2
 
 #pragma once
 
+#ifndef pack_mph_functions
+#define pack_mph_functions
+// minimal perfect hash functions used by the generated <package>_entry_index functions
+[[maybe_unused]] static constexpr unsigned int pack_mph_hash(const char *name)
+{
+    unsigned int hash = 2166136261u;
+
+    for (; *name != '\0'; ++name)
+    {
+        hash ^= (unsigned char)*name;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+[[maybe_unused]] static constexpr unsigned int pack_mph_slot(unsigned int hash, unsigned int seed, unsigned int size)
+{
+    unsigned int x = hash ^ seed;
+    x = ((x >> 16) ^ x) * 0x45d9f3bu;
+    x = ((x >> 16) ^ x) * 0x45d9f3bu;
+    x = (x >> 16) ^ x;
+    return x % size;
+}
+
+[[maybe_unused]] static constexpr bool pack_mph_equals(const char *a, const char *b)
+{
+    while (*a != '\0' && *a == *b)
+    {
+        ++a;
+        ++b;
+    }
+
+    return *a == *b;
+}
+
+[[maybe_unused]] static constexpr int pack_mph_lookup(const char *name, const char *const *files, const unsigned int *seeds, unsigned int bucket_count, const int *entries, unsigned int size)
+{
+    if (entries[0] == -1)
+        return -1;
+
+    unsigned int hash = pack_mph_hash(name);
+    int entry = entries[pack_mph_slot(hash, seeds[hash % bucket_count], size)];
+
+    return pack_mph_equals(files[entry], name) ? entry : -1;
+}
+#endif
+
 #define testpack_pack "testpack.pack"
 #define testpack_pack_file_count 1
-static const char *testpack_pack_files[] = {
+[[maybe_unused]] static constexpr const char *testpack_pack_files[] = {
     "test_file.txt",
 };
 
 #define testpack_pack__test_file_txt 0
+
+#define testpack_pack_mph_size 1
+#define testpack_pack_mph_bucket_count 1
+[[maybe_unused]] static constexpr unsigned int testpack_pack_mph_seeds[] = {
+    0u,
+};
+[[maybe_unused]] static constexpr int testpack_pack_mph_entries[] = {
+    0,
+};
+
+// returns the index of the entry with the given name, or -1 if there is none
+[[maybe_unused]] static constexpr int testpack_pack_entry_index(const char *name)
+{
+    return pack_mph_lookup(name, testpack_pack_files, testpack_pack_mph_seeds, testpack_pack_mph_bucket_count, testpack_pack_mph_entries, testpack_pack_mph_size);
+}